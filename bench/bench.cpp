@@ -0,0 +1,156 @@
+/**
+ * \file bench.cpp
+ * \brief Provide micro benchmark runner
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "bench.h"
+
+#include "../src/tools.h"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <utility>
+
+
+using Benchmarks = std::vector<std::pair<std::string, Bench_function> >;
+
+static Benchmarks& get_benchmarks() {
+  static Benchmarks benchmarks;
+  return benchmarks;
+}
+
+
+int add_benchmark(const std::string& name, Bench_function function) {
+  get_benchmarks().emplace_back(name, function);
+  return static_cast<int>(get_benchmarks().size());
+}
+
+
+//! Minimum running time of a benchmark in seconds
+static constexpr double min_time = 0.5;
+
+
+struct Bench_result {
+  std::string name;
+  size_t iterations;
+  double elapsed;
+  size_t items;
+};
+
+
+static Bench_result run(const std::string& name, Bench_function& function) {
+  size_t iterations = 1;
+  // Increase iterations until the benchmark runs long enough to be measured
+  while (true) {
+    Bench_state state(iterations);
+    auto start = std::chrono::steady_clock::now();
+    function(state);
+    auto stop = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(stop - start).count();
+    if (elapsed >= min_time) {
+      return Bench_result{name, iterations, elapsed, state.get_items_per_iteration()};
+    }
+    iterations *= elapsed > 0.01 ? static_cast<size_t>(1.4 * min_time / elapsed) + 1 : 10;
+  }
+}
+
+
+static void print_table(const std::vector<Bench_result>& results) {
+  std::cout << std::left << std::setw(40) << "Benchmark"
+      << std::right << std::setw(12) << "Iterations"
+      << std::setw(16) << "ns/iteration"
+      << std::setw(16) << "items/s" << std::endl;
+  for (auto& result: results) {
+    std::cout << std::left << std::setw(40) << result.name
+        << std::right << std::setw(12) << result.iterations
+        << std::setw(16) << std::fixed << std::setprecision(1)
+        << 1E9 * result.elapsed / result.iterations
+        << std::setw(16) << std::setprecision(0)
+        << result.iterations * result.items / result.elapsed << std::endl;
+  }
+}
+
+
+/**
+ * Print results as JSON, for comparing releases
+ *
+ * The build is identified in "context". Benchmark names are plain
+ * identifiers, so they need no escaping.
+ */
+static void print_json(const std::vector<Bench_result>& results) {
+  std::cout << "{\n"
+      << "  \"context\": {\n"
+      << "    \"version\": \"" << STRINGIFY(VERSION) << "\",\n"
+      << "    \"git_revision\": \"" << STRINGIFY(GITREV) << "\",\n"
+      << "    \"build_date\": \"" << STRINGIFY(BUILD_DATE) << "\",\n"
+      << "    \"build_type\": \"" << STRINGIFY(BUILD_TYPE) << "\"\n"
+      << "  },\n"
+      << "  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto& result = results[i];
+    std::cout << (i > 0 ? "," : "") << "\n    {"
+        << "\"name\": \"" << result.name << "\", "
+        << "\"iterations\": " << result.iterations << ", "
+        << std::fixed << std::setprecision(1)
+        << "\"ns_per_iteration\": " << 1E9 * result.elapsed / result.iterations << ", "
+        << std::setprecision(0)
+        << "\"items_per_second\": " << result.iterations * result.items / result.elapsed << "}";
+  }
+  std::cout << "\n  ]\n}" << std::endl;
+}
+
+
+/**
+ * Run benchmarks
+ *
+ * Usage: bench [--json] [filter]. Only benchmarks with filter in their
+ * name are run.
+ */
+int main(int argc, char* argv[]) {
+  bool json = false;
+  std::string filter;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--json") {
+      json = true;
+    }
+    else {
+      filter = arg;
+    }
+  }
+  std::vector<Bench_result> results;
+  for (auto& benchmark: get_benchmarks()) {
+    if (benchmark.first.find(filter) == std::string::npos) {
+      continue;
+    }
+    results.push_back(run(benchmark.first, benchmark.second));
+  }
+  if (json) {
+    print_json(results);
+  }
+  else {
+    print_table(results);
+  }
+  return 0;
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
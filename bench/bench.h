@@ -0,0 +1,91 @@
+/**
+ * \file bench.h
+ * \brief Provide a minimal micro benchmark harness
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <string>
+#include <functional>
+#include <cstddef>
+
+
+/**
+ * State passed to a benchmark function
+ *
+ * The benchmark function loops while keep_running() returns true and
+ * can report the number of items processed per iteration.
+ */
+struct Bench_state {
+  explicit Bench_state(const size_t iterations):
+      iterations_(iterations), count_(0), items_per_iteration_(1) {}
+
+  bool keep_running() {
+    return count_++ < iterations_;
+  }
+
+  size_t get_iterations() const {
+    return iterations_;
+  }
+
+  void set_items_per_iteration(const size_t items) {
+    items_per_iteration_ = items;
+  }
+
+  size_t get_items_per_iteration() const {
+    return items_per_iteration_;
+  }
+
+private:
+  size_t iterations_;
+  size_t count_;
+  size_t items_per_iteration_;
+};
+
+
+//! Directory with recorded device data, set by the build
+#ifndef BENCH_DATA_DIR
+#define BENCH_DATA_DIR "../test/data"
+#endif
+
+
+using Bench_function = std::function<void(Bench_state&)>;
+
+//! Register a benchmark, returns the number of registered benchmarks
+extern int add_benchmark(const std::string& name, Bench_function function);
+
+
+//! Prevent the compiler from optimizing away a computed value
+template <typename T>
+inline void do_not_optimize(T const& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+
+#define BENCHMARK(NAME) \
+  static void NAME(Bench_state&); \
+  static int NAME##_registered = add_benchmark(#NAME, NAME); \
+  static void NAME(Bench_state& state)
+
+
+#endif  // BENCH_H_
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
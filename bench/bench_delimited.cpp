@@ -0,0 +1,51 @@
+/**
+ * \file bench_delimited.cpp
+ * \brief Benchmark extracting values from delimited text lines
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "bench.h"
+
+#include "../src/devices/delimited.h"
+
+
+//! The Runwell line of the regex benchmarks, with the same quantities
+BENCHMARK(delimited_parse_runwell) {
+  set_log_level(level::error);
+  const std::string line = "1,0,224,69767,18.927,18.984,27.366,0.630\n";
+  prtr::ptree options;
+  const char* names[] = { "md0", "md1", "sts0", "frq", "vset", "vsig", "vsup", "isup" };
+  for (int i = 0; i < 8; ++i) {
+    options.put(std::string(names[i]) + ".column", i);
+  }
+  delimited::parser::Delimited_parser parser;
+  parser.set_options(options);
+  size_t values = 0;
+  double stamp = 0;
+  while (state.keep_running()) {
+    stamp += 1;
+    parser.add_and_parse(stamp, line.begin(), line.end());
+    values += parser.get_values().size();
+    parser.get_values().clear();
+  }
+  do_not_optimize(values);
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -0,0 +1,93 @@
+/**
+ * \file bench_insert.cpp
+ * \brief Compare per sample and batch insertion of samples through device and processors
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "bench.h"
+
+#include "../src/device.h"
+#include "../src/processors/statistics.h"
+#include "../src/processors/acceleration_history.h"
+
+
+namespace {
+
+// Device with the default processor setup of an MTi: four statistics and a peak detector
+struct Insert_device: public Device {
+  Insert_device() {
+    const char* periods[] = {"period=1", "period=10", "period=60", "period=600"};
+    for (auto period: periods) {
+      auto statistics = std::make_shared<Statistics>();
+      statistics->set_params(period);
+      add_processor(statistics);
+    }
+    auto history = std::make_shared<Acceleration_history>();
+    history->set_params("value_threshold=0.4,duration_threshold=0.5,item_count=5,direction=3");
+    add_processor(history);
+  }
+  using Device::insert_value;
+  using Device::insert_values;
+};
+
+
+// Samples of a single MTData2 packet
+std::vector<Stamped_quantity> get_packet(const double stamp) {
+  std::vector<Stamped_quantity> packet;
+  for (int q = 0; q < 30; ++q) {
+    packet.push_back(Stamped_quantity(sin(stamp + q), stamp, static_cast<Quantity>(q)));
+  }
+  return packet;
+}
+
+}  // namespace
+
+
+BENCHMARK(device_insert_value) {
+  set_log_level(level::error);
+  Insert_device device;
+  auto packet = get_packet(0);
+  double stamp = 0;
+  while (state.keep_running()) {
+    stamp += 0.01;
+    for (auto& value: packet) {
+      value.stamp = stamp;
+      device.insert_value(value);
+    }
+  }
+  state.set_items_per_iteration(packet.size());
+}
+
+
+BENCHMARK(device_insert_values) {
+  set_log_level(level::error);
+  Insert_device device;
+  auto packet = get_packet(0);
+  double stamp = 0;
+  while (state.keep_running()) {
+    stamp += 0.01;
+    for (auto& value: packet) {
+      value.stamp = stamp;
+    }
+    device.insert_values(packet);
+  }
+  state.set_items_per_iteration(packet.size());
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
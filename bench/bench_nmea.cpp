@@ -0,0 +1,79 @@
+/**
+ * \file bench_nmea.cpp
+ * \brief Benchmark parsing NMEA 0183 sentences
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "bench.h"
+
+#include "../src/devices/nmea.h"
+
+#include <vector>
+#include <string>
+
+
+namespace {
+
+const char* const sentences[] = {
+  "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n",
+  "$GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W*6A\r\n",
+  "$GPVTG,054.7,T,034.4,M,005.5,N,010.2,K,A*25\r\n",
+  "$GPZDA,201530.00,04,07,2002,00,00*60\r\n",
+  "$GPGST,172814.0,0.006,0.023,0.020,273.6,0.023,0.020,0.031*6A\r\n",
+  "$HEHDT,274.07,T*19\r\n",
+  "$HEROT,-12.0,A*35\r\n",
+  "$PASHR,085335.000,224.19,T,-01.26,+00.83,+0.01,0.101,0.113,2.145,1,0*36\r\n",
+  "$WIMWV,045.0,R,10.0,N,A*13\r\n",
+};
+
+}  // namespace
+
+
+/**
+ * One second of traffic of 64 ports sending 50 sentences per second each
+ *
+ * Each sentence arrives in a read of its own, as from a serial port.
+ */
+BENCHMARK(nmea_parse_ports) {
+  set_log_level(level::error);
+  constexpr size_t ports = 64;
+  constexpr size_t rate = 50;
+  constexpr size_t count = sizeof(sentences) / sizeof(sentences[0]);
+  std::vector<std::string> lines(sentences, sentences + count);
+  std::vector<nmea::parser::Nmea_parser> parsers(ports);
+  state.set_items_per_iteration(ports * rate);
+  size_t values = 0;
+  double stamp = 0;
+  while (state.keep_running()) {
+    for (size_t i = 0; i < rate; ++i) {
+      stamp += 1.0 / rate;
+      for (size_t port = 0; port < ports; ++port) {
+        auto& line = lines[(i + port) % count];
+        auto& parser = parsers[port];
+        parser.add_and_parse(stamp, line.begin(), line.end());
+        values += parser.get_values().size();
+        parser.get_values().clear();
+      }
+    }
+  }
+  do_not_optimize(values);
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
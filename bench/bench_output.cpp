@@ -0,0 +1,124 @@
+/**
+ * \file bench_output.cpp
+ * \brief Benchmark serving device data as JSON, SignalK and Modbus
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "bench.h"
+
+#include "../src/device.h"
+#include "../src/modbus.h"
+#include "../src/processors/statistics.h"
+#include "../src/processors/signalk_converter.h"
+
+#include <cmath>
+
+
+namespace {
+
+// Device with a recent sample of every quantity
+struct Output_device: public Device {
+  Output_device() {
+    for (int q = 0; q < static_cast<int>(Quantity::end); ++q) {
+      insert_value(Stamped_quantity(sin(q), 1.5E9, static_cast<Quantity>(q)));
+    }
+  }
+};
+
+
+// Modbus allows reading at most 125 registers per request
+constexpr uint16_t max_register_count = 125;
+constexpr int quantity_count = static_cast<int>(Quantity::end);
+
+}  // namespace
+
+
+BENCHMARK(device_json) {
+  set_log_level(level::error);
+  Output_device device;
+  size_t size = 0;
+  while (state.keep_running()) {
+    size += get_device_json(device).size();
+  }
+  do_not_optimize(size);
+}
+
+
+BENCHMARK(signalk_get_delta) {
+  set_log_level(level::error);
+  SignalK_converter converter;
+  std::vector<Stamped_quantity> packet;
+  for (int q = 0; q < quantity_count; ++q) {
+    packet.push_back(Stamped_quantity(sin(q), 1.5E9, static_cast<Quantity>(q)));
+  }
+  size_t size = 0;
+  while (state.keep_running()) {
+    for (auto& value: packet) {
+      value.stamp += 0.01;
+      size += converter.get_delta(value).size();
+    }
+  }
+  do_not_optimize(size);
+  state.set_items_per_iteration(packet.size());
+}
+
+
+/**
+ * Read all registers of a device and a statistics processor
+ *
+ * The base, plain and processor register ranges are read in requests of
+ * the maximum size.
+ */
+BENCHMARK(modbus_handle) {
+  set_log_level(level::error);
+  Devices devices;
+  devices.push_back(std::make_unique<Output_device>());
+  auto statistics = std::make_shared<Statistics>();
+  for (int q = 0; q < quantity_count; ++q) {
+    statistics->insert_value(Stamped_quantity(sin(q), 1.5E9, static_cast<Quantity>(q)));
+  }
+  Processors processors{statistics};
+  Modbus_handler handler(devices, processors, prtr::ptree());
+  const std::vector<std::pair<int, int> > ranges = {
+    {0, quantity_count + 4},
+    {10000, 8 * quantity_count},
+    {20000, static_cast<int>(statistics->size())}
+  };
+  size_t registers = 0;
+  for (auto& range: ranges) {
+    registers += range.second;
+  }
+  uint16_t sum = 0;
+  while (state.keep_running()) {
+    for (auto& range: ranges) {
+      for (int offset = 0; offset < range.second; offset += max_register_count) {
+        modbus::request::read_input_registers request;
+        request.address = static_cast<uint16_t>(range.first + offset);
+        request.count = static_cast<uint16_t>(std::min<int>(max_register_count, range.second - offset));
+        auto response = handler.handle(0, request);
+        sum += response.values[0];
+      }
+    }
+  }
+  do_not_optimize(sum);
+  state.set_items_per_iteration(registers);
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -0,0 +1,62 @@
+/**
+ * \file bench_regex.cpp
+ * \brief Benchmark parsing of Runwell data with regular expressions
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "bench.h"
+
+#include "../src/devices/runwell.h"
+
+
+namespace {
+
+void parse_runwell(Bench_state& state, const bool line_mode) {
+  set_log_level(level::error);
+  const std::string line = "1,0,224,69767,18.927,18.984,27.366,0.630\n";
+  regexp::parser::Regex_parser parser;
+  parser.set_filters(runwell::get_regex_options());
+  parser.set_line_mode(line_mode);
+  size_t values = 0;
+  double stamp = 0;
+  while (state.keep_running()) {
+    stamp += 1;
+    parser.add_and_parse(stamp, line.begin(), line.end());
+    values += parser.get_values().size();
+    parser.get_values().clear();
+  }
+  do_not_optimize(values);
+}
+
+}  // namespace
+
+
+//! Each filter searched for in the whole buffer
+BENCHMARK(regex_parse_runwell) {
+  parse_runwell(state, false);
+}
+
+
+//! Filters combined into one expression per line
+BENCHMARK(regex_parse_runwell_lines) {
+  parse_runwell(state, true);
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
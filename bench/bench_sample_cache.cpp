@@ -0,0 +1,111 @@
+/**
+ * \file bench_sample_cache.cpp
+ * \brief Compare ring buffer sample cache with map of deques
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "bench.h"
+
+#include "../src/sample_cache.h"
+
+
+// 30 quantities at 100Hz, as produced by an MTi, with a cache that is full
+static constexpr int quantity_count = 30;
+static constexpr size_t cache_size = 0x4000;
+static constexpr double rate = 100.0;
+
+
+static void insert_data_map(Data_map& data, const Stamped_quantity& value) {
+  auto item = data.try_emplace(value.quantity);
+  auto& queue = item.first->second;
+  queue.push_back({value.value, value.stamp});
+  while (queue.size() > cache_size || value.stamp - queue.front().stamp > default_cache_age) {
+    queue.pop_front();
+  }
+}
+
+
+template <typename Insert>
+static double fill(Insert insert) {
+  double stamp = 0;
+  for (size_t i = 0; i < cache_size; ++i) {
+    stamp += 1 / rate;
+    for (int q = 0; q < quantity_count; ++q) {
+      insert(Stamped_quantity(q, stamp, static_cast<Quantity>(q)));
+    }
+  }
+  return stamp;
+}
+
+
+BENCHMARK(data_map_insert) {
+  Data_map data;
+  double stamp = fill([&](const Stamped_quantity& value) { insert_data_map(data, value); });
+  while (state.keep_running()) {
+    stamp += 1 / rate;
+    for (int q = 0; q < quantity_count; ++q) {
+      insert_data_map(data, Stamped_quantity(q, stamp, static_cast<Quantity>(q)));
+    }
+  }
+  state.set_items_per_iteration(quantity_count);
+}
+
+
+BENCHMARK(sample_cache_insert) {
+  Sample_cache data;
+  data.set_capacity(cache_size);
+  double stamp = fill([&](const Stamped_quantity& value) { data.insert(value); });
+  while (state.keep_running()) {
+    stamp += 1 / rate;
+    for (int q = 0; q < quantity_count; ++q) {
+      data.insert(Stamped_quantity(q, stamp, static_cast<Quantity>(q)));
+    }
+  }
+  state.set_items_per_iteration(quantity_count);
+}
+
+
+BENCHMARK(data_map_get_sample) {
+  Data_map data;
+  fill([&](const Stamped_quantity& value) { insert_data_map(data, value); });
+  while (state.keep_running()) {
+    for (int q = 0; q < quantity_count; ++q) {
+      auto it = data.find(static_cast<Quantity>(q));
+      Stamped_value sample = it->second.back();
+      do_not_optimize(sample);
+    }
+  }
+  state.set_items_per_iteration(quantity_count);
+}
+
+
+BENCHMARK(sample_cache_get_sample) {
+  Sample_cache data;
+  data.set_capacity(cache_size);
+  fill([&](const Stamped_quantity& value) { data.insert(value); });
+  while (state.keep_running()) {
+    for (int q = 0; q < quantity_count; ++q) {
+      Stamped_value sample = data[static_cast<Quantity>(q)].back();
+      do_not_optimize(sample);
+    }
+  }
+  state.set_items_per_iteration(quantity_count);
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
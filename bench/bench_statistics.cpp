@@ -0,0 +1,82 @@
+/**
+ * \file bench_statistics.cpp
+ * \brief Benchmark the statistics processor at several window lengths
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "bench.h"
+
+#include "../src/processors/statistics.h"
+
+#include <cmath>
+
+
+namespace {
+
+// 30 quantities at 100Hz, as produced by an MTi
+constexpr int quantity_count = 30;
+constexpr double rate = 100.0;
+
+
+void insert_packet(Statistics& statistics, const double stamp) {
+  for (int q = 0; q < quantity_count; ++q) {
+    statistics.insert_value(Stamped_quantity(sin(stamp + q), stamp, static_cast<Quantity>(q)));
+  }
+}
+
+
+/**
+ * Insert samples in statistics with a window of period seconds
+ *
+ * The window is filled before measuring, so samples drop out of it as
+ * new ones are inserted.
+ */
+void insert_values(Bench_state& state, const int period) {
+  set_log_level(level::error);
+  Statistics statistics;
+  statistics.set_params(fmt::format("period={}", period));
+  double stamp = 0;
+  for (int i = 0; i < period * rate; ++i) {
+    stamp += 1 / rate;
+    insert_packet(statistics, stamp);
+  }
+  while (state.keep_running()) {
+    stamp += 1 / rate;
+    insert_packet(statistics, stamp);
+  }
+  do_not_optimize(statistics[0]);
+  state.set_items_per_iteration(quantity_count);
+}
+
+
+int register_benchmarks() {
+  int result = 0;
+  for (int period: {1, 10, 60, 600}) {
+    result = add_benchmark(fmt::format("statistics_insert_value/{}", period),
+        [period](Bench_state& state) { insert_values(state, period); });
+  }
+  return result;
+}
+
+int registered = register_benchmarks();
+
+}  // namespace
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -0,0 +1,120 @@
+/**
+ * \file bench_ublox.cpp
+ * \brief Benchmark parsing of recorded u-blox UBX data
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "bench.h"
+
+#include "../src/devices/ublox_impl.h"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+
+namespace {
+
+//! Size of the chunks the recorded data is fed to the parser in
+constexpr size_t chunk_size = 0x200;
+//! Chunk size of a slow serial port, splitting most packets
+constexpr size_t small_chunk_size = 0x10;
+
+
+bytes_t read_recorded() {
+  std::string path = std::string(BENCH_DATA_DIR) + "/ublox_bin.log";
+  std::ifstream in(path, std::ios_base::binary);
+  if (!in) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  return bytes_t((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+
+//! The NAV-PVT packets of the recorded data
+bytes_t read_nav_pvt() {
+  bytes_t recorded = read_recorded();
+  bytes_t stream;
+  for (size_t i = 0; i + 8 <= recorded.size(); ) {
+    if (recorded[i] != ubx::command::sync_1 || recorded[i + 1] != ubx::command::sync_2) {
+      ++i;
+      continue;
+    }
+    size_t size = 8 + recorded[i + 4] + (recorded[i + 5] << 8);
+    if (i + size > recorded.size()) {
+      break;
+    }
+    if (recorded[i + 2] == ubx::command::cls_nav && recorded[i + 3] == ubx::command::nav::pvt) {
+      stream.insert(stream.end(), recorded.begin() + i, recorded.begin() + i + size);
+    }
+    i += size;
+  }
+  return stream;
+}
+
+
+template <typename Parser>
+void parse_stream(Bench_state& state, cbytes_t& stream, const size_t size) {
+  Parser parser;
+  size_t values = 0;
+  while (state.keep_running()) {
+    for (size_t i = 0; i < stream.size(); i += size) {
+      auto end = stream.begin() + std::min(i + size, stream.size());
+      parser.add_and_parse(i / 11520.0, stream.begin() + i, end);
+      values += parser.get_values().size();
+      parser.get_values().clear();
+    }
+  }
+  do_not_optimize(values);
+  state.set_items_per_iteration(stream.size());
+}
+
+
+void parse_recorded(Bench_state& state, const size_t size) {
+  set_log_level(level::error);
+  parse_stream<ubx::parser::Ublox_parser>(state, read_recorded(), size);
+}
+
+}  // namespace
+
+
+BENCHMARK(ublox_parse) {
+  parse_recorded(state, chunk_size);
+}
+
+
+BENCHMARK(ublox_parse_small_chunks) {
+  parse_recorded(state, small_chunk_size);
+}
+
+
+//! Hand written framing on NAV-PVT only, to compare with the generated parser
+BENCHMARK(ublox_parse_nav_pvt) {
+  set_log_level(level::error);
+  parse_stream<ubx::parser::Ublox_parser>(state, read_nav_pvt(), chunk_size);
+}
+
+
+//! Parser generated from the NAV-PVT description
+BENCHMARK(ublox_parse_nav_pvt_generated) {
+  parse_stream<ubx::parser::Nav_pvt_parser>(state, read_nav_pvt(), chunk_size);
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
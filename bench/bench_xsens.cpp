@@ -0,0 +1,157 @@
+/**
+ * \file bench_xsens.cpp
+ * \brief Benchmark parsing of Xsens MTData2 streams
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "bench.h"
+
+#include "../src/devices/xsens_impl.h"
+
+#include <cmath>
+#include <cstring>
+
+
+namespace {
+
+//! Packets in the stream and size of the chunks it is fed to the parser in
+constexpr int packet_count = 100;
+constexpr size_t chunk_size = 0x200;
+
+
+void add_floats(Bytes& data, const uint16_t did, const std::vector<float>& values) {
+  data << endian::order::big << did << static_cast<byte_t>(values.size() * sizeof(float));
+  for (auto value: values) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    data << bits;
+  }
+}
+
+
+void add_doubles(Bytes& data, const uint16_t did, const std::vector<double>& values) {
+  data << endian::order::big << did << static_cast<byte_t>(values.size() * sizeof(double));
+  for (auto value: values) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    data << static_cast<uint32_t>(bits >> 32) << static_cast<uint32_t>(bits);
+  }
+}
+
+
+/**
+ * MTData2 stream with the data of the default MTi-670 output configuration
+ */
+bytes_t get_stream() {
+  using namespace xsens;
+  bytes_t stream;
+  for (int i = 0; i < packet_count; ++i) {
+    float t = 0.01f * i;
+    Bytes data;
+    data << endian::order::big << static_cast<uint16_t>(XDI_PacketCounter) << static_cast<byte_t>(2)
+        << static_cast<uint16_t>(i);
+    data << static_cast<uint16_t>(XDI_UtcTime) << static_cast<byte_t>(12)
+        << static_cast<uint32_t>(i * 10000000) << static_cast<uint16_t>(2019)
+        << static_cast<byte_t>(6) << static_cast<byte_t>(1) << static_cast<byte_t>(12)
+        << static_cast<byte_t>(0) << static_cast<byte_t>(i / 100) << static_cast<byte_t>(0x07);
+    add_floats(data, XDI_Acceleration | XDI_SubFormatFloat, {sinf(t), cosf(t), 9.81f});
+    add_floats(data, XDI_FreeAcceleration | XDI_SubFormatFloat, {sinf(t), cosf(t), 0.01f});
+    add_floats(data, XDI_RateOfTurn | XDI_SubFormatFloat, {0.1f * sinf(t), 0.1f * cosf(t), 0.01f});
+    add_doubles(data, XDI_LatLon | XDI_SubFormatDouble, {51.8 + 1E-7 * i, 4.6});
+    add_floats(data, XDI_MagneticField | XDI_SubFormatFloat, {0.4f, 0.1f, 0.9f});
+    add_floats(data, XDI_VelocityXYZ | XDI_SubFormatFloat, {2.0f, 0.5f, 0.0f});
+    add_floats(data, XDI_AltitudeEllipsoid | XDI_SubFormatFloat, {45.0f});
+    add_floats(data, XDI_AltitudeMsl | XDI_SubFormatFloat, {2.0f});
+    add_floats(data, XDI_EulerAngles | XDI_SubFormatFloat, {0.5f * sinf(t), 0.5f * cosf(t), 90.0f});
+    add_floats(data, XDI_Quaternion | XDI_SubFormatFloat, {1.0f, 0.0f, 0.0f, 0.0f});
+    auto packet = command::packet(XMID_MtData2, data);
+    stream.insert(stream.end(), packet.begin(), packet.end());
+  }
+  return stream;
+}
+
+
+void parse_stream(Bench_state& state, const bool flip_axes) {
+  set_log_level(level::error);
+  auto stream = get_stream();
+  xsens::parser::Xsens_parser parser;
+  parser.set_flip_axes(flip_axes);
+  size_t values = 0;
+  while (state.keep_running()) {
+    for (size_t i = 0; i < stream.size(); i += chunk_size) {
+      auto end = stream.begin() + std::min(i + chunk_size, stream.size());
+      parser.add_and_parse(i / 11520.0, stream.begin() + i, end);
+      values += parser.get_values().size();
+      parser.get_values().clear();
+    }
+  }
+  do_not_optimize(values);
+  state.set_items_per_iteration(packet_count);
+}
+
+
+/**
+ * Buffer the stream in chunks and consume it a packet at a time
+ *
+ * Compares the parser buffers without the cost of decoding.
+ */
+template <typename Buffer>
+void buffer_stream(Bench_state& state) {
+  auto stream = get_stream();
+  size_t packet_size = stream.size() / packet_count;
+  Buffer buffer;
+  size_t sum = 0;
+  while (state.keep_running()) {
+    for (size_t i = 0; i < stream.size(); i += chunk_size) {
+      auto end = stream.begin() + std::min(i + chunk_size, stream.size());
+      buffer.insert(buffer.end(), stream.begin() + i, end);
+      while (buffer.size() >= packet_size) {
+        sum += *(buffer.begin() + packet_size - 1);
+        buffer.erase(buffer.begin(), buffer.begin() + packet_size);
+      }
+    }
+  }
+  do_not_optimize(sum);
+  state.set_items_per_iteration(packet_count);
+}
+
+}  // namespace
+
+
+BENCHMARK(parser_buffer_deque) {
+  buffer_stream<std::deque<uint8_t> >(state);
+}
+
+
+BENCHMARK(parser_buffer_contiguous) {
+  buffer_stream<Contiguous_buffer>(state);
+}
+
+
+BENCHMARK(xsens_parse) {
+  parse_stream(state, false);
+}
+
+
+BENCHMARK(xsens_parse_flipped) {
+  parse_stream(state, true);
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -24,14 +24,102 @@
 #include "log.h"
 
 #include <cstdint>
+#include <algorithm>
+
+const char* get_clock_state_name(const Clock_state state) {
+  switch (state) {
+    case Clock_state::locking:
+      return "locking";
+    case Clock_state::locked:
+      return "locked";
+    default:
+      return "unlocked";
+  }
+}
+
+
+Clock_discipline::Clock_discipline(const double time_constant)
+  : time_constant_(time_constant), state_(Clock_state::unlocked), offset_(0), drift_(0),
+    last_local_(0), error_(0), updates_(0), rejected_(0), steps_(0),
+    consecutive_rejected_(0) {}
+
+
+void Clock_discipline::reset() {
+  state_ = Clock_state::unlocked;
+  offset_ = 0;
+  drift_ = 0;
+  error_ = 0;
+  consecutive_rejected_ = 0;
+}
+
+
+void Clock_discipline::step(const double error) {
+  log(level::info, "Stepping clock by %", error);
+  offset_ += error;
+  ++steps_;
+  error_ = 0;
+  consecutive_rejected_ = 0;
+  state_ = Clock_state::locking;
+}
+
+
+bool Clock_discipline::update(const double local_time, const double reference_time) {
+  ++updates_;
+  if (state_ == Clock_state::unlocked) {
+    last_local_ = local_time;
+    step(reference_time - local_time - offset_);
+    return true;
+  }
+  double dt = local_time - last_local_;
+  if (dt < 0) {
+    // Late sample: don't integrate backwards
+    dt = 0;
+  }
+  offset_ += drift_ * dt;
+  last_local_ += dt;
+  double error = reference_time - local_time - offset_;
+
+  if (state_ == Clock_state::locked
+      && std::abs(error) > std::max(min_outlier_threshold, outlier_factor * error_)) {
+    if (++consecutive_rejected_ > max_rejected) {
+      step(error);
+      return true;
+    }
+    ++rejected_;
+    return false;
+  }
+  consecutive_rejected_ = 0;
+  if (std::abs(error) > step_threshold) {
+    step(error);
+    return true;
+  }
+
+  double omega = 1.0 / time_constant_;
+  offset_ += std::min(1.0, 2 * damping * omega * dt) * error;
+  drift_ = std::max(-max_drift, std::min(max_drift, drift_ + omega * omega * dt * error));
+  error_ += std::min(1.0, dt / time_constant_) * (std::abs(error) - error_);
+  if (error_ < lock_threshold && updates_ > 1) {
+    state_ = Clock_state::locked;
+  }
+  else if (error_ > 2 * lock_threshold) {
+    state_ = Clock_state::locking;
+  }
+  return true;
+}
+
+
+Clock_status Clock_discipline::get_status() const {
+  return Clock_status{state_, offset_, drift_, error_, updates_, rejected_, steps_};
+}
+
 
 /**
  * Singleton clock that serves as central time keeping device
  *
  * Clock that returns a POSIX/unix timestamp (seconds since 1970-01-01 00:00:00.000 UTC)
- * in double format. The clock is monotonous and can be gradually adjusted to indicate
- * a time from another source than the system clock while still keeping the system 
- * clock pace. 
+ * in double format. The clock can be disciplined to indicate a time from another
+ * source than the system clock. The clock is monotonous: it jumps forward when the
+ * discipline steps forward, but slows down after a backward step, see Monotonic_clock.
  */
 struct Clock {
   Clock(Clock const&) = delete;
@@ -43,24 +131,28 @@ struct Clock {
   }
 
   double get_time() {
-    set_value(get_clock());
-    return value_;
+    return monotonic_.get_time(get_clock());
   }
 
   void adjust(const double& towards_time) {
-    adjust_diff(towards_time - get_clock());
+    discipline_.update(get_local(), towards_time);
   }
 
   void adjust_diff(const double& diff) {
-    offset_ += adjust_rate_ * diff;
+    double local = get_local();
+    discipline_.update(local, local + discipline_.get_correction(local) + diff);
   }
 
-  void set_adjust_rate(const double& adjust_rate) {
-    adjust_rate_ = adjust_rate;
+  void set_time_constant(const double& time_constant) {
+    discipline_.set_time_constant(time_constant);
+  }
+
+  Clock_status get_status() const {
+    return discipline_.get_status();
   }
 
 private:
-  Clock(): value_(0), offset_(0), adjust_rate_(DEFAULT_ADJUST_RATE) {
+  Clock(): offset_(0), monotonic_(), discipline_() {
     auto dt_now = date_time::microsec_clock<pt::ptime>::universal_time();
     auto sys_now = chrono::system_clock::now().time_since_epoch();
     
@@ -72,18 +164,17 @@ private:
     auto sys_now = chrono::system_clock::now().time_since_epoch();
     return static_cast<double>(sys_now.count()) * rate_;
   }
-  void set_value(const double& value) {
-    if (value > value_) {
-      // Clock should be monotonous, so never allow a decreasing value
-      value_ = value;
-    }
+  //! Return undisciplined time
+  double get_local() {
+    return get_sys_clock() + offset_;
   }
   double get_clock() {
-    return get_sys_clock() + offset_;
+    double local = get_local();
+    return local + discipline_.get_correction(local);
   }
-  double value_;
   double offset_;
-  double adjust_rate_;
+  Monotonic_clock monotonic_;
+  Clock_discipline discipline_;
   static const double rate_;
 };
 
@@ -105,11 +196,89 @@ void adjust_clock_diff(const double& diff) {
   Clock::get_instance().adjust_diff(diff);
 }
 
-void set_clock_adjust_rate(const double& rate) {
-  log(level::info, "Setting clock adjust rate to %", rate);
-  Clock::get_instance().set_adjust_rate(rate);
+void set_clock_time_constant(const double& time_constant) {
+  log(level::info, "Setting clock time constant to %", time_constant);
+  Clock::get_instance().set_time_constant(time_constant);
+}
+
+Clock_status get_clock_status() {
+  return Clock::get_instance().get_status();
+}
+
+
+Device_clock::Device_clock(const double period, const double window)
+  : period_(period), window_(window), started_(false), last_raw_(0), wraps_(0), origin_(0),
+    window_start_(0), window_min_(0), window_min_time_(0), sum_w_(0), sum_t_(0), sum_o_(0),
+    sum_tt_(0), sum_to_(0), intercept_(0), drift_(0), offset_(0), windows_(0) {}
+
+
+void Device_clock::reset() {
+  started_ = false;
+  wraps_ = 0;
+  sum_w_ = sum_t_ = sum_o_ = sum_tt_ = sum_to_ = 0;
+  intercept_ = 0;
+  drift_ = 0;
+  windows_ = 0;
 }
 
+
+double Device_clock::map(const double device_time, const double arrival) {
+  if (started_ && period_ > 0) {
+    if (device_time < last_raw_ - period_ / 2) {
+      wraps_ += period_;
+    }
+    else if (device_time > last_raw_ + period_ / 2) {
+      // Late sample from before the last wrap around
+      wraps_ -= period_;
+    }
+  }
+  last_raw_ = device_time;
+  double time = device_time + wraps_;
+  double diff = arrival - time;
+
+  if (windows_ > 0 && std::abs(diff - intercept_ - drift_ * (time - origin_)) > reset_threshold) {
+    log(level::info, "Device clock offset changed by %, restarting estimation",
+        diff - intercept_ - drift_ * (time - origin_));
+    reset();
+    time = device_time;
+    diff = arrival - time;
+  }
+
+  if (!started_) {
+    started_ = true;
+    origin_ = time;
+    window_start_ = time;
+    window_min_ = diff;
+    window_min_time_ = time;
+  }
+  else if (diff < window_min_) {
+    window_min_ = diff;
+    window_min_time_ = time;
+  }
+
+  if (time - window_start_ >= window_) {
+    double t = window_min_time_ - origin_;
+    sum_w_ = forgetting * sum_w_ + 1;
+    sum_t_ = forgetting * sum_t_ + t;
+    sum_o_ = forgetting * sum_o_ + window_min_;
+    sum_tt_ = forgetting * sum_tt_ + t * t;
+    sum_to_ = forgetting * sum_to_ + t * window_min_;
+    ++windows_;
+    double det = sum_w_ * sum_tt_ - sum_t_ * sum_t_;
+    if (windows_ >= min_drift_windows && det > 0) {
+      drift_ = (sum_w_ * sum_to_ - sum_t_ * sum_o_) / det;
+    }
+    intercept_ = (sum_o_ - drift_ * sum_t_) / sum_w_;
+    window_start_ = time;
+    window_min_ = diff;
+    window_min_time_ = time;
+  }
+
+  offset_ = windows_ > 0 ? intercept_ + drift_ * (time - origin_) : window_min_;
+  return time + offset_;
+}
+
+
 double to_timestamp(const pt::ptime& time) {
   auto since_epoch =  time - unix_epoch;
   return static_cast<double>(since_epoch.ticks()) / static_cast<double>(since_epoch.ticks_per_second());
@@ -25,18 +25,10 @@
 
 #include <string>
 #include <cmath>
+#include <cstdint>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/chrono.hpp>
 
-/**
- * Adjust the clock by 2.5% of clock difference with each call to "Clock::adjust"
- *
- * This value is somewhat arbitrary, but is intended to move the clock
- * towards the desired time with a reasonable pace while avoiding large
- * clock jumps.
- */
-#define DEFAULT_ADJUST_RATE 0.025
-
 namespace chrono = boost::chrono;
 namespace pt = boost::posix_time;
 namespace date_time = boost::date_time;
@@ -47,31 +39,155 @@ namespace date_time = boost::date_time;
 extern double get_time();
 extern const pt::ptime unix_epoch; 
 
+enum class Clock_state {
+  //! No reference time received
+  unlocked,
+  //! Converging on the reference
+  locking,
+  //! Following the reference within Clock_discipline::lock_threshold
+  locked
+};
+
+extern const char* get_clock_state_name(const Clock_state state);
+
+struct Clock_status {
+  Clock_state state;
+  //! Current correction of local time in seconds
+  double offset;
+  //! Frequency correction in seconds per second
+  double drift;
+  //! Smoothed absolute difference between reference and corrected time
+  double error;
+  uint64_t updates;
+  //! Reference samples rejected as outliers
+  uint64_t rejected;
+  //! Times the clock was stepped instead of slewed
+  uint64_t steps;
+};
+
+
+/**
+ * Phase locked loop disciplining a local clock to a reference clock
+ *
+ * Each reference sample gives the error of the corrected local time. A
+ * second order loop with time constant time_constant adjusts both the
+ * offset and the frequency correction, so a constant drift of the local
+ * clock leaves no steady state error. Gains are scaled by the interval
+ * between samples, which makes the response independent of their rate.
+ * Once locked, samples deviating more than outlier_factor times the
+ * smoothed error are rejected; after max_rejected consecutive rejections
+ * the reference is taken to have stepped and the clock steps too. Errors
+ * over step_threshold while locking step the clock as well. A step can be
+ * backwards. Updates are O(1).
+ */
+struct Clock_discipline {
+  explicit Clock_discipline(const double time_constant=default_time_constant);
+
+  //! Return the correction to add to local_time
+  double get_correction(const double local_time) const {
+    return state_ == Clock_state::unlocked ? 0.0 : offset_ + drift_ * (local_time - last_local_);
+  }
+
+  /**
+   * Process reference_time, sampled at uncorrected local_time
+   *
+   * Returns false when the sample was rejected.
+   */
+  bool update(const double local_time, const double reference_time);
+
+  void reset();
+
+  void set_time_constant(const double time_constant) {
+    time_constant_ = time_constant;
+  }
+
+  Clock_status get_status() const;
+
+  static constexpr double default_time_constant = 10.0;
+  static constexpr double damping = 0.7071;
+  static constexpr double lock_threshold = 0.005;
+  static constexpr double step_threshold = 1.0;
+  static constexpr double outlier_factor = 5.0;
+  //! Outlier threshold for a near perfect reference
+  static constexpr double min_outlier_threshold = 0.02;
+  static constexpr int max_rejected = 10;
+  static constexpr double max_drift = 500E-6;
+
+private:
+  double time_constant_;
+  Clock_state state_;
+  double offset_;
+  double drift_;
+  double last_local_;
+  double error_;
+  uint64_t updates_;
+  uint64_t rejected_;
+  uint64_t steps_;
+  int consecutive_rejected_;
+
+  void step(const double error);
+};
+
+
+/**
+ * Monotonic time following a clock that may step
+ *
+ * Sample stamps are taken from the central clock and sample caches rely on
+ * them increasing. Forward steps are followed directly. After a backward
+ * step the time keeps running, at slew_speed times the speed of the clock,
+ * until the clock has caught up with it.
+ */
+struct Monotonic_clock {
+  Monotonic_clock(): value_(0), last_(0) {}
+
+  //! Return the monotonic time for clock_time
+  double get_time(const double clock_time) {
+    if (clock_time >= value_) {
+      value_ = clock_time;
+    }
+    else if (clock_time > last_) {
+      value_ += slew_speed * (clock_time - last_);
+    }
+    last_ = clock_time;
+    return value_;
+  }
+
+  //! Speed of the time relative to the clock while the clock catches up
+  static constexpr double slew_speed = 0.1;
+
+private:
+  double value_;
+  //! Clock time of the last call
+  double last_;
+};
+
+
 /**
  * Adjust central clock
  *
- * \param towards_time UTC unix timestamp to use for adjusting the clock. The clock
- *                     will only be adjusted by a fraction that defaults to 1/40 and
- *                     can be set with set_clock_adjust_rate.
+ * \param towards_time UTC unix timestamp to discipline the clock with.
  */
 extern void adjust_clock(const double& towards_time);
 
 /**
  * Adjust central clock
  *
- * \param diff Difference between recorded time and system UTC unix timestamp to use for adjusting 
- *             the clock. The clock will only be adjusted by a fraction that defaults to 1/40
- *             and can be set with set_clock_adjust_rate
+ * \param diff Difference between recorded time and the clock's time of the record to
+ *             discipline the clock with
  */
 extern void adjust_clock_diff(const double& diff);
 
 
 /**
- * Set rate with which to adjust central clock
+ * Set time constant of the central clock's discipline
  *
- * \param rate Rate with which to adjust the clock with each call to adjust_clock(_diff)
+ * \param time_constant Time in seconds the clock takes to follow its reference
  */
-extern void set_clock_adjust_rate(const double& rate);
+extern void set_clock_time_constant(const double& time_constant);
+
+
+//! Return the state of the central clock's discipline
+extern Clock_status get_clock_status();
 
 
 /**
@@ -82,6 +198,84 @@ extern void set_clock_adjust_rate(const double& rate);
 extern double to_timestamp(const pt::ptime& time); 
 
 
+/**
+ * Map time of a device clock to hub time
+ *
+ * Data is read from devices in chunks, so the arrival time of a sample
+ * includes a variable delay. Time stamps a device puts in its data are
+ * evenly spaced, but have an unknown offset from hub time and drift. The
+ * minimum difference between arrival time and device time in a window of
+ * device time excludes most of the delay. Offset and drift are estimated by
+ * a least squares fit of a line through the minima of past windows, which
+ * are weighted less as they get older. Updates are O(1).
+ */
+struct Device_clock {
+  /**
+   * \param period Device time after which device time wraps around to 0, or 0
+   *               when it doesn't
+   * \param window Length of the windows in seconds of device time
+   */
+  explicit Device_clock(const double period=0, const double window=1.0);
+
+  /**
+   * Return hub time of a sample with device_time that arrived at arrival
+   *
+   * Estimation restarts when the difference between the device time and the
+   * arrival time deviates more than reset_threshold seconds from the
+   * estimate, e.g. when the device restarted.
+   */
+  double map(const double device_time, const double arrival);
+
+  void reset();
+
+  //! Estimated offset of hub time from device time at the latest device time
+  double get_offset() const {
+    return offset_;
+  }
+
+  //! Estimated drift of the device clock in seconds per second
+  double get_drift() const {
+    return drift_;
+  }
+
+  //! Whether enough windows have passed to estimate the drift
+  bool has_drift() const {
+    return windows_ >= min_drift_windows;
+  }
+
+  static constexpr double reset_threshold = 1.0;
+  //! Weight of the minimum of a window relative to that of the next window
+  static constexpr double forgetting = 0.99;
+  //! Number of windows before estimating drift
+  static constexpr int min_drift_windows = 10;
+
+private:
+  double period_;
+  double window_;
+  bool started_;
+  double last_raw_;
+  //! Device time added for wrap arounds
+  double wraps_;
+  //! Device time the fit is relative to
+  double origin_;
+  double window_start_;
+  //! Minimum of arrival minus device time in the current window and its device time
+  double window_min_;
+  double window_min_time_;
+  //! Weighted sums of the window minima for the least squares fit
+  double sum_w_;
+  double sum_t_;
+  double sum_o_;
+  double sum_tt_;
+  double sum_to_;
+  //! Fitted offset at origin and drift
+  double intercept_;
+  double drift_;
+  double offset_;
+  int windows_;
+};
+
+
 inline std::string timestamp_to_string(const double& stamp) {
   double secs = 0;
   double micros = std::modf(stamp, &secs) * 1E6;
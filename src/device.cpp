@@ -25,6 +25,10 @@
 
 #define RAPIDJSON_HAS_STDSTRING 1
 #include <rapidjson/prettywriter.h>
+#include <rapidjson/writer.h>
+
+#include <iterator>
+#include <limits>
 
 int Device::seq_ = 0;
 
@@ -75,6 +79,16 @@ prtr::ptree get_device_tree(const Device& device) {
 }
 
 
+template <class Writer>
+static void write_log_channel(Writer& writer, const Log_channel& channel) {
+  writer.StartObject();
+  writer.String("queue_depth"); writer.Uint64(channel.get_queue_depth());
+  writer.String("bytes_written"); writer.Uint64(channel.get_bytes_written());
+  writer.String("dropped"); writer.Uint64(channel.get_dropped());
+  writer.EndObject();
+}
+
+
 std::string get_device_json(const Device& device) {
   using namespace rapidjson;
   StringBuffer sb;
@@ -84,6 +98,32 @@ std::string get_device_json(const Device& device) {
   writer.String("id"); writer.String(device.get_id());
   writer.String("connected"); writer.Bool(device.is_connected());
   writer.String("time"); writer.Double(get_time());
+  writer.String("cache_memory"); writer.Uint64(device.get_cache_memory_size());
+  if (auto device_log = device.get_device_log()) {
+    writer.String("log"); write_log_channel(writer, *device_log);
+  }
+  if (auto raw_capture = device.get_raw_capture()) {
+    writer.String("capture"); write_log_channel(writer, *raw_capture);
+  }
+  if (auto link = device.get_link_statistics()) {
+    writer.String("link"); writer.StartObject();
+    for (size_t i = 0; i < Link_statistics::size; ++i) {
+      writer.String(Link_statistics::get_name(i)); writer.Uint64(link->get(i));
+    }
+    writer.EndObject();
+  }
+  if (device.is_time_source()) {
+    Clock_status clock = get_clock_status();
+    writer.String("clock"); writer.StartObject();
+    writer.String("state"); writer.String(get_clock_state_name(clock.state));
+    writer.String("offset"); writer.Double(clock.offset);
+    writer.String("drift"); writer.Double(clock.drift);
+    writer.String("error"); writer.Double(clock.error);
+    writer.String("updates"); writer.Uint64(clock.updates);
+    writer.String("rejected"); writer.Uint64(clock.rejected);
+    writer.String("steps"); writer.Uint64(clock.steps);
+    writer.EndObject();
+  }
   writer.String("data"); writer.StartObject();
   for (auto it = Quantity_iter::begin(); it != Quantity_iter::end(); ++it) {
     Stamped_value sample;
@@ -99,4 +139,111 @@ std::string get_device_json(const Device& device) {
   return sb.GetString();
 }
 
+
+History_writer::History_writer(const Device& device, const std::vector<Quantity>& quantities,
+    double from, double to, size_t max_points)
+  : device_(device), quantities_(quantities), from_(from), to_(to), max_points_(max_points),
+    index_(0), next_(from), stride_(0), level_(0), first_(true), started_(false) {}
+
+
+namespace {
+
+void append_sample(std::string& chunk, const bool first, const double stamp, const Value_type value) {
+  fmt::format_to(std::back_inserter(chunk), "{}[{:.15g},{:.15g}]", first ? "" : ",", stamp, value);
+}
+
+void append_sample(std::string& chunk, const bool first, const double stamp, const Aggregate& value) {
+  fmt::format_to(std::back_inserter(chunk), "{}[{:.15g},{:.15g},{:.15g},{:.15g}]",
+      first ? "" : ",", stamp, value.mean, value.min, value.max);
+}
+
+}  // namespace
+
+
+size_t History_writer::select_level(const Quantity quantity) const {
+  const Sample_buffer& samples = device_.get_samples(quantity);
+  if (!samples.empty() && samples.stamp(0) <= from_) {
+    return 0;
+  }
+  const Aggregate_tiers& tiers = device_.get_aggregates(quantity);
+  size_t result = 0;
+  double earliest = samples.empty() ? std::numeric_limits<double>::max() : samples.stamp(0);
+  for (size_t i = 0; i < tiers.size(); ++i) {
+    const Aggregate_buffer& aggregates = tiers[i].get_samples();
+    if (aggregates.empty()) {
+      continue;
+    }
+    if (aggregates.stamp(0) <= from_) {
+      return i + 1;
+    }
+    if (aggregates.stamp(0) < earliest) {
+      earliest = aggregates.stamp(0);
+      result = i + 1;
+    }
+  }
+  return result;
+}
+
+
+template <typename Buffer>
+bool History_writer::write_samples(const Buffer& samples, std::string& chunk, size_t max_size) {
+  size_t end = samples.upper_bound(to_);
+  if (stride_ == 0) {
+    // Start writing a new quantity
+    size_t begin = samples.lower_bound(from_);
+    size_t count = end > begin ? end - begin : 0;
+    stride_ = max_points_ > 0 && count > max_points_ ? (count + max_points_ - 1) / max_points_ : 1;
+    fmt::format_to(std::back_inserter(chunk), "{}\"{}\":[",
+        index_ > 0 ? "," : "", get_quantity_name(quantities_[index_]));
+    next_ = from_;
+    first_ = true;
+  }
+  for (size_t i = samples.lower_bound(next_); i < end; i += stride_) {
+    if (chunk.size() >= max_size) {
+      // Continue from this sample when called again
+      next_ = samples.stamp(i);
+      return true;
+    }
+    append_sample(chunk, first_, samples.stamp(i), samples.value(i));
+    first_ = false;
+  }
+  chunk.append("]");
+  stride_ = 0;
+  ++index_;
+  return false;
+}
+
+
+bool History_writer::write(std::string& chunk, size_t max_size) {
+  if (!started_) {
+    using namespace rapidjson;
+    StringBuffer sb;
+    Writer<StringBuffer> writer(sb);
+    writer.StartObject();
+    writer.String("name"); writer.String(device_.get_name());
+    writer.String("id"); writer.String(device_.get_id());
+    writer.String("data"); writer.StartObject();
+    chunk.append(sb.GetString());
+    started_ = true;
+  }
+  else if (index_ > quantities_.size()) {
+    return false;
+  }
+  while (index_ < quantities_.size()) {
+    Quantity quantity = quantities_[index_];
+    if (stride_ == 0) {
+      level_ = select_level(quantity);
+    }
+    bool more = level_ == 0
+      ? write_samples(device_.get_samples(quantity), chunk, max_size)
+      : write_samples(device_.get_aggregates(quantity)[level_ - 1].get_samples(), chunk, max_size);
+    if (more) {
+      return true;
+    }
+  }
+  chunk.append("}}");
+  ++index_;
+  return false;
+}
+
 // vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
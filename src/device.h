@@ -24,12 +24,16 @@
 #define DEVICE_H_
 
 #include <vector>
+#include <array>
 #include <memory>
 #include <exception>
 #include <iomanip>
+#include <type_traits>
 
 #include "quantities.h"
+#include "sample_cache.h"
 #include "log.h"
+#include "device_log.h"
 #include "datetime.h"
 #include "processor.h"
 #include "types.h"
@@ -108,7 +112,9 @@ struct Device: public Named_object {
   Device(): Named_object(fmt::format("id_{:d}", seq_), fmt::format("device_{:d}", seq_)),
             connected_(false), data_(), 
             enable_logging_(false), max_log_files_(32), max_log_size_(64 * 1024 * 1024), 
-            device_log_initialized_(false), processors_() {
+            log_format_(device_log::Format::text), device_log_initialized_(false), device_log_(),
+            capture_raw_(false), raw_capture_(),
+            processors_(), routes_(), subscribers_(), batch_() {
     log(level::debug, "Constructing Device");
     ++seq_;
   }
@@ -120,25 +126,31 @@ struct Device: public Named_object {
 
   virtual ~Device() {
     log(level::debug, "Destroying Device");
+    if (device_log_) {
+      device_log_->close();
+    }
+    if (raw_capture_) {
+      raw_capture_->close();
+    }
   }
 
 
   virtual bool get_value(const Quantity& quantity, Value_type& value) const {
-    auto it = data_.find(quantity);
-    if (it == data_.end() || it->second.empty()) {
+    auto& buffer = data_[quantity];
+    if (buffer.empty()) {
       return false;
     }
-    value = it->second.back().value;
+    value = buffer.value(buffer.size() - 1);
     return true;
   }
 
 
   virtual bool get_sample(const Quantity& quantity, Stamped_value& sample) const {
-    auto it = data_.find(quantity);
-    if (it == data_.end() || it->second.empty()) {
+    auto& buffer = data_[quantity];
+    if (buffer.empty()) {
       return false;
     }
-    sample = it->second.back();
+    sample = buffer.back();
     return true;
   }
 
@@ -223,6 +235,71 @@ struct Device: public Named_object {
     max_log_size_ = static_cast<int>(value);
   }
 
+  //! Set device log format: text, binary or delta for delta encoded binary
+  void set_log_format(const std::string& value) {
+    if (value == "text") {
+      log_format_ = device_log::Format::text;
+    }
+    else if (value == "binary") {
+      log_format_ = device_log::Format::binary;
+    }
+    else if (value == "delta") {
+      log_format_ = device_log::Format::delta;
+    }
+    else {
+      log(level::error, "Unexpected log format \"%\" for %", value, this->get_name());
+      return;
+    }
+    log(level::info, "Set log format to % for %", value, this->get_name());
+  }
+
+  //! Capture all data read from the device port to file for replay
+  void set_capture_raw(const bool value) {
+    capture_raw_ = value;
+    if (value) {
+      log(level::info, "Raw capture enabled for %", this->get_name());
+    }
+  }
+
+  //! Set maximum number of samples cached per quantity
+  void set_cache_size(const size_t value) {
+    log(level::info, "Set cache size to % for %", value, this->get_name());
+    data_.set_capacity(value);
+  }
+
+  //! Set maximum age in seconds of samples cached per quantity
+  void set_cache_age(const double value) {
+    log(level::info, "Set cache age to % for %", value, this->get_name());
+    data_.set_max_age(value);
+  }
+
+  //! Set retention tiers for all quantities
+  void set_cache_tiers(const Retention_tiers& tiers) {
+    log(level::info, "Set % cache tiers for %", tiers.size(), this->get_name());
+    data_.set_tiers(tiers);
+  }
+
+  //! Set retention tiers for a single quantity
+  void set_cache_tiers(const Quantity& quantity, const Retention_tiers& tiers) {
+    log(level::info, "Set % cache tiers of % for %", tiers.size(), quantity, this->get_name());
+    data_.set_tiers(quantity, tiers);
+  }
+
+  //! Return cached samples for a quantity
+  const Sample_buffer& get_samples(const Quantity& quantity) const {
+    return data_[quantity];
+  }
+
+  //! Return cached aggregates for a quantity, ordered by increasing interval
+  const Aggregate_tiers& get_aggregates(const Quantity& quantity) const {
+    return data_.get_tiers(quantity);
+  }
+
+  //! Return number of bytes allocated by the sample cache
+  size_t get_cache_memory_size() const {
+    return data_.get_memory_size();
+  }
+
   virtual void use_as_time_source(const bool value) {
     use_as_time_source_ = value;
     if (value) {
@@ -230,12 +307,61 @@ struct Device: public Named_object {
     }
   }
 
+  bool is_time_source() const {
+    return use_as_time_source_;
+  }
+
 
+  /**
+   * Attach a processor to this device
+   *
+   * The processor is added to the dispatch table entry of each quantity it
+   * subscribes to, so samples only reach processors that want them.
+   */
   void add_processor(Processor_ptr processor) {
+    Quantity_set subscription = processor->get_subscription();
+    for (size_t q = 0; q < subscription.size(); ++q) {
+      if (subscription.test(q)) {
+        routes_[q].push_back(processor.get());
+      }
+    }
+    if (subscription.any()) {
+      subscribers_.push_back({processor.get(), subscription});
+    }
     processors_.push_back(processor);
   }
 
 
+  //! Return the device log channel, or nullptr when the device log isn't started
+  const Device_log_channel* get_device_log() const {
+    return device_log_.get();
+  }
+
+  //! Return packet statistics of the link with the device, or nullptr when not collected
+  virtual const Link_statistics* get_link_statistics() const {
+    return nullptr;
+  }
+
+  //! Return the raw capture channel, or nullptr when raw capture isn't started
+  const Raw_capture_channel* get_raw_capture() const {
+    return raw_capture_.get();
+  }
+
+  //! Start raw capture if enabled
+  void setup_raw_capture() {
+    if (!capture_raw_ || raw_capture_)
+      return;
+    raw_capture_ = get_device_log_service().open_capture(this->get_id(), this->get_name(),
+        get_device_log_dir(), max_log_files_, max_log_size_);
+  }
+
+  //! Queue a chunk of data read from the port at stamp for raw capture, if started
+  void capture_raw(const double stamp, const char* data, const size_t size) {
+    if (raw_capture_) {
+      raw_capture_->push(stamp, data, size);
+    }
+  }
+
   void check_setup_device_log() {
     if (this->is_connected()) {
       setup_device_log();
@@ -248,46 +374,57 @@ protected:
   void setup_device_log() {
     if (!enable_logging_ || device_log_initialized_)
       return;
-    device_log_initialized_ = init_device_log(this->get_id(), this->get_name(), 
-        max_log_files_, max_log_size_);
-    if (device_log_initialized_) {
-      log(level::info, "Device log started: %", this->get_name());
-    }
+    // The writer thread opens the log file, so logging doesn't do file I/O on this thread
+    device_log_ = get_device_log_service().open(this->get_id(), this->get_name(),
+        get_device_log_dir(), max_log_files_, max_log_size_, log_format_);
+    device_log_initialized_ = true;
+    log(level::info, "Device log started: %", this->get_name());
   }
 
   void insert_value(const Stamped_quantity& value) {
-    // When registered as time source, adjust application clock when receiving time sample
-    if (use_as_time_source_ && value.quantity == Quantity::ut) {
-      adjust_clock_diff(value.value - value.stamp);
-    }
-    // Add value to sample cache
-    auto item = data_.try_emplace(value.quantity);
-    auto& queue = item.first->second;
-    queue.push_back({value.value, value.stamp});
+    cache_value(value);
 
-    // Pass value to processors
-    for (auto&& processor: processors_) {
+    // Pass value to processors that subscribed to its quantity
+    for (auto processor: routes_[static_cast<size_t>(value.quantity)]) {
       processor->insert_value(value);
     }
-    // Prune sample cache: maximum 256K or 1h of samples
-    while (queue.size() > 0x0040000 || value.stamp - queue.front().stamp > 3600) {
-      queue.pop_front();
+
+    log_value(value);
+  }
+
+  /**
+   * Insert a batch of samples, e.g. all samples parsed from a single packet
+   *
+   * Processors receive the samples of the batch they subscribed to in a
+   * single call
+   */
+  void insert_values(Stamped_span values) {
+    if (values.empty()) {
+      return;
+    }
+    for (auto& value: values) {
+      cache_value(value);
     }
-    // Write device log if enabled
-    if (enable_logging_) {
-      try {
-        std::stringstream ss;
-        ss << std::setprecision(15) << value.stamp << "," << value.quantity << "," << value.value;
-        if (enable_logging_ && device_log_initialized_) {
-          log(this->get_name(), ss.str());
-        }
+
+    for (auto& subscriber: subscribers_) {
+      if (subscriber.quantities.all()) {
+        subscriber.processor->insert_values(values);
+        continue;
       }
-      catch (...) {
-        static int err_count = 0;
-        if ((err_count % 10000) == 0) {
-          log(level::error, "Failed to write device log");
+      batch_.clear();
+      for (auto& value: values) {
+        if (subscriber.quantities.test(static_cast<size_t>(value.quantity))) {
+          batch_.push_back(value);
         }
-        ++err_count;
+      }
+      if (!batch_.empty()) {
+        subscriber.processor->insert_values(batch_);
+      }
+    }
+
+    if (enable_logging_) {
+      for (auto& value: values) {
+        log_value(value);
       }
     }
   }
@@ -309,17 +446,47 @@ protected:
 
 
 private:
+  void cache_value(const Stamped_quantity& value) {
+    // When registered as time source, adjust application clock when receiving time sample
+    if (use_as_time_source_ && value.quantity == Quantity::ut) {
+      adjust_clock_diff(value.value - value.stamp);
+    }
+    // Add value to sample cache, which drops samples exceeding cache size or age
+    data_.insert(value);
+  }
+
+  void log_value(const Stamped_quantity& value) {
+    // Queue value for the device log writer thread if enabled
+    if (enable_logging_ && device_log_) {
+      device_log_->push(value);
+    }
+  }
+
+  //! Processor with the quantities it subscribed to
+  struct Subscriber {
+    Processor* processor;
+    Quantity_set quantities;
+  };
+
   static int seq_;
   bool connected_;
   std::string connection_string_;
-  Data_map data_;
+  Sample_cache data_;
   bool enable_logging_;
   int max_log_files_;
   int max_log_size_;
+  device_log::Format log_format_;
   bool device_log_initialized_;
+  Device_log_channel_ptr device_log_;
+  bool capture_raw_;
+  Raw_capture_channel_ptr raw_capture_;
   bool use_as_time_source_;
   Processors processors_;
-
+  //! Processors to pass samples to, indexed by quantity
+  std::array<std::vector<Processor*>, q_end> routes_;
+  std::vector<Subscriber> subscribers_;
+  //! Reusable buffer for the part of a batch a processor subscribed to
+  std::vector<Stamped_quantity> batch_;
 };
 
 
@@ -338,6 +505,20 @@ struct Context_device: public Device {
 };
 
 
+//! Baud rate from the connection string of ports that provide a static get_baud_rate
+template <typename Port>
+auto get_port_baud_rate(const std::string& connection_string, int)
+    -> decltype(Port::get_baud_rate(connection_string)) {
+  return Port::get_baud_rate(connection_string);
+}
+
+//! Ports without a baud rate
+template <typename Port>
+unsigned get_port_baud_rate(const std::string&, long) {
+  return 0;
+}
+
+
 /**
  * Device that controls an IO port supporting asio's basic_io_object interface
  */
@@ -399,6 +580,11 @@ struct Port_device: public Context_device<ContextProvider> {
     return *port_;
   }
 
+  //! Baud rate of the port, or 0 when the port isn't a serial line
+  unsigned get_baud_rate() const {
+    return get_port_baud_rate<Port>(this->get_connection_string(), 0);
+  }
+
 
   bool exec_command(
       cbytes_t& command,
@@ -546,31 +732,25 @@ private:
 
 
 
+//! Whether Port hands out received data in place with async_read_data
+template <typename Port, typename = void>
+struct has_read_data: std::false_type {};
+
+template <typename Port>
+struct has_read_data<Port, std::void_t<decltype(
+    std::declval<Port&>().async_read_data(std::declval<asio::yield_context>()))> >: std::true_type {};
+
+
 template <class DeviceClass>
 struct Port_polling_mixin: public Polling_mixin<DeviceClass> {
 
   void poll_data(asio::yield_context yield) override {
     log(level::debug, "Start polling %", this->get_device()->get_name());
+    this->get_device()->setup_raw_capture();
     asio::streambuf buf;
     while (this->get_device()->is_connected()) {
       try {
-        auto bytes_read = this->get_device()->get_port().async_read_some(
-            buf.prepare(this->get_poll_size()), yield);
-        double stamp = get_time();
-        log(level::debug, "% read % bytes", this->get_device()->get_name(), bytes_read);
-        if (bytes_read > 0) {
-          buf.commit(bytes_read);
-          auto buf_begin = asio::buffers_begin(buf.data());
-          auto buf_end = buf_begin + buf.size();
-#ifdef DEBUG
-          cbytes_t data(buf_begin, buf_end);
-          std::stringstream ss;
-          ss << data;
-          log(level::debug, "% received: %", this->get_device()->get_name(), ss.str());
-#endif
-          this->get_device()->handle_data(stamp, buf_begin, buf_end);
-          buf.consume(bytes_read);
-        }
+        read_and_handle(buf, yield);
       }
       catch (std::exception& e) {
         log(level::error, "Error while polling %: %", this->get_device()->get_name(), e.what());
@@ -579,6 +759,44 @@ struct Port_polling_mixin: public Polling_mixin<DeviceClass> {
     }
     log(level::debug, "Stopped polling %", this->get_device()->get_name());
   }
+
+private:
+  template <typename Iterator>
+  void handle(double stamp, Iterator buf_begin, Iterator buf_end) {
+    size_t bytes_read = static_cast<size_t>(buf_end - buf_begin);
+    log(level::debug, "% read % bytes", this->get_device()->get_name(), bytes_read);
+#ifdef DEBUG
+    cbytes_t data(buf_begin, buf_end);
+    std::stringstream ss;
+    ss << data;
+    log(level::debug, "% received: %", this->get_device()->get_name(), ss.str());
+#endif
+    this->get_device()->handle_data(stamp, buf_begin, buf_end);
+  }
+
+  void read_and_handle(asio::streambuf& buf, asio::yield_context yield) {
+    auto& port = this->get_device()->get_port();
+    if constexpr (has_read_data<std::decay_t<decltype(port)> >::value) {
+      // Parse the received data in place, the port reuses it on the next read
+      auto data = port.async_read_data(yield);
+      double stamp = get_time();
+      if (data.size > 0) {
+        this->get_device()->capture_raw(stamp, reinterpret_cast<const char*>(data.data), data.size);
+        handle(stamp, data.begin(), data.end());
+      }
+    }
+    else {
+      auto bytes_read = port.async_read_some(buf.prepare(this->get_poll_size()), yield);
+      double stamp = get_time();
+      if (bytes_read > 0) {
+        buf.commit(bytes_read);
+        this->get_device()->capture_raw(stamp, static_cast<const char*>(buf.data().data()), bytes_read);
+        auto buf_begin = asio::buffers_begin(buf.data());
+        handle(stamp, buf_begin, buf_begin + buf.size());
+        buf.consume(bytes_read);
+      }
+    }
+  }
 };  // struct Port_polling_mixin
 
 
@@ -637,6 +855,51 @@ extern prtr::ptree get_device_tree(const Device& device);
 extern std::string get_device_json(const Device& device);
 
 
+/**
+ * Incremental writer of the cached sample history of a device as json
+ *
+ * Writes samples for the requested quantities within [from, to] directly
+ * from the sample cache in chunks of limited size. When max_points is
+ * nonzero, samples are decimated to at most that number per quantity.
+ * For each quantity, the raw samples are used when they reach back to
+ * from. Otherwise the finest aggregate tier that does is used, or the
+ * one reaching back furthest.
+ * The position in the cache is tracked by stamp, so samples being added
+ * or dropped in between writing chunks is harmless.
+ */
+struct History_writer {
+  History_writer(const Device& device, const std::vector<Quantity>& quantities,
+      double from, double to, size_t max_points);
+
+  /**
+   * Append the next part of the history to chunk
+   *
+   * Stops appending samples when chunk size reaches max_size. Returns false
+   * when the complete history has been written.
+   */
+  bool write(std::string& chunk, size_t max_size);
+
+private:
+  size_t select_level(const Quantity quantity) const;
+
+  template <typename Buffer>
+  bool write_samples(const Buffer& samples, std::string& chunk, size_t max_size);
+
+  const Device& device_;
+  std::vector<Quantity> quantities_;
+  double from_;
+  double to_;
+  size_t max_points_;
+  size_t index_;
+  double next_;
+  size_t stride_;
+  //! Raw samples (0) or aggregate tier (1 and up) the current quantity is written from
+  size_t level_;
+  bool first_;
+  bool started_;
+};
+
+
 #endif  // ifndef DEVICE_H_
 
 // vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -0,0 +1,726 @@
+/**
+ * \file device_log.cpp
+ * \brief Provide implementation of binary block oriented device log and its writer thread
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "device_log.h"
+
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <iomanip>
+#include <iterator>
+#include <chrono>
+
+#ifdef _WIN32
+#   include <io.h>
+#else
+#   include <unistd.h>
+#endif
+
+#include <boost/endian/conversion.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace pt = boost::posix_time;
+namespace endian = boost::endian;
+
+using namespace device_log;
+
+
+namespace {
+
+//! Minimum free space to keep on the device log file system
+constexpr uintmax_t min_free_space = 256 * 1024 * 1024;
+//! Size of a block header
+constexpr size_t block_header_size = 16;
+
+template <typename T>
+void append(std::vector<char>& buffer, T value) {
+  endian::native_to_little_inplace(value);
+  const char* bytes = reinterpret_cast<const char*>(&value);
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+void append(std::vector<char>& buffer, const double value) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  append(buffer, bits);
+}
+
+void append(std::vector<char>& buffer, const std::string& value) {
+  append(buffer, static_cast<uint16_t>(value.size()));
+  buffer.insert(buffer.end(), value.begin(), value.end());
+}
+
+template <typename T>
+void set(std::vector<char>& buffer, const size_t offset, T value) {
+  endian::native_to_little_inplace(value);
+  std::memcpy(&buffer[offset], &value, sizeof(T));
+}
+
+template <typename T>
+bool read_value(std::istream& stream, T& value) {
+  if (!stream.read(reinterpret_cast<char*>(&value), sizeof(T))) {
+    return false;
+  }
+  endian::little_to_native_inplace(value);
+  return true;
+}
+
+bool read_value(std::istream& stream, double& value) {
+  uint64_t bits;
+  if (!read_value(stream, bits)) {
+    return false;
+  }
+  std::memcpy(&value, &bits, sizeof(value));
+  return true;
+}
+
+template <typename Length>
+bool read_string(std::istream& stream, std::string& value) {
+  Length length;
+  if (!read_value(stream, length)) {
+    return false;
+  }
+  value.resize(length);
+  return length == 0 || static_cast<bool>(stream.read(&value[0], length));
+}
+
+}  // namespace
+
+
+Rolling_file::Rolling_file(const std::string& device_id, const std::string& device_name,
+    const fs::path& dir, const int max_files, const size_t max_size,
+    const char* extension, const std::vector<char>& header)
+  : device_id_(device_id), device_name_(device_name), dir_(dir),
+    max_files_(max_files), max_size_(max_size), extension_(extension), header_(header),
+    file_(nullptr), file_name_(), file_size_(0), file_count_(0), pending_(), bytes_written_(0) {
+  open_file();
+}
+
+
+Rolling_file::~Rolling_file() {
+  try {
+    flush();
+  }
+  catch (std::exception& e) {
+    log(level::error, "Failed to flush %: %", file_name_.string(), e.what());
+  }
+  close_file();
+}
+
+
+void Rolling_file::append(const char* data, const size_t size) {
+  size_t file_size = file_size_ + pending_.size();
+  if (file_ != nullptr && file_size > header_.size() && file_size + size > max_size_) {
+    flush();
+    open_file();
+  }
+  pending_.insert(pending_.end(), data, data + size);
+}
+
+
+void Rolling_file::flush() {
+  if (pending_.empty()) {
+    return;
+  }
+  if (file_ == nullptr) {
+    // Opening the next file failed before
+    open_file();
+  }
+  if (std::fwrite(pending_.data(), 1, pending_.size(), file_) != pending_.size()
+      || std::fflush(file_) != 0) {
+    pending_.clear();
+    throw Device_log_exception(fmt::format("Failed to write to {}", file_name_.string()));
+  }
+  file_size_ += pending_.size();
+  bytes_written_ += pending_.size();
+  pending_.clear();
+}
+
+
+void Rolling_file::sync() {
+  flush();
+  if (file_ == nullptr) {
+    return;
+  }
+#ifdef _WIN32
+  int result = _commit(_fileno(file_));
+#else
+  int result = fdatasync(fileno(file_));
+#endif
+  if (result != 0) {
+    throw Device_log_exception(fmt::format("Failed to sync {}", file_name_.string()));
+  }
+}
+
+
+void Rolling_file::open_file() {
+  close_file();
+  file_name_ = dir_ / fmt::format("{}.{}.{}.{:08d}{}", device_id_,
+      pt::to_iso_string(pt::second_clock::local_time()), device_name_, file_count_++, extension_);
+  file_size_ = 0;
+  file_ = std::fopen(file_name_.string().c_str(), "wb");
+  if (file_ == nullptr) {
+    throw Device_log_exception(fmt::format("Failed to open {}", file_name_.string()));
+  }
+  pending_.insert(pending_.begin(), header_.begin(), header_.end());
+  remove_old_files();
+}
+
+
+void Rolling_file::close_file() {
+  if (file_ != nullptr) {
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+
+void Rolling_file::remove_old_files() {
+  std::vector<fs::path> files;
+  std::string prefix = device_id_ + ".";
+  for (auto& entry: fs::directory_iterator(dir_)) {
+    std::string name = entry.path().filename().string();
+    if (fs::is_regular_file(entry.path()) && name.compare(0, prefix.size(), prefix) == 0
+        && entry.path().extension() == extension_) {
+      files.push_back(entry.path());
+    }
+  }
+  // File names start with their creation time, so sorting them puts the oldest first
+  std::sort(files.begin(), files.end(), [](const fs::path& a, const fs::path& b) {
+      return a.filename().string() < b.filename().string(); });
+  size_t count = files.size();
+  for (auto& file: files) {
+    if (count <= 1) {
+      break;
+    }
+    if (count <= static_cast<size_t>(max_files_) && fs::space(dir_).available >= min_free_space) {
+      break;
+    }
+    if (file == file_name_) {
+      continue;
+    }
+    boost::system::error_code ec;
+    fs::remove(file, ec);
+    if (ec) {
+      log(level::warning, "Failed to remove device log %: %", file.string(), ec.message());
+    }
+    --count;
+  }
+}
+
+
+namespace {
+
+std::vector<char> get_device_log_header(const std::string& device_id, const std::string& device_name,
+    const Format format) {
+  std::vector<char> header;
+  if (format == Format::text) {
+    return header;
+  }
+  header.insert(header.end(), file_magic, file_magic + sizeof(file_magic));
+  append(header, format_version);
+  append(header, device_id);
+  append(header, device_name);
+  append(header, static_cast<uint16_t>(q_end));
+  for (auto it = Quantity_iter::begin(); it != Quantity_iter::end(); ++it) {
+    std::string name = get_quantity_name(*it);
+    append(header, static_cast<uint8_t>(*it));
+    append(header, static_cast<uint8_t>(name.size()));
+    header.insert(header.end(), name.begin(), name.end());
+  }
+  return header;
+}
+
+}  // namespace
+
+
+Device_log_writer::Device_log_writer(const std::string& device_id, const std::string& device_name,
+    const fs::path& dir, const int max_files, const size_t max_size, const Format format)
+  : format_(format),
+    file_(device_id, device_name, dir, max_files, max_size,
+        format == Format::text ? text_file_extension : file_extension,
+        get_device_log_header(device_id, device_name, format)),
+    block_(), count_(0), base_(0) {
+  block_.reserve(block_header_size + max_block_records * plain_record_size);
+}
+
+
+Device_log_writer::~Device_log_writer() {
+  try {
+    complete_block();
+  }
+  catch (std::exception& e) {
+    log(level::error, "Failed to flush device log %: %", get_file_name().string(), e.what());
+  }
+}
+
+
+void Device_log_writer::write(const Stamped_quantity& value) {
+  double offset = value.stamp - base_;
+  if (count_ > 0 && (count_ >= max_block_records || offset > max_block_age || offset < 0)) {
+    complete_block();
+  }
+  if (count_ == 0) {
+    start_block(value.stamp);
+    offset = 0;
+  }
+  switch (format_) {
+    case Format::text:
+      fmt::format_to(std::back_inserter(block_), "{:.15g},{},{:.15g}\n",
+          value.stamp, get_quantity_name(value.quantity), value.value);
+      break;
+    case Format::delta:
+      append(block_, static_cast<uint32_t>(std::lround(offset / delta_resolution)));
+      append(block_, static_cast<uint8_t>(value.quantity));
+      append(block_, value.value);
+      break;
+    case Format::binary:
+      append(block_, value.stamp);
+      append(block_, static_cast<uint8_t>(value.quantity));
+      append(block_, value.value);
+      break;
+  }
+  ++count_;
+}
+
+
+void Device_log_writer::flush() {
+  complete_block();
+  file_.flush();
+}
+
+
+void Device_log_writer::sync() {
+  complete_block();
+  file_.sync();
+}
+
+
+void Device_log_writer::start_block(const double stamp) {
+  block_.clear();
+  base_ = stamp;
+  if (format_ == Format::text) {
+    return;
+  }
+  block_.insert(block_.end(), block_magic, block_magic + sizeof(block_magic));
+  append(block_, static_cast<uint8_t>(format_ == Format::delta ? Encoding::delta : Encoding::plain));
+  append(block_, uint8_t{0});
+  // Record count is filled in when the block is completed
+  append(block_, uint16_t{0});
+  append(block_, stamp);
+}
+
+
+void Device_log_writer::complete_block() {
+  if (count_ == 0) {
+    return;
+  }
+  if (format_ != Format::text) {
+    set(block_, 6, count_);
+  }
+  file_.append(block_.data(), block_.size());
+  block_.clear();
+  count_ = 0;
+}
+
+
+bool Log_channel::drain() {
+  // Read closed before draining, so data queued before close is written
+  bool closed = closed_.load(std::memory_order_acquire);
+  if (!failed_) {
+    try {
+      failed_ = !open();
+    }
+    catch (std::exception& e) {
+      log(level::error, "Can't initialize device log: %", e.what());
+      failed_ = true;
+    }
+  }
+  try {
+    write_queued();
+    if (closed && !failed_) {
+      sync();
+    }
+  }
+  catch (std::exception& e) {
+    static int err_count = 0;
+    if ((err_count % 10000) == 0) {
+      log(level::error, "Failed to write device log: %", e.what());
+    }
+    ++err_count;
+  }
+  if (closed) {
+    release();
+  }
+  return !closed;
+}
+
+
+Device_log_channel::Device_log_channel(const std::string& device_id, const std::string& device_name,
+    const fs::path& dir, const int max_files, const size_t max_size,
+    const Format format, const size_t queue_size)
+  : Log_channel(), device_id_(device_id), device_name_(device_name), dir_(dir),
+    max_files_(max_files), max_size_(max_size), format_(format), queue_(queue_size), writer_() {
+}
+
+
+bool Device_log_channel::open() {
+  if (!writer_) {
+    writer_ = std::make_unique<Device_log_writer>(device_id_, device_name_, dir_,
+        max_files_, max_size_, format_);
+    log(level::info, "Device log started: %", writer_->get_file_name().string());
+  }
+  return true;
+}
+
+
+void Device_log_channel::write_queued() {
+  if (failed_) {
+    dropped_.fetch_add(queue_.consume_all([](const Stamped_quantity&) {}), std::memory_order_relaxed);
+    return;
+  }
+  std::string error;
+  queue_.consume_all([this, &error](const Stamped_quantity& value) {
+      try {
+        writer_->write(value);
+      }
+      catch (std::exception& e) {
+        error = e.what();
+      }
+    });
+  try {
+    writer_->flush();
+  }
+  catch (std::exception& e) {
+    error = e.what();
+  }
+  bytes_written_.store(writer_->get_bytes_written(), std::memory_order_relaxed);
+  if (!error.empty()) {
+    throw Device_log_exception(error);
+  }
+}
+
+
+void Device_log_channel::sync() {
+  writer_->sync();
+  bytes_written_.store(writer_->get_bytes_written(), std::memory_order_relaxed);
+}
+
+
+void Device_log_channel::release() {
+  writer_.reset();
+}
+
+
+Raw_capture_channel::Raw_capture_channel(const std::string& device_id, const std::string& device_name,
+    const fs::path& dir, const int max_files, const size_t max_size, const size_t queue_size)
+  : Log_channel(), device_id_(device_id), device_name_(device_name), dir_(dir),
+    max_files_(max_files), max_size_(max_size), queue_(queue_size), records_(), file_() {
+}
+
+
+void Raw_capture_channel::push(const double stamp, const char* data, const size_t size) {
+  char header[capture_record_header_size];
+  uint64_t stamp_bits;
+  std::memcpy(&stamp_bits, &stamp, sizeof(stamp_bits));
+  endian::native_to_little_inplace(stamp_bits);
+  uint32_t record_size = endian::native_to_little(static_cast<uint32_t>(size));
+  std::memcpy(header, &stamp_bits, sizeof(stamp_bits));
+  std::memcpy(header + sizeof(stamp_bits), &record_size, sizeof(record_size));
+  if (!queue_.push(Span<const char>(header, sizeof(header)), Span<const char>(data, size))) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+
+bool Raw_capture_channel::open() {
+  if (!file_) {
+    std::vector<char> header(capture_magic, capture_magic + sizeof(capture_magic));
+    append(header, capture_version);
+    append(header, device_id_);
+    append(header, device_name_);
+    file_ = std::make_unique<Rolling_file>(device_id_, device_name_, dir_,
+        max_files_, max_size_, capture_extension, header);
+    log(level::info, "Raw capture started: %", file_->get_file_name().string());
+  }
+  return true;
+}
+
+
+void Raw_capture_channel::write_queued() {
+  records_.clear();
+  queue_.consume_spans([this](Span<const char> bytes) {
+      records_.insert(records_.end(), bytes.begin(), bytes.end());
+    });
+  if (failed_) {
+    return;
+  }
+  // Records are queued whole, so they can be split at their sizes
+  size_t offset = 0;
+  while (offset + capture_record_header_size <= records_.size()) {
+    uint32_t size;
+    std::memcpy(&size, &records_[offset + sizeof(double)], sizeof(size));
+    endian::little_to_native_inplace(size);
+    size_t record_size = capture_record_header_size + size;
+    file_->append(&records_[offset], record_size);
+    offset += record_size;
+  }
+  file_->flush();
+  bytes_written_.store(file_->get_bytes_written(), std::memory_order_relaxed);
+}
+
+
+void Raw_capture_channel::sync() {
+  file_->sync();
+  bytes_written_.store(file_->get_bytes_written(), std::memory_order_relaxed);
+}
+
+
+void Raw_capture_channel::release() {
+  file_.reset();
+}
+
+
+Device_log_service::Device_log_service()
+  : mutex_(), wake_(), channels_(), sync_interval_(10), stop_(false), thread_() {
+  thread_ = std::thread(&Device_log_service::run, this);
+}
+
+
+Device_log_service::~Device_log_service() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+}
+
+
+Device_log_channel_ptr Device_log_service::open(const std::string& device_id,
+    const std::string& device_name, const fs::path& dir, const int max_files,
+    const size_t max_size, const Format format, const size_t queue_size) {
+  auto channel = std::make_shared<Device_log_channel>(device_id, device_name, dir,
+      max_files, max_size, format, queue_size);
+  add(channel);
+  return channel;
+}
+
+
+Raw_capture_channel_ptr Device_log_service::open_capture(const std::string& device_id,
+    const std::string& device_name, const fs::path& dir, const int max_files,
+    const size_t max_size, const size_t queue_size) {
+  auto channel = std::make_shared<Raw_capture_channel>(device_id, device_name, dir,
+      max_files, max_size, queue_size);
+  add(channel);
+  return channel;
+}
+
+
+void Device_log_service::add(const Log_channel_ptr& channel) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  channels_.push_back(channel);
+}
+
+
+void Device_log_service::set_sync_interval(const double seconds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sync_interval_ = seconds;
+}
+
+
+void Device_log_service::run() {
+  using clock = std::chrono::steady_clock;
+  auto last_sync = clock::now();
+  std::vector<Log_channel_ptr> channels;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wake_.wait_for(lock, std::chrono::duration<double>(flush_interval), [this]() { return stop_; });
+    bool stop = stop_;
+    double sync_interval = sync_interval_;
+    channels = channels_;
+    lock.unlock();
+
+    auto now = clock::now();
+    bool sync = stop || (sync_interval > 0
+        && now - last_sync >= std::chrono::duration<double>(sync_interval));
+    std::vector<Log_channel*> done;
+    for (auto& channel: channels) {
+      if (stop) {
+        channel->close();
+      }
+      if (!channel->drain()) {
+        done.push_back(channel.get());
+      }
+      else if (sync && !channel->failed_) {
+        try {
+          channel->sync();
+        }
+        catch (std::exception& e) {
+          log(level::warning, "Failed to sync device log: %", e.what());
+        }
+      }
+    }
+    if (sync) {
+      last_sync = now;
+    }
+    channels.clear();
+
+    lock.lock();
+    channels_.erase(std::remove_if(channels_.begin(), channels_.end(),
+        [&done](const Log_channel_ptr& channel) {
+          return std::find(done.begin(), done.end(), channel.get()) != done.end(); }),
+        channels_.end());
+    if (stop) {
+      break;
+    }
+  }
+}
+
+
+Device_log_service& get_device_log_service() {
+  static Device_log_service service;
+  return service;
+}
+
+
+Device_log_reader::Device_log_reader(std::istream& stream)
+  : stream_(stream), device_id_(), device_name_(), quantity_names_(),
+    encoding_(Encoding::plain), remaining_(0), base_(0) {
+  char magic[sizeof(file_magic)];
+  uint16_t version;
+  if (!stream_.read(magic, sizeof(magic)) || std::memcmp(magic, file_magic, sizeof(magic)) != 0) {
+    throw Device_log_exception("Not a device log");
+  }
+  if (!read_value(stream_, version) || version != format_version) {
+    throw Device_log_exception("Unsupported device log version");
+  }
+  uint16_t count;
+  if (!read_string<uint16_t>(stream_, device_id_) || !read_string<uint16_t>(stream_, device_name_)
+      || !read_value(stream_, count)) {
+    throw Device_log_exception("Invalid device log header");
+  }
+  quantity_names_.resize(0x100);
+  for (uint16_t i = 0; i < count; ++i) {
+    uint8_t code;
+    std::string name;
+    if (!read_value(stream_, code) || !read_string<uint8_t>(stream_, name)) {
+      throw Device_log_exception("Invalid device log quantity dictionary");
+    }
+    quantity_names_[code] = name;
+  }
+}
+
+
+bool Device_log_reader::read_block_header() {
+  char magic[sizeof(block_magic)];
+  if (!stream_.read(magic, sizeof(magic))) {
+    return false;
+  }
+  if (std::memcmp(magic, block_magic, sizeof(magic)) != 0) {
+    throw Device_log_exception("Invalid device log block");
+  }
+  uint8_t encoding;
+  uint8_t reserved;
+  if (!read_value(stream_, encoding) || !read_value(stream_, reserved)
+      || !read_value(stream_, remaining_) || !read_value(stream_, base_)) {
+    return false;
+  }
+  if (encoding > static_cast<uint8_t>(Encoding::delta)) {
+    throw Device_log_exception("Unsupported device log block encoding");
+  }
+  encoding_ = static_cast<Encoding>(encoding);
+  return true;
+}
+
+
+bool Device_log_reader::read(Stamped_quantity& value) {
+  while (remaining_ == 0) {
+    if (!read_block_header()) {
+      return false;
+    }
+  }
+  uint8_t quantity;
+  if (encoding_ == Encoding::delta) {
+    uint32_t offset;
+    if (!read_value(stream_, offset)) {
+      return false;
+    }
+    value.stamp = base_ + offset * delta_resolution;
+  }
+  else if (!read_value(stream_, value.stamp)) {
+    return false;
+  }
+  if (!read_value(stream_, quantity) || !read_value(stream_, value.value)) {
+    return false;
+  }
+  value.quantity = static_cast<Quantity>(quantity);
+  --remaining_;
+  return true;
+}
+
+
+std::string Device_log_reader::get_quantity_name(const Quantity quantity) const {
+  return quantity_names_[static_cast<uint8_t>(quantity)];
+}
+
+
+Raw_capture_reader::Raw_capture_reader(std::istream& stream)
+  : stream_(stream), device_id_(), device_name_() {
+  char magic[sizeof(capture_magic)];
+  uint16_t version;
+  if (!stream_.read(magic, sizeof(magic)) || std::memcmp(magic, capture_magic, sizeof(magic)) != 0) {
+    throw Device_log_exception("Not a raw capture");
+  }
+  if (!read_value(stream_, version) || version != capture_version) {
+    throw Device_log_exception("Unsupported raw capture version");
+  }
+  if (!read_string<uint16_t>(stream_, device_id_) || !read_string<uint16_t>(stream_, device_name_)) {
+    throw Device_log_exception("Invalid raw capture header");
+  }
+}
+
+
+bool Raw_capture_reader::read(double& stamp, std::vector<char>& data) {
+  uint32_t size;
+  if (!read_value(stream_, stamp) || !read_value(stream_, size)) {
+    return false;
+  }
+  data.resize(size);
+  return size == 0 || static_cast<bool>(stream_.read(data.data(), size));
+}
+
+
+size_t device_log_to_csv(std::istream& in, std::ostream& out) {
+  Device_log_reader reader(in);
+  Stamped_quantity value;
+  size_t count = 0;
+  out << std::setprecision(15);
+  while (reader.read(value)) {
+    out << value.stamp << "," << reader.get_quantity_name(value.quantity) << "," << value.value << "\n";
+    ++count;
+  }
+  return count;
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
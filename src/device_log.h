@@ -0,0 +1,463 @@
+/**
+ * \file device_log.h
+ * \brief Provide binary block oriented device log and its writer thread
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DEVICE_LOG_H_
+#define DEVICE_LOG_H_
+
+#include "quantities.h"
+#include "tools.h"
+#include "log.h"
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+/**
+ * Binary device log format
+ *
+ * All numbers are little endian. A file starts with a header:
+ *   - magic "SHDL" and uint16 format version
+ *   - uint16 length and characters of the device id and of the device name
+ *   - uint16 number of dictionary entries, each an uint8 quantity code
+ *     followed by an uint8 length and the characters of the quantity name
+ *
+ * followed by blocks, each with a header:
+ *   - magic "SHDB", uint8 encoding, uint8 reserved and uint16 record count
+ *   - double base stamp
+ *
+ * and fixed width records. Plain records are a double stamp, an uint8
+ * quantity code and a double value (17 bytes). Delta encoded records store
+ * the stamp as uint32 microseconds after the base stamp instead (13 bytes).
+ */
+namespace device_log {
+
+constexpr char file_magic[4] = {'S', 'H', 'D', 'L'};
+constexpr char block_magic[4] = {'S', 'H', 'D', 'B'};
+constexpr uint16_t format_version = 1;
+constexpr const char* file_extension = ".sdl";
+constexpr const char* text_file_extension = ".log";
+
+enum class Encoding: uint8_t {
+  plain = 0,
+  delta = 1,
+};
+
+//! Device log file format
+enum class Format {
+  text,
+  binary,
+  delta,
+};
+
+constexpr size_t plain_record_size = 17;
+constexpr size_t delta_record_size = 13;
+//! Resolution of delta encoded stamps in seconds
+constexpr double delta_resolution = 1e-6;
+
+static_assert(q_end <= 0x100, "Quantity codes should fit in a byte");
+
+/*
+ * Raw capture format
+ *
+ * A file starts with magic "SHRC", uint16 format version and the device id
+ * and name as in the device log header, followed by a record for each chunk
+ * of data read from the device: double stamp, uint32 size and the data.
+ */
+constexpr char capture_magic[4] = {'S', 'H', 'R', 'C'};
+constexpr uint16_t capture_version = 1;
+constexpr const char* capture_extension = ".raw";
+constexpr size_t capture_record_header_size = 12;
+
+}  // namespace device_log
+
+
+class Device_log_exception: public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+
+/**
+ * Log file of a device, rotated when it would exceed the maximum size
+ *
+ * Data is collected until flush, which writes it out in a single write.
+ * Every new file starts with the header. After rotation the oldest files of
+ * the device with the same extension that exceed the maximum number of
+ * files are removed.
+ */
+struct Rolling_file {
+  Rolling_file(const std::string& device_id, const std::string& device_name,
+      const fs::path& dir, const int max_files, const size_t max_size,
+      const char* extension, const std::vector<char>& header);
+  ~Rolling_file();
+
+  Rolling_file(const Rolling_file&) = delete;
+  Rolling_file& operator=(const Rolling_file&) = delete;
+
+  //! Append data that should not be split over files
+  void append(const char* data, const size_t size);
+
+  //! Write out the appended data
+  void flush();
+
+  //! Flush and commit the file contents to storage
+  void sync();
+
+  const fs::path& get_file_name() const {
+    return file_name_;
+  }
+
+  //! Return the total number of bytes written to file
+  uint64_t get_bytes_written() const {
+    return bytes_written_;
+  }
+
+private:
+  std::string device_id_;
+  std::string device_name_;
+  fs::path dir_;
+  int max_files_;
+  size_t max_size_;
+  const char* extension_;
+  std::vector<char> header_;
+  std::FILE* file_;
+  fs::path file_name_;
+  size_t file_size_;
+  unsigned file_count_;
+  std::vector<char> pending_;
+  uint64_t bytes_written_;
+
+  void open_file();
+  void close_file();
+  void remove_old_files();
+};
+
+
+/**
+ * Buffered writer of the device log of a single device
+ *
+ * Samples are collected in a block that is completed when it is full or
+ * when it spans more than max_block_age seconds. The text format writes
+ * stamp,quantity,value lines in blocks of the same number of samples.
+ */
+struct Device_log_writer {
+  Device_log_writer(const std::string& device_id, const std::string& device_name,
+      const fs::path& dir, const int max_files, const size_t max_size,
+      const device_log::Format format=device_log::Format::binary);
+  ~Device_log_writer();
+
+  Device_log_writer(const Device_log_writer&) = delete;
+  Device_log_writer& operator=(const Device_log_writer&) = delete;
+
+  void write(const Stamped_quantity& value);
+
+  //! Complete the current block and write out all completed blocks
+  void flush();
+
+  //! Flush and commit the file contents to storage
+  void sync();
+
+  const fs::path& get_file_name() const {
+    return file_.get_file_name();
+  }
+
+  //! Return the total number of bytes written to file
+  uint64_t get_bytes_written() const {
+    return file_.get_bytes_written();
+  }
+
+  static constexpr size_t max_block_records = 1024;
+  static constexpr double max_block_age = 1.0;
+
+private:
+  device_log::Format format_;
+  Rolling_file file_;
+  std::vector<char> block_;
+  uint16_t count_;
+  double base_;
+
+  void start_block(const double stamp);
+  void complete_block();
+};
+
+
+/**
+ * Device side of an asynchronous log
+ *
+ * The device queues data in a preallocated lock free queue, which the
+ * writer thread of Device_log_service drains. Queueing never blocks, formats
+ * or does file I/O. When the queue is full, data is dropped and counted.
+ */
+struct Log_channel {
+  Log_channel(): closed_(false), failed_(false), bytes_written_(0), dropped_(0) {}
+  virtual ~Log_channel() = default;
+
+  Log_channel(const Log_channel&) = delete;
+  Log_channel& operator=(const Log_channel&) = delete;
+
+  //! Stop logging; the writer thread writes out the queued data and closes the log
+  void close() {
+    closed_.store(true, std::memory_order_release);
+  }
+
+  virtual size_t get_queue_depth() const = 0;
+
+  uint64_t get_bytes_written() const {
+    return bytes_written_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t get_dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+protected:
+  friend struct Device_log_service;
+
+  std::atomic<bool> closed_;
+  //! Whether the log couldn't be opened. Writer thread only.
+  bool failed_;
+  std::atomic<uint64_t> bytes_written_;
+  std::atomic<uint64_t> dropped_;
+
+  //! Write the queued data, return false when the channel is done. Writer thread only.
+  bool drain();
+
+  //! Open the log if needed, return false when that failed
+  virtual bool open() = 0;
+  //! Pass queued data to the log and flush it, or discard it when the log failed
+  virtual void write_queued() = 0;
+  virtual void sync() = 0;
+  //! Close the log
+  virtual void release() = 0;
+};
+
+using Log_channel_ptr = std::shared_ptr<Log_channel>;
+
+
+/**
+ * Channel queueing the samples of a device for its device log
+ */
+struct Device_log_channel: public Log_channel {
+  Device_log_channel(const std::string& device_id, const std::string& device_name,
+      const fs::path& dir, const int max_files, const size_t max_size,
+      const device_log::Format format, const size_t queue_size);
+
+  //! Queue a sample for the writer thread. Producer only.
+  void push(const Stamped_quantity& value) {
+    if (!queue_.push(value)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  size_t get_queue_depth() const override {
+    return queue_.size();
+  }
+
+private:
+  std::string device_id_;
+  std::string device_name_;
+  fs::path dir_;
+  int max_files_;
+  size_t max_size_;
+  device_log::Format format_;
+  Spsc_queue<Stamped_quantity> queue_;
+  //! Writer, owned by the writer thread, which creates it on first use
+  std::unique_ptr<Device_log_writer> writer_;
+
+  bool open() override;
+  void write_queued() override;
+  void sync() override;
+  void release() override;
+};
+
+using Device_log_channel_ptr = std::shared_ptr<Device_log_channel>;
+
+
+/**
+ * Channel queueing the raw data read from the port of a device
+ *
+ * Chunks are queued as capture records, so the read path only copies the
+ * data once. Chunks that don't fit in the queue are dropped whole and
+ * counted.
+ */
+struct Raw_capture_channel: public Log_channel {
+  Raw_capture_channel(const std::string& device_id, const std::string& device_name,
+      const fs::path& dir, const int max_files, const size_t max_size, const size_t queue_size);
+
+  //! Queue a chunk of data read at stamp for the writer thread. Producer only.
+  void push(const double stamp, const char* data, const size_t size);
+
+  size_t get_queue_depth() const override {
+    return queue_.size();
+  }
+
+private:
+  std::string device_id_;
+  std::string device_name_;
+  fs::path dir_;
+  int max_files_;
+  size_t max_size_;
+  Spsc_queue<char> queue_;
+  //! Queued bytes copied out of the queue by the writer thread
+  std::vector<char> records_;
+  std::unique_ptr<Rolling_file> file_;
+
+  bool open() override;
+  void write_queued() override;
+  void sync() override;
+  void release() override;
+};
+
+using Raw_capture_channel_ptr = std::shared_ptr<Raw_capture_channel>;
+
+
+/**
+ * Single thread writing the logs of all devices
+ *
+ * The thread wakes up every flush_interval, writes the data queued in each
+ * channel in a single write per log and commits the files to storage every
+ * sync interval. Destruction writes out what is queued and stops the
+ * thread.
+ */
+struct Device_log_service {
+  Device_log_service();
+  ~Device_log_service();
+
+  Device_log_service(const Device_log_service&) = delete;
+  Device_log_service& operator=(const Device_log_service&) = delete;
+
+  //! Create a channel for a device log. The log file is opened by the writer thread.
+  Device_log_channel_ptr open(const std::string& device_id, const std::string& device_name,
+      const fs::path& dir, const int max_files, const size_t max_size,
+      const device_log::Format format, const size_t queue_size=default_queue_size);
+
+  //! Create a channel for a raw capture. The capture file is opened by the writer thread.
+  Raw_capture_channel_ptr open_capture(const std::string& device_id, const std::string& device_name,
+      const fs::path& dir, const int max_files, const size_t max_size,
+      const size_t queue_size=default_capture_queue_size);
+
+  //! Set interval in seconds between commits to storage, 0 to leave it to the OS
+  void set_sync_interval(const double seconds);
+
+  static constexpr size_t default_queue_size = 32768;
+  static constexpr size_t default_capture_queue_size = 4 * 1024 * 1024;
+  static constexpr double flush_interval = 0.2;
+
+private:
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::vector<Log_channel_ptr> channels_;
+  double sync_interval_;
+  bool stop_;
+  std::thread thread_;
+
+  void add(const Log_channel_ptr& channel);
+  void run();
+};
+
+
+//! Return the device log service of the application
+extern Device_log_service& get_device_log_service();
+
+
+/**
+ * Reader of a binary device log
+ */
+struct Device_log_reader {
+  //! Read the file header. Throws Device_log_exception when it is invalid
+  explicit Device_log_reader(std::istream& stream);
+
+  /**
+   * Read the next record
+   *
+   * Returns false at the end of the log. The quantity of the record is
+   * the quantity code as written, see get_quantity_name.
+   */
+  bool read(Stamped_quantity& value);
+
+  const std::string& get_device_id() const {
+    return device_id_;
+  }
+
+  const std::string& get_device_name() const {
+    return device_name_;
+  }
+
+  //! Return the name the quantity had when the log was written
+  std::string get_quantity_name(const Quantity quantity) const;
+
+private:
+  std::istream& stream_;
+  std::string device_id_;
+  std::string device_name_;
+  std::vector<std::string> quantity_names_;
+  device_log::Encoding encoding_;
+  uint16_t remaining_;
+  double base_;
+
+  bool read_block_header();
+};
+
+
+/**
+ * Reader of a raw capture
+ */
+struct Raw_capture_reader {
+  //! Read the file header. Throws Device_log_exception when it is invalid
+  explicit Raw_capture_reader(std::istream& stream);
+
+  //! Read the next chunk, return false at the end of the capture
+  bool read(double& stamp, std::vector<char>& data);
+
+  const std::string& get_device_id() const {
+    return device_id_;
+  }
+
+  const std::string& get_device_name() const {
+    return device_name_;
+  }
+
+private:
+  std::istream& stream_;
+  std::string device_id_;
+  std::string device_name_;
+};
+
+
+/**
+ * Write the records of a binary device log as stamp,quantity,value lines
+ *
+ * Returns the number of records written
+ */
+extern size_t device_log_to_csv(std::istream& in, std::ostream& out);
+
+
+#endif  // ifndef DEVICE_LOG_H_
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -0,0 +1,47 @@
+/**
+ * \file delimited.cpp
+ * \brief Provide implementation for delimited text device class
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "delimited.h"
+
+#include "../usb.h"
+#include "../serial.h"
+#include "../socket.h"
+// For context provider
+#include "../loop.h"
+
+using Delimited_device_usb = delimited::Delimited_device<Usb, Context_provider>;
+using Delimited_device_serial = delimited::Delimited_device<Serial, Context_provider>;
+using Delimited_device_socket = delimited::Delimited_device<Socket, Context_provider>;
+
+using Delimited_device_usb_factory = Device_factory<Delimited_device_usb>;
+using Delimited_device_serial_factory = Device_factory<Delimited_device_serial>;
+using Delimited_device_socket_factory = Device_factory<Delimited_device_socket>;
+
+static auto& delimited_usb_device_factory =
+    add_device_factory("delimited_device_usb", std::move(std::make_unique<Delimited_device_usb_factory>()));
+static auto& delimited_serial_device_factory =
+    add_device_factory("delimited_device_serial", std::move(std::make_unique<Delimited_device_serial_factory>()));
+static auto& delimited_socket_device_factory =
+    add_device_factory("delimited_device_tcp", std::move(std::make_unique<Delimited_device_socket_factory>()));
+
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -0,0 +1,346 @@
+/**
+ * \file delimited.h
+ * \brief Provide device extracting values from delimited text lines
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DELIMITED_H_
+#define DELIMITED_H_
+
+
+#include "../device.h"
+#include "../log.h"
+#include "../functions.h"
+#include "../datetime.h"
+#include "../parser.h"
+#include "../quantities.h"
+#include "../types.h"
+
+#include <string>
+#include <vector>
+#include <charconv>
+#include <algorithm>
+
+namespace delimited {
+
+namespace parser {
+
+//! Column of a line holding a quantity value
+struct Column {
+  size_t index;
+  Quantity quantity;
+  double multiplier;
+  double offset;
+};
+
+using Columns = std::vector<Column>;
+
+
+//! Format of the time column
+enum class Time_format {
+  seconds,  ///< Unix time in seconds
+  iso,  ///< Date and time, e.g. 2020-04-22T17:10:43.782Z or 2020-04-22 17:10:43.782
+  time_of_day,  ///< Time of day, e.g. 17:10:43.782
+};
+
+
+//! Skip spaces and tabs on both ends of [begin, end)
+inline void trim(const char*& begin, const char*& end) {
+  while (begin < end && (*begin == ' ' || *begin == '\t'))
+    ++begin;
+  while (end > begin && (end[-1] == ' ' || end[-1] == '\t'))
+    --end;
+}
+
+
+//! Read a number taking up all of [begin, end)
+inline bool read_number(const char* begin, const char* end, double& value) {
+  trim(begin, end);
+  if (begin < end && *begin == '+')
+    ++begin;
+  auto result = std::from_chars(begin, end, value);
+  return result.ec == std::errc() && result.ptr == end && begin < end;
+}
+
+
+//! Read an unsigned integer of count digits at data
+inline bool read_digits(const char*& data, const char* end, const size_t count, int& value) {
+  if (end - data < static_cast<std::ptrdiff_t>(count)) {
+    return false;
+  }
+  auto result = std::from_chars(data, data + count, value);
+  if (result.ec != std::errc() || result.ptr != data + count) {
+    return false;
+  }
+  data += count;
+  return true;
+}
+
+
+//! Read time of day [h]h:mm:ss[.fff] at data
+inline bool read_time_of_day(const char*& data, const char* end, int& hour, int& minute, double& second) {
+  auto result = std::from_chars(data, end, hour);
+  if (result.ec != std::errc()) {
+    return false;
+  }
+  data = result.ptr;
+  if (data == end || *data++ != ':' || !read_digits(data, end, 2, minute) || data == end || *data++ != ':') {
+    return false;
+  }
+  result = std::from_chars(data, end, second);
+  if (result.ec != std::errc()) {
+    return false;
+  }
+  data = result.ptr;
+  return true;
+}
+
+
+//! Read a time in format from [begin, end)
+inline bool read_time(const char* begin, const char* end, const Time_format format, double& value) {
+  trim(begin, end);
+  if (format == Time_format::seconds) {
+    return read_number(begin, end, value);
+  }
+  int year = 0;
+  int month = 0;
+  int day = 0;
+  if (format == Time_format::iso) {
+    if (!read_digits(begin, end, 4, year) || begin == end || *begin++ != '-'
+        || !read_digits(begin, end, 2, month) || begin == end || *begin++ != '-'
+        || !read_digits(begin, end, 2, day) || begin == end || (*begin != 'T' && *begin != ' ')) {
+      return false;
+    }
+    ++begin;
+  }
+  int hour = 0;
+  int minute = 0;
+  double second = 0;
+  if (!read_time_of_day(begin, end, hour, minute, second)) {
+    return false;
+  }
+  if (begin < end && *begin == 'Z')
+    ++begin;
+  if (begin != end || hour > 23 || minute > 59 || second >= 61.0) {
+    return false;
+  }
+  value = hour * 3600.0 + minute * 60.0 + second;
+  if (format == Time_format::iso) {
+    if (month < 1 || month > 12 || day < 1 || day > 31) {
+      return false;
+    }
+    value += compose_time_value(year, month, day, 0, 0, 0, 0);
+  }
+  return true;
+}
+
+
+/**
+ * Parser extracting quantity values from columns of delimited lines
+ *
+ * Lines are split into fields once and each configured column is read
+ * from its field, so adding quantities doesn't add passes over the line.
+ * Parsing doesn't allocate. Lines that don't start with the prefix are
+ * skipped. When a time column is configured, values are stamped with its
+ * time, mapped to hub time.
+ */
+struct Delimited_parser: public Packet_parser<std::string> {
+  Delimited_parser(): Packet_parser(), values_(), columns_(), prefix_(), delimiter_(','),
+      time_column_(no_column), time_format_(Time_format::seconds), clock_() {}
+
+  //! Time column index when there is none
+  static constexpr size_t no_column = static_cast<size_t>(-1);
+
+  void parse(const double& stamp) override {
+    const char* data = buffer.data();
+    const char* end = data + buffer.size();
+    const char* line = data;
+    while (true) {
+      const char* eol = std::find(line, end, '\n');
+      if (eol == end) {
+        break;
+      }
+      const char* line_end = eol > line && eol[-1] == '\r' ? eol - 1 : eol;
+      parse_line(stamp, line, line_end);
+      line = eol + 1;
+    }
+    buffer.erase(0, line - data);
+    cur = buffer.begin();
+  }
+
+  Stamped_quantities& get_values() override {
+    return values_;
+  }
+
+  //! Add a column, several quantities may be read from the same column
+  void add_column(const Column& column) {
+    auto pos = std::upper_bound(columns_.begin(), columns_.end(), column,
+        [](const Column& a, const Column& b) { return a.index < b.index; });
+    columns_.insert(pos, column);
+  }
+
+  const Columns& get_columns() const {
+    return columns_;
+  }
+
+  void set_prefix(const std::string& prefix) {
+    prefix_ = prefix;
+  }
+
+  void set_delimiter(const char delimiter) {
+    delimiter_ = delimiter;
+  }
+
+  void set_time_column(const size_t index, const Time_format format) {
+    time_column_ = index;
+    time_format_ = format;
+    clock_ = Device_clock(format == Time_format::time_of_day ? 24 * 3600.0 : 0.0);
+  }
+
+  /**
+   * Set up from options
+   *
+   * "<quantity>.column" with optional "<quantity>.multiplier" and
+   * "<quantity>.offset" for each quantity, "prefix", "delimiter",
+   * "time_column" and "time_format": "seconds", "iso" or "time_of_day".
+   */
+  void set_options(const prtr::ptree& options) {
+    for (auto it = Quantity_iter::begin(); it != Quantity_iter::end(); ++it) {
+      std::string q_name = get_quantity_name(*it);
+      auto index = options.get_optional<int>(q_name + ".column");
+      if (!index) {
+        continue;
+      }
+      if (*index < 0) {
+        log(level::error, "Invalid % column: %", q_name, *index);
+        continue;
+      }
+      add_column(Column{static_cast<size_t>(*index), *it,
+          options.get(q_name + ".multiplier", 1.0), options.get(q_name + ".offset", 0.0)});
+    }
+    prefix_ = options.get("prefix", prefix_);
+    std::string delimiter = options.get("delimiter", std::string(1, delimiter_));
+    if (delimiter.size() == 1) {
+      delimiter_ = delimiter[0];
+    }
+    else {
+      log(level::error, "Invalid delimiter: \"%\", expected a single character", delimiter);
+    }
+    auto time_column = options.get_optional<int>("time_column");
+    if (time_column && *time_column >= 0) {
+      std::string format = options.get("time_format", "seconds");
+      if (format == "seconds" || format == "iso" || format == "time_of_day") {
+        set_time_column(static_cast<size_t>(*time_column),
+            format == "iso" ? Time_format::iso :
+            format == "time_of_day" ? Time_format::time_of_day : Time_format::seconds);
+      }
+      else {
+        log(level::error, "Invalid time format: %", format);
+      }
+    }
+  }
+
+private:
+  Stamped_quantities values_;
+  //! Sorted by index
+  Columns columns_;
+  std::string prefix_;
+  char delimiter_;
+  size_t time_column_;
+  Time_format time_format_;
+  Device_clock clock_;
+
+  void parse_line(const double& stamp, const char* line, const char* end) {
+    if (static_cast<size_t>(end - line) < prefix_.size()
+        || !std::equal(prefix_.begin(), prefix_.end(), line)) {
+      return;
+    }
+    line += prefix_.size();
+    size_t first = values_.size();
+    bool have_time = false;
+    double time = 0;
+    auto column = columns_.begin();
+    size_t index = 0;
+    const char* field = line;
+    while (column != columns_.end() || (time_column_ != no_column && index <= time_column_)) {
+      const char* field_end = std::find(field, end, delimiter_);
+      while (column != columns_.end() && column->index == index) {
+        double value;
+        if (read_number(field, field_end, value)) {
+          values_.push_back({value * column->multiplier + column->offset, stamp, column->quantity});
+        }
+        ++column;
+      }
+      if (index == time_column_) {
+        have_time = read_time(field, field_end, time_format_, time);
+      }
+      if (field_end == end) {
+        break;
+      }
+      field = field_end + 1;
+      ++index;
+    }
+    if (have_time) {
+      double line_stamp = clock_.map(time, stamp);
+      for (size_t i = first; i < values_.size(); ++i) {
+        values_[i].stamp = line_stamp;
+      }
+    }
+  }
+};
+
+}  // namespace parser
+
+
+template <class Port, class ContextProvider>
+struct Delimited_device: public Port_device<Port, ContextProvider>,
+    public Port_polling_mixin<Delimited_device<Port, ContextProvider> > {
+
+  bool initialize(asio::yield_context) override {
+    log(level::info, "Successfully initialized %", this->get_name());
+    this->start_polling();
+    return true;
+  }
+
+  template <typename Iterator>
+  void handle_data(double stamp, Iterator buf_begin, Iterator buf_end) {
+    parser_.add_and_parse(stamp, buf_begin, buf_end);
+    auto& values = parser_.get_values();
+    this->insert_values(values);
+    values.clear();
+  }
+
+  void set_options(const prtr::ptree& options) override {
+    parser_.set_options(options);
+    log(level::info, "Delimited columns: %", parser_.get_columns().size());
+  }
+
+  const parser::Delimited_parser& get_parser() const {
+    return parser_;
+  }
+
+private:
+  parser::Delimited_parser parser_;
+};
+
+}  // namespace delimited
+
+#endif  // ifndef DELIMITED_H_
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -29,37 +29,628 @@
 #include "../tools.h"
 #include "../functions.h"
 #include "../datetime.h"
+#include "../parser.h"
+#include "../quantities.h"
+
+#include <array>
+#include <string>
+#include <vector>
+#include <charconv>
+#include <algorithm>
+#include <cmath>
 
 namespace nmea {
 
-template <class Port, class ContextProvider>
-struct Generic_NMEA: public Port_device<Port, ContextProvider>, 
-    public Polling_mixin<Generic_NMEA<Port, ContextProvider> > {
+namespace parser {
+
+//! Sentences the parser decodes
+enum class Sentence {
+  gga,  ///< Position fix
+  rmc,  ///< Recommended minimum: date, time, position, speed and course
+  vtg,  ///< Course and speed over ground
+  hdt,  ///< True heading
+  zda,  ///< Date and time
+  gst,  ///< Position error statistics
+  rot,  ///< Rate of turn
+  hpr,  ///< Heading, pitch and roll, $--HPR or $PSAT,HPR
+  pashr,  ///< Heading, roll, pitch and heave, $PASHR
+  mwv,  ///< Wind angle and speed
+  count
+};
+
+constexpr const char* sentence_names[static_cast<size_t>(Sentence::count)] = {
+  "GGA", "RMC", "VTG", "HDT", "ZDA", "GST", "ROT", "HPR", "PASHR", "MWV"
+};
+
+//! Longer lines are taken to be missing their end of line
+constexpr size_t max_sentence_size = 0x100;
+constexpr size_t max_fields = 32;
+constexpr double knot = 1852.0 / 3600.0;
+
 
-  bool initialize(asio::yield_context yield) override {
-    bool result = true;
+//! Field of a sentence, not including the comma
+struct Field {
+  const char* begin;
+  const char* end;
+
+  bool empty() const {
+    return begin == end;
+  }
 
-    if (result) {
-      log(level::info, "Successfully initialized %", this->get_name());
-      this->start_polling();
+  bool is(const char* text) const {
+    const char* c = begin;
+    while (*text && c < end && *c == *text) {
+      ++c;
+      ++text;
     }
-    else {
-      log(level::error, "Failed to initialize %", this->get_name());
-      if (this->reset(yield)) {
-        log(level::info, "Successfully reset %", this->get_name());
+    return *text == 0 && c == end;
+  }
+
+  char first() const {
+    return begin < end ? *begin : 0;
+  }
+};
+
+using Fields = std::array<Field, max_fields>;
+
+
+//! Read a number, with optional plus sign, taking up the whole field
+inline bool read_number(const Field& field, double& value) {
+  const char* begin = field.first() == '+' ? field.begin + 1 : field.begin;
+  auto result = std::from_chars(begin, field.end, value);
+  return result.ec == std::errc() && result.ptr == field.end && begin < field.end;
+}
+
+
+inline bool read_integer(const Field& field, int& value) {
+  auto result = std::from_chars(field.begin, field.end, value);
+  return result.ec == std::errc() && result.ptr == field.end && !field.empty();
+}
+
+
+//! Read [d]ddmm.mmmm with hemisphere N, S, E or W in radians
+inline bool read_angle(const Field& field, const Field& hemisphere, double& value) {
+  double dm;
+  if (!read_number(field, dm)) {
+    return false;
+  }
+  double degrees = std::floor(dm / 100);
+  value = deg_to_rad(degrees + (dm - degrees * 100) / 60);
+  char h = hemisphere.first();
+  if (h == 'S' || h == 'W') {
+    value = -value;
+  }
+  return h == 'N' || h == 'S' || h == 'E' || h == 'W';
+}
+
+
+//! Read hhmmss[.ss] in seconds since midnight
+inline bool read_time_of_day(const Field& field, double& value) {
+  if (field.end - field.begin < 6 || !std::all_of(field.begin, field.begin + 6,
+      [](const char c) { return c >= '0' && c <= '9'; })) {
+    return false;
+  }
+  const char* c = field.begin;
+  int hour = (c[0] - '0') * 10 + c[1] - '0';
+  int minute = (c[2] - '0') * 10 + c[3] - '0';
+  double second;
+  auto result = std::from_chars(c + 4, field.end, second);
+  if (result.ec != std::errc() || result.ptr != field.end
+      || hour > 23 || minute > 59 || second >= 61.0) {
+    return false;
+  }
+  value = hour * 3600.0 + minute * 60.0 + second;
+  return true;
+}
+
+
+//! Return value of hexadecimal digit c, or -1 when it isn't one
+inline int hex_value(const char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+
+/**
+ * Parser for NMEA 0183 sentences
+ *
+ * Sentences are split into fields in place, so parsing doesn't allocate.
+ * Sentences with a wrong checksum are dropped, sentences without a checksum
+ * are accepted. Only the configured talkers and sentences are decoded.
+ *
+ * Date and time from ZDA and RMC are reported as ut. With device time
+ * enabled, values of sentences with a time of day are stamped with the
+ * time of the sentence mapped to hub time once a date was received, other
+ * values are stamped with their arrival time.
+ */
+struct Nmea_parser: public Packet_parser<Contiguous_buffer> {
+  Nmea_parser(): Packet_parser(), values_(), fields_(), statistics_(), talkers_(),
+      clock_(), use_device_time_(false), have_date_(false), date_(0), last_time_of_day_(0),
+      wind_angle_(Quantity::cst0), wind_speed_(Quantity::cst1),
+      true_wind_angle_(Quantity::cst2), true_wind_speed_(Quantity::cst3) {
+    sentences_.fill(true);
+  }
+
+  void parse(const double& stamp) override {
+    const char* data = reinterpret_cast<const char*>(buffer.begin());
+    const char* end = data + buffer.size();
+    const char* cur = data;
+    while (cur < end) {
+      const char* start = cur;
+      while (start < end && *start != '$' && *start != '!')
+        ++start;
+      skip(cur, start);
+      cur = start;
+      if (start == end) {
+        break;
+      }
+      const char* eol = std::find(start + 1, end, '\n');
+      // A start inside the line means the line was cut off
+      const char* restart = std::find_if(start + 1, eol,
+          [](const char c) { return c == '$' || c == '!'; });
+      if (restart < eol) {
+        skip(start, restart);
+        cur = restart;
+        continue;
+      }
+      if (eol == end) {
+        if (static_cast<size_t>(end - start) > max_sentence_size) {
+          skip(start, end);
+          cur = end;
+        }
+        break;
       }
+      const char* line_end = eol > start && eol[-1] == '\r' ? eol - 1 : eol;
+      parse_sentence(stamp, start + 1, line_end);
+      cur = eol + 1;
     }
+    buffer.erase(buffer.begin(), buffer.begin() + (cur - data));
+  }
+
+  Stamped_quantities& get_values() override {
+    return values_;
+  }
+
+  const Link_statistics& get_statistics() const {
+    return statistics_;
+  }
+
+  //! Stamp values with the time of their sentence mapped to hub time
+  void set_use_device_time(const bool value) {
+    use_device_time_ = value;
+    clock_.reset();
+  }
 
+  //! Only decode sentences of talkers, e.g. "GP", or of all talkers when empty
+  void set_talkers(const std::vector<std::string>& talkers) {
+    talkers_.clear();
+    for (auto& talker: talkers) {
+      if (talker.size() == 2) {
+        talkers_.push_back({talker[0], talker[1]});
+      }
+      else {
+        log(level::error, "Invalid NMEA talker: \"%\"", talker);
+      }
+    }
+  }
+
+  //! Only decode the named sentences, e.g. "GGA", or all when empty
+  void set_sentences(const std::vector<std::string>& names) {
+    sentences_.fill(names.empty());
+    for (auto& name: names) {
+      auto it = std::find_if(std::begin(sentence_names), std::end(sentence_names),
+          [&name](const char* n) { return name == n; });
+      if (it != std::end(sentence_names)) {
+        sentences_[it - std::begin(sentence_names)] = true;
+      }
+      else {
+        log(level::error, "Unsupported NMEA sentence: \"%\"", name);
+      }
+    }
+  }
+
+  /**
+   * Set up from options
+   *
+   * "talkers" and "sentences" are comma separated lists; "device_time";
+   * "wind_angle", "wind_speed", "true_wind_angle" and "true_wind_speed" name
+   * the quantities of relative and true wind of MWV.
+   */
+  void set_options(const prtr::ptree& options) {
+    set_talkers(split_list(options.get("talkers", "")));
+    set_sentences(split_list(options.get("sentences", "")));
+    set_use_device_time(options.get("device_time", use_device_time_));
+    get_quantity_option(options, "wind_angle", wind_angle_);
+    get_quantity_option(options, "wind_speed", wind_speed_);
+    get_quantity_option(options, "true_wind_angle", true_wind_angle_);
+    get_quantity_option(options, "true_wind_speed", true_wind_speed_);
+  }
+
+private:
+  Stamped_quantities values_;
+  Fields fields_;
+  Link_statistics statistics_;
+  std::vector<std::array<char, 2> > talkers_;
+  std::array<bool, static_cast<size_t>(Sentence::count)> sentences_;
+  Device_clock clock_;
+  bool use_device_time_;
+  bool have_date_;
+  //! Unix time of midnight of the latest date
+  double date_;
+  double last_time_of_day_;
+  Quantity wind_angle_;
+  Quantity wind_speed_;
+  Quantity true_wind_angle_;
+  Quantity true_wind_speed_;
+
+  static std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> result;
+    size_t begin = 0;
+    while (begin < list.size()) {
+      size_t end = std::min(list.find(',', begin), list.size());
+      std::string item = list.substr(begin, end - begin);
+      item.erase(0, item.find_first_not_of(' '));
+      item.erase(item.find_last_not_of(' ') + 1);
+      if (!item.empty()) {
+        result.push_back(item);
+      }
+      begin = end + 1;
+    }
     return result;
   }
 
-  void poll_data(asio::yield_context yield) override {
-    (void)yield;
+  static void get_quantity_option(const prtr::ptree& options, const std::string& name, Quantity& quantity) {
+    auto q_name = options.get_optional<std::string>(name);
+    if (!q_name) {
+      return;
+    }
+    Quantity q = get_quantity(*q_name);
+    if (q != Quantity::end) {
+      quantity = q;
+    }
+    else {
+      log(level::error, "Invalid % quantity: %", name, *q_name);
+    }
+  }
+
+  void skip(const char* begin, const char* end) {
+    size_t junk = std::count_if(begin, end, [](const char c) { return c != '\r' && c != '\n'; });
+    if (junk > 0) {
+      statistics_.junk_bytes += junk;
+      ++statistics_.resyncs;
+    }
   }
 
+  bool is_enabled(const Sentence sentence) const {
+    return sentences_[static_cast<size_t>(sentence)];
+  }
+
+  //! Parse sentence between start character and end of line
+  void parse_sentence(const double& stamp, const char* begin, const char* end) {
+    const char* star = std::find(begin, end, '*');
+    if (star != end) {
+      if (end - star != 3) {
+        ++statistics_.checksum_errors;
+        return;
+      }
+      int high = hex_value(star[1]);
+      int low = hex_value(star[2]);
+      uint8_t checksum = 0;
+      for (const char* c = begin; c < star; ++c)
+        checksum ^= static_cast<uint8_t>(*c);
+      if (high < 0 || low < 0 || checksum != ((high << 4) | low)) {
+        ++statistics_.checksum_errors;
+        return;
+      }
+    }
+    ++statistics_.packets;
+
+    size_t count = 0;
+    const char* field = begin;
+    while (count < max_fields) {
+      const char* field_end = std::find(field, star, ',');
+      fields_[count++] = {field, field_end};
+      if (field_end == star) {
+        break;
+      }
+      field = field_end + 1;
+    }
+    // Missing trailing fields read as empty
+    for (size_t i = count; i < max_fields; ++i) {
+      fields_[i] = {star, star};
+    }
+
+    const Field& address = fields_[0];
+    if (address.first() == 'P') {
+      if (address.is("PASHR") && is_enabled(Sentence::pashr)) {
+        decode_pashr(stamp, fields_.data());
+      }
+      else if (address.is("PSAT") && fields_[1].is("HPR") && is_enabled(Sentence::hpr)) {
+        decode_hpr(stamp, fields_.data() + 1);
+      }
+      return;
+    }
+    if (address.end - address.begin != 5 || !is_talker_enabled(address.begin)) {
+      return;
+    }
+    Field formatter{address.begin + 2, address.end};
+    for (size_t i = 0; i < static_cast<size_t>(Sentence::pashr); ++i) {
+      if (formatter.is(sentence_names[i])) {
+        if (sentences_[i]) {
+          decode(static_cast<Sentence>(i), stamp, fields_.data());
+        }
+        return;
+      }
+    }
+    if (formatter.is("MWV") && is_enabled(Sentence::mwv)) {
+      decode_mwv(stamp, fields_.data());
+    }
+  }
+
+  bool is_talker_enabled(const char* talker) const {
+    if (talkers_.empty()) {
+      return true;
+    }
+    return std::any_of(talkers_.begin(), talkers_.end(),
+        [talker](const std::array<char, 2>& t) { return t[0] == talker[0] && t[1] == talker[1]; });
+  }
+
+  void decode(const Sentence sentence, const double& stamp, const Field* f) {
+    switch (sentence) {
+      case Sentence::gga: decode_gga(stamp, f); break;
+      case Sentence::rmc: decode_rmc(stamp, f); break;
+      case Sentence::vtg: decode_vtg(stamp, f); break;
+      case Sentence::hdt: decode_hdt(stamp, f); break;
+      case Sentence::zda: decode_zda(stamp, f); break;
+      case Sentence::gst: decode_gst(stamp, f); break;
+      case Sentence::rot: decode_rot(stamp, f); break;
+      case Sentence::hpr: decode_hpr(stamp, f); break;
+      default: break;
+    }
+  }
+
+  void add_value(const double value, const double stamp, const Quantity quantity) {
+    values_.push_back({value, stamp, quantity});
+  }
+
+  void set_date(const int year, const int month, const int day, const double time_of_day) {
+    if (year < 1970 || month < 1 || month > 12 || day < 1 || day > 31) {
+      return;
+    }
+    date_ = compose_time_value(year, month, day, 0, 0, 0, 0);
+    last_time_of_day_ = time_of_day;
+    have_date_ = true;
+  }
+
+  /**
+   * Return stamp for values of a sentence with time of day in field
+   *
+   * Sets time to the unix time of the sentence when a date is known.
+   */
+  double get_stamp(const double& stamp, const Field& field, double& time) {
+    time = 0;
+    double time_of_day;
+    if (!have_date_ || !read_time_of_day(field, time_of_day)) {
+      return stamp;
+    }
+    if (time_of_day < last_time_of_day_ - 12 * 3600.0) {
+      // Passed midnight since the latest date
+      date_ += 24 * 3600.0;
+    }
+    else if (time_of_day > last_time_of_day_ + 12 * 3600.0) {
+      // Late sentence from before midnight
+      time = date_ - 24 * 3600.0 + time_of_day;
+      return use_device_time_ ? clock_.map(time, stamp) : stamp;
+    }
+    last_time_of_day_ = time_of_day;
+    time = date_ + time_of_day;
+    return use_device_time_ ? clock_.map(time, stamp) : stamp;
+  }
+
+  //! $--GGA,time,lat,N,lon,E,quality,satellites,hdop,altitude,M,separation,M,age,station
+  void decode_gga(const double& stamp, const Field* f) {
+    int quality;
+    if (!read_integer(f[6], quality) || quality == 0) {
+      return;
+    }
+    double time;
+    double s = get_stamp(stamp, f[1], time);
+    double value;
+    if (read_angle(f[2], f[3], value))
+      add_value(value, s, Quantity::la);
+    if (read_angle(f[4], f[5], value))
+      add_value(value, s, Quantity::lo);
+    double altitude;
+    if (read_number(f[9], altitude)) {
+      add_value(altitude, s, Quantity::hmsl);
+      double separation;
+      if (read_number(f[11], separation))
+        add_value(altitude + separation, s, Quantity::hg84);
+    }
+  }
+
+  //! $--RMC,time,status,lat,N,lon,E,speed,course,date,variation,E,mode
+  void decode_rmc(const double& stamp, const Field* f) {
+    int date;
+    double time_of_day;
+    if (f[9].end - f[9].begin == 6 && read_integer(f[9], date) && read_time_of_day(f[1], time_of_day)) {
+      int year = date % 100;
+      set_date(year < 80 ? 2000 + year : 1900 + year, date / 100 % 100, date / 10000, time_of_day);
+    }
+    double time;
+    double s = get_stamp(stamp, f[1], time);
+    if (time > 0)
+      add_value(time, s, Quantity::ut);
+    if (f[2].first() != 'A') {
+      return;
+    }
+    double value;
+    if (read_angle(f[3], f[4], value))
+      add_value(value, s, Quantity::la);
+    if (read_angle(f[5], f[6], value))
+      add_value(value, s, Quantity::lo);
+    if (read_number(f[7], value))
+      add_value(value * knot, s, Quantity::vog);
+    if (read_number(f[8], value))
+      add_value(deg_to_rad(value), s, Quantity::crs);
+  }
+
+  //! $--VTG,course,T,course,M,speed,N,speed,K,mode
+  void decode_vtg(const double& stamp, const Field* f) {
+    if (f[9].first() == 'N') {
+      // Data not valid
+      return;
+    }
+    double value;
+    if (read_number(f[1], value))
+      add_value(deg_to_rad(value), stamp, Quantity::crs);
+    if (read_number(f[7], value))
+      add_value(value / 3.6, stamp, Quantity::vog);
+    else if (read_number(f[5], value))
+      add_value(value * knot, stamp, Quantity::vog);
+  }
+
+  //! $--HDT,heading,T
+  void decode_hdt(const double& stamp, const Field* f) {
+    double value;
+    if (read_number(f[1], value))
+      add_value(deg_to_rad(value), stamp, Quantity::hdg);
+  }
+
+  //! $--ZDA,time,day,month,year,zone hours,zone minutes
+  void decode_zda(const double& stamp, const Field* f) {
+    int day, month, year;
+    double time_of_day;
+    if (!read_integer(f[2], day) || !read_integer(f[3], month) || !read_integer(f[4], year)
+        || !read_time_of_day(f[1], time_of_day)) {
+      return;
+    }
+    set_date(year, month, day, time_of_day);
+    double time;
+    double s = get_stamp(stamp, f[1], time);
+    if (time > 0)
+      add_value(time, s, Quantity::ut);
+  }
+
+  //! $--GST,time,rms,major,minor,orientation,lat error,lon error,alt error
+  void decode_gst(const double& stamp, const Field* f) {
+    double time;
+    double s = get_stamp(stamp, f[1], time);
+    double lat, lon, alt;
+    if (read_number(f[6], lat) && read_number(f[7], lon))
+      add_value(std::sqrt(lat * lat + lon * lon), s, Quantity::hacc);
+    if (read_number(f[8], alt))
+      add_value(alt, s, Quantity::vacc);
+  }
+
+  //! $--ROT,rate in degrees per minute,status
+  void decode_rot(const double& stamp, const Field* f) {
+    double value;
+    if (f[2].first() == 'A' && read_number(f[1], value))
+      add_value(deg_to_rad(value / 60), stamp, Quantity::yr);
+  }
+
+  //! $--HPR,time,heading,pitch,roll or $PSAT,HPR,time,heading,pitch,roll
+  void decode_hpr(const double& stamp, const Field* f) {
+    double time;
+    double s = get_stamp(stamp, f[1], time);
+    double value;
+    if (read_number(f[2], value))
+      add_value(deg_to_rad(value), s, Quantity::hdg);
+    if (read_number(f[3], value))
+      add_value(deg_to_rad(value), s, Quantity::pi);
+    if (read_number(f[4], value))
+      add_value(deg_to_rad(value), s, Quantity::ro);
+  }
+
+  //! $PASHR,time,heading,T,roll,pitch,heave,roll accuracy,pitch accuracy,heading accuracy,...
+  void decode_pashr(const double& stamp, const Field* f) {
+    double time;
+    double s = get_stamp(stamp, f[1], time);
+    double value;
+    if (read_number(f[2], value))
+      add_value(deg_to_rad(value), s, Quantity::hdg);
+    if (read_number(f[4], value))
+      add_value(deg_to_rad(value), s, Quantity::ro);
+    if (read_number(f[5], value))
+      add_value(deg_to_rad(value), s, Quantity::pi);
+    if (read_number(f[6], value))
+      // Heave is up, z down
+      add_value(-value, s, Quantity::z);
+    if (read_number(f[7], value))
+      add_value(deg_to_rad(value), s, Quantity::racc);
+    if (read_number(f[8], value))
+      add_value(deg_to_rad(value), s, Quantity::pacc);
+    if (read_number(f[9], value))
+      add_value(deg_to_rad(value), s, Quantity::hdac);
+  }
+
+  //! $--MWV,angle,reference R or T,speed,unit K, M, N or S,status
+  void decode_mwv(const double& stamp, const Field* f) {
+    if (f[5].first() != 'A') {
+      return;
+    }
+    char reference = f[2].first();
+    if (reference != 'R' && reference != 'T') {
+      return;
+    }
+    double value;
+    if (read_number(f[1], value))
+      add_value(deg_to_rad(value), stamp, reference == 'R' ? wind_angle_ : true_wind_angle_);
+    if (read_number(f[3], value)) {
+      switch (f[4].first()) {
+        case 'K': value /= 3.6; break;
+        case 'M': break;
+        case 'N': value *= knot; break;
+        case 'S': value *= 1609.344 / 3600; break;
+        default: return;
+      }
+      add_value(value, stamp, reference == 'R' ? wind_speed_ : true_wind_speed_);
+    }
+  }
 };
 
+}  // namespace parser
+
+
+template <class Port, class ContextProvider>
+struct Generic_NMEA: public Port_device<Port, ContextProvider>,
+    public Port_polling_mixin<Generic_NMEA<Port, ContextProvider> > {
+
+  bool initialize(asio::yield_context) override {
+    log(level::info, "Successfully initialized %", this->get_name());
+    this->start_polling();
+    return true;
+  }
+
+  template <typename Iterator>
+  void handle_data(double stamp, Iterator buf_begin, Iterator buf_end) {
+    parser_.add_and_parse(stamp, buf_begin, buf_end);
+    auto& values = parser_.get_values();
+    this->insert_values(values);
+    values.clear();
+  }
 
+  void set_options(const prtr::ptree& options) override {
+    parser_.set_options(options);
+  }
+
+  const Link_statistics* get_link_statistics() const override {
+    return &parser_.get_statistics();
+  }
+
+  const parser::Nmea_parser& get_parser() const {
+    return parser_;
+  }
+
+private:
+  parser::Nmea_parser parser_;
+};
 
 }  // namespace nmea
 
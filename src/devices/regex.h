@@ -39,8 +39,13 @@
 #include <ostream>
 #include <string>
 #include <map>
+#include <vector>
 #include <ctime>
 #include <iomanip>
+#include <charconv>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
 
 namespace regexp {
 
@@ -57,9 +62,270 @@ struct Quantity_filter {
 
 using Quantity_filters = std::map<Quantity, Quantity_filter>;
 
+
+//! Start and end of a capture group in the expression with its captures removed
+struct Capture_span {
+  size_t begin;
+  size_t end;
+
+  bool operator==(const Capture_span& other) const {
+    return begin == other.begin && end == other.end;
+  }
+};
+
+using Capture_spans = std::vector<Capture_span>;
+
+/**
+ * Remove the capture groups from a regular expression
+ *
+ * Returns false when removing the parentheses of a capture group could
+ * change what the expression matches, i.e. for groups with a quantifier
+ * or alternatives, or when the expression has back references or named
+ * groups. Expressions that differ only in their capture groups then
+ * match the same text and can be evaluated as one.
+ */
+inline bool split_captures(const std::string& expression, std::string& skeleton, Capture_spans& captures) {
+  struct Group {
+    bool capturing;
+    size_t capture;
+    bool alternatives;
+  };
+  std::vector<Group> groups;
+  skeleton.clear();
+  captures.clear();
+  size_t i = 0;
+  size_t size = expression.size();
+  while (i < size) {
+    char c = expression[i];
+    if (c == '\\') {
+      char next = i + 1 < size ? expression[i + 1] : '\0';
+      if (std::isdigit(static_cast<unsigned char>(next)) || next == 'k' || next == 'g') {
+        // Back reference
+        return false;
+      }
+      skeleton.append(expression, i, 2);
+      i += 2;
+    }
+    else if (c == '[') {
+      // Copy character class, in which a leading ] is a literal
+      size_t j = i + 1;
+      if (j < size && expression[j] == '^')
+        ++j;
+      if (j < size && expression[j] == ']')
+        ++j;
+      while (j < size && expression[j] != ']') {
+        j += expression[j] == '\\' ? 2 : 1;
+      }
+      skeleton.append(expression, i, j + 1 - i);
+      i = j + 1;
+    }
+    else if (c == '(') {
+      if (i + 1 < size && expression[i + 1] == '?') {
+        if (i + 2 < size && (expression[i + 2] == 'P' || expression[i + 2] == '\'' ||
+              (expression[i + 2] == '<' && i + 3 < size && expression[i + 3] != '=' && expression[i + 3] != '!'))) {
+          return false;
+        }
+        groups.push_back({false, 0, false});
+        skeleton.push_back(c);
+      }
+      else {
+        groups.push_back({true, captures.size(), false});
+        captures.push_back({skeleton.size(), skeleton.size()});
+      }
+      ++i;
+    }
+    else if (c == ')') {
+      if (groups.empty()) {
+        return false;
+      }
+      Group group = groups.back();
+      groups.pop_back();
+      if (group.capturing) {
+        if (group.alternatives || (i + 1 < size && std::strchr("*+?{", expression[i + 1]) != nullptr)) {
+          return false;
+        }
+        captures[group.capture].end = skeleton.size();
+      }
+      else {
+        skeleton.push_back(c);
+      }
+      ++i;
+    }
+    else {
+      if (c == '|' && !groups.empty()) {
+        groups.back().alternatives = true;
+      }
+      skeleton.push_back(c);
+      ++i;
+    }
+  }
+  return groups.empty();
+}
+
+
+/**
+ * Insert capture groups into an expression without captures
+ *
+ * Groups are numbered in the order of their opening parentheses, which is
+ * the order of the spans when sorted by begin and, for equal begins, by
+ * descending end. Spans should not cross.
+ */
+inline std::string join_captures(const std::string& skeleton, const Capture_spans& spans) {
+  std::string expression;
+  for (size_t pos = 0; pos <= skeleton.size(); ++pos) {
+    // Close innermost groups first
+    for (auto span = spans.rbegin(); span != spans.rend(); ++span) {
+      if (span->end == pos && span->begin != pos) {
+        expression.push_back(')');
+      }
+    }
+    for (auto& span: spans) {
+      if (span.begin == pos) {
+        expression += span.end == pos ? "()" : "(";
+      }
+    }
+    if (pos < skeleton.size()) {
+      expression.push_back(skeleton[pos]);
+    }
+  }
+  return expression;
+}
+
+
+inline bool spans_cross(const Capture_span& a, const Capture_span& b) {
+  return (a.begin < b.begin && b.begin < a.end && a.end < b.end)
+      || (b.begin < a.begin && a.begin < b.end && b.end < a.end);
+}
+
+
+/**
+ * Filters evaluated with a single expression
+ *
+ * The expression holds the capture groups of all its member filters,
+ * each member knows the groups that are its own.
+ */
+struct Pattern_set {
+  struct Member {
+    Quantity quantity;
+    const Quantity_filter* filter;
+    //! Index in the expression of each capture group of the filter
+    std::vector<int> groups;
+  };
+
+  std::string skeleton;
+  Capture_spans spans;
+  boost::regex expression;
+  std::vector<Member> members;
+};
+
+using Pattern_sets = std::vector<Pattern_set>;
+
+
+/**
+ * Combine filters whose expressions differ only in their capture groups
+ *
+ * E.g. filters extracting different columns of the same line become a
+ * single expression capturing all of those columns.
+ */
+inline Pattern_sets make_pattern_sets(const Quantity_filters& filters) {
+  struct Candidate {
+    Quantity quantity;
+    const Quantity_filter* filter;
+    Capture_spans captures;
+  };
+  // Candidates per set, sets that can't be combined have no skeleton
+  std::vector<std::vector<Candidate>> candidates;
+  Pattern_sets sets;
+  std::string skeleton;
+  Capture_spans captures;
+  for (const auto& [q, filter]: filters) {
+    bool split = split_captures(filter.expression.str(), skeleton, captures)
+        && captures.size() == filter.expression.mark_count();
+    Pattern_set* target = nullptr;
+    if (split) {
+      for (auto& set: sets) {
+        if (set.skeleton.empty() || set.skeleton != skeleton) {
+          continue;
+        }
+        bool crossing = false;
+        for (auto& capture: captures) {
+          for (auto& span: set.spans) {
+            crossing = crossing || spans_cross(capture, span);
+          }
+        }
+        if (!crossing) {
+          target = &set;
+          break;
+        }
+      }
+      if (target == nullptr) {
+        sets.push_back(Pattern_set{skeleton, {}, boost::regex(), {}});
+        candidates.emplace_back();
+        target = &sets.back();
+      }
+      for (auto& capture: captures) {
+        if (std::find(target->spans.begin(), target->spans.end(), capture) == target->spans.end()) {
+          target->spans.push_back(capture);
+        }
+      }
+      candidates[target - sets.data()].push_back({q, &filter, captures});
+    }
+    else {
+      // Evaluated on its own with its original groups
+      Pattern_set set{"", {}, filter.expression, {}};
+      Pattern_set::Member member{q, &filter, {}};
+      for (size_t i = 1; i <= filter.expression.mark_count(); ++i) {
+        member.groups.push_back(static_cast<int>(i));
+      }
+      set.members.push_back(member);
+      sets.push_back(set);
+      candidates.emplace_back();
+    }
+  }
+
+  for (size_t i = 0; i < sets.size(); ++i) {
+    auto& set = sets[i];
+    if (candidates[i].empty()) {
+      continue;
+    }
+    std::sort(set.spans.begin(), set.spans.end(), [](const Capture_span& a, const Capture_span& b) {
+      return a.begin < b.begin || (a.begin == b.begin && a.end > b.end);
+    });
+    if (candidates[i].size() == 1) {
+      set.expression = candidates[i].front().filter->expression;
+    }
+    else {
+      set.expression = boost::regex(join_captures(set.skeleton, set.spans));
+    }
+    for (auto& candidate: candidates[i]) {
+      Pattern_set::Member member{candidate.quantity, candidate.filter, {}};
+      for (auto& capture: candidate.captures) {
+        auto span = std::find(set.spans.begin(), set.spans.end(), capture);
+        member.groups.push_back(static_cast<int>(span - set.spans.begin()) + 1);
+      }
+      set.members.push_back(member);
+    }
+  }
+  return sets;
+}
+
+
+/**
+ * Parser extracting quantity values with regular expressions
+ *
+ * By default each filter is searched for in the whole buffer. In line
+ * mode the buffer is split into lines once and filters are matched
+ * against each complete line, with filters that differ only in their
+ * capture groups combined into one expression. Numbers are converted
+ * without copying the matched text.
+ */
 struct Regex_parser: public Packet_parser<std::string> {
 
   void parse(const double& stamp) override {
+    if (line_mode_) {
+      parse_lines(stamp);
+      return;
+    }
     bool matched = true;
     while (matched) {
       matched = false;
@@ -68,7 +334,6 @@ struct Regex_parser: public Packet_parser<std::string> {
         break;
       for (const auto& [q, filter]: filters_) {
         Stamped_quantity sq{0.0, stamp, q};
-        log(level::debug, "Looking for % in % with %", get_quantity_name(q), buffer, filter.expression);
         boost::match_results<iterator> match;
         if (boost::regex_search(cur, buffer.end(), match, filter.expression, boost::match_perl)) {
           matched = true;
@@ -79,44 +344,9 @@ struct Regex_parser: public Packet_parser<std::string> {
             int ii = static_cast<int>(i);
             if (match[ii].matched) {
               log(level::debug, "Found: %", match[ii]);
-
-              double value;
-              std::string s = match[ii];
-
-              if (i <= filter.formats.size()) {
-                auto format = filter.formats[i - 1];
-                if (format == "f") {
-                  if (s.find(".") == std::string::npos) {
-                    boost::algorithm::replace_last(s, ",", ".");
-                  }
-                  boost::algorithm::replace_all(s, ",", "");
-                  value = std::stod(s);
-                }
-                else if (format == "dt") {
-                  pt::ptime dt;
-                  if (s.find("T") == std::string::npos) {
-                    dt = pt::time_from_string(s);
-                  }
-                  else {
-                    dt = pt::from_iso_string(s);
-                  }
-                  value = to_timestamp(dt);
-                }
-                else {
-                  std::tm tm = {};
-                  std::stringstream ss(s);
-                  ss >> std::get_time(&tm, format.c_str());
-                  value = static_cast<double>(std::mktime(&tm));
-                }
-              }
-
-              if (i <= filter.multipliers.size()) {
-                value *= filter.multipliers[i - 1];
-              }
-              if (i <= filter.offsets.size()) {
-                value += filter.offsets[i - 1];
-              }
-              sq.value += value;
+              const char* begin = buffer.data() + (match[ii].first - buffer.begin());
+              const char* end = buffer.data() + (match[ii].second - buffer.begin());
+              sq.value += get_value(filter, i, begin, end);
             }
           }
           values_.push_back(sq);
@@ -127,17 +357,151 @@ struct Regex_parser: public Packet_parser<std::string> {
     buffer.erase(buffer.begin(), cur);
   }
 
-  Stamped_queue& get_values() override {
+  /**
+   * Parse complete lines from the buffer
+   *
+   * Lines end with a newline, optionally preceded by a carriage return.
+   * An incomplete line at the end stays in the buffer.
+   */
+  void parse_lines(const double& stamp) {
+    if (pattern_sets_dirty_) {
+      pattern_sets_ = make_pattern_sets(filters_);
+      pattern_sets_dirty_ = false;
+    }
+    const char* data = buffer.data();
+    const char* end = data + buffer.size();
+    const char* line = data;
+    boost::match_results<const char*> match;
+    while (true) {
+      const char* eol = std::find(line, end, '\n');
+      if (eol == end) {
+        break;
+      }
+      const char* line_end = eol > line && eol[-1] == '\r' ? eol - 1 : eol;
+      for (const auto& set: pattern_sets_) {
+        if (!boost::regex_search(line, line_end, match, set.expression, boost::match_perl)) {
+          continue;
+        }
+        for (const auto& member: set.members) {
+          Stamped_quantity sq{0.0, stamp, member.quantity};
+          const Quantity_filter& filter = *member.filter;
+          for (size_t i = 1; i <= member.groups.size(); ++i) {
+            auto& group = match[member.groups[i - 1]];
+            if (group.matched) {
+              sq.value += get_value(filter, i, group.first, group.second);
+            }
+          }
+          values_.push_back(sq);
+        }
+      }
+      line = eol + 1;
+    }
+    buffer.erase(0, line - data);
+    cur = buffer.begin();
+  }
+
+  Stamped_quantities& get_values() override {
     return values_;
   }
 
   Quantity_filters& filters() {
+    pattern_sets_dirty_ = true;
     return filters_;
   }
 
+  //! Match filters against complete lines instead of the whole buffer
+  void set_line_mode(const bool value) {
+    line_mode_ = value;
+  }
+
+  bool get_line_mode() const {
+    return line_mode_;
+  }
+
+  //! Number of expressions evaluated per line in line mode
+  size_t get_pattern_set_count() {
+    if (pattern_sets_dirty_) {
+      pattern_sets_ = make_pattern_sets(filters_);
+      pattern_sets_dirty_ = false;
+    }
+    return pattern_sets_.size();
+  }
+
+  //! Add filters for quantities with a "<quantity>.filter" expression in options
+  void set_filters(const prtr::ptree& options) {
+    for (auto it = Quantity_iter::begin(); it != Quantity_iter::end(); ++it) {
+      try {
+        std::string q_name = get_quantity_name(*it);
+        auto filter = Quantity_filter(options.get<std::string>(q_name + ".filter"));
+        for (int i = 0; i < 10; ++i) {
+          filter.multipliers.push_back(options.get(fmt::format("{:s}.multiplier{:d}", q_name, i), 1.0));
+          filter.offsets.push_back(options.get(fmt::format("{:s}.offset{:d}", q_name, i), 0.0));
+          filter.formats.push_back(options.get(fmt::format("{:s}.format{:d}", q_name, i), "f"));
+        }
+        filters_.emplace(std::pair(*it, filter));
+      }
+      catch (prtr::ptree_bad_path&) {
+        // Quantity filter not provided: fine!
+      }
+    }
+    pattern_sets_dirty_ = true;
+  }
+
 private:
-  Stamped_queue values_;
+  Stamped_quantities values_;
   Quantity_filters filters_;
+  bool line_mode_ = false;
+  Pattern_sets pattern_sets_;
+  bool pattern_sets_dirty_ = true;
+
+  //! Value of capture group i of filter in [begin, end), with its format, multiplier and offset applied
+  static double get_value(const Quantity_filter& filter, const size_t i, const char* begin, const char* end) {
+    double value = 0.0;
+    if (i <= filter.formats.size() && filter.formats[i - 1] != "f") {
+      value = get_value(filter.formats[i - 1], std::string(begin, end));
+    }
+    else {
+      auto result = std::from_chars(begin, end, value);
+      if (result.ec != std::errc() || result.ptr != end) {
+        // E.g. thousands separators or a decimal comma
+        value = get_value("f", std::string(begin, end));
+      }
+    }
+    if (i <= filter.multipliers.size()) {
+      value *= filter.multipliers[i - 1];
+    }
+    if (i <= filter.offsets.size()) {
+      value += filter.offsets[i - 1];
+    }
+    return value;
+  }
+
+  //! Convert s to a value according to format
+  static double get_value(const std::string& format, std::string s) {
+    if (format == "f") {
+      if (s.find(".") == std::string::npos) {
+        boost::algorithm::replace_last(s, ",", ".");
+      }
+      boost::algorithm::replace_all(s, ",", "");
+      return std::stod(s);
+    }
+    else if (format == "dt") {
+      pt::ptime dt;
+      if (s.find("T") == std::string::npos) {
+        dt = pt::time_from_string(s);
+      }
+      else {
+        dt = pt::from_iso_string(s);
+      }
+      return to_timestamp(dt);
+    }
+    else {
+      std::tm tm = {};
+      std::stringstream ss(s);
+      ss >> std::get_time(&tm, format.c_str());
+      return static_cast<double>(std::mktime(&tm));
+    }
+  }
 };
 
 }
@@ -167,31 +531,23 @@ struct Regex_device: public Port_device<Port, ContextProvider>,
   void handle_data(double stamp, Iterator buf_begin, Iterator buf_end) {
     parser_.add_and_parse(stamp, buf_begin, buf_end);
     auto& values = parser_.get_values();
-    while (!values.empty()) {
-      this->insert_value(values.front());
-      values.pop_front();
-    }
+    this->insert_values(values);
+    values.clear();
   }
 
   void set_options(const prtr::ptree& options) override {
-    (void)options;
-    for (auto it = Quantity_iter::begin(); it != Quantity_iter::end(); ++it) {
-      try {
-        std::string q_name = get_quantity_name(*it);
-        auto filter = parser::Quantity_filter(options.get<std::string>(q_name + ".filter"));
-        for (int i = 0; i < 10; ++i) {
-          filter.multipliers.push_back(options.get(fmt::format("{:s}.multiplier{:d}", q_name, i), 1.0));
-          filter.offsets.push_back(options.get(fmt::format("{:s}.offset{:d}", q_name, i), 0.0));
-          filter.formats.push_back(options.get(fmt::format("{:s}.format{:d}", q_name, i), "f"));
-        }
-        parser_.filters().emplace(std::pair(*it, filter));
-      }
-      catch (prtr::ptree_bad_path&) {
-        // Quantity filter not provided: fine!
-      }
+    parser_.set_filters(options);
+    auto line_mode = options.get_optional<bool>("line_mode");
+    if (line_mode) {
+      parser_.set_line_mode(*line_mode);
+      log(level::info, "Set line mode: %", *line_mode);
     }
   }
 
+  const parser::Regex_parser& get_parser() const {
+    return parser_;
+  }
+
 private:
   parser::Regex_parser parser_;
 };
@@ -28,30 +28,38 @@
 
 namespace runwell {
 
+//! Regular expressions extracting the quantities from a Runwell data line
+inline prtr::ptree get_regex_options() {
+  prtr::ptree regex_options;
+  regex_options.put( "md0.filter", 
+      "^([0-2]),[0-2],[0-9]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+$");
+  regex_options.put( "md1.filter", 
+      "^[0-2],([0-2]),[0-9]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+$");
+  regex_options.put("sts0.filter", 
+      "^[0-2],[0-2],([0-9]+),[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+$");
+  regex_options.put( "frq.filter", 
+      "^[0-2],[0-2],[0-9]+,([0-9\\-.]+),[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+$");
+  regex_options.put("vset.filter", 
+      "^[0-2],[0-2],[0-9]+,[0-9\\-.]+,([0-9\\-.]+),[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+$");
+  regex_options.put("vsig.filter", 
+      "^[0-2],[0-2],[0-9]+,[0-9\\-.]+,[0-9\\-.]+,([0-9\\-.]+),[0-9\\-.]+,[0-9\\-.]+$");
+  regex_options.put("vsup.filter", 
+      "^[0-2],[0-2],[0-9]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,([0-9\\-.]+),[0-9\\-.]+$");
+  regex_options.put("isup.filter", 
+      "^[0-2],[0-2],[0-9]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,([0-9\\-.]+)$");
+  // All filters match the same line: evaluated as a single expression per line
+  regex_options.put("line_mode", true);
+  return regex_options;
+}
+
+
 template <class Port, class ContextProvider>
 struct Runwell_device: public regexp::Regex_device<Port, ContextProvider> {
   using Regex = regexp::Regex_device<Port, ContextProvider>;
 
   Runwell_device(): Regex(),
       interval_(60), tmr_(ContextProvider::get_context()) {
-    prtr::ptree regex_options;
-    regex_options.put( "md0.filter", 
-        "^([0-2]),[0-2],[0-9]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+$");
-    regex_options.put( "md1.filter", 
-        "^[0-2],([0-2]),[0-9]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+$");
-    regex_options.put("sts0.filter", 
-        "^[0-2],[0-2],([0-9]+),[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+$");
-    regex_options.put( "frq.filter", 
-        "^[0-2],[0-2],[0-9]+,([0-9\\-.]+),[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+$");
-    regex_options.put("vset.filter", 
-        "^[0-2],[0-2],[0-9]+,[0-9\\-.]+,([0-9\\-.]+),[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+$");
-    regex_options.put("vsig.filter", 
-        "^[0-2],[0-2],[0-9]+,[0-9\\-.]+,[0-9\\-.]+,([0-9\\-.]+),[0-9\\-.]+,[0-9\\-.]+$");
-    regex_options.put("vsup.filter", 
-        "^[0-2],[0-2],[0-9]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,([0-9\\-.]+),[0-9\\-.]+$");
-    regex_options.put("isup.filter", 
-        "^[0-2],[0-2],[0-9]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,[0-9\\-.]+,([0-9\\-.]+)$");
-    Regex::set_options(regex_options);
+    Regex::set_options(get_regex_options());
   }
 
   ~Runwell_device() {
@@ -49,7 +49,12 @@ struct Ublox_NEO_M8U_serial: public ubx::NEO_M8U<Serial, Context_provider> {
 
 using Ublox_NEO_M8U_serial_factory = Device_factory<Ublox_NEO_M8U_serial>;
 
+using Ublox_NEO_M8U_replay = ubx::NEO_M8U_replay<Context_provider>;
+using Ublox_NEO_M8U_replay_factory = Device_factory<Ublox_NEO_M8U_replay>;
+
 static auto& neo_m8u_serial_factory =
     add_device_factory("ublox_neo_m8u_serial", std::move(std::make_unique<Ublox_NEO_M8U_serial_factory>()));
+static auto& neo_m8u_replay_factory =
+    add_device_factory("ublox_neo_m8u_replay", std::move(std::make_unique<Ublox_NEO_M8U_replay_factory>()));
 
 // vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -23,19 +23,20 @@
 #ifndef UBLOX_H_
 #define UBLOX_H_
 
-#include "../spirit_x3.h"
 #include "../device.h"
 #include "../log.h"
 #include "../tools.h"
 #include "../datetime.h"
 #include "../types.h"
 #include "../parser.h"
+#include "../replay.h"
 
 #include <boost/algorithm/string.hpp>
 
 #include <ios>
 #include <ostream>
 #include <deque>
+#include <array>
 #include <iterator>
 #include <type_traits>
 
@@ -207,6 +208,10 @@ namespace cfg {
     0x0A,  // 10Hz
     0x00, 0x00, 0x00,  // Reserved
   };
+  //! Default high navigation rate in Hz
+  constexpr uint8_t default_hnr_rate = 10;
+  //! Highest high navigation rate of the NEO-M8U in Hz
+  constexpr uint8_t max_hnr_rate = 30;
 
   cbyte_t pms = 0x86;
   cbytes_t pms_payload = {
@@ -235,6 +240,14 @@ namespace esf {
 }  // namespace esf
 
 
+cbyte_t cls_hnr = 0x28;
+namespace hnr {
+  cbyte_t pvt = 0x00;
+  cbyte_t att = 0x01;
+  cbyte_t ins = 0x02;
+}  // namespace hnr
+
+
 cbyte_t cls_sec = 0x27;
 namespace sec {
   cbyte_t uniqid = 0x03;
@@ -385,14 +398,67 @@ private:
 };
 
 
-struct Ublox_parser: public Packet_parser<> {
+/**
+ * Resumable UBX packet parser
+ *
+ * Bytes are fed through a state machine that keeps its position across
+ * chunks, so each byte is looked at once, whatever the chunk boundaries.
+ * The checksum is computed as bytes arrive and payloads are collected in a
+ * fixed buffer, from which the messages we're interested in are decoded
+ * directly. Payloads of other messages are skipped without being copied.
+ * Once HNR messages arrive, NAV-PVT, NAV-ATT and ESF-INS, which decode into
+ * the same quantities, are no longer decoded.
+ */
+struct Ublox_parser: public Packet_parser<Contiguous_buffer> {
   Ublox_parser();
   ~Ublox_parser();
   struct Payload_visitor;
   std::unique_ptr<Payload_visitor> visitor;
 
   void parse(const double& stamp) override;
-  Stamped_queue& get_values() override;
+  Stamped_quantities& get_values() override;
+  //! Stamp values with the time of week of the device mapped to hub time
+  void set_use_device_time(const bool value);
+  const Link_statistics& get_statistics() const {
+    return statistics_;
+  }
+
+  //! Larger payloads are taken to be a corrupt length
+  static constexpr size_t max_payload_size = 0x1000;
+
+private:
+  enum class State {
+    sync_1,
+    sync_2,
+    cls,
+    id,
+    length_1,
+    length_2,
+    payload,
+    checksum_a,
+    checksum_b,
+    skip
+  };
+
+  State state_;
+  byte_t cls_;
+  byte_t id_;
+  uint16_t length_;
+  //! Payload bytes received or, when skipping, payload bytes left to skip
+  size_t count_;
+  byte_t chk_a_;
+  byte_t chk_b_;
+  std::array<byte_t, max_payload_size> payload_;
+  Link_statistics statistics_;
+  //! HNR messages were received, which replace NAV-PVT, NAV-ATT and ESF-INS
+  bool use_hnr_;
+
+  void add_checksum(const byte_t byte) {
+    chk_a_ += byte;
+    chk_b_ += chk_a_;
+  }
+  void start_payload();
+  void decode_payload();
 };
 
 }  // namespace parser
@@ -438,11 +504,18 @@ cbytes_t cfg_gnss_glonass = parser::Data_packet(cls_cfg, cfg::gnss, gnss_glonass
 cbytes_t cfg_gnss_galileo = parser::Data_packet(cls_cfg, cfg::gnss, gnss_galileo_payload).get_packet();
 cbytes_t cfg_gnss_beidou = parser::Data_packet(cls_cfg, cfg::gnss, gnss_beidou_payload).get_packet();
 
-cbytes_t cfg_msg_nav_pvt = parser::Data_packet(cls_cfg, cfg::msg, { cls_nav, nav::pvt, 0x01 }).get_packet();
-cbytes_t cfg_msg_nav_att = parser::Data_packet(cls_cfg, cfg::msg, { cls_nav, nav::att, 0x01 }).get_packet();
-cbytes_t cfg_msg_esf_ins = parser::Data_packet(cls_cfg, cfg::msg, { cls_esf, esf::ins, 0x01 }).get_packet();
 cbytes_t cfg_msg_esf_raw = parser::Data_packet(cls_cfg, cfg::msg, { cls_esf, esf::raw, 0x0A }).get_packet();
 
+/**
+ * Enable (rate 1) or disable (rate 0) output of a message every epoch
+ *
+ * Epochs of HNR messages are high navigation rate epochs, those of other
+ * messages navigation epochs.
+ */
+inline bytes_t cfg_msg(const byte_t cls, const byte_t id, const byte_t rate) {
+  return parser::Data_packet(cls_cfg, cfg::msg, { cls, id, rate }).get_packet();
+}
+
 cbytes_t sec_uniqid = parser::Data_packet(cls_sec, sec::uniqid, {}).get_packet();
 
 }  // namespace command
@@ -466,10 +539,8 @@ struct Ublox: public Port_device<Port, ContextProvider>,
   void handle_data(double stamp, Iterator buf_begin, Iterator buf_end) {
     parser_.add_and_parse(stamp, buf_begin, buf_end);
     auto& values = parser_.get_values();
-    while (!values.empty()) {
-      this->insert_value(values.front());
-      values.pop_front();
-    }
+    this->insert_values(values);
+    values.clear();
   }
 
   bool initialize(asio::yield_context yield) override {
@@ -497,10 +568,20 @@ struct Ublox: public Port_device<Port, ContextProvider>,
     Device::use_as_time_source(value);
   }
 
+  void set_options(const prtr::ptree& options) override {
+    bool device_time = options.get("device_time", false);
+    parser_.set_use_device_time(device_time);
+    log(level::info, "Set use device time: %", device_time);
+  }
+
   const parser::Ublox_parser& get_parser() const {
     return parser_;
   }
 
+  const Link_statistics* get_link_statistics() const override {
+    return &parser_.get_statistics();
+  }
+
   virtual bool setup_ports(asio::yield_context yield) = 0;
   virtual bool request_version(asio::yield_context yield) = 0;
   virtual bool request_id(asio::yield_context yield) = 0;
@@ -538,7 +619,8 @@ struct NEO_M8U: public Ublox<Port, ContextProvider> {
   };
 
 
-  NEO_M8U(): Ublox<Port, ContextProvider>(), dyn_model_(portable), gnss_type_(glonass) {
+  NEO_M8U(): Ublox<Port, ContextProvider>(), dyn_model_(portable), gnss_type_(glonass),
+      hnr_rate_(command::cfg::default_hnr_rate) {
     log(level::info, "Constructing Ublox_NEO_M8U");
   }
 
@@ -548,6 +630,7 @@ struct NEO_M8U: public Ublox<Port, ContextProvider> {
 
 
   void set_options(const prtr::ptree& options) override {
+    Ublox<Port, ContextProvider>::set_options(options);
     std::string s = options.get("dyn_model", "portable");
     dyn_model_ =
       s == "portable" ? portable :
@@ -565,6 +648,19 @@ struct NEO_M8U: public Ublox<Port, ContextProvider> {
       s == "glonass" ? glonass :
       s == "galileo" ? galileo :
       s == "beidou" ? beidou : glonass;
+    int hnr_rate = options.get("hnr_rate", static_cast<int>(command::cfg::default_hnr_rate));
+    if (hnr_rate < 0 || hnr_rate > command::cfg::max_hnr_rate) {
+      log(level::error, "Invalid HNR rate: %, expected 0 to %",
+          hnr_rate, static_cast<int>(command::cfg::max_hnr_rate));
+    }
+    else {
+      hnr_rate_ = static_cast<uint8_t>(hnr_rate);
+      log(level::info, "Set HNR rate: % Hz", hnr_rate);
+    }
+  }
+
+  uint8_t get_hnr_rate() const {
+    return hnr_rate_;
   }
 
 
@@ -658,17 +754,43 @@ struct NEO_M8U: public Ublox<Port, ContextProvider> {
 
   bool setup_navigation_rate(asio::yield_context yield) override {
     log(level::info, "Ublox NEO M8U setup navigation rate");
-    return this->exec_command(command::cfg_rate, response::ack, response::nak, yield)
-        && this->exec_command(command::cfg_hnr, response::ack, response::nak, yield);
+    if (!this->exec_command(command::cfg_rate, response::ack, response::nak, yield)) {
+      return false;
+    }
+    if (hnr_rate_ == 0) {
+      return true;
+    }
+    // High navigation rate: fused output of the dead reckoning engine
+    bytes_t payload = command::cfg::hnr_payload;
+    payload[0] = hnr_rate_;
+    log(level::info, "Ublox NEO M8U HNR rate: % Hz", static_cast<int>(hnr_rate_));
+    bytes_t cfg_hnr = parser::Data_packet(command::cls_cfg, command::cfg::hnr, payload).get_packet();
+    return this->exec_command(cfg_hnr, response::ack, response::nak, yield);
   }
 
 
   bool setup_messages(asio::yield_context yield) override {
     log(level::info, "Ublox NEO M8U setup messages");
-    return this->exec_command(command::cfg_msg_nav_pvt, response::ack, response::nak, yield)
-        && this->exec_command(command::cfg_msg_nav_att, response::ack, response::nak, yield)
-        && this->exec_command(command::cfg_msg_esf_ins, response::ack, response::nak, yield)
-        && this->exec_command(command::cfg_msg_esf_raw, response::ack, response::nak, yield);
+    using namespace command;
+    // The HNR messages replace the navigation solution, attitude and vehicle
+    // dynamics messages, which have the same quantities at a lower rate
+    byte_t hnr_output = hnr_rate_ > 0 ? 1 : 0;
+    byte_t nav_output = hnr_rate_ > 0 ? 0 : 1;
+    const bytes_t messages[] = {
+      cfg_msg(cls_nav, nav::pvt, nav_output),
+      cfg_msg(cls_nav, nav::att, nav_output),
+      cfg_msg(cls_esf, esf::ins, nav_output),
+      cfg_msg_esf_raw,
+      cfg_msg(cls_hnr, hnr::pvt, hnr_output),
+      cfg_msg(cls_hnr, hnr::att, hnr_output),
+      cfg_msg(cls_hnr, hnr::ins, hnr_output)
+    };
+    for (auto& message: messages) {
+      if (!this->exec_command(message, response::ack, response::nak, yield)) {
+        return false;
+      }
+    }
+    return true;
   }
 
 
@@ -692,10 +814,47 @@ struct NEO_M8U: public Ublox<Port, ContextProvider> {
 private:
   dyn_model dyn_model_;
   gnss_type gnss_type_;
+  uint8_t hnr_rate_;
 
 };
 
 
+/**
+ * Responses of a NEO-M8U to the commands sent during initialization
+ */
+inline Replay_script get_replay_script() {
+  using namespace command;
+  Replay_script script;
+  for (byte_t id: { cfg::prt, cfg::pms, cfg::nav5, cfg::gnss, cfg::rate, cfg::hnr, cfg::msg }) {
+    script.push_back(Replay_response{ { sync_1, sync_2, cls_cfg, id },
+        parser::Data_packet(cls_ack, ack::ack, { cls_cfg, id }).get_packet() });
+  }
+  // Software and hardware version
+  bytes_t version(40, ' ');
+  std::string sw_version = "REPLAY";
+  std::string hw_version = "00080000";
+  std::copy(sw_version.begin(), sw_version.end(), version.begin());
+  std::copy(hw_version.begin(), hw_version.end(), version.begin() + 30);
+  script.push_back(Replay_response{ { sync_1, sync_2, cls_mon, mon::ver },
+      parser::Data_packet(cls_mon, mon::ver, version).get_packet() });
+  // Message version, reserved and a unique id of all zeros
+  script.push_back(Replay_response{ { sync_1, sync_2, cls_sec, sec::uniqid },
+      parser::Data_packet(cls_sec, sec::uniqid, bytes_t(9, 0)).get_packet() });
+  return script;
+}
+
+
+/**
+ * NEO-M8U replaying recorded data
+ */
+template <typename ContextProvider>
+struct NEO_M8U_replay: public NEO_M8U<Replay_port, ContextProvider> {
+  NEO_M8U_replay(): NEO_M8U<Replay_port, ContextProvider>() {
+    this->get_port().set_script(get_replay_script());
+  }
+};
+
+
 }  //namespace ubx
 
 #endif  // ifndef UBLOX_H_
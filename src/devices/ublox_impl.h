@@ -25,9 +25,11 @@
 
 #include "ublox.h"
 #include "../functions.h"
+#include "../packet.h"
 
 #include <vector>
-#include <boost/variant.hpp>
+#include <cstring>
+#include <boost/endian/conversion.hpp>
 
 
 namespace gregorian = boost::gregorian;
@@ -38,27 +40,27 @@ namespace ubx {
 
 namespace parser {
 
-using x3::repeat;
-using x3::omit;
-using x3::eps;
-
-using x3::byte_;
-using x3::little_word;
-using x3::little_dword;
-using x3::little_bin_float;
-using x3::little_bin_double;
-
-using x3::_attr;
-using x3::_val;
-using x3::_pass;
-
 
+/**
+ * Read a little endian value of type T from data
+ */
+template <typename T>
+inline T get_little(const byte_t* data) {
+  T result;
+  std::memcpy(&result, data, sizeof(result));
+  return boost::endian::little_to_native(result);
+}
 
 
 struct Payload {
   virtual Stamped_quantities get_values() const {
     return Stamped_quantities();
   }
+
+  //! Get the GPS time of week in ms of the navigation epoch, if the payload has one
+  virtual bool get_itow(uint32_t&) const {
+    return false;
+  }
 };
 
 struct Time_data {
@@ -74,9 +76,19 @@ struct Time_data {
   uint32_t tacc;  // scale 10e-9
   int32_t nano;  // scale 10e-9
 
-  static const auto get_parse_rule() {
-    return little_dword >> little_word >> byte_ >> byte_  // itow - day
-           >> byte_ >> byte_ >> byte_ >> byte_ >> little_dword >> little_dword; // hour - nano
+  static constexpr size_t size = 20;
+
+  void decode(const byte_t* data) {
+    itow = get_little<uint32_t>(data);
+    year = get_little<uint16_t>(data + 4);
+    month = data[6];
+    day = data[7];
+    hour = data[8];
+    min = data[9];
+    sec = data[10];
+    valid = data[11];
+    tacc = get_little<uint32_t>(data + 12);
+    nano = get_little<int32_t>(data + 16);
   }
 
   bool add_values(Stamped_quantities& values) const {
@@ -98,11 +110,6 @@ struct Position_data {
   uint32_t hacc;  // scale 10E-3
   uint32_t vacc;  // scale 10E-3
 
-  static const auto get_parse_rule() {
-    return little_dword >> little_dword >> little_dword >> little_dword  // lon - hmsl
-      >> little_dword >> little_dword;  // hacc - vacc
-  }
-
   bool add_values_horizontal(Stamped_quantities& values) const {
     values.push_back({ lat * 1E-7 * M_PI / 180.0, 0.0, Quantity::la });
     values.push_back({ lon * 1E-7 * M_PI / 180.0, 0.0, Quantity::lo });
@@ -142,15 +149,14 @@ struct Velocity_data {
     values.push_back({ headacc * 1E-5 * M_PI / 180.0, 0.0, Quantity::hdac });
     return true;
   }
-
-  static const auto get_parse_rule() {
-    return little_dword >> little_dword >> little_dword // veln - veld
-        >> little_dword >> little_dword >> little_dword >> little_dword // gspeed - headacc
-        >> little_word >> omit[repeat(6)[byte_]] >> little_dword; // pdop - headveh
-        // >> little_word >> little_dword >> little_word >> little_dword; // pdop - headveh
-  }
 };
 
+/**
+ * Position, velocity and time
+ *
+ * Holds the values of HNR-PVT. NAV-PVT, with the same values, is decoded
+ * from its description, nav_pvt_message.
+ */
 struct Payload_pvt: public Payload {
 	Time_data time_data;
   uint8_t fixtype;  // 0: nofix, 1: dead reck, 2: 2D fix, 3: 3D fix,
@@ -166,8 +172,10 @@ struct Payload_pvt: public Payload {
   int16_t magdec;  // scale 1E-2 degrees
   uint16_t magacc;  // scale 1E-2 degrees
 
-
-  static const auto get_parse_rule();
+  bool get_itow(uint32_t& value) const override {
+    value = time_data.itow;
+    return true;
+  }
 
   Stamped_quantities get_values() const override {
     Stamped_quantities values;
@@ -189,6 +197,129 @@ struct Payload_pvt: public Payload {
 };
 
 
+/**
+ * High rate fused position, velocity and time of the dead reckoning engine
+ *
+ * Same values as NAV-PVT, with a different layout and without time,
+ * position dilution and magnetic declination accuracies.
+ */
+struct Payload_hnr_pvt: public Payload_pvt {
+  static constexpr byte_t cls = command::cls_hnr;
+  static constexpr byte_t id = command::hnr::pvt;
+  enum { hnr_flags_headveh_valid = 0x10 };
+
+  bool decode(const byte_t* data, const size_t size) {
+    if (size != 72) {
+      return false;
+    }
+    time_data.itow = get_little<uint32_t>(data);
+    time_data.year = get_little<uint16_t>(data + 4);
+    time_data.month = data[6];
+    time_data.day = data[7];
+    time_data.hour = data[8];
+    time_data.min = data[9];
+    time_data.sec = data[10];
+    time_data.valid = data[11];
+    time_data.tacc = 0;
+    time_data.nano = get_little<int32_t>(data + 12);
+    fixtype = data[16];
+    // Map flags onto those of NAV-PVT: the vehicle heading flag is in a different bit
+    flags = data[17] & (flags_gnss | flags_differential);
+    if (data[17] & hnr_flags_headveh_valid) {
+      flags |= flags_headveh_valid;
+    }
+    flags2 = 0;
+    numsv = 0;
+    position_data.lon = get_little<int32_t>(data + 20);
+    position_data.lat = get_little<int32_t>(data + 24);
+    position_data.height = get_little<int32_t>(data + 28);
+    position_data.hmsl = get_little<int32_t>(data + 32);
+    position_data.hacc = get_little<uint32_t>(data + 52);
+    position_data.vacc = get_little<uint32_t>(data + 56);
+    velocity_data.veln = 0;
+    velocity_data.vele = 0;
+    velocity_data.veld = 0;
+    velocity_data.gspeed = get_little<int32_t>(data + 36);
+    velocity_data.hmot = get_little<int32_t>(data + 44);
+    velocity_data.headveh = get_little<int32_t>(data + 48);
+    velocity_data.sacc = get_little<uint32_t>(data + 60);
+    velocity_data.headacc = get_little<uint32_t>(data + 64);
+    velocity_data.pdop = 0;
+    magdec = 0;
+    magacc = 0;
+    return true;
+  }
+};
+
+
+/**
+ * UBX framing for generated parsers: class, id and length follow the sync
+ * bytes; the class and id read big endian make the message id
+ */
+using Framing = packet::Framing<packet::Sync<command::sync_1, command::sync_2>, 4,
+    packet::Header_field<2, uint16_t>, packet::Header_field<0, uint16_t, packet::Endian::big>,
+    packet::Fletcher8>;
+
+constexpr uint16_t message_id(const byte_t cls, const byte_t id) {
+  return static_cast<uint16_t>(cls << 8 | id);
+}
+
+
+//! Date and time of a Time_data at offset, added when fully resolved
+struct Time_field {
+  size_t offset;
+
+  constexpr size_t end() const {
+    return offset + Time_data::size;
+  }
+
+  void add_values(const byte_t* payload, const double stamp, Stamped_quantities& values) const {
+    Time_data time_data;
+    time_data.decode(payload + offset);
+    if (time_data.add_values(values)) {
+      values.back().stamp = stamp;
+    }
+  }
+};
+
+
+namespace nav_pvt_fields {
+
+constexpr double deg_1e7 = 1E-7 * M_PI / 180.0;
+constexpr double deg_1e5 = 1E-5 * M_PI / 180.0;
+constexpr packet::Condition horizontal_fix =
+    packet::in_range(20, Payload_pvt::fixtype_2d, Payload_pvt::fixtype_3d_deadreck);
+constexpr packet::Condition vertical_fix =
+    packet::in_range(20, Payload_pvt::fixtype_3d, Payload_pvt::fixtype_3d_deadreck);
+constexpr packet::Condition headveh_valid = packet::bits_set(21, Payload_pvt::flags_headveh_valid);
+
+}  // namespace nav_pvt_fields
+
+
+/**
+ * NAV-PVT, decoded by Ublox_parser and by a generated parser
+ *
+ * Adds the values Payload_pvt adds, in the same order.
+ */
+inline constexpr auto nav_pvt_message = packet::message(message_id(command::cls_nav, command::nav::pvt), 92,
+    Time_field{ 0 },
+    packet::field<int32_t>(28, Quantity::la, nav_pvt_fields::deg_1e7, nav_pvt_fields::horizontal_fix),
+    packet::field<int32_t>(24, Quantity::lo, nav_pvt_fields::deg_1e7, nav_pvt_fields::horizontal_fix),
+    packet::field<uint32_t>(40, Quantity::hacc, 1E-3, nav_pvt_fields::horizontal_fix),
+    packet::field<int32_t>(32, Quantity::hg84, 1E-3, nav_pvt_fields::vertical_fix),
+    packet::field<int32_t>(36, Quantity::hmsl, 1E-3, nav_pvt_fields::vertical_fix),
+    packet::field<uint32_t>(44, Quantity::vacc, 1E-3, nav_pvt_fields::vertical_fix),
+    packet::field<int32_t>(60, Quantity::vog, 1E-3, nav_pvt_fields::headveh_valid),
+    packet::field<int32_t>(64, Quantity::crs, nav_pvt_fields::deg_1e5, nav_pvt_fields::headveh_valid),
+    packet::field<uint32_t>(68, Quantity::sacc, 1E-3, nav_pvt_fields::headveh_valid),
+    packet::field<uint32_t>(72, Quantity::cacc, nav_pvt_fields::deg_1e5, nav_pvt_fields::headveh_valid),
+    packet::field<int32_t>(84, Quantity::hdg, nav_pvt_fields::deg_1e5, nav_pvt_fields::headveh_valid),
+    packet::field<uint32_t>(72, Quantity::hdac, nav_pvt_fields::deg_1e5, nav_pvt_fields::headveh_valid));
+
+//! Parser of NAV-PVT generated from its description
+using Nav_pvt_parser = packet::Parser<Framing, nav_pvt_message>;
+
+
 struct Payload_att: public Payload {
   uint32_t itow;
   uint8_t version;
@@ -201,11 +332,29 @@ struct Payload_att: public Payload {
   uint32_t accpitch;  // scale 1e-5
   uint32_t accheading;  // scale 1e-5
 
-  static const auto get_parse_rule() {
-    return byte_(command::cls_nav) >> byte_(command::nav::att) >> little_word(32)
-        >> little_dword >> byte_ >> little_word >> byte_  // itow - reserved1
-        >> little_dword >> little_dword >> little_dword  // roll - heading
-        >> little_dword >> little_dword >> little_dword;  // accroll - accheading
+  static constexpr byte_t cls = command::cls_nav;
+  static constexpr byte_t id = command::nav::att;
+
+  bool decode(const byte_t* data, const size_t size) {
+    if (size != 32) {
+      return false;
+    }
+    itow = get_little<uint32_t>(data);
+    version = data[4];
+    reserved1_16 = get_little<uint16_t>(data + 5);
+    reserved1_8 = data[7];
+    roll = get_little<int32_t>(data + 8);
+    pitch = get_little<int32_t>(data + 12);
+    heading = get_little<int32_t>(data + 16);
+    accroll = get_little<uint32_t>(data + 20);
+    accpitch = get_little<uint32_t>(data + 24);
+    accheading = get_little<uint32_t>(data + 28);
+    return true;
+  }
+
+  bool get_itow(uint32_t& value) const override {
+    value = itow;
+    return true;
   }
 
   Stamped_quantities get_values() const override {
@@ -236,6 +385,13 @@ struct Payload_att: public Payload {
 };
 
 
+//! High rate attitude, same layout as NAV-ATT
+struct Payload_hnr_att: public Payload_att {
+  static constexpr byte_t cls = command::cls_hnr;
+  static constexpr byte_t id = command::hnr::att;
+};
+
+
 struct Payload_ins: public Payload {
   uint32_t bitfield0;
   enum {
@@ -256,12 +412,28 @@ struct Payload_ins: public Payload {
   int32_t yaccel;  // scale 1E-2, free acceleration: no gravity
   int32_t zaccel;  // scale 1E-2, free acceleration: no gravity
 
-  static const auto get_parse_rule() {
-    return byte_(command::cls_esf) >> byte_(command::esf::ins) >> little_word(36)
-        >> little_dword >> little_dword  // bitfield0 - reserved1
-        >> little_dword  // itow
-        >> little_dword >> little_dword >> little_dword  // xangrate - zangrate
-        >> little_dword >> little_dword >> little_dword;  // xaccel - zaccel
+  static constexpr byte_t cls = command::cls_esf;
+  static constexpr byte_t id = command::esf::ins;
+
+  bool decode(const byte_t* data, const size_t size) {
+    if (size != 36) {
+      return false;
+    }
+    bitfield0 = get_little<uint32_t>(data);
+    reserved1 = get_little<uint32_t>(data + 4);
+    itow = get_little<uint32_t>(data + 8);
+    xangrate = get_little<int32_t>(data + 12);
+    yangrate = get_little<int32_t>(data + 16);
+    zangrate = get_little<int32_t>(data + 20);
+    xaccel = get_little<int32_t>(data + 24);
+    yaccel = get_little<int32_t>(data + 28);
+    zaccel = get_little<int32_t>(data + 32);
+    return true;
+  }
+
+  bool get_itow(uint32_t& value) const override {
+    value = itow;
+    return true;
   }
 
   Stamped_quantities get_values() const override {
@@ -283,27 +455,39 @@ struct Payload_ins: public Payload {
 };
 
 
+//! High rate vehicle dynamics, same layout as ESF-INS
+struct Payload_hnr_ins: public Payload_ins {
+  static constexpr byte_t cls = command::cls_hnr;
+  static constexpr byte_t id = command::hnr::ins;
+};
+
+
 struct Sensor_data {
   uint32_t data;  // 8 bit datatype + 24 bit data
   uint32_t stag;  // time tag
-  static const auto get_parse_rule() {
-    return little_dword >> little_dword;
-  }
-
   enum { data_type_none=0, data_type_ryr=5, data_type_gtmp=12, data_type_rpr= 13, data_type_rrr=14,
          data_type_rax=16, data_type_ray=17, data_type_raz=18 };
 
+  //! Sensor time tag ticks per second
+  static constexpr double ticks_per_second = 25600.0;
+  //! Sensor time after which the time tag wraps around to 0
+  static constexpr double tag_period = 4294967296.0 / ticks_per_second;
+
   uint8_t get_data_type() const {
     return data >> 24;
   }
 
+  /**
+   * Return the value of the measurement
+   *
+   * The stamp is the time of the measurement relative to reftag, which
+   * may have wrapped around since the measurement.
+   */
   Stamped_quantity get_value(uint32_t reftag) const {
     uint32_t shifted = (data & 0xFFFFFF) << 8;
     int signed_shifted = *reinterpret_cast<int*>(&shifted);
     Value_type value = static_cast<Value_type>(signed_shifted);
-    if (reftag < stag)
-        return {0.0, 0.0, Quantity::end};
-    double offset = (reftag - stag) * 0.01 / -256.0;
+    double offset = static_cast<int32_t>(stag - reftag) / ticks_per_second;
 
     switch (get_data_type()) {
       case data_type_ryr:
@@ -332,58 +516,72 @@ struct Payload_raw: public Payload {
   uint32_t reserved1;
   std::vector<Sensor_data> sensor_data;
 
-  static const auto get_parse_rule();
+  static constexpr byte_t cls = command::cls_esf;
+  static constexpr byte_t id = command::esf::raw;
 
-  Stamped_quantities get_values() const override {
-    Stamped_quantities values;
-    if (!sensor_data.empty()) {
-      auto reftag = sensor_data.back().stag;
-      for (auto& data: sensor_data) {
-        auto value = data.get_value(reftag);
-        if (value.quantity != Quantity::end) {
-          values.push_back(value);
-        }
-      }
+  bool decode(const byte_t* data, const size_t size) {
+    //! Reserved field, followed by data and time tag of each measurement
+    constexpr size_t header_size = 4;
+    constexpr size_t measurement_size = 8;
+    if (size < header_size || (size - header_size) % measurement_size != 0) {
+      return false;
     }
-    return values;
+    length = static_cast<uint16_t>(size);
+    reserved1 = get_little<uint32_t>(data);
+    sensor_data.resize((size - header_size) / measurement_size);
+    data += header_size;
+    for (auto& measurement: sensor_data) {
+      measurement.data = get_little<uint32_t>(data);
+      measurement.stag = get_little<uint32_t>(data + 4);
+      data += measurement_size;
+    }
+    return true;
   }
-};
 
-#define RULE_DEFINE(name, type) \
-x3::rule<struct name, type> const name = "\"" #name "\""; \
-auto name##_def = type::get_parse_rule(); \
-BOOST_SPIRIT_DEFINE(name)
-
-RULE_DEFINE(t_data, Time_data)
-RULE_DEFINE(p_data, Position_data)
-RULE_DEFINE(v_data, Velocity_data)
-RULE_DEFINE(s_data, Sensor_data)
-
-const auto Payload_pvt::get_parse_rule() {
-  return byte_(command::cls_nav) >> byte_(command::nav::pvt) >> little_word(92)
-    >> t_data  // time_data
-    >> byte_ >> byte_ >> byte_ >> byte_  // fixtype - numsv
-    >> p_data  // postion_data
-    >> v_data // velocity_data
-    >> little_word >> little_word;  // magdec - magacc
-}
-
-const auto Payload_raw::get_parse_rule() {
-  return byte_(command::cls_esf) >> byte_(command::esf::raw)
-    >> little_word >> little_dword   // length - reserved1
-    >> *s_data;  // sensor_data
-}
+  //! Time tag of the latest measurement, which the other measurements are stamped relative to
+  uint32_t get_reftag() const {
+    return sensor_data.empty() ? 0 : sensor_data.back().stag;
+  }
 
-RULE_DEFINE(nav_pvt, Payload_pvt)
-RULE_DEFINE(nav_att, Payload_att)
-RULE_DEFINE(esf_ins, Payload_ins)
-RULE_DEFINE(esf_raw, Payload_raw)
+  /**
+   * Append the measurements to values as one block per sensor
+   *
+   * A packet holds the measurements of all sensors for several sensor
+   * epochs. Each measurement is stamped at stamp plus its time tag
+   * relative to the reftag. Blocks are ordered by quantity and time
+   * ordered within, so each sensor's samples can be inserted in one go.
+   */
+  void add_values(Stamped_quantities& values, const double stamp) const {
+    if (sensor_data.empty()) {
+      return;
+    }
+    auto reftag = get_reftag();
+    size_t first = values.size();
+    for (auto& data: sensor_data) {
+      auto value = data.get_value(reftag);
+      if (value.quantity != Quantity::end) {
+        value.stamp += stamp;
+        values.push_back(value);
+      }
+    }
+    std::sort(values.begin() + first, values.end(),
+        [](const Stamped_quantity& a, const Stamped_quantity& b) {
+          return a.quantity < b.quantity || (a.quantity == b.quantity && a.stamp < b.stamp);
+        });
+  }
 
-#undef RULE_DEFINE
+  Stamped_quantities get_values() const override {
+    Stamped_quantities values;
+    add_values(values, 0.0);
+    return values;
+  }
+};
 
 Ublox_parser::Ublox_parser()
   : Packet_parser(),
-    visitor(std::make_unique<Payload_visitor>()) {
+    visitor(std::make_unique<Payload_visitor>()),
+    state_(State::sync_1), cls_(0), id_(0), length_(0), count_(0), chk_a_(0), chk_b_(0),
+    payload_(), statistics_(), use_hnr_(false) {
 }
 
 
@@ -391,122 +589,271 @@ Ublox_parser::~Ublox_parser() {
 }
 
 struct Ublox_parser::Payload_visitor {
-  Stamped_queue values;
+  Stamped_quantities values;
   double stamp;
+  bool use_device_time = false;
+  //! Time of week wraps around weekly
+  Device_clock clock{7 * 24 * 3600.0};
+  Device_clock sensor_clock{Sensor_data::tag_period};
+  //! Raw payload reused for each packet, so decoding doesn't allocate
+  Payload_raw raw;
+
+  //! Stamp of a payload of the navigation epoch at itow
+  double get_stamp(const uint32_t itow) {
+    return use_device_time ? clock.map(itow * 1E-3, stamp) : stamp;
+  }
 
   void operator()(const Payload& payload) {
+    double payload_stamp = stamp;
+    uint32_t itow = 0;
+    if (payload.get_itow(itow)) {
+      payload_stamp = get_stamp(itow);
+    }
     for (auto& value: payload.get_values()) {
-      value.stamp += stamp;
+      value.stamp += payload_stamp;
       values.push_back(value);
     }
   }
+
+  //! Raw sensor measurements are stamped with their sensor time tags
+  void operator()(const Payload_raw& payload) {
+    double payload_stamp = stamp;
+    if (use_device_time && !payload.sensor_data.empty()) {
+      payload_stamp = sensor_clock.map(payload.get_reftag() / Sensor_data::ticks_per_second, stamp);
+    }
+    payload.add_values(values, payload_stamp);
+  }
 };
 
-Stamped_queue& Ublox_parser::get_values() {
+Stamped_quantities& Ublox_parser::get_values() {
   return visitor->values;
 }
 
-using Payload_variant = boost::variant<Payload_pvt, Payload_att, Payload_ins, Payload_raw>;
-
-auto payload_parse_rule = nav_pvt | nav_att | esf_ins | esf_raw;
+void Ublox_parser::set_use_device_time(const bool value) {
+  visitor->use_device_time = value;
+  visitor->clock.reset();
+  visitor->sensor_clock.reset();
+}
 
-} }  // namespace ubx::parser
+using Decode_function = bool (*)(const byte_t* data, const size_t size,
+    Ublox_parser::Payload_visitor& visitor);
 
-BOOST_FUSION_ADAPT_STRUCT(ubx::parser::Time_data,
-  itow, year, month, day,
-  hour, min, sec,
-  valid, tacc,
-  nano
-)
+/**
+ * Decoder for the payload of one message class and id
+ */
+struct Payload_decoder {
+  byte_t cls;
+  byte_t id;
+  Decode_function decode;
+  //! Same quantities as an HNR message, so ignored once HNR messages arrive
+  bool replaced_by_hnr;
+};
 
-BOOST_FUSION_ADAPT_STRUCT(ubx::parser::Position_data,
-  lon, lat, height, hmsl,
-  hacc, vacc
-)
+template <typename T>
+bool decode_payload(const byte_t* data, const size_t size, Ublox_parser::Payload_visitor& visitor) {
+  T payload;
+  if (!payload.decode(data, size)) {
+    return false;
+  }
+  visitor(payload);
+  return true;
+}
 
-BOOST_FUSION_ADAPT_STRUCT(ubx::parser::Velocity_data,
-  veln, vele, veld,
-  gspeed, hmot, sacc, headacc,
-  pdop, headveh
-)
+template <>
+inline bool decode_payload<Payload_raw>(const byte_t* data, const size_t size,
+    Ublox_parser::Payload_visitor& visitor) {
+  if (!visitor.raw.decode(data, size)) {
+    return false;
+  }
+  visitor(visitor.raw);
+  return true;
+}
 
-BOOST_FUSION_ADAPT_STRUCT(ubx::parser::Payload_pvt,
-  time_data,
-  fixtype, flags, flags2, numsv,
-  position_data,
-  velocity_data,
-  magdec, magacc
-)
+//! NAV-PVT is decoded from its description, starting with the time of week
+inline bool decode_nav_pvt(const byte_t* data, const size_t size, Ublox_parser::Payload_visitor& visitor) {
+  if (size != nav_pvt_message.size) {
+    return false;
+  }
+  return nav_pvt_message.decode(data, size, visitor.get_stamp(get_little<uint32_t>(data)), visitor.values);
+}
 
+template <typename T>
+constexpr Payload_decoder make_decoder(const bool replaced_by_hnr=false) {
+  return Payload_decoder{T::cls, T::id, &decode_payload<T>, replaced_by_hnr};
+}
 
-BOOST_FUSION_ADAPT_STRUCT(ubx::parser::Payload_att,
-  itow, version, reserved1_16, reserved1_8,
-  roll, pitch, heading,
-  accroll, accpitch, accheading
-)
+/**
+ * Decoders for the messages we're interested in
+ *
+ * Payloads of other messages are skipped by the parser. To decode
+ * another message, add a decode function to its payload type and a
+ * decoder here.
+ */
+constexpr Payload_decoder payload_decoders[] = {
+  Payload_decoder{command::cls_nav, command::nav::pvt, &decode_nav_pvt, true},
+  make_decoder<Payload_att>(true),
+  make_decoder<Payload_ins>(true),
+  make_decoder<Payload_raw>(),
+  make_decoder<Payload_hnr_pvt>(),
+  make_decoder<Payload_hnr_att>(),
+  make_decoder<Payload_hnr_ins>()
+};
 
-BOOST_FUSION_ADAPT_STRUCT(ubx::parser::Payload_ins,
-  bitfield0, reserved1,
-  itow,
-  xangrate, yangrate, zangrate,
-  xaccel, yaccel, zaccel)
+inline const Payload_decoder* find_decoder(const byte_t cls, const byte_t id) {
+  for (auto& decoder: payload_decoders) {
+    if (decoder.cls == cls && decoder.id == id) {
+      return &decoder;
+    }
+  }
+  return nullptr;
+}
 
-BOOST_FUSION_ADAPT_STRUCT(ubx::parser::Payload_raw,
-    length, reserved1, sensor_data)
 
-BOOST_FUSION_ADAPT_STRUCT(ubx::parser::Sensor_data,
-    data, stag)
+void Ublox_parser::start_payload() {
+  count_ = 0;
+  if (length_ > max_payload_size) {
+    log(level::error, "Ublox packet length error: %", length_);
+    ++statistics_.resyncs;
+    state_ = State::sync_1;
+  }
+  else if (find_decoder(cls_, id_) == nullptr) {
+    // Skip the payload of messages we're not interested in, but still check
+    // the checksum: a false sync shouldn't silently swallow the next packets
+    count_ = length_;
+    state_ = length_ > 0 ? State::skip : State::checksum_a;
+  }
+  else {
+    state_ = length_ > 0 ? State::payload : State::checksum_a;
+  }
+}
 
-namespace ubx { namespace parser {
 
-void Ublox_parser::parse(const double& stamp) {
-  Data_packet packet;
-  int len = 0;
-  auto set_cls = [&](auto& ctx) { packet.set_cls(_attr(ctx)); };
-  auto set_id = [&](auto& ctx) { packet.set_id(_attr(ctx)); };
-  auto set_len = [&](auto& ctx) {
-    len = _attr(ctx);
-    packet.set_length(len);
-  };
+void Ublox_parser::decode_payload() {
+  auto decoder = find_decoder(cls_, id_);
+  if (decoder == nullptr) {
+    // Skipped message
+    return;
+  }
+  ++statistics_.packets;
+  ++statistics_.expected;
+  if (cls_ == command::cls_hnr) {
+    use_hnr_ = true;
+  }
+  else if (use_hnr_ && decoder->replaced_by_hnr) {
+    // The navigation epochs of these arrive later than HNR messages of later
+    // epochs: decoding both would add duplicate samples out of order
+    return;
+  }
+  if (!decoder->decode(payload_.data(), length_, *visitor)) {
+    log(level::error, "Malformed ublox message: class %, id %, length %",
+        static_cast<int>(cls_), static_cast<int>(id_), length_);
+  }
+}
 
-  auto have_data = [&](auto& ctx) { _pass(ctx) = len-- > 0; };
-  auto have_all = [&](auto& ctx) { _pass(ctx) = len < 0; };
-  auto add_payload = [&](auto& ctx) {
-    packet.add_data(_attr(ctx));
-  };
-  auto set_chk = [&](auto& ctx) { packet.set_checksum(_attr(ctx)); };
-
-  //! Start of a packet
-  auto preamble = byte_(command::sync_1) >> byte_(command::sync_2);
-  //! Anything that is not the start of a packet
-  auto junk = *(byte_ - preamble);
-  //! The actual data we're looking for
-  auto content = *(eps[have_data] >> byte_[add_payload]) >> eps[have_all];
-  //! The complete packet
-  auto packet_rule = junk >> preamble >> byte_[set_cls] >> byte_[set_id]
-                          >> little_word[set_len] >> content >> little_word[set_chk];
 
+void Ublox_parser::parse(const double& stamp) {
   visitor->stamp = stamp;
-  //! Look for messages in the buffer
-  while (cur != buffer.end() && x3::parse(cur, buffer.end(), packet_rule)) {
-    //! Consume the message from the buffer
-    cur = buffer.erase(buffer.begin(), cur);
-    if (packet.check()) {
-      Payload_variant payload;
-      if (x3::parse(packet.get_data().begin(), packet.get_data().end(),
-                    payload_parse_rule, payload)) {
-        boost::apply_visitor(*visitor, payload);
+  const byte_t* data = buffer.begin();
+  const byte_t* end = buffer.end();
+  while (data < end) {
+    switch (state_) {
+      case State::sync_1: {
+        const byte_t* start = std::find(data, end, command::sync_1);
+        if (start != data) {
+          statistics_.junk_bytes += start - data;
+          ++statistics_.resyncs;
+        }
+        if (start != end) {
+          state_ = State::sync_2;
+          data = start + 1;
+        }
+        else {
+          data = end;
+        }
+        break;
       }
-      else {
-        log(level::debug, "Received an unsollicited ubx message");
+      case State::sync_2:
+        if (*data == command::sync_2) {
+          chk_a_ = 0;
+          chk_b_ = 0;
+          state_ = State::cls;
+          ++data;
+        }
+        else {
+          // Junk: this byte may be the start of the next packet
+          ++statistics_.junk_bytes;
+          state_ = State::sync_1;
+        }
+        break;
+      case State::cls:
+        cls_ = *data++;
+        add_checksum(cls_);
+        state_ = State::id;
+        break;
+      case State::id:
+        id_ = *data++;
+        add_checksum(id_);
+        state_ = State::length_1;
+        break;
+      case State::length_1:
+        length_ = *data;
+        add_checksum(*data++);
+        state_ = State::length_2;
+        break;
+      case State::length_2:
+        length_ |= *data << 8;
+        add_checksum(*data++);
+        start_payload();
+        break;
+      case State::payload: {
+        size_t size = std::min(static_cast<size_t>(end - data), length_ - count_);
+        std::copy(data, data + size, payload_.begin() + count_);
+        for (const byte_t* c = data; c < data + size; ++c) {
+          add_checksum(*c);
+        }
+        data += size;
+        count_ += size;
+        if (count_ == length_) {
+          state_ = State::checksum_a;
+        }
+        break;
+      }
+      case State::checksum_a:
+        if (*data++ == chk_a_) {
+          state_ = State::checksum_b;
+        }
+        else {
+          log(level::error, "Ublox packet checksum error");
+          ++statistics_.checksum_errors;
+          state_ = State::sync_1;
+        }
+        break;
+      case State::checksum_b:
+        if (*data++ == chk_b_) {
+          decode_payload();
+        }
+        else {
+          log(level::error, "Ublox packet checksum error");
+          ++statistics_.checksum_errors;
+        }
+        state_ = State::sync_1;
+        break;
+      case State::skip: {
+        size_t size = std::min(static_cast<size_t>(end - data), count_);
+        for (const byte_t* c = data; c < data + size; ++c) {
+          add_checksum(*c);
+        }
+        data += size;
+        count_ -= size;
+        if (count_ == 0) {
+          state_ = State::checksum_a;
+        }
+        break;
       }
     }
-    else {
-      log(level::error, "Ublox packet check error: lenght %, %, checksum %, %",
-          packet.get_length(), packet.calc_length(), packet.get_checksum(), packet.calc_checksum());
-    }
-    packet.clear();
   }
+  buffer.clear();
+  cur = buffer.begin();
 }
 
 }  // namespace parser
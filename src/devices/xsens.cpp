@@ -87,6 +87,9 @@ struct Xsens_MTi_630: public xsens::MTi_630<Serial, Context_provider> {
   }
 };
 
+using Xsens_MTi_670_replay = xsens::MTi_670_replay<Context_provider>;
+using Xsens_MTi_670_replay_factory = Device_factory<Xsens_MTi_670_replay>;
+
 using Xsens_MTi_630_factory = Device_factory<Xsens_MTi_630>;
 
 using Xsens_MTi_630_tcp = xsens::MTi_630<Socket, Context_provider>;
@@ -102,6 +105,8 @@ static auto& mti_670_factory =
     add_device_factory("xsens_mti_670", std::move(std::make_unique<Xsens_MTi_670_factory>()));
 static auto& mti_670_tcp_factory =
     add_device_factory("xsens_mti_670_tcp", std::move(std::make_unique<Xsens_MTi_670_tcp_factory>()));
+static auto& mti_670_replay_factory =
+    add_device_factory("xsens_mti_670_replay", std::move(std::make_unique<Xsens_MTi_670_replay_factory>()));
 
 static auto& mti_630_factory =
     add_device_factory("xsens_mti_630", std::move(std::make_unique<Xsens_MTi_630_factory>()));
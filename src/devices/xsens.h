@@ -22,13 +22,13 @@
 #ifndef XSENS_H_
 #define XSENS_H_
 
-#include "../spirit_x3.h"
 #include "../types.h"
 #include "../device.h"
 #include "../log.h"
 #include "../tools.h"
 #include "../datetime.h"
 #include "../parser.h"
+#include "../replay.h"
 
 #include <xsens/xsxbusmessageid.h>
 #include <xsens/xsdataidentifier.h>
@@ -38,6 +38,7 @@
 #include <ostream>
 #include <deque>
 #include <iterator>
+#include <map>
 
 namespace xsens {
 
@@ -80,27 +81,204 @@ Bytes packet(cbyte_t mid, cbytes_t command=cbytes_t()) {
   return result;
 }
 
+//! Sub format of output values by data group
+using Output_formats = std::map<uint16_t, uint16_t>;
+
+//! Data groups of which the output format can be selected, by option name
+const std::map<std::string, uint16_t> output_format_groups = {
+  { "orientation", XDI_OrientationGroup },
+  { "acceleration", XDI_AccelerationGroup },
+  { "position", XDI_PositionGroup },
+  { "angular_velocity", XDI_AngularVelocityGroup },
+  { "magnetic", XDI_MagneticGroup },
+  { "velocity", XDI_VelocityGroup }
+};
+
+//! Output value sub formats by option name
+const std::map<std::string, uint16_t> output_format_names = {
+  { "float", XDI_SubFormatFloat },
+  { "fp1220", XDI_SubFormatFp1220 },
+  { "fp1632", XDI_SubFormatFp1632 },
+  { "double", XDI_SubFormatDouble }
+};
+
+/**
+ * Return output configuration with the sub format of the items in the
+ * data groups of formats replaced
+ */
+inline bytes_t apply_output_formats(cbytes_t& configuration, const Output_formats& formats) {
+  bytes_t result = configuration;
+  // Each item is a big endian data identifier followed by a big endian rate
+  for (size_t i = 0; i + 1 < result.size(); i += 4) {
+    uint16_t did = static_cast<uint16_t>(result[i] << 8 | result[i + 1]);
+    auto format = formats.find(did & XDI_TypeMask);
+    if (format != formats.end()) {
+      result[i + 1] = static_cast<byte_t>((result[i + 1] & ~XDI_SubFormatMask) | format->second);
+    }
+  }
+  return result;
+}
+
+//! Highest output rate of MTi-6xx and MTi-7xx devices in Hz
+constexpr uint16_t max_output_rate = 400;
+//! Rate of items that are sent along with every packet
+constexpr uint16_t every_packet_rate = 0xFFFF;
+//! Preamble, bus id, message id, length and checksum
+constexpr size_t packet_overhead = 5;
+//! Data identifier and size preceding each item
+constexpr size_t item_overhead = 3;
+
+//! Data item that can be included in the output configuration
+struct Output_item {
+  const char* name;
+  uint16_t did;
+  //! Number of values of the item's sub format, or 0 when it has none
+  uint8_t values;
+  //! Size of items without sub format
+  uint8_t size;
+  //! Whether the item requires a GNSS receiver
+  bool gnss;
+};
+
+//! Items of which the output rate can be configured
+const Output_item output_items[] = {
+  { "packet_counter", XDI_PacketCounter, 0, 2, false },
+  { "sample_time_fine", XDI_SampleTimeFine, 0, 4, false },
+  { "utc_time", XDI_UtcTime, 0, 12, true },
+  { "acceleration", XDI_Acceleration, 3, 0, false },
+  { "free_acceleration", XDI_FreeAcceleration, 3, 0, false },
+  { "rate_of_turn", XDI_RateOfTurn, 3, 0, false },
+  { "lat_lon", XDI_LatLon, 2, 0, true },
+  { "magnetic_field", XDI_MagneticField, 3, 0, false },
+  { "velocity", XDI_VelocityXYZ, 3, 0, true },
+  { "altitude_ellipsoid", XDI_AltitudeEllipsoid, 1, 0, true },
+  { "altitude_msl", XDI_AltitudeMsl, 1, 0, true },
+  { "euler_angles", XDI_EulerAngles, 3, 0, false },
+  { "quaternion", XDI_Quaternion, 4, 0, false }
+};
+
+//! Return the item with data identifier did, ignoring its format, or nullptr
+inline const Output_item* find_output_item(const uint16_t did) {
+  for (auto& item: output_items) {
+    if (item.did == (did & XDI_FullTypeMask)) {
+      return &item;
+    }
+  }
+  return nullptr;
+}
+
+//! Size of a single value in sub format
+inline size_t get_value_size(const uint16_t sub_format) {
+  switch (sub_format & XDI_SubFormatMask) {
+    case XDI_SubFormatFp1632:
+      return 6;
+    case XDI_SubFormatDouble:
+      return 8;
+    default:
+      return 4;
+  }
+}
+
+//! Output rate in Hz by data identifier of the item, 0 removes the item
+using Output_rates = std::map<uint16_t, uint16_t>;
+
+/**
+ * Return output configuration with the rates of the items in rates replaced
+ *
+ * Items with a rate of 0 are removed and items not in the configuration
+ * are appended with float format.
+ */
+inline bytes_t apply_output_rates(cbytes_t& configuration, const Output_rates& rates) {
+  Bytes result;
+  result << endian::order::big;
+  Output_rates pending = rates;
+  for (size_t i = 0; i + 3 < configuration.size(); i += 4) {
+    uint16_t did = static_cast<uint16_t>(configuration[i] << 8 | configuration[i + 1]);
+    auto rate = pending.find(did & XDI_FullTypeMask);
+    if (rate == pending.end()) {
+      result.insert(result.end(), configuration.begin() + i, configuration.begin() + i + 4);
+      continue;
+    }
+    if (rate->second > 0) {
+      result << configuration[i] << configuration[i + 1] << rate->second;
+    }
+    pending.erase(rate);
+  }
+  for (auto& rate: pending) {
+    if (rate.second > 0) {
+      result << rate.first << rate.second;
+    }
+  }
+  return result;
+}
+
+/**
+ * Return the number of bytes per second a device sends with configuration
+ *
+ * The device sends a packet at the highest configured rate. Items at
+ * every_packet_rate are included in each of them. Items that aren't in
+ * output_items are not accounted for.
+ */
+inline double get_output_bytes_per_second(cbytes_t& configuration) {
+  double packet_rate = 0;
+  double packet_size = packet_overhead;
+  double item_bytes = 0;
+  for (size_t i = 0; i + 3 < configuration.size(); i += 4) {
+    uint16_t did = static_cast<uint16_t>(configuration[i] << 8 | configuration[i + 1]);
+    uint16_t rate = static_cast<uint16_t>(configuration[i + 2] << 8 | configuration[i + 3]);
+    auto item = find_output_item(did);
+    if (item == nullptr) {
+      continue;
+    }
+    size_t size = item_overhead + (item->values > 0 ? item->values * get_value_size(did) : item->size);
+    if (rate == every_packet_rate) {
+      packet_size += size;
+    }
+    else {
+      packet_rate = std::max<double>(packet_rate, rate);
+      item_bytes += static_cast<double>(rate) * size;
+    }
+  }
+  return packet_rate * packet_size + item_bytes;
+}
+
 }  // command
 
 
 namespace parser {
 
-struct Xsens_parser: public Packet_parser<> {
+struct Xsens_parser: public Packet_parser<Contiguous_buffer> {
   Xsens_parser();
-  ~Xsens_parser();
-  struct Data_packets;
-  struct Data_visitor;
-  std::unique_ptr<Data_packets> data_packets;
-  std::unique_ptr<Data_visitor> visitor;
 
   void parse(const double& stamp) override;
-  Stamped_queue& get_values() override;
+  Stamped_quantities& get_values() override;
   void set_flip_axes(const bool value) {
     flip_axes_ = value;
   }
+  const Link_statistics& get_statistics() const {
+    return statistics_;
+  }
+  //! Stamp values with the sample time of the device mapped to hub time
+  void set_use_device_time(const bool value) {
+    use_device_time_ = value;
+    clock_.reset();
+  }
+  //! Packet counter and sample time of an MTData2 message, when present
+  struct Packet_info;
 private:
+  Stamped_quantities values_;
   bool flip_axes_;
+  Link_statistics statistics_;
+  bool has_counter_;
+  uint16_t counter_;
+  bool has_sample_time_;
+  uint32_t sample_time_;
+  //! Shortest interval between sample times seen
+  uint32_t nominal_interval_;
+  bool use_device_time_;
+  Device_clock clock_;
   bool parse_single(const double& stamp);
+  void update_statistics(const Packet_info& info);
 };
 
 } //parser
@@ -114,10 +292,8 @@ struct Xsens: public Port_device<Port, ContextProvider>,
   void handle_data(double stamp, Iterator buf_begin, Iterator buf_end) {
     parser_.add_and_parse(stamp, buf_begin, buf_end);
     auto& values = parser_.get_values();
-    while (!values.empty()) {
-      this->insert_value(values.front());
-      values.pop_front();
-    }
+    this->insert_values(values);
+    values.clear();
   }
 
   virtual bool look_for_wakeup(asio::yield_context) {
@@ -185,6 +361,38 @@ struct Xsens: public Port_device<Port, ContextProvider>,
     return true;
   }
 
+  //! Output configuration with the configured output rates and formats applied
+  bytes_t get_output_configuration() const {
+    return command::apply_output_formats(
+        command::apply_output_rates(get_default_output_configuration(), output_rates_),
+        output_formats_);
+  }
+
+  /**
+   * Warn when the output configuration takes more bandwidth than the port provides
+   *
+   * Serial lines take 10 bits per byte. Always succeeds.
+   */
+  bool check_bandwidth() {
+    bytes_t configuration = get_output_configuration();
+    if (configuration.empty()) {
+      return true;
+    }
+    double required = command::get_output_bytes_per_second(configuration);
+    unsigned baud_rate = this->get_baud_rate();
+    if (baud_rate == 0) {
+      log(level::info, "Xsens output requires % bytes/s", required);
+    }
+    else if (required > baud_rate / 10.0) {
+      log(level::warning, "Xsens output requires % bytes/s, which exceeds the % bytes/s of % baud: "
+          "reduce output rates or use a higher baud rate", required, baud_rate / 10, baud_rate);
+    }
+    else {
+      log(level::info, "Xsens output requires % bytes/s of % available", required, baud_rate / 10);
+    }
+    return true;
+  }
+
   virtual bool set_output_configuration(asio::yield_context) {
     return true;
   }
@@ -290,6 +498,7 @@ struct Xsens: public Port_device<Port, ContextProvider>,
         && set_option_flags(yield)
         && set_string_output_type(yield)
         && set_filter_profile(yield)
+        && check_bandwidth()
         && (check_output_configuration(yield)
             || (set_output_configuration(yield) && init_mt(yield)))
         && goto_measurement(yield);
@@ -314,26 +523,79 @@ struct Xsens: public Port_device<Port, ContextProvider>,
     bool flip_axes = options.get("flip_axes", get_default_flip_axes());
     parser_.set_flip_axes(flip_axes);
     log(level::info, "Set flip axes: %", flip_axes);
-  }
 
-  void use_as_time_source(const bool value) override {
-    Device::use_as_time_source(value);
-    // Decrease clock adjust rate because of high sample frequency of xsens
-    set_clock_adjust_rate(0.0001);
+    bool device_time = options.get("device_time", false);
+    parser_.set_use_device_time(device_time);
+    log(level::info, "Set use device time: %", device_time);
+
+    output_formats_.clear();
+    for (auto& group: command::output_format_groups) {
+      std::string name = options.get("output_format." + group.first, "");
+      if (name.empty()) {
+        continue;
+      }
+      auto format = command::output_format_names.find(name);
+      if (format != command::output_format_names.end()) {
+        output_formats_[group.second] = format->second;
+        log(level::info, "Set % output format: %", group.first, name);
+      }
+      else {
+        log(level::error, "Invalid % output format: %", group.first, name);
+      }
+    }
+
+    output_rates_.clear();
+    uint16_t max_rate = get_max_output_rate();
+    for (auto& item: command::output_items) {
+      auto rate = options.get_optional<int>(std::string("output_rate.") + item.name);
+      if (!rate) {
+        continue;
+      }
+      if (item.gnss && !has_gnss()) {
+        log(level::error, "Output of % not supported by device without GNSS", item.name);
+      }
+      else if (*rate < 0 || *rate > max_rate || (*rate > 0 && max_rate % *rate != 0)) {
+        log(level::error, "Invalid % output rate: %, expected 0 or a divisor of %",
+            item.name, *rate, max_rate);
+      }
+      else {
+        output_rates_[item.did] = static_cast<uint16_t>(*rate);
+        log(level::info, "Set % output rate: % Hz", item.name, *rate);
+      }
+    }
   }
 
   const parser::Xsens_parser& get_parser() const {
     return parser_;
   }
 
+  const Link_statistics* get_link_statistics() const override {
+    return &parser_.get_statistics();
+  }
+
 protected:
   virtual bool get_default_flip_axes() {
     return true;
   }
 
+  virtual bytes_t get_default_output_configuration() const {
+    return bytes_t();
+  }
+
+  //! Highest output rate in Hz, configured rates need to divide it
+  virtual uint16_t get_max_output_rate() const {
+    return command::max_output_rate;
+  }
+
+  virtual bool has_gnss() const {
+    return false;
+  }
+
 private:
   parser::Xsens_parser parser_;
   byte_t filter_profile_;
+  command::Output_formats output_formats_;
+  command::Output_rates output_rates_;
 };
 
 
@@ -343,14 +605,14 @@ struct MTi_GPS_based: public Xsens<Port, ContextProvider> {
   bool check_output_configuration(asio::yield_context yield) override {
     return this->do_check(
         XMID_ReqOutputConfiguration, XMID_ReqOutputConfigurationAck,
-        yield, command::output_configuration, "Xsens ReqOutputConfiguration");
+        yield, this->get_output_configuration(), "Xsens ReqOutputConfiguration");
   }
 
 
   bool set_output_configuration(asio::yield_context yield) override {
     return this->do_set(
         XMID_SetOutputConfiguration, XMID_SetOutputConfigurationAck,
-        yield, command::output_configuration, "Xsens SetOutputConfiguration");
+        yield, this->get_output_configuration(), "Xsens SetOutputConfiguration");
   }
 
 
@@ -365,6 +627,14 @@ struct MTi_GPS_based: public Xsens<Port, ContextProvider> {
         yield, command::string_output_type, "Xsens SetStringOutputType");
   }
 
+protected:
+  bytes_t get_default_output_configuration() const override {
+    return command::output_configuration;
+  }
+
+  bool has_gnss() const override {
+    return true;
+  }
 };
 
 
@@ -466,7 +736,7 @@ struct MTi_630: public Xsens<Port, ContextProvider> {
   bool check_output_configuration(asio::yield_context yield) override {
     return this->do_check(
         XMID_ReqOutputConfiguration, XMID_ReqOutputConfigurationAck,
-        yield, command::output_configuration_630, "Xsens ReqOutputConfiguration");
+        yield, this->get_output_configuration(), "Xsens ReqOutputConfiguration");
   }
 
   bool set_option_flags(asio::yield_context yield) override {
@@ -478,7 +748,7 @@ struct MTi_630: public Xsens<Port, ContextProvider> {
   bool set_output_configuration(asio::yield_context yield) override {
     return this->do_set(
         XMID_SetOutputConfiguration, XMID_SetOutputConfigurationAck,
-        yield, command::output_configuration_630, "Xsens SetOutputConfiguration");
+        yield, this->get_output_configuration(), "Xsens SetOutputConfiguration");
   }
 
   bool set_string_output_type(asio::yield_context yield) override {
@@ -492,6 +762,52 @@ protected:
     return false;
   }
 
+  bytes_t get_default_output_configuration() const override {
+    return command::output_configuration_630;
+  }
+};
+
+/**
+ * Responses of an Xsens device to the commands sent during initialization
+ *
+ * \param output_configuration Output configuration the device reports
+ */
+inline Replay_script get_replay_script(cbytes_t& output_configuration) {
+  using command::packet;
+  using command::packet_head;
+  std::string product_code = "MTi-REPLAY";
+  return Replay_script{
+    { packet(XMID_GotoConfig), packet(XMID_GotoConfigAck) },
+    { packet(XMID_ReqDid), packet(XMID_DeviceId, { 0x00, 0x00, 0x00, 0x00 }) },
+    { packet(XMID_ReqProductCode), packet(XMID_ProductCode, bytes_t(product_code.begin(), product_code.end())) },
+    { packet(XMID_ReqFirmwareRevision), packet(XMID_FirmwareRevision, bytes_t(11, 0)) },
+    { packet_head(XMID_SetOptionFlags), packet(XMID_SetOptionFlagsAck) },
+    { packet_head(XMID_SetStringOutputType), packet(XMID_SetStringOutputTypeAck) },
+    { packet_head(XMID_SetFilterProfile), packet(XMID_SetFilterProfileAck) },
+    // Request and set output configuration share their message id
+    { packet(XMID_ReqOutputConfiguration), packet(XMID_ReqOutputConfigurationAck, output_configuration) },
+    { packet_head(XMID_SetOutputConfiguration), packet(XMID_SetOutputConfigurationAck, output_configuration) },
+    { packet(XMID_Initbus), packet(XMID_InitBusResults) },
+    { packet(XMID_GotoMeasurement), packet(XMID_GotoMeasurementAck) },
+    { packet(XMID_Reset), packet(XMID_ResetAck) },
+  };
+}
+
+
+/**
+ * MTi-670 replaying recorded data
+ */
+template <class ContextProvider>
+struct MTi_670_replay: public MTi_670<Replay_port, ContextProvider> {
+  MTi_670_replay(): MTi_670<Replay_port, ContextProvider>() {
+    this->get_port().set_script(get_replay_script(command::output_configuration));
+  }
+
+  //! Report the output configuration the options ask for, as a configured device would
+  void set_options(const prtr::ptree& options) override {
+    MTi_670<Replay_port, ContextProvider>::set_options(options);
+    this->get_port().set_script(get_replay_script(this->get_output_configuration()));
+  }
 };
 
 }  // namespace xsens
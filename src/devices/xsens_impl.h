@@ -25,6 +25,11 @@
 #include "xsens.h"
 #include "../functions.h"
 
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
 namespace xsens {
 
 namespace command {
@@ -58,6 +63,8 @@ cbytes_t string_output_type_6 = {
 };
 
 cbytes_t output_configuration = {
+  0x10, 0x20, 0xFF, 0xFF, // Packet counter
+  0x10, 0x60, 0xFF, 0xFF, // Sample time fine
   0x10, 0x10, 0xFF, 0xFF, // Utc time
   0x40, 0x20, 0x00, 0x64, // Acceleration, 100Hz
   0x40, 0x30, 0x00, 0x64, // Free Acceleration, 100Hz
@@ -72,6 +79,8 @@ cbytes_t output_configuration = {
 };
 
 cbytes_t output_configuration_630 = {
+  0x10, 0x20, 0xFF, 0xFF, // Packet counter
+  0x10, 0x60, 0xFF, 0xFF, // Sample time fine
   0x40, 0x20, 0x00, 0x64, // Acceleration, 100Hz
   0x40, 0x30, 0x00, 0x64, // Free Acceleration, 100Hz
   0x80, 0x20, 0x00, 0x64, // Rate of turn, 100Hz
@@ -84,20 +93,6 @@ cbytes_t output_configuration_630 = {
 
 namespace parser {
 
-using x3::repeat;
-using x3::omit;
-using x3::eps;
-
-using x3::byte_;
-using x3::big_word;
-using x3::big_dword;
-using x3::big_bin_float;
-using x3::big_bin_double;
-
-using x3::_attr;
-using x3::_val;
-using x3::_pass;
-
 /**
  * Provides default convertion value
  *
@@ -192,57 +187,88 @@ struct TeslaConverter {
 
 
 /**
- * Base class for data packets received from sensor
- *
- * Data packets arrive as part of XMID_MtData2 messages
- * received from the sensor. Each block of data in this
- * message is described by a data identifier (DID) and
- * a length.
+ * Read a big endian value of type T from data
  */
-struct Data_packet {
-  Data_packet(): id(0), len(0) {}
-  Data_packet(const uint16_t did): id(did), len(0) {}
-  uint16_t id;
-  int len;
-  /**
-   * Return a vector of Quantity_value's contained
-   * in this data packet
-   */
-  virtual Quantity_values get_values() const {
-    return Quantity_values();
+template <typename T>
+inline T get_big(const byte_t* data) {
+  using Bits = typename std::conditional<sizeof(T) == 8, uint64_t,
+               typename std::conditional<sizeof(T) == 4, uint32_t,
+               typename std::conditional<sizeof(T) == 2, uint16_t, uint8_t
+               >::type >::type >::type;
+  Bits bits;
+  std::memcpy(&bits, data, sizeof(bits));
+  bits = endian::big_to_native(bits);
+  T result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+
+/**
+ * Size and decoding of a single value in one of the MTData2 sub formats
+ */
+template <uint16_t FORMAT>
+struct Value_format;
+
+template <>
+struct Value_format<XDI_SubFormatFloat> {
+  static constexpr size_t size = 4;
+  static double get(const byte_t* data) {
+    return get_big<float>(data);
   }
 };
 
+//! Signed fixed point with 20 fractional bits
+template <>
+struct Value_format<XDI_SubFormatFp1220> {
+  static constexpr size_t size = 4;
+  static double get(const byte_t* data) {
+    return get_big<int32_t>(data) / static_cast<double>(1 << 20);
+  }
+};
+
+//! Signed fixed point with 32 fractional bits, sent as fraction followed by integer part
+template <>
+struct Value_format<XDI_SubFormatFp1632> {
+  static constexpr size_t size = 6;
+  static double get(const byte_t* data) {
+    return get_big<int16_t>(data + 4) + get_big<uint32_t>(data) / 4294967296.0;
+  }
+};
+
+template <>
+struct Value_format<XDI_SubFormatDouble> {
+  static constexpr size_t size = 8;
+  static double get(const byte_t* data) {
+    return get_big<double>(data);
+  }
+};
+
+
 /**
- * Date-time data structure
+ * Date-time data item
  */
-struct Date_time: public Data_packet {
+struct Date_time {
   static constexpr uint8_t len = 12;
   static constexpr uint8_t valid_utc = 0x04;
   static constexpr uint16_t did = XDI_UtcTime;
   static constexpr Quantity quantity = Quantity::ut;
-  uint32_t nano;
-  uint16_t year;
-  uint8_t month;
-  uint8_t day;
-  uint8_t hour;
-  uint8_t minute;
-  uint8_t second;
-  uint8_t flags;
-
-  Quantity_values get_values() const override {
-    if (flags & valid_utc) {
-      // Return a list with one Unix Time value
-      return Quantity_values{compose_time_quantity(year, month, day, hour, minute, second, nano)};
+
+  /**
+   * Decode the data of an item with identifier id into values
+   *
+   * Returns false when the item doesn't have the expected identifier and size.
+   */
+  static bool decode(const uint16_t id, const byte_t* data, const size_t size,
+      const double stamp, Stamped_quantities& values) {
+    if (id != did || size != len) {
+      return false;
     }
-    else {
-      // Return an empy list
-      return Quantity_values();
+    if (data[11] & valid_utc) {
+      values.push_back(Stamped_quantity(stamp, compose_time_quantity(get_big<uint16_t>(data + 4),
+          data[6], data[7], data[8], data[9], data[10], get_big<uint32_t>(data))));
     }
-  }
-
-  static const auto get_parse_rule() {
-    return big_word(did) >> byte_(len) >> big_dword >> big_word >> byte_ >> byte_ >> byte_ >> byte_ >> byte_ >> byte_;
+    return true;
   }
 };
 
@@ -262,73 +288,63 @@ inline int index_permute<4, false>(int i) {
 }
 
 /**
- * Generic data packet
+ * Generic data item
  *
- * Describes all data packets except date-time
+ * Describes all data items except date-time
  *
- * @tparam DID data identifier of this packet
+ * @tparam DID data identifier of this item
  * @tparam COORD coordinate system use by sensor when providing this data value
- * @tparam FORMAT number format used by sensro when providing this data value
+ * @tparam FORMAT number format requested from the sensor for this data value
  * @tparam DIM number of values provided for this data type
  * @tparam QUANT The sensor hub quantity associated with this data
- * @tparam Converter Value converter provider for this data packet
+ * @tparam Converter Value converter provider for this data item
  * @tparam FLIP whether to convert for flipped axes
  */
 template<uint16_t DID, uint16_t COORD, uint16_t FORMAT, int DIM, Quantity QUANT,
          template<int D, bool F> typename Converter=IdentityConverter, bool FLIP=false >
-struct Data_value: public Data_packet {
+struct Data_value {
   typedef Converter<DIM, FLIP> converter;
   static constexpr uint16_t did = DID | COORD | FORMAT;
   static constexpr Quantity quantity = QUANT;
-  Data_value(): Data_packet(did), data() {}
-
-  // Associate a C++ native type with the format specifier in the data packet
-  typedef typename std::conditional<FORMAT == XDI_SubFormatFloat, float,
-          typename std::conditional<FORMAT == XDI_SubFormatFp1220, uint32_t,
-          typename std::conditional<FORMAT == XDI_SubFormatFp1632, std::vector<uint16_t>,
-          typename std::conditional<FORMAT == XDI_SubFormatDouble, double, void
-          >::type >::type >::type >::type bytes_type;
-
-  std::vector<bytes_type> data;
 
   /**
-   * Get a list of converted sensor hub Values from the raw data that was
-   * received from the sensor
+   * Decode the data of an item with identifier id into values
+   *
+   * The item may be in any of the sub formats. Returns false when the
+   * item doesn't have the expected identifier and size.
    */
-  Quantity_values get_values() const override {
-    Quantity_values result(DIM);
-    Quantity_iter qi(quantity);
-    for (int dim=0; dim < DIM; ++dim) {
-      // When a data packet contains multiple values, the quantities of these
-      // values are always consecutive, so we can just increment the quantity
-      double value =static_cast<double>(data[detail::index_permute<DIM,FLIP>(dim)]);
-      result[dim] = {value_norm(*qi, converter::convert(dim, value)), *qi++};
+  static bool decode(const uint16_t id, const byte_t* data, const size_t size,
+      const double stamp, Stamped_quantities& values) {
+    if ((id & ~XDI_SubFormatMask) != (did & ~XDI_SubFormatMask)) {
+      return false;
+    }
+    switch (id & XDI_SubFormatMask) {
+      case XDI_SubFormatFloat:
+        return decode_values<XDI_SubFormatFloat>(data, size, stamp, values);
+      case XDI_SubFormatFp1220:
+        return decode_values<XDI_SubFormatFp1220>(data, size, stamp, values);
+      case XDI_SubFormatFp1632:
+        return decode_values<XDI_SubFormatFp1632>(data, size, stamp, values);
+      default:
+        return decode_values<XDI_SubFormatDouble>(data, size, stamp, values);
     }
-    return result;
-  }
-
-
-  /**
-   * Get parse rule for single precision data
-   */
-  template <uint16_t PFORMAT = FORMAT>
-  static const auto get_parse_rule(typename std::enable_if<PFORMAT == XDI_SubFormatFloat, int>::type n=0) {
-    (void)n;
-    return big_word(did) >> byte_(DIM * 4) >> repeat(DIM)[big_bin_float];
-  }
-
-  /**
-   * Get parse rule for double precision data
-   */
-  template <uint16_t PFORMAT = FORMAT>
-  static const auto get_parse_rule(typename std::enable_if<PFORMAT == XDI_SubFormatDouble, int>::type n=0) {
-    (void)n;
-    return big_word(did) >> byte_(DIM * 8) >> repeat(DIM)[big_bin_double];
   }
 
-  // Other formats are not currently supported
-
 private:
+  template <uint16_t PFORMAT>
+  static bool decode_values(const byte_t* data, const size_t size,
+      const double stamp, Stamped_quantities& values) {
+    using format = Value_format<PFORMAT>;
+    if (size != DIM * format::size) {
+      return false;
+    }
+    Quantity_iter qi(quantity);
+    for (int dim=0; dim < DIM; ++dim) {
+      double value = format::get(data + format::size * detail::index_permute<DIM,FLIP>(dim));
+      values.push_back(Stamped_quantity(stamp, {value_norm(*qi, converter::convert(dim, value)), *qi++}));
+    }
+    return true;
+  }
 };
 
 
@@ -366,192 +382,226 @@ using Quaternion = QuaternionT<false>;
 using Quaternion_flipped = QuaternionT<true>;
 
 
-auto set_did = [](auto& ctx) { _val(ctx).id = _attr(ctx); };
-auto set_len = [](auto& ctx) { _val(ctx).len = static_cast<int>(_attr(ctx)); };
-auto more = [](auto& ctx) { _pass(ctx) = _val(ctx).len-- > 0; };
-auto done = [](auto& ctx) { _pass(ctx) = _val(ctx).len < 0; };
-
-// Parse rule for data packets other than the ones we're interested in
-x3::rule<struct unknown_data, Data_packet> const unknown_data = "unknown_data";
-auto unknown_data_def = big_word[set_did] >> byte_[set_len] >> *(eps[more] >> omit[byte_]) >> eps[done];
-BOOST_SPIRIT_DEFINE(unknown_data)
-
-#define RULE_DEFINE(name, type) \
-x3::rule<struct name, type> const name = "\"" #name "\""; \
-auto name##_def = type::get_parse_rule(); \
-BOOST_SPIRIT_DEFINE(name)
-
-// Define parse rules for each individual data packet type
-RULE_DEFINE(date_time, Date_time)
-RULE_DEFINE(acceleration, Acceleration)
-RULE_DEFINE(acceleration_flipped, Acceleration_flipped)
-RULE_DEFINE(free_acceleration, Free_acceleration)
-RULE_DEFINE(free_acceleration_flipped, Free_acceleration_flipped)
-RULE_DEFINE(rate_of_turn, Rate_of_turn)
-RULE_DEFINE(rate_of_turn_flipped, Rate_of_turn_flipped)
-RULE_DEFINE(lat_lon, Lat_lon)
-RULE_DEFINE(magnetic_flux, Magnetic_flux)
-RULE_DEFINE(magnetic_flux_flipped, Magnetic_flux_flipped)
-RULE_DEFINE(velocity, Velocity)
-RULE_DEFINE(velocity_flipped, Velocity_flipped)
-RULE_DEFINE(altitude_ellipsoid, Altitude_ellipsoid)
-RULE_DEFINE(altitude_msl, Altitude_msl)
-RULE_DEFINE(euler_angles, Euler_angles)
-RULE_DEFINE(euler_angles_flipped, Euler_angles_flipped)
-RULE_DEFINE(quaternion, Quaternion)
-RULE_DEFINE(quaternion_flipped, Quaternion_flipped)
-
-#undef RULE_DEFINE
-
-// Parse rule for data packets..
-static auto data_parser = *(
-    date_time |
-    acceleration |
-    free_acceleration |
-    rate_of_turn |
-    lat_lon |
-    magnetic_flux |
-    velocity |
-    altitude_ellipsoid |
-    altitude_msl |
-    euler_angles |
-    quaternion |
-    unknown_data);
-
-// ... and for flipped data packets
-static auto flipped_parser = *(
-    date_time |
-    acceleration_flipped |
-    free_acceleration_flipped |
-    rate_of_turn_flipped |
-    lat_lon |
-    magnetic_flux_flipped |
-    velocity_flipped |
-    altitude_ellipsoid |
-    altitude_msl |
-    euler_angles_flipped |
-    quaternion_flipped |
-    unknown_data);
+using Decode_function = bool (*)(const uint16_t id, const byte_t* data, const size_t size,
+    const double stamp, Stamped_quantities& values);
 
 /**
- * Vector with parsed results
+ * Decoder for the MTData2 items of one data type
  *
- * Since the type of each packet is not known in advance
- * the elements have to be of a variant type, which will
- * require a visitor to access.
+ * The type is the data identifier with the format bits masked.
  */
-struct Xsens_parser::Data_packets
-  : public std::vector<
-    boost::variant<
-      Data_packet,
-      Date_time,
-      Acceleration,
-      Acceleration_flipped,
-      Free_acceleration,
-      Free_acceleration_flipped,
-      Rate_of_turn,
-      Rate_of_turn_flipped,
-      Lat_lon,
-      Magnetic_flux,
-      Magnetic_flux_flipped,
-      Velocity,
-      Velocity_flipped,
-      Altitude_ellipsoid,
-      Altitude_msl,
-      Euler_angles,
-      Euler_angles_flipped,
-      Quaternion,
-      Quaternion_flipped
-    > > {
+struct Data_decoder {
+  uint16_t type;
+  Decode_function decode;
+  Decode_function decode_flipped;
 };
 
+template <class T, class T_flipped = T>
+constexpr Data_decoder make_decoder() {
+  return Data_decoder{static_cast<uint16_t>(T::did & XDI_FullTypeMask), &T::decode, &T_flipped::decode};
+}
+
 /**
- * Visitor for accessing parsed data packets
+ * Decoders for the MTData2 items we're interested in
+ *
+ * Items of other types are skipped. To decode a new type, add its
+ * decoder here. The first entry is the "no decoder" entry.
  */
-struct Xsens_parser::Data_visitor {
+constexpr Data_decoder data_decoders[] = {
+  {0, nullptr, nullptr},
+  make_decoder<Date_time>(),
+  make_decoder<Acceleration, Acceleration_flipped>(),
+  make_decoder<Free_acceleration, Free_acceleration_flipped>(),
+  make_decoder<Rate_of_turn, Rate_of_turn_flipped>(),
+  make_decoder<Lat_lon>(),
+  make_decoder<Magnetic_flux, Magnetic_flux_flipped>(),
+  make_decoder<Velocity, Velocity_flipped>(),
+  make_decoder<Altitude_ellipsoid>(),
+  make_decoder<Altitude_msl>(),
+  make_decoder<Euler_angles, Euler_angles_flipped>(),
+  make_decoder<Quaternion, Quaternion_flipped>()
+};
 
-  Stamped_queue values;
-  double stamp;
+//! Key into the decoder index: the data group and the type within the group
+constexpr size_t get_decoder_key(const uint16_t id) {
+  return (id >> 11) << 4 | ((id >> 4) & 0x0F);
+}
 
-  void operator()(const Data_packet& data_packet) {
-    for (auto& value: data_packet.get_values()) {
-      values.push_back(Stamped_quantity(stamp, value));
+constexpr auto make_decoder_index() {
+  std::array<uint8_t, 0x200> index{};
+  for (size_t i = 1; i < std::size(data_decoders); ++i) {
+    auto& slot = index[get_decoder_key(data_decoders[i].type)];
+    if (slot != 0) {
+      // Evaluated at compile time, so this fails the build
+      throw std::logic_error("Data decoder keys should be unique");
     }
+    slot = static_cast<uint8_t>(i);
   }
+  return index;
+}
+
+//! Index into data_decoders by decoder key
+constexpr auto data_decoder_index = make_decoder_index();
+
+
+struct Xsens_parser::Packet_info {
+  bool has_counter = false;
+  uint16_t counter = 0;
+  bool has_sample_time = false;
+  //! Sample time in ticks of 100 us
+  uint32_t sample_time = 0;
 };
 
 
-Xsens_parser::Xsens_parser()
-  : Packet_parser(),
-    data_packets(std::make_unique<Data_packets>()),
-    visitor(std::make_unique<Data_visitor>()) {
+/**
+ * Decode the items in MTData2 message content into values
+ *
+ * Items are looked up by type in data_decoders and decoded in place.
+ * The packet counter and sample time are stored in info, when provided.
+ * Returns false when the content is malformed.
+ */
+bool decode_data(const byte_t* data, const byte_t* end, const double stamp, const bool flip_axes,
+    Stamped_quantities& values, Xsens_parser::Packet_info* info=nullptr) {
+  //! Data identifier and size
+  constexpr size_t item_header_size = 3;
+  while (data < end) {
+    if (static_cast<size_t>(end - data) < item_header_size) {
+      return false;
+    }
+    uint16_t id = get_big<uint16_t>(data);
+    size_t size = data[2];
+    data += item_header_size;
+    if (static_cast<size_t>(end - data) < size) {
+      return false;
+    }
+    if (info != nullptr && id == XDI_PacketCounter && size == sizeof(uint16_t)) {
+      info->has_counter = true;
+      info->counter = get_big<uint16_t>(data);
+    }
+    else if (info != nullptr && id == XDI_SampleTimeFine && size == sizeof(uint32_t)) {
+      info->has_sample_time = true;
+      info->sample_time = get_big<uint32_t>(data);
+    }
+    auto& decoder = data_decoders[data_decoder_index[get_decoder_key(id)]];
+    if (decoder.type == (id & XDI_FullTypeMask)) {
+      (flip_axes ? decoder.decode_flipped : decoder.decode)(id, data, size, stamp, values);
+    }
+    data += size;
+  }
+  return true;
+}
+
+
+Xsens_parser::Xsens_parser(): Packet_parser(), values_(), flip_axes_(false), statistics_(),
+    has_counter_(false), counter_(0), has_sample_time_(false), sample_time_(0),
+    nominal_interval_(0), use_device_time_(false),
+    // Sample time is in ticks of 100 us and wraps around after 2^32 ticks
+    clock_(static_cast<double>(1ull << 32) * 1E-4) {
 }
 
 
-Xsens_parser::~Xsens_parser() {
+/**
+ * Count packets missing from the sequence of packet counters and gaps in sample time
+ *
+ * A packet counter going back more than half its range is taken to be a
+ * restart of the device rather than a drop. Gaps are intervals longer than
+ * one and a half times the shortest interval seen.
+ */
+void Xsens_parser::update_statistics(const Packet_info& info) {
+  ++statistics_.packets;
+  if (info.has_counter) {
+    uint16_t step = static_cast<uint16_t>(info.counter - counter_);
+    if (has_counter_ && step > 0 && step < 0x8000) {
+      statistics_.expected += step;
+      statistics_.dropped += step - 1u;
+    }
+    else {
+      ++statistics_.expected;
+    }
+    has_counter_ = true;
+    counter_ = info.counter;
+  }
+  if (info.has_sample_time) {
+    uint32_t interval = info.sample_time - sample_time_;
+    if (has_sample_time_ && interval > 0) {
+      if (nominal_interval_ == 0 || interval < nominal_interval_) {
+        nominal_interval_ = interval;
+      }
+      else if (interval > nominal_interval_ + nominal_interval_ / 2) {
+        ++statistics_.gaps;
+      }
+    }
+    has_sample_time_ = true;
+    sample_time_ = info.sample_time;
+  }
 }
 
 
+/**
+ * Parse the first packet in the buffer and remove it
+ *
+ * The packet is validated and decoded in place. Returns false when the
+ * buffer doesn't contain a complete packet; junk before the start of a
+ * packet is removed.
+ */
 bool Xsens_parser::parse_single(const double& stamp) {
-  uint8_t mid = 0;
-  int len = 0;
-  std::vector<uint8_t> data;
-  uint8_t sum = command::sys_command;
-
-  auto set_mid = [&](auto& ctx) { mid = _attr(ctx); sum += mid; };
-  auto set_len = [&](auto& ctx) { len = _attr(ctx); sum += len; };
-  auto add_data = [&](auto& ctx) {
-    uint8_t val = _attr(ctx);
-    data.push_back(val);
-    sum += val;
-  };
-  auto set_chk = [&](auto& ctx) { sum += _attr(ctx); };
-  auto have_data = [&](auto& ctx) { _pass(ctx) = len-- > 0; };
-  auto have_all = [&](auto& ctx) { _pass(ctx) = len < 0; };
-
-  //! Start of a packet
-  auto preamble = byte_(command::packet_start) >> byte_(command::sys_command);
-  //! Anything that is not the start of a packet
-  auto junk = *(byte_ - preamble);
-  //! The actual data we're looking for
-  auto content = *(eps[have_data] >> byte_[add_data]) >> eps[have_all];
-  //! The complete packet
-  auto packet_rule = junk >> preamble >> byte_[set_mid] >> byte_[set_len] >> content >> byte_[set_chk];
-
-  visitor->stamp = stamp;
-
-  //! Look for messages in the buffer
-  if (x3::parse(cur, buffer.end(), packet_rule)) {
-    //! Consume the message from the buffer
-    buffer.erase(buffer.begin(), cur);
-    //! Verify the checksum is 0
-    if (sum == 0) {
-      //! The content of the message is now in "data"
-      auto dcur = data.begin();
-      //! We're only interested in data messages
-      if (mid == XMID_MtData2) {
-        //! Look for data packets in the message content
-        if (flip_axes_ ?
-              x3::parse(dcur, data.end(), flipped_parser, *data_packets) :
-              x3::parse(dcur, data.end(), data_parser, *data_packets)) {
-          for (auto& data_packet: *data_packets) {
-            //! Visit each packet. The visitor will extract the data from it
-            boost::apply_visitor(*visitor, data_packet);
-          }
+  //! Packet start, bus id, message id and length
+  constexpr size_t header_size = 4;
+  const byte_t* start = buffer.begin();
+  const byte_t* end = buffer.end();
+
+  //! Find the start of a packet
+  while (true) {
+    start = std::find(start, end, command::packet_start);
+    if (end - start < 2 || start[1] == command::sys_command) {
+      break;
+    }
+    ++start;
+  }
+  if (start != buffer.begin()) {
+    statistics_.junk_bytes += start - buffer.begin();
+    ++statistics_.resyncs;
+    buffer.erase(buffer.begin(), start);
+  }
+  if (static_cast<size_t>(end - start) < header_size
+      || static_cast<size_t>(end - start) < header_size + start[3] + 1) {
+    return false;
+  }
+  const byte_t mid = start[2];
+  const byte_t* data = start + header_size;
+  const byte_t* data_end = data + start[3];
+
+  //! The sum of all bytes except the packet start should be 0
+  byte_t sum = 0;
+  for (const byte_t* c = start + 1; c <= data_end; ++c) {
+    sum += *c;
+  }
+  if (sum != 0) {
+    // The length may be corrupt as well, so look for the next packet right after this start
+    log(level::error, "Xsens checksum error: %", static_cast<int>(sum));
+    ++statistics_.checksum_errors;
+    buffer.erase(buffer.begin(), start + 1);
+    return true;
+  }
+  //! We're only interested in data messages
+  if (mid == XMID_MtData2) {
+    Packet_info info;
+    size_t first = values_.size();
+    if (decode_data(data, data_end, stamp, flip_axes_, values_, &info)) {
+      update_statistics(info);
+      if (use_device_time_ && info.has_sample_time) {
+        double sample_stamp = clock_.map(info.sample_time * 1E-4, stamp);
+        for (size_t i = first; i < values_.size(); ++i) {
+          values_[i].stamp = sample_stamp;
         }
-        log(level::debug, "Successfully parsed packet: %", data);
       }
     }
     else {
-      log(level::error, "Xsens checksum error: %", sum);
+      log(level::error, "Malformed Xsens data message");
     }
-    //! Reset message content
-    data_packets->clear();
-    return true;
-  }
-  else {
-    return false;
   }
+  buffer.erase(buffer.begin(), data_end + 1);
+  return true;
 }
 
 void Xsens_parser::parse(const double& stamp) {
@@ -561,37 +611,14 @@ void Xsens_parser::parse(const double& stamp) {
 }
 
 
-Stamped_queue& Xsens_parser::get_values() {
-  return visitor->values;
+Stamped_quantities& Xsens_parser::get_values() {
+  return values_;
 }
 
 }  // namespace parser
 
 }  // namespace xsens
 
-// Magic to map parsed values which are stored in fusion::vector to the actual data packet type.
-// Macro call is at global scope as stated in the manual. Trivial for anything but the
-// date-time values.
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Date_time, nano, year, month, day,
-                                                    hour, minute, second, flags)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Acceleration, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Acceleration_flipped, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Free_acceleration, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Free_acceleration_flipped, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Rate_of_turn, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Rate_of_turn_flipped, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Lat_lon, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Magnetic_flux, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Magnetic_flux_flipped, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Velocity, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Velocity_flipped, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Altitude_ellipsoid, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Altitude_msl, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Euler_angles, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Euler_angles_flipped, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Quaternion, data)
-BOOST_FUSION_ADAPT_STRUCT(xsens::parser::Quaternion_flipped, data)
-
 #endif
 
 // vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -30,6 +30,9 @@
 #include <sstream>
 #include <string>
 #include <set>
+#include <limits>
+
+#include <boost/algorithm/string.hpp>
 
 struct Header {
   std::string name;
@@ -71,6 +74,9 @@ struct Reply {
   /// The content to be sent in the reply.
   std::string content;
 
+  /// Optional producer of further content, streamed after the initial reply
+  Content_producer producer;
+
   /// Convert the reply into a vector of buffers. The buffers do not own the
   /// underlying memory blocks, therefore the reply object must remain valid and
   /// not be changed until the write operation has completed.
@@ -352,18 +358,26 @@ void Request_handler::handle_request(const Request& req, Reply& rep) {
   }
 
   std::string content;
-  std::string content_type = get_content(request_path, content);
+  Content_producer producer;
+  std::string content_type = get_content(request_path, content, producer);
   // Fill out the reply to be sent to the client.
   if (!content_type.empty()) {
     rep.status = Reply::ok;
     rep.content.append(content);
+    rep.producer = producer;
     rep.headers.resize(3);
-    rep.headers[0].name = "Content-Length";
-    rep.headers[0].value = std::to_string(rep.content.size());
-    rep.headers[1].name = "Content-Type";
-    rep.headers[1].value = content_type;
-    rep.headers[2].name = "Access-Control-Allow-Origin";
-    rep.headers[2].value = "*";
+    rep.headers[0].name = "Content-Type";
+    rep.headers[0].value = content_type;
+    rep.headers[1].name = "Access-Control-Allow-Origin";
+    rep.headers[1].value = "*";
+    // Streamed content length is unknown: the end of the content is marked by closing the connection
+    if (!producer) {
+      rep.headers[2].name = "Content-Length";
+      rep.headers[2].value = std::to_string(rep.content.size());
+    }
+    else {
+      rep.headers.resize(2);
+    }
   }
   else {
     rep = Reply::stock_reply(Reply::not_found);
@@ -371,7 +385,8 @@ void Request_handler::handle_request(const Request& req, Reply& rep) {
 }
 
 
-std::string Request_handler::get_content(const std::string& path, std::string& content) {
+std::string Request_handler::get_content(const std::string& request_path, std::string& content,
+    Content_producer& producer) {
   static const char html[] =
     "<html>\n"
     "<head>\n"
@@ -389,6 +404,10 @@ std::string Request_handler::get_content(const std::string& path, std::string& c
     "<hr><p class=\"attribution\">"
     "Version: {} built from revision: {}. Written by "
     "<a href=\"mailto:jaap.versteegh@damen.com?subject=Damen Sensor Hub\">Jaap Versteegh</a>";
+  // Split off query string
+  size_t query_pos = request_path.find('?');
+  std::string path = request_path.substr(0, query_pos);
+  std::string query = query_pos != std::string::npos ? request_path.substr(query_pos + 1) : "";
   if (path == "/") {
     std::string devices;
     for (size_t i = 0; i < devices_.size(); ++i) {
@@ -417,11 +436,24 @@ std::string Request_handler::get_content(const std::string& path, std::string& c
     return "text/html";
   }
   else if (path.substr(0, 9) == "/devices/") {
-    std::string id = path.substr(9, 32);
+    std::string id = path.substr(9);
+    bool history = false;
+    size_t slash_pos = id.find('/');
+    if (slash_pos != std::string::npos) {
+      if (id.substr(slash_pos) != "/history") {
+        return "";
+      }
+      history = true;
+      id = id.substr(0, slash_pos);
+    }
     content = "{}";
     for (size_t i = 0; i < devices_.size(); ++i) {
       const Device& device = *devices_[i];
       if (std::to_string(i) == id || device.get_id() == id || device.get_name() == id) {
+        if (history) {
+          content.clear();
+          return get_history(device, query, producer);
+        }
         content = get_device_json(device);
       }
     }
@@ -444,6 +476,75 @@ std::string Request_handler::get_content(const std::string& path, std::string& c
 }
 
 
+/**
+ * Setup streaming of device sample history
+ *
+ * Recognized query parameters are "q": a comma separated list of quantities, 
+ * "from" and "to": unix time range, where negative values are relative to the current
+ * time, and "max_points": maximum number of samples per quantity.
+ */
+std::string Request_handler::get_history(const Device& device, const std::string& query,
+    Content_producer& producer) {
+  std::vector<Quantity> quantities;
+  double from = -std::numeric_limits<double>::infinity();
+  double to = std::numeric_limits<double>::infinity();
+  size_t max_points = 0;
+  std::vector<std::string> params;
+  boost::split(params, query, [](const char c) { return c == '&'; });
+  try {
+    for (auto& param: params) {
+      size_t eq_pos = param.find('=');
+      std::string key = param.substr(0, eq_pos);
+      std::string value = eq_pos != std::string::npos ? param.substr(eq_pos + 1) : "";
+      if (key == "q") {
+        std::vector<std::string> names;
+        boost::split(names, value, [](const char c) { return c == ','; });
+        for (auto& name: names) {
+          Quantity quantity = get_quantity(name);
+          if (quantity != Quantity::end) {
+            quantities.push_back(quantity);
+          }
+        }
+      }
+      else if (key == "from" && !value.empty()) {
+        from = std::stod(value);
+      }
+      else if (key == "to" && !value.empty()) {
+        to = std::stod(value);
+      }
+      else if (key == "max_points" && !value.empty()) {
+        max_points = std::stoul(value);
+      }
+    }
+  }
+  catch (std::exception& e) {
+    log(level::warning, "Invalid history query \"%\": %", query, e.what());
+    return "";
+  }
+  // Make negative times relative to now
+  double now = get_time();
+  if (from < 0) {
+    from += now;
+  }
+  if (to < 0) {
+    to += now;
+  }
+  // Default to all available quantities
+  if (quantities.empty()) {
+    for (auto qi = Quantity_iter::begin(); qi != Quantity_iter::end(); ++qi) {
+      if (!device.get_samples(*qi).empty()) {
+        quantities.push_back(*qi);
+      }
+    }
+  }
+  auto writer = std::make_shared<History_writer>(device, quantities, from, to, max_points);
+  producer = [writer](std::string& chunk) {
+    return writer->write(chunk, 0x4000);
+  };
+  return "application/json";
+}
+
+
 bool Request_handler::url_decode(const std::string& in, std::string& out) {
   out.clear();
   out.reserve(in.size());
@@ -796,6 +897,8 @@ private:
 
   void do_write();
 
+  void do_write_content();
+
   boost::asio::ip::tcp::socket socket_;
 
   Connection_manager& connection_manager_;
@@ -876,6 +979,39 @@ void Connection::do_write()
   auto self(shared_from_this());
   boost::asio::async_write(socket_, reply_.to_buffers(),
       [this, self](boost::system::error_code ec, std::size_t) {
+        if (!ec && reply_.producer) {
+          do_write_content();
+          return;
+        }
+        if (!ec) {
+          // Initiate graceful connection closure.
+          boost::system::error_code ignored_ec;
+          socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both,
+            ignored_ec);
+        }
+
+        if (ec != boost::asio::error::operation_aborted) {
+          connection_manager_.stop(shared_from_this());
+        }
+      }
+  );
+}
+
+
+void Connection::do_write_content()
+{
+  auto self(shared_from_this());
+  reply_.content.clear();
+  if (!reply_.producer(reply_.content)) {
+    // Last part of the content: no need to call the producer again
+    reply_.producer = nullptr;
+  }
+  boost::asio::async_write(socket_, boost::asio::buffer(reply_.content),
+      [this, self](boost::system::error_code ec, std::size_t) {
+        if (!ec && reply_.producer) {
+          do_write_content();
+          return;
+        }
         if (!ec) {
           // Initiate graceful connection closure.
           boost::system::error_code ignored_ec;
@@ -25,6 +25,7 @@
 
 #include <string>
 #include <memory>
+#include <functional>
 #include <boost/asio.hpp>
 
 #include "device.h"
@@ -32,6 +33,13 @@
 struct Request;
 struct Reply;
 
+/**
+ * Function that appends the next part of reply content to its argument
+ *
+ * Used for streaming large replies. Returns false when all content has been produced.
+ */
+using Content_producer = std::function<bool(std::string&)>;
+
 struct Request_handler {
   Request_handler(const Request_handler&) = delete;
   Request_handler& operator=(const Request_handler&) = delete;
@@ -40,7 +48,7 @@ struct Request_handler {
     : devices_(devices), processors_(processors), css_() {};
 
   void handle_request(const Request& req, Reply& rep);
-  std::string get_content(const std::string& path, std::string& content);
+  std::string get_content(const std::string& path, std::string& content, Content_producer& producer);
 
   void set_css(const std::string& css) {
     css_ = css;
@@ -50,6 +58,7 @@ private:
   const Processors& processors_;
   std::string css_;
   static bool url_decode(const std::string& in, std::string& out);
+  std::string get_history(const Device& device, const std::string& query, Content_producer& producer);
 };
 
 
@@ -38,7 +38,6 @@
 #include <boost/log/utility/manipulators/to_log.hpp>
 #include <boost/log/utility/exception_handler.hpp>
 #include <boost/log/support/date_time.hpp>
-#include <boost/log/sinks/async_frontend.hpp>
 
 #ifdef _WIN32
 #include <shlobj.h>
@@ -49,7 +48,6 @@ using namespace boost::log;
 namespace pt = boost::posix_time;
 
 BOOST_LOG_ATTRIBUTE_KEYWORD(severity, "Severity", level)
-BOOST_LOG_ATTRIBUTE_KEYWORD(tag_attr, "Tag", std::string)
 
 static const char* level_strings[] = {
   " - DEBUG   - ",
@@ -60,29 +58,6 @@ static const char* level_strings[] = {
 };
 
 
-struct device_log_exception_handler {
-
-  typedef void result_type;
-
-  void handle(std::string const& msg) const {
-    auto cur = pt::second_clock::local_time().time_of_day().hours();
-    static auto last = cur - 1;
-
-    if (cur != last) {
-      log(level::error, msg);
-      last = cur;
-    }
-  }
-
-  void operator() (std::exception const& e) const {
-    handle(fmt::format("Exception in device logger: {:s}", e.what()));
-  }
-
-  void operator() () const {
-    handle("Unknown exception in device logger");
-  }
-};
-
 std::ostream& operator<< (std::ostream& strm, level lvl)
 {
   if (static_cast< std::size_t >(lvl) < sizeof(level_strings) / sizeof(*level_strings))
@@ -119,10 +94,6 @@ struct Logger {
     return log_;
   }
 
-  sources::logger& get_device_log() {
-    return device_log_;
-  }
-
   void flush() {
     file_sink_->flush();
   }
@@ -176,7 +147,7 @@ struct Logger {
 
 
   void set_log_level(level lvl) {
-    file_sink_->set_filter(!expressions::has_attr(tag_attr) && severity >= lvl);
+    file_sink_->set_filter(severity >= lvl);
   }
 
 
@@ -186,7 +157,7 @@ struct Logger {
 
 private:
 
-  Logger(): device_log_dir_(), log_(), device_log_() {
+  Logger(): device_log_dir_(), log_() {
     add_common_attributes();
     core::get()->add_global_attribute("UtcStamp", boost::log::attributes::utc_clock());
     core::get()->set_exception_handler(make_exception_suppressor());
@@ -210,12 +181,10 @@ private:
     );
     file_sink_->locked_backend()->set_file_collector(collector);
     file_sink_->locked_backend()->scan_for_files();
-    file_sink_->set_filter(!expressions::has_attr(tag_attr));
   }
 
   fs::path device_log_dir_;
   sources::severity_logger_mt<level> log_;
-  sources::logger device_log_;
   boost::shared_ptr<sinks::synchronous_sink<sinks::text_file_backend> > file_sink_;
 
   fs::path get_log_filename() {
@@ -233,42 +202,6 @@ void flush_log() {
 }
 
 
-sources::logger& get_device_log() {
-  return Logger::get_instance().get_device_log();
-}
-
-
-bool init_device_log(const std::string& device_id, const std::string& device_name, 
-    const int max_files, const size_t file_size) {
-  try {
-    auto log_dir = Logger::get_instance().get_device_log_dir();
-    typedef sinks::asynchronous_sink<sinks::text_file_backend> file_sink;
-    auto filename = log_dir / (device_id + ".%Y%m%dT%H%M%S."  + device_name + ".%8N.log");
-    auto collector = sinks::file::make_collector(
-        keywords::target = log_dir,
-        keywords::min_free_space = 256 * 1024 * 1024,
-        keywords::max_files = max_files
-        );
-    auto sink = boost::make_shared<file_sink>(
-        keywords::file_name = filename,
-        keywords::open_mode = std::ios_base::app,
-        keywords::rotation_size = file_size,
-        keywords::auto_flush = false
-        );
-    sink->set_exception_handler(make_exception_handler<std::exception>(device_log_exception_handler()));
-    sink->locked_backend()->set_file_collector(collector);
-    sink->locked_backend()->scan_for_files();
-    sink->set_filter(tag_attr == device_name);
-    core::get()->add_sink(sink);
-  }
-  catch (std::exception const& e) {
-    log(level::debug, "Can't initialize device log: %", e.what());
-    return false;
-  }
-  return true;
-}
-
-
 void set_log_level(level lvl) {
   Logger::get_instance().set_log_level(lvl);
 }
@@ -277,6 +210,10 @@ void set_device_log_dir(const fs::path& dir) {
   Logger::get_instance().set_device_log_dir(dir);
 }
 
+fs::path get_device_log_dir() {
+  return Logger::get_instance().get_device_log_dir();
+}
+
 std::string get_current_log_file() {
   return Logger::get_instance().get_current_log_file();
 }
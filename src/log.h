@@ -29,11 +29,9 @@
 #include <sstream>
 
 #include <boost/log/core.hpp>
-#include <boost/log/sources/logger.hpp>
 #include <boost/log/trivial.hpp>
 #include <boost/log/sources/severity_logger.hpp>
 #include <boost/log/sources/record_ostream.hpp>
-#include <boost/log/attributes/scoped_attribute.hpp>
 #include <boost/filesystem.hpp>
 
 #include <fmt/format.h>
@@ -50,11 +48,9 @@ enum class level {
 };
 
 extern boost::log::sources::severity_logger_mt<level>& get_log();
-extern boost::log::sources::logger& get_device_log();
-extern bool init_device_log(const std::string& device_id, const std::string& device_name, 
-    const int max_files=32, const size_t file_size=64*1024*1024);
 extern void set_log_level(level lvl);
 extern void set_device_log_dir(const fs::path& dir);
+extern fs::path get_device_log_dir();
 
 
 template <typename M>
@@ -85,12 +81,6 @@ inline void log(level lvl, const char* format, const As&... args) {
   log(lvl, ss.str());
 }
 
-template <typename M>
-inline void log(const std::string& device_name, const M& msg) {
-  BOOST_LOG_SCOPED_THREAD_TAG("Tag", device_name);
-  BOOST_LOG(get_device_log()) << msg;
-}
-
 extern void flush_log();
 
 inline void set_log_level(const std::string& slevel) {
@@ -0,0 +1,55 @@
+/**
+ * \file log2csv.cpp
+ * \brief Convert binary device logs to csv
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "device_log.h"
+
+#include <iostream>
+#include <fstream>
+
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: sensor_hub_log2csv <device log>..." << std::endl;
+    std::cerr << "Write the samples in binary device logs to standard output as" << std::endl;
+    std::cerr << "<time>,<quantity>,<value> lines." << std::endl;
+    return 1;
+  }
+  int result = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::ifstream in(argv[i], std::ios_base::binary);
+    if (!in) {
+      std::cerr << "Failed to open " << argv[i] << std::endl;
+      result = 1;
+      continue;
+    }
+    try {
+      device_log_to_csv(in, std::cout);
+    }
+    catch (std::exception& e) {
+      std::cerr << argv[i] << ": " << e.what() << std::endl;
+      result = 1;
+    }
+  }
+  return result;
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
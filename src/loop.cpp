@@ -180,7 +180,16 @@ struct Service {
       device->enable_logging(device_cfg.get("enable_logging", false));
       device->set_max_log_files(device_cfg.get("max_log_files", 32));
       device->set_max_log_size(device_cfg.get("max_log_size", 64 * 1024 * 1024));
+      device->set_log_format(device_cfg.get("log_format", "text"));
+      device->set_capture_raw(device_cfg.get("capture_raw", false));
+      device->set_cache_size(device_cfg.get("cache_size", default_cache_size));
+      device->set_cache_age(device_cfg.get("cache_age", default_cache_age));
+      setup_cache_tiers(*device, device_cfg);
       device->use_as_time_source(device_cfg.get("use_as_time_source", false));
+      if (device->is_time_source()) {
+        set_clock_time_constant(device_cfg.get("clock_time_constant",
+              Clock_discipline::default_time_constant));
+      }
       devices_.push_back(std::move(device));
     }
   }
@@ -333,6 +342,30 @@ struct Service {
   }
 
 private:
+  /**
+   * Setup retention tiers of the device sample cache from device configuration
+   *
+   * cache_tiers applies to all quantities, cache_tiers_<quantity> to a single one
+   */
+  void setup_cache_tiers(Device& device, const prtr::ptree& device_cfg) {
+    try {
+      auto tiers = device_cfg.get_optional<std::string>("cache_tiers");
+      if (tiers) {
+        device.set_cache_tiers(parse_retention_tiers(*tiers));
+      }
+      for (auto it = Quantity_iter::begin(); it != Quantity_iter::end(); ++it) {
+        tiers = device_cfg.get_optional<std::string>(fmt::format("cache_tiers_{}", get_quantity_name(*it)));
+        if (tiers) {
+          device.set_cache_tiers(*it, parse_retention_tiers(*tiers));
+        }
+      }
+    }
+    catch (std::exception& e) {
+      log(level::error, "Failed to setup cache tiers for %: %", device.get_name(), e.what());
+    }
+  }
+
+
   /**
    * Private default constructor for singleton
    */
@@ -379,6 +412,7 @@ int enter_loop() {
   set_log_level(cfg.get("logging.level", "info"));
   log(level::debug, "Debug logging enabled");
   set_device_log_dir(cfg.get("logging.device_log_dir", ""));
+  get_device_log_service().set_sync_interval(cfg.get("logging.sync_interval", 10.0));
 
   Service& service = Service::get_instance();
 
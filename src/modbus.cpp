@@ -31,6 +31,7 @@
 using namespace modbus;
 
 static Stamped_value const zero = {};
+static constexpr uint16_t const link_base_address = 3000;
 static constexpr uint16_t const plain_base_address = 10000;
 static constexpr uint16_t const processor_base_address = 20000;
 
@@ -111,6 +112,19 @@ void Modbus_handler::base_map(const Device& device,
   }
 }
 
+void Modbus_handler::link_map(const Device& device,
+    int reg_index, const int count, response::read_input_registers& resp) {
+  const Link_statistics* link = device.get_link_statistics();
+  for (int index = 0; index < count; ++index) {
+    if (link != nullptr) {
+      // Two registers per counter, high word first
+      uint32_t v = static_cast<uint32_t>(link->get(reg_index / 2));
+      resp.values[index] = reg_index % 2 == 0 ? v >> 16 : v & 0xFFFF;
+    }
+    ++reg_index;
+  }
+}
+
 void Modbus_handler::processor_map(const Processor& processor,
     int reg_index, const int count, response::read_input_registers& resp) {
   for (int i = 0; i < count; ++i) {
@@ -138,6 +152,9 @@ response::read_input_registers Modbus_handler::handle(uint8_t unit_id, const req
     if (req.address >= plain_base_address) {
       plain_map(device, req.address - plain_base_address, req.count, resp);
     }
+    else if (req.address >= link_base_address) {
+      link_map(device, req.address - link_base_address, req.count, resp);
+    }
     // Cast to swallow compiler warning
     else {
       base_map(device, req.address, req.count, resp);
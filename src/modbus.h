@@ -39,6 +39,7 @@ struct Modbus_handler: public modbus::Default_handler {
 private:
   void plain_map(const Device& device, int reg_index, int count, modbus::response::read_input_registers& resp);
   void base_map(const Device& device, int reg_index, int count, modbus::response::read_input_registers& resp);
+  void link_map(const Device& device, int reg_index, int count, modbus::response::read_input_registers& resp);
   void processor_map(const Processor& processor, 
       int reg_index, int count, modbus::response::read_input_registers& resp);
   const Devices& devices_;
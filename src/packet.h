@@ -0,0 +1,407 @@
+/**
+ * \file packet.h
+ * \brief Provide parsers generated from descriptions of binary protocols
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PACKET_H_
+#define PACKET_H_
+
+#include "parser.h"
+#include "types.h"
+#include "quantities.h"
+
+#include <array>
+#include <tuple>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+#include <boost/endian/conversion.hpp>
+
+/**
+ * Description of binary protocols
+ *
+ * A protocol is described at compile time by its framing: sync bytes, a
+ * header holding the payload length and the message id, and a checksum
+ * over header and payload following the payload. Messages are described by
+ * constexpr objects listing the payload fields holding quantities, e.g.
+ * \code
+ * using Framing = packet::Framing<packet::Sync<0xb5, 0x62>, 4,
+ *     packet::Header_field<2, uint16_t>,  // Length
+ *     packet::Header_field<0, uint16_t, packet::Endian::big>,  // Class and id
+ *     packet::Fletcher8>;
+ * inline constexpr auto position = packet::message(uint16_t(0x0102), 28,
+ *     packet::field<int32_t>(4, Quantity::lo, 1E-7 * M_PI / 180.0),
+ *     packet::field<int32_t>(8, Quantity::la, 1E-7 * M_PI / 180.0));
+ * using Position_parser = packet::Parser<Framing, position>;
+ * \endcode
+ * Offsets, types and scales are compile time constants of the generated
+ * parser.
+ */
+namespace packet {
+
+enum class Endian {
+  little,
+  big
+};
+
+
+//! Read a value of type T with endianness E from data
+template <typename T, Endian E = Endian::little>
+inline T get(const uint8_t* data) {
+  static_assert(std::is_arithmetic<T>::value, "Fields have to be numbers");
+  if constexpr (std::is_floating_point<T>::value) {
+    using Raw = std::conditional_t<sizeof(T) == 8, uint64_t, uint32_t>;
+    Raw raw = get<Raw, E>(data);
+    T result;
+    std::memcpy(&result, &raw, sizeof(result));
+    return result;
+  }
+  else {
+    T result;
+    std::memcpy(&result, data, sizeof(result));
+    return E == Endian::little ? boost::endian::little_to_native(result) : boost::endian::big_to_native(result);
+  }
+}
+
+
+//! Bytes starting a frame
+template <uint8_t... Bytes>
+struct Sync {
+  static constexpr size_t size = sizeof...(Bytes);
+  static constexpr std::array<uint8_t, size> bytes = { Bytes... };
+  static_assert(size > 0, "A frame needs at least one sync byte");
+};
+
+
+//! Field at Offset in the header, counting from the end of the sync bytes
+template <size_t Offset, typename T, Endian E = Endian::little>
+struct Header_field {
+  using type = T;
+  static constexpr size_t end = Offset + sizeof(T);
+
+  static T read(const uint8_t* header) {
+    return get<T, E>(header + Offset);
+  }
+};
+
+
+//! Frames without checksum
+struct No_checksum {
+  static constexpr size_t size = 0;
+  void add(const uint8_t*, const uint8_t*) {}
+  bool check(const uint8_t*) const {
+    return true;
+  }
+};
+
+
+//! 8-bit Fletcher checksum of two bytes, e.g. of u-blox UBX
+struct Fletcher8 {
+  static constexpr size_t size = 2;
+  uint8_t a = 0;
+  uint8_t b = 0;
+
+  void add(const uint8_t* begin, const uint8_t* end) {
+    for (const uint8_t* c = begin; c < end; ++c) {
+      a += *c;
+      b += a;
+    }
+  }
+
+  bool check(const uint8_t* checksum) const {
+    return checksum[0] == a && checksum[1] == b;
+  }
+};
+
+
+//! Exclusive or of all bytes
+struct Xor8 {
+  static constexpr size_t size = 1;
+  uint8_t x = 0;
+
+  void add(const uint8_t* begin, const uint8_t* end) {
+    for (const uint8_t* c = begin; c < end; ++c) {
+      x ^= *c;
+    }
+  }
+
+  bool check(const uint8_t* checksum) const {
+    return checksum[0] == x;
+  }
+};
+
+
+//! Checksum byte making the 8-bit sum of all bytes 0, e.g. of Xsens
+struct Sum8 {
+  static constexpr size_t size = 1;
+  uint8_t sum = 0;
+
+  void add(const uint8_t* begin, const uint8_t* end) {
+    for (const uint8_t* c = begin; c < end; ++c) {
+      sum += *c;
+    }
+  }
+
+  bool check(const uint8_t* checksum) const {
+    return static_cast<uint8_t>(sum + checksum[0]) == 0;
+  }
+};
+
+
+/**
+ * Framing of a protocol
+ *
+ * Frames are the sync bytes, a header of HeaderSize bytes with the payload
+ * length in LengthField and the message id in IdField, the payload and the
+ * checksum of header and payload. Larger lengths are taken to be corrupt.
+ */
+template <typename SyncBytes, size_t HeaderSize, typename LengthField, typename IdField,
+    typename Checksum, size_t MaxPayloadSize = 0x800>
+struct Framing {
+  using sync = SyncBytes;
+  using length_field = LengthField;
+  using id_field = IdField;
+  using id_type = typename IdField::type;
+  using checksum = Checksum;
+  static constexpr size_t header_size = HeaderSize;
+  static constexpr size_t max_payload_size = MaxPayloadSize;
+  //! Frame size besides the payload
+  static constexpr size_t overhead = sync::size + header_size + checksum::size;
+
+  static_assert(LengthField::end <= HeaderSize, "Length field beyond the header");
+  static_assert(IdField::end <= HeaderSize, "Id field beyond the header");
+};
+
+
+/**
+ * Condition on a payload byte for adding a field
+ *
+ * Holds when the byte at offset, masked, is in [min, max], or always when
+ * the mask is 0.
+ */
+struct Condition {
+  size_t offset;
+  uint8_t mask;
+  uint8_t min;
+  uint8_t max;
+
+  constexpr bool test(const uint8_t* payload) const {
+    return mask == 0
+        || ((payload[offset] & mask) >= min && (payload[offset] & mask) <= max);
+  }
+
+  //! Minimum payload size for testing
+  constexpr size_t end() const {
+    return mask == 0 ? 0 : offset + 1;
+  }
+};
+
+constexpr Condition always = { 0, 0, 0, 0 };
+
+//! All bits of mask set in the byte at offset
+constexpr Condition bits_set(const size_t offset, const uint8_t mask) {
+  return { offset, mask, mask, mask };
+}
+
+//! Byte at offset in [min, max]
+constexpr Condition in_range(const size_t offset, const uint8_t min, const uint8_t max) {
+  return { offset, 0xff, min, max };
+}
+
+
+/**
+ * Payload field of type T holding quantity
+ *
+ * Adds the value multiplied by scale when condition holds.
+ */
+template <typename T, Endian E = Endian::little>
+struct Field {
+  size_t offset;
+  Quantity quantity;
+  double scale;
+  Condition condition;
+
+  constexpr size_t end() const {
+    return std::max(offset + sizeof(T), condition.end());
+  }
+
+  void add_values(const uint8_t* payload, const double stamp, Stamped_quantities& values) const {
+    if (condition.test(payload)) {
+      values.push_back({ get<T, E>(payload + offset) * scale, stamp, quantity });
+    }
+  }
+};
+
+template <typename T, Endian E = Endian::little>
+constexpr Field<T, E> field(const size_t offset, const Quantity quantity, const double scale = 1.0,
+    const Condition condition = always) {
+  return { offset, quantity, scale, condition };
+}
+
+
+/**
+ * Message with id and fields
+ *
+ * Fields are Field or any other type with end() and add_values(), for
+ * values that aren't a scaled number, e.g. a date and time. The payload
+ * has to be size bytes, or when size is 0, at least hold all fields.
+ */
+template <typename Id, typename... Fields>
+struct Message {
+  Id id;
+  size_t size;
+  std::tuple<Fields...> fields;
+
+  //! Size of the payload holding all fields
+  constexpr size_t get_min_size() const {
+    return std::apply([](const Fields&... f) {
+        size_t result = 0;
+        ((result = std::max(result, f.end())), ...);
+        return result;
+      }, fields);
+  }
+
+  bool decode(const uint8_t* payload, const size_t payload_size, const double stamp,
+      Stamped_quantities& values) const {
+    if (size != 0 ? payload_size != size : payload_size < get_min_size()) {
+      return false;
+    }
+    std::apply([&](const Fields&... f) { (f.add_values(payload, stamp, values), ...); }, fields);
+    return true;
+  }
+};
+
+template <typename Id, typename... Fields>
+constexpr Message<Id, Fields...> message(const Id id, const size_t size, const Fields&... fields) {
+  return { id, size, std::tuple<Fields...>(fields...) };
+}
+
+
+/**
+ * Parser for frames of Framing decoding Messages
+ *
+ * Messages are references to constexpr message descriptions. Frames are
+ * decoded in place in the buffer; a partial frame is kept until the rest
+ * arrives, so parsing doesn't allocate once the buffer has grown to the
+ * size of the chunks received. Frames of other messages are checked and
+ * skipped.
+ */
+template <typename Framing, const auto&... Messages>
+struct Parser: public Packet_parser<Contiguous_buffer> {
+  using id_type = typename Framing::id_type;
+
+  static_assert(((Messages.size == 0 || Messages.get_min_size() <= Messages.size) && ...),
+      "Message field beyond the payload");
+
+  Parser(): Packet_parser(), values_(), statistics_() {}
+
+  void parse(const double& stamp) override {
+    constexpr size_t sync_size = Framing::sync::size;
+    constexpr size_t header_size = Framing::header_size;
+    const uint8_t* data = buffer.begin();
+    const uint8_t* end = buffer.end();
+    // Bytes skipped since the last frame
+    size_t junk = 0;
+    while (true) {
+      const uint8_t* start = find_sync(data, end);
+      junk += start - data;
+      data = start;
+      if (static_cast<size_t>(end - data) < sync_size + header_size) {
+        break;
+      }
+      const uint8_t* header = data + sync_size;
+      size_t length = Framing::length_field::read(header);
+      if (length > Framing::max_payload_size) {
+        // Not the start of a frame after all
+        ++junk;
+        ++data;
+        continue;
+      }
+      if (static_cast<size_t>(end - data) < Framing::overhead + length) {
+        break;
+      }
+      end_junk(junk);
+      const uint8_t* payload = header + header_size;
+      typename Framing::checksum checksum;
+      checksum.add(header, payload + length);
+      if (checksum.check(payload + length)) {
+        ++statistics_.packets;
+        decode(Framing::id_field::read(header), payload, length, stamp);
+        data += Framing::overhead + length;
+      }
+      else {
+        // Maybe a false sync: a frame may start within this one
+        ++statistics_.checksum_errors;
+        ++junk;
+        ++data;
+      }
+    }
+    end_junk(junk);
+    buffer.erase(buffer.begin(), data);
+    cur = buffer.begin();
+  }
+
+  Stamped_quantities& get_values() override {
+    return values_;
+  }
+
+  const Link_statistics& get_statistics() const {
+    return statistics_;
+  }
+
+private:
+  Stamped_quantities values_;
+  Link_statistics statistics_;
+
+  //! Return start of the first, possibly partial, sync in [data, end)
+  static const uint8_t* find_sync(const uint8_t* data, const uint8_t* end) {
+    constexpr auto& sync = Framing::sync::bytes;
+    while (true) {
+      data = std::find(data, end, sync[0]);
+      if (data == end) {
+        return end;
+      }
+      size_t size = std::min(sync.size(), static_cast<size_t>(end - data));
+      if (std::equal(sync.begin() + 1, sync.begin() + size, data + 1)) {
+        return data;
+      }
+      ++data;
+    }
+  }
+
+  void end_junk(size_t& junk) {
+    if (junk > 0) {
+      statistics_.junk_bytes += junk;
+      ++statistics_.resyncs;
+      junk = 0;
+    }
+  }
+
+  void decode(const id_type id, const uint8_t* payload, const size_t size, const double stamp) {
+    (void)((id == Messages.id && Messages.decode(payload, size, stamp, values_)) || ...);
+  }
+};
+
+}  // namespace packet
+
+#endif  // ifndef PACKET_H_
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -32,7 +32,9 @@
 #include <ios>
 #include <ostream>
 #include <deque>
+#include <vector>
 #include <iterator>
+#include <algorithm>
 
 namespace x3 = boost::spirit::x3;
 
@@ -40,6 +42,72 @@ using Quantity_values = std::vector<Quantity_value>;
 using Stamped_quantities = std::vector<Stamped_quantity>;
 using Stamped_queue = std::deque<Stamped_quantity>;
 
+/**
+ * Contiguous byte buffer for parsing packets in place
+ *
+ * Data is appended at the end and consumed from the front, so buffered
+ * packets can be decoded from a pointer range without copying them out.
+ * Consuming only advances the start of the data; what remains is moved to
+ * the front of the storage when an append would not fit behind it. Only
+ * the partial packet at the end of a chunk is ever moved. Supports the
+ * subset of the std::deque interface used by Packet_parser: insert only at
+ * end() and erase only from begin().
+ */
+struct Contiguous_buffer {
+  using value_type = uint8_t;
+  using iterator = uint8_t*;
+  using const_iterator = const uint8_t*;
+
+  Contiguous_buffer(): storage_(), begin_(0), end_(0) {}
+
+  iterator begin() { return storage_.data() + begin_; }
+  iterator end() { return storage_.data() + end_; }
+  const_iterator begin() const { return storage_.data() + begin_; }
+  const_iterator end() const { return storage_.data() + end_; }
+  size_t size() const { return end_ - begin_; }
+  bool empty() const { return begin_ == end_; }
+
+  void clear() {
+    begin_ = 0;
+    end_ = 0;
+  }
+
+  //! Append data, pos has to be end()
+  template <typename Iterator>
+  iterator insert(const_iterator pos, Iterator first, Iterator last) {
+    (void)pos;
+    size_t count = std::distance(first, last);
+    if (end_ + count > storage_.size()) {
+      std::copy(begin(), end(), storage_.data());
+      end_ -= begin_;
+      begin_ = 0;
+      if (end_ + count > storage_.size()) {
+        storage_.resize(std::max(end_ + count, 2 * storage_.size()));
+      }
+    }
+    iterator result = end();
+    std::copy(first, last, result);
+    end_ += count;
+    return result;
+  }
+
+  //! Consume data, first has to be begin()
+  iterator erase(const_iterator first, const_iterator last) {
+    (void)first;
+    begin_ = last - storage_.data();
+    if (begin_ == end_) {
+      clear();
+    }
+    return begin();
+  }
+
+private:
+  std::vector<uint8_t> storage_;
+  size_t begin_;
+  size_t end_;
+};
+
+
 template<typename BufferType = std::deque<uint8_t> >
 struct Packet_parser {
   Packet_parser(): buffer(), cur(buffer.begin()) {}
@@ -59,7 +127,12 @@ struct Packet_parser {
     parse(stamp);
   }
   virtual void parse(const double& stamp) = 0;
-  virtual Stamped_queue& get_values() = 0;
+  /**
+   * Return parsed values
+   *
+   * The container is reused: clear it after consuming the values
+   */
+  virtual Stamped_quantities& get_values() = 0;
 };
 
 #endif  // ifndef PARSER_H_
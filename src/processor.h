@@ -42,6 +42,28 @@ struct Processor {
   virtual void insert_value(const Stamped_quantity&) {
   }
 
+  /**
+   * Insert a batch of samples
+   *
+   * Override for processors that can handle batches more efficiently than
+   * one sample at a time
+   */
+  virtual void insert_values(Stamped_span values) {
+    for (auto& value: values) {
+      insert_value(value);
+    }
+  }
+
+  /**
+   * Return the quantities this processor wants to receive
+   *
+   * Devices only pass samples of these quantities to the processor. The
+   * subscription is read once, when the processor is added to a device.
+   */
+  virtual Quantity_set get_subscription() const {
+    return Quantity_set().set();
+  }
+
   virtual double operator[](size_t) {
     return 0;
   }
@@ -81,26 +81,23 @@ struct Acceleration_history: public Processor {
 
 
   void insert_value(const Stamped_quantity& value) override {
-    if ((direction_ & x_dir) && (value.quantity == Quantity::fax)) {
-      if (fax_.stamp != 0) {
-        handle_value();
-      } 
-      fax_ = value;
-    } 
-    else if ((direction_ & y_dir) && (value.quantity == Quantity::fay)) {
-      if (fay_.stamp != 0) {
-        handle_value();
-      }
-      fay_ = value;
-    }
-    else if ((direction_ & z_dir) && (value.quantity == Quantity::faz)) {
-      if (faz_.stamp != 0) {
-        handle_value();
-      }
-      faz_ = value;
+    insert(value);
+  }
+
+  void insert_values(Stamped_span values) override {
+    for (auto& value: values) {
+      insert(value);
     }
   }
 
+  Quantity_set get_subscription() const override {
+    Quantity_set result;
+    result.set(static_cast<size_t>(Quantity::fax), (direction_ & x_dir) != 0);
+    result.set(static_cast<size_t>(Quantity::fay), (direction_ & y_dir) != 0);
+    result.set(static_cast<size_t>(Quantity::faz), (direction_ & z_dir) != 0);
+    return result;
+  }
+
   double operator[](const size_t index) override {
     size_t i = index / Acceleration_peak::size();
     size_t m = index % Acceleration_peak::size();
@@ -137,6 +134,27 @@ struct Acceleration_history: public Processor {
   }
 
 private:
+  void insert(const Stamped_quantity& value) {
+    if ((direction_ & x_dir) && (value.quantity == Quantity::fax)) {
+      if (fax_.stamp != 0) {
+        handle_value();
+      } 
+      fax_ = value;
+    } 
+    else if ((direction_ & y_dir) && (value.quantity == Quantity::fay)) {
+      if (fay_.stamp != 0) {
+        handle_value();
+      }
+      fay_ = value;
+    }
+    else if ((direction_ & z_dir) && (value.quantity == Quantity::faz)) {
+      if (faz_.stamp != 0) {
+        handle_value();
+      }
+      faz_ = value;
+    }
+  }
+
   void handle_value() {
     double amp = 0;
     double sqamp = 0;
@@ -62,6 +62,10 @@ struct Fusion: public Processor {
   void insert_value(const Stamped_quantity&) override {
   }
 
+  Quantity_set get_subscription() const override {
+    return Quantity_set();
+  }
+
   double operator[](size_t) override {
     return 0.0;
   }
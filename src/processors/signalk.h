@@ -48,6 +48,20 @@ struct SignalK_pusher: public Port_processor<tcp_server,ContextProvider> {
     log(level::debug, get_json());
   }
 
+  void insert_values(Stamped_span values) override {
+    // Collect deltas of the complete batch and send them at once
+    std::string deltas;
+    for (auto& q: values) {
+      if (signalk_converter_.produces_delta(q)) {
+        deltas += signalk_converter_.get_delta(q) + "\n";
+      }
+    }
+    if (!deltas.empty()) {
+      this->get_port().send(deltas);
+    }
+    log(level::debug, get_json());
+  }
+
   double operator[](size_t) override {
     return 0.0;
   }
@@ -69,10 +69,61 @@ struct Statistics: public Processor {
   Statistics(): Processor(), data_(), statistics_(), period_(1.0), filter_() {}
 
   void insert_value(const Stamped_quantity& value) override {
+    insert(value);
+  }
+
+  void insert_values(Stamped_span values) override {
+    for (auto& value: values) {
+      insert(value);
+    }
+  }
+
+  //! Subscribe to the quantities in the filter, or to all quantities when there is no filter
+  Quantity_set get_subscription() const override {
+    return filter_.any() ? filter_ : Quantity_set().set();
+  }
+
+  double operator[](size_t index) override {
+    size_t q = index / Statistic::size();
+    size_t m = index % Statistic::size();
+    auto qit = statistics_.find(static_cast<Quantity>(q));
+    if (qit == statistics_.end())
+      return 0;
+    return qit->second[m];
+  }
+
+  std::string get_json() const override;
+  uint16_t get_modbus_reg(size_t index, const Base_scale& scaler) const override;
+
+  size_t size() override {
+    return Statistic::size() * static_cast<size_t>(Quantity::end);
+  }
+
+  void set_param(const std::string& name, const double& value) override { 
+    if (name == "period") {
+      period_ = value;
+      log(level::info, "Set period to % for %", value, get_name());
+    }
+  }
+
+  void set_filter(const std::string& filter) override {
+    std::vector<std::string> quantities;
+    log(level::info, "Set filter to % for %", filter, get_name());
+    boost::split(quantities, filter, [](const char c) { return c == ','; });
+    for (auto& quantity_str: quantities) {
+      Quantity quantity = get_quantity(quantity_str);
+      if (quantity != Quantity::end)
+        filter_.set(static_cast<size_t>(quantity));
+    }
+  }
+
+private:
+  void insert(const Stamped_quantity& value) {
     Quantity quantity = value.quantity;
 
-    if (!filter_.empty() && filter_.find(quantity) == filter_.end())
-      // We have a filter and it doesn't contain quantity: ignore this value
+    if (filter_.any() && !filter_.test(static_cast<size_t>(quantity)))
+      // We have a filter and it doesn't contain quantity: ignore this value,
+      // e.g. when the filter was set after subscribing
       return;
 
     auto item = data_.try_emplace(quantity);
@@ -139,45 +190,10 @@ struct Statistics: public Processor {
     stat.time = value.stamp;
   }
 
-  double operator[](size_t index) override {
-    size_t q = index / Statistic::size();
-    size_t m = index % Statistic::size();
-    auto qit = statistics_.find(static_cast<Quantity>(q));
-    if (qit == statistics_.end())
-      return 0;
-    return qit->second[m];
-  }
-
-  std::string get_json() const override;
-  uint16_t get_modbus_reg(size_t index, const Base_scale& scaler) const override;
-
-  size_t size() override {
-    return Statistic::size() * static_cast<size_t>(Quantity::end);
-  }
-
-  void set_param(const std::string& name, const double& value) override { 
-    if (name == "period") {
-      period_ = value;
-      log(level::info, "Set period to % for %", value, get_name());
-    }
-  }
-
-  void set_filter(const std::string& filter) override {
-    std::vector<std::string> quantities;
-    log(level::info, "Set filter to % for %", filter, get_name());
-    boost::split(quantities, filter, [](const char c) { return c == ','; });
-    for (auto& quantity_str: quantities) {
-      Quantity quantity = get_quantity(quantity_str);
-      if (quantity != Quantity::end)
-        filter_.insert(quantity );
-    }
-  }
-
-private:
-  Data_list_map data_;
+  Data_map data_;
   Statistic_map statistics_;
   double period_;
-  std::set<Quantity> filter_;
+  Quantity_set filter_;
 };
 
 #endif
@@ -35,6 +35,10 @@ struct Tcp_pusher: public Processor {
   void insert_value(const Stamped_quantity&) override {
   }
 
+  Quantity_set get_subscription() const override {
+    return Quantity_set();
+  }
+
   double operator[](size_t) override {
     return 0.0;
   }
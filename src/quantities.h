@@ -32,6 +32,7 @@
 #include <map>
 #include <deque>
 #include <list>
+#include <bitset>
 
  // As long as <boost/bind.hpp> is still used within boost itself, ignore
  // hints about deprecated global placeholders
@@ -240,6 +241,9 @@ constexpr auto q_end = static_cast<Quantity_type>(Quantity::end);
 using Quantity_sequence = std::make_integer_sequence<Quantity_type, q_end>;
 constexpr auto quantity_sequence = Quantity_sequence();
 
+//! Set of quantities, e.g. the quantities a processor subscribes to
+using Quantity_set = std::bitset<q_end>;
+
 
 template <typename T>
 constexpr inline const char* get_quantity_name_impl(Quantity) {
@@ -410,11 +414,29 @@ struct Stamped_quantity: public Stamped_value, Data_quantity {
 };
 
 
+//! View of a contiguous batch of samples
+using Stamped_span = Span<const Stamped_quantity>;
+
 using Data_queue = std::deque<Stamped_value>;
 using Data_map = std::map<Quantity, Data_queue>;
 using Data_list = std::list<Stamped_value>;
 using Data_list_map = std::map<Quantity, Data_list>;
 
+//! Values of angles wrap around, see value_norm and value_diff
+inline bool is_angle(Quantity quantity) {
+  switch (quantity) {
+    case Quantity::lo:
+    case Quantity::hdg:
+    case Quantity::crs:
+    case Quantity::ro:
+    case Quantity::pi:
+    case Quantity::ya:
+      return true;
+    default:
+      return false;
+  }
+}
+
 inline double value_norm(Quantity quantity, double value) {
   switch (quantity) {
     case Quantity::lo:
@@ -0,0 +1,263 @@
+/**
+ * \file replay.h
+ * \brief Provide port replaying recorded device data
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include "types.h"
+#include "log.h"
+#include "device_log.h"
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+
+//! Scripted response to a command written to a replay port
+struct Replay_response {
+  //! Start of the command
+  bytes_t command;
+  bytes_t response;
+};
+
+using Replay_script = std::vector<Replay_response>;
+
+
+/**
+ * Port replaying a raw capture or a plain binary dump of device data
+ *
+ * The connection string is the path of the file, optionally followed by
+ * ":<speed>". Chunks of a raw capture are delivered with their original
+ * timing divided by speed. A speed of 0 delivers the data as fast as it is
+ * read. Plain dumps are delivered in chunks of plain_chunk_size bytes at
+ * the rate of a 115200 baud serial line. Commands written to the port are
+ * answered with the response of the first script entry the command starts
+ * with, ahead of the replayed data. Other commands are ignored. The read
+ * after the last chunk fails with end of file.
+ */
+struct Replay_port {
+  using executor_type = boost::asio::io_context::executor_type;
+
+  explicit Replay_port(boost::asio::io_context& context)
+    : context_(context), timer_(context), script_(), chunks_(), next_(0), offset_(0),
+      responses_(), speed_(1), start_(), first_stamp_(0), open_(false) {}
+
+  void open(const std::string& connection_string) {
+    std::string path = connection_string;
+    speed_ = 1;
+    auto colon = connection_string.rfind(':');
+    if (colon != std::string::npos && colon + 1 < connection_string.size()) {
+      try {
+        size_t len = 0;
+        double speed = std::stod(connection_string.substr(colon + 1), &len);
+        if (len == connection_string.size() - colon - 1) {
+          speed_ = speed;
+          path = connection_string.substr(0, colon);
+        }
+      }
+      catch (std::exception&) {
+        // Not a speed, but part of the path
+      }
+    }
+    if (speed_ < 0) {
+      throw std::invalid_argument(fmt::format("Invalid replay speed: {}", speed_));
+    }
+    load(path);
+    log(level::info, "Replaying % chunks from % at speed %", chunks_.size(), path, speed_);
+    next_ = 0;
+    offset_ = 0;
+    responses_.clear();
+    start_ = std::chrono::steady_clock::now();
+    first_stamp_ = chunks_.empty() ? 0 : chunks_.front().stamp;
+    open_ = true;
+  }
+
+  void close() {
+    cancel();
+    chunks_.clear();
+    responses_.clear();
+    open_ = false;
+  }
+
+  bool is_open() const {
+    return open_;
+  }
+
+  void cancel() {
+    timer_.cancel();
+  }
+
+  executor_type get_executor() {
+    return context_.get_executor();
+  }
+
+  void set_script(const Replay_script& script) {
+    script_ = script;
+  }
+
+  template <typename MutableBufferSequence, typename ReadHandler>
+  auto async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler) {
+    return boost::asio::async_initiate<ReadHandler, void(boost::system::error_code, size_t)>(
+        [this](auto&& handler, const MutableBufferSequence& buffers) {
+          start_read(buffers, std::move(handler));
+        },
+        handler, buffers);
+  }
+
+  template <typename ConstBufferSequence, typename WriteHandler>
+  auto async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler) {
+    return boost::asio::async_initiate<WriteHandler, void(boost::system::error_code, size_t)>(
+        [this](auto&& handler, const ConstBufferSequence& buffers) {
+          bytes_t command(boost::asio::buffers_begin(buffers), boost::asio::buffers_end(buffers));
+          respond(command);
+          boost::asio::post(context_,
+              [handler = std::move(handler), size = command.size()]() mutable {
+                handler(boost::system::error_code(), size);
+              });
+        },
+        handler, buffers);
+  }
+
+  static constexpr size_t plain_chunk_size = 0x200;
+  static constexpr double plain_bytes_per_second = 11520;
+
+private:
+  struct Chunk {
+    double stamp;
+    bytes_t data;
+  };
+
+  boost::asio::io_context& context_;
+  boost::asio::steady_timer timer_;
+  Replay_script script_;
+  std::vector<Chunk> chunks_;
+  size_t next_;
+  //! Offset into the next chunk when a read took only part of it
+  size_t offset_;
+  std::deque<byte_t> responses_;
+  double speed_;
+  std::chrono::steady_clock::time_point start_;
+  double first_stamp_;
+  bool open_;
+
+  void load(const std::string& path) {
+    std::ifstream in(path, std::ios_base::binary);
+    if (!in) {
+      throw std::runtime_error(fmt::format("Failed to open {}", path));
+    }
+    chunks_.clear();
+    char magic[sizeof(device_log::capture_magic)];
+    bool is_capture = in.read(magic, sizeof(magic))
+        && std::equal(magic, magic + sizeof(magic), device_log::capture_magic);
+    in.clear();
+    in.seekg(0);
+    if (is_capture) {
+      Raw_capture_reader reader(in);
+      double stamp;
+      std::vector<char> data;
+      while (reader.read(stamp, data)) {
+        chunks_.push_back(Chunk{stamp, bytes_t(data.begin(), data.end())});
+      }
+    }
+    else {
+      bytes_t data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+      for (size_t i = 0; i < data.size(); i += plain_chunk_size) {
+        size_t size = std::min(plain_chunk_size, data.size() - i);
+        chunks_.push_back(Chunk{i / plain_bytes_per_second,
+            bytes_t(data.begin() + i, data.begin() + i + size)});
+      }
+    }
+  }
+
+  void respond(cbytes_t& command) {
+    for (auto& entry: script_) {
+      if (command.size() >= entry.command.size()
+          && std::equal(entry.command.begin(), entry.command.end(), command.begin())) {
+        responses_.insert(responses_.end(), entry.response.begin(), entry.response.end());
+        return;
+      }
+    }
+  }
+
+  template <typename MutableBufferSequence, typename Handler>
+  void start_read(const MutableBufferSequence& buffers, Handler&& handler) {
+    if (!responses_.empty() || offset_ > 0 || next_ >= chunks_.size() || speed_ == 0) {
+      complete_read(buffers, std::move(handler));
+      return;
+    }
+    auto due = start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>((chunks_[next_].stamp - first_stamp_) / speed_));
+    timer_.expires_at(due);
+    timer_.async_wait(
+        [this, buffers, handler = std::move(handler)](const boost::system::error_code& ec) mutable {
+          if (ec) {
+            handler(boost::asio::error::operation_aborted, 0);
+          }
+          else {
+            complete_read(buffers, std::move(handler));
+          }
+        });
+  }
+
+  //! Copy pending responses or the next chunk into buffers and post the handler
+  template <typename MutableBufferSequence, typename Handler>
+  void complete_read(const MutableBufferSequence& buffers, Handler&& handler) {
+    boost::system::error_code ec;
+    size_t size = 0;
+    auto out = boost::asio::buffers_begin(buffers);
+    size_t capacity = boost::asio::buffer_size(buffers);
+    if (!responses_.empty()) {
+      size = std::min(capacity, responses_.size());
+      std::copy(responses_.begin(), responses_.begin() + size, out);
+      responses_.erase(responses_.begin(), responses_.begin() + size);
+    }
+    else if (next_ < chunks_.size()) {
+      auto& data = chunks_[next_].data;
+      size = std::min(capacity, data.size() - offset_);
+      std::copy(data.begin() + offset_, data.begin() + offset_ + size, out);
+      offset_ += size;
+      if (offset_ >= data.size()) {
+        offset_ = 0;
+        ++next_;
+      }
+    }
+    else {
+      ec = boost::asio::error::eof;
+    }
+    boost::asio::post(context_,
+        [handler = std::move(handler), ec, size]() mutable {
+          handler(ec, size);
+        });
+  }
+};
+
+
+#endif  // REPLAY_H_
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2 filetype=cpp
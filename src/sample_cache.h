@@ -0,0 +1,481 @@
+/**
+ * \file sample_cache.h
+ * \brief Provide per quantity ring buffers for caching device samples
+ *
+ * \author J.R. Versteegh <j.r.versteegh@orca-st.com>
+ * \copyright
+ * Copyright (C) 2019 Damen Shipyards
+ * \license
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SAMPLE_CACHE_H_
+#define SAMPLE_CACHE_H_
+
+#include "quantities.h"
+
+#include <array>
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+#include <boost/algorithm/string.hpp>
+
+
+//! Default maximum number of samples cached per quantity
+constexpr size_t default_cache_size = 0x0040000;
+//! Default maximum age in seconds of samples cached per quantity
+constexpr double default_cache_age = 3600.0;
+
+
+/**
+ * Ring buffer of stamped items
+ *
+ * Stamps and items are kept in separate arrays. Storage grows by doubling
+ * until the capacity is reached, after which inserting never allocates: the
+ * oldest item is overwritten. Indexing is relative to the oldest item.
+ */
+template <typename T>
+struct Ring_buffer {
+
+  Ring_buffer(): stamps_(), values_(), allocated_(0), head_(0), size_(0),
+                 capacity_(default_cache_size), max_age_(default_cache_age) {}
+
+  Ring_buffer(const Ring_buffer&) = delete;
+  Ring_buffer& operator=(const Ring_buffer&) = delete;
+  Ring_buffer(Ring_buffer&&) = default;
+  Ring_buffer& operator=(Ring_buffer&&) = default;
+
+
+  void push_back(const double stamp, const T& value) {
+    if (size_ == allocated_ && allocated_ < capacity_) {
+      grow();
+    }
+    if (allocated_ == 0) {
+      return;
+    }
+    size_t tail = wrap(head_ + size_);
+    stamps_[tail] = stamp;
+    values_[tail] = value;
+    if (size_ < allocated_) {
+      ++size_;
+    }
+    else {
+      head_ = wrap(head_ + 1);
+    }
+    // Drop items that exceed maximum age
+    while (size_ > 1 && stamp - stamps_[head_] > max_age_) {
+      head_ = wrap(head_ + 1);
+      --size_;
+    }
+  }
+
+
+  double stamp(const size_t index) const {
+    return stamps_[wrap(head_ + index)];
+  }
+
+
+  const T& value(const size_t index) const {
+    return values_[wrap(head_ + index)];
+  }
+
+
+  /**
+   * Return index of first item with a stamp not before the given stamp
+   *
+   * Performs a binary search, which relies on stamps being inserted in
+   * increasing order. Returns size() when no such item exists.
+   */
+  size_t lower_bound(const double stamp) const {
+    size_t first = 0;
+    size_t count = size_;
+    while (count > 0) {
+      size_t step = count / 2;
+      if (this->stamp(first + step) < stamp) {
+        first += step + 1;
+        count -= step + 1;
+      }
+      else {
+        count = step;
+      }
+    }
+    return first;
+  }
+
+
+  //! Return index of first item with a stamp after the given stamp
+  size_t upper_bound(const double stamp) const {
+    size_t first = 0;
+    size_t count = size_;
+    while (count > 0) {
+      size_t step = count / 2;
+      if (!(stamp < this->stamp(first + step))) {
+        first += step + 1;
+        count -= step + 1;
+      }
+      else {
+        count = step;
+      }
+    }
+    return first;
+  }
+
+
+  size_t size() const {
+    return size_;
+  }
+
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+
+  void clear() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+
+  size_t get_capacity() const {
+    return capacity_;
+  }
+
+
+  /**
+   * Set maximum number of items
+   *
+   * Reduces storage when currently allocated storage exceeds the new capacity,
+   * keeping the most recent items.
+   */
+  void set_capacity(const size_t capacity) {
+    capacity_ = capacity;
+    if (allocated_ > capacity_) {
+      reallocate(capacity_);
+    }
+  }
+
+
+  double get_max_age() const {
+    return max_age_;
+  }
+
+
+  void set_max_age(const double max_age) {
+    max_age_ = max_age;
+  }
+
+
+  //! Return number of bytes allocated for item storage
+  size_t get_memory_size() const {
+    return allocated_ * (sizeof(double) + sizeof(T));
+  }
+
+private:
+  std::unique_ptr<double[]> stamps_;
+  std::unique_ptr<T[]> values_;
+  size_t allocated_;
+  size_t head_;
+  size_t size_;
+  size_t capacity_;
+  double max_age_;
+
+  size_t wrap(const size_t index) const {
+    return index < allocated_ ? index : index - allocated_;
+  }
+
+  void grow() {
+    reallocate(std::min(std::max(allocated_ * 2, size_t{16}), capacity_));
+  }
+
+  void reallocate(const size_t allocated) {
+    size_t keep = std::min(size_, allocated);
+    auto stamps = std::make_unique<double[]>(allocated);
+    auto values = std::make_unique<T[]>(allocated);
+    for (size_t i = 0; i < keep; ++i) {
+      size_t j = wrap(head_ + size_ - keep + i);
+      stamps[i] = stamps_[j];
+      values[i] = values_[j];
+    }
+    stamps_ = std::move(stamps);
+    values_ = std::move(values);
+    allocated_ = allocated;
+    head_ = 0;
+    size_ = keep;
+  }
+};
+
+
+/**
+ * Ring buffer of stamped values for a single quantity
+ */
+struct Sample_buffer: public Ring_buffer<Value_type> {
+  using Ring_buffer<Value_type>::push_back;
+
+
+  void push_back(const Stamped_value& sample) {
+    push_back(sample.stamp, sample.value);
+  }
+
+
+  Stamped_value operator[](const size_t index) const {
+    return Stamped_value(value(index), stamp(index));
+  }
+
+
+  Stamped_value front() const {
+    return (*this)[0];
+  }
+
+
+  Stamped_value back() const {
+    return (*this)[size() - 1];
+  }
+};
+
+
+//! Mean, minimum and maximum of the samples of a quantity in an interval
+struct Aggregate {
+  Value_type mean;
+  Value_type min;
+  Value_type max;
+};
+
+
+using Aggregate_buffer = Ring_buffer<Aggregate>;
+
+
+/**
+ * Aggregates of a single quantity over fixed intervals
+ *
+ * Samples are accumulated incrementally into the aggregate of the current
+ * interval, which is added to the buffer once a sample of a later interval
+ * arrives. Aggregates are stamped with the start of their interval.
+ */
+struct Aggregate_tier {
+
+  Aggregate_tier(const double interval, const double max_age)
+    : samples_(), interval_(interval), start_(0), count_(0), current_(), low_(0), high_(0) {
+    samples_.set_capacity(static_cast<size_t>(std::ceil(max_age / interval)) + 1);
+    samples_.set_max_age(max_age);
+  }
+
+
+  void insert(const Quantity quantity, const double stamp, const Value_type value) {
+    double start = std::floor(stamp / interval_) * interval_;
+    if (count_ > 0 && start > start_) {
+      samples_.push_back(start_, current_);
+      count_ = 0;
+    }
+    if (count_ == 0) {
+      start_ = start;
+      current_ = {value, value, value};
+      low_ = 0;
+      high_ = 0;
+    }
+    else {
+      // Use the difference with the mean to average angles correctly
+      double shift = value_diff(quantity, value, current_.mean) / (count_ + 1);
+      current_.mean = value_norm(quantity, current_.mean + shift);
+      if (is_angle(quantity)) {
+        // The range of angles may cross the wrap, so track it relative to the mean
+        double offset = value_diff(quantity, value, current_.mean);
+        low_ = std::min(low_ - shift, offset);
+        high_ = std::max(high_ - shift, offset);
+        current_.min = value_norm(quantity, current_.mean + low_);
+        current_.max = value_norm(quantity, current_.mean + high_);
+      }
+      else {
+        current_.min = std::min(current_.min, value);
+        current_.max = std::max(current_.max, value);
+      }
+    }
+    ++count_;
+  }
+
+
+  double get_interval() const {
+    return interval_;
+  }
+
+
+  const Aggregate_buffer& get_samples() const {
+    return samples_;
+  }
+
+
+  size_t get_memory_size() const {
+    return samples_.get_memory_size();
+  }
+
+private:
+  Aggregate_buffer samples_;
+  double interval_;
+  double start_;
+  size_t count_;
+  Aggregate current_;
+  //! Minimum and maximum of the current angle aggregate as offsets from its mean
+  double low_;
+  double high_;
+};
+
+
+using Aggregate_tiers = std::vector<Aggregate_tier>;
+
+
+//! Aggregation interval and maximum age in seconds. An interval of 0 denotes raw samples
+struct Retention_tier {
+  double interval;
+  double max_age;
+};
+
+
+using Retention_tiers = std::vector<Retention_tier>;
+
+
+/**
+ * Parse comma separated <interval>:<max age> retention tiers
+ *
+ * For example "0:600,1:86400,60:2592000" keeps raw samples for 10 minutes,
+ * 1 second aggregates for a day and 1 minute aggregates for 30 days. Throws
+ * std::invalid_argument on malformed input.
+ */
+inline Retention_tiers parse_retention_tiers(const std::string& spec) {
+  Retention_tiers result;
+  std::vector<std::string> fields;
+  boost::split(fields, spec, [](char c) { return c == ','; });
+  for (auto& field: fields) {
+    boost::trim(field);
+    if (field.empty()) {
+      continue;
+    }
+    std::vector<std::string> values;
+    boost::split(values, field, [](char c) { return c == ':'; });
+    if (values.size() != 2) {
+      throw std::invalid_argument(fmt::format("Expected <interval>:<max age>. Got \"{}\"", field));
+    }
+    Retention_tier tier{std::stod(values[0]), std::stod(values[1])};
+    if (tier.interval < 0 || tier.max_age <= 0) {
+      throw std::invalid_argument(fmt::format("Invalid retention tier: \"{}\"", field));
+    }
+    result.push_back(tier);
+  }
+  std::sort(result.begin(), result.end(),
+      [](const Retention_tier& a, const Retention_tier& b) { return a.interval < b.interval; });
+  return result;
+}
+
+
+/**
+ * Sample cache with a ring buffer for each quantity, indexed by quantity
+ *
+ * Optionally, each quantity has aggregate tiers that retain aggregates of
+ * its samples over longer periods than the raw samples.
+ */
+struct Sample_cache {
+
+  void insert(const Stamped_quantity& value) {
+    size_t q = static_cast<size_t>(value.quantity);
+    buffers_[q].push_back(value.stamp, value.value);
+    for (auto& tier: tiers_[q]) {
+      tier.insert(value.quantity, value.stamp, value.value);
+    }
+  }
+
+
+  const Sample_buffer& operator[](const Quantity quantity) const {
+    return buffers_[static_cast<size_t>(quantity)];
+  }
+
+
+  Sample_buffer& operator[](const Quantity quantity) {
+    return buffers_[static_cast<size_t>(quantity)];
+  }
+
+
+  void set_capacity(const size_t capacity) {
+    for (auto& buffer: buffers_) {
+      buffer.set_capacity(capacity);
+    }
+  }
+
+
+  void set_max_age(const double max_age) {
+    for (auto& buffer: buffers_) {
+      buffer.set_max_age(max_age);
+    }
+  }
+
+
+  /**
+   * Set retention tiers of a quantity
+   *
+   * A tier with interval 0 sets the maximum age of the raw samples. Other
+   * tiers replace the existing aggregate tiers, discarding their aggregates.
+   */
+  void set_tiers(const Quantity quantity, const Retention_tiers& tiers) {
+    size_t q = static_cast<size_t>(quantity);
+    tiers_[q].clear();
+    for (auto& tier: tiers) {
+      if (tier.interval == 0) {
+        buffers_[q].set_max_age(tier.max_age);
+      }
+      else {
+        tiers_[q].emplace_back(tier.interval, tier.max_age);
+      }
+    }
+  }
+
+
+  //! Set retention tiers of all quantities
+  void set_tiers(const Retention_tiers& tiers) {
+    for (size_t q = 0; q < buffers_.size(); ++q) {
+      set_tiers(static_cast<Quantity>(q), tiers);
+    }
+  }
+
+
+  //! Return aggregate tiers of a quantity, ordered by increasing interval
+  const Aggregate_tiers& get_tiers(const Quantity quantity) const {
+    return tiers_[static_cast<size_t>(quantity)];
+  }
+
+
+  //! Return number of bytes allocated for sample and aggregate storage of all quantities
+  size_t get_memory_size() const {
+    size_t result = 0;
+    for (auto& buffer: buffers_) {
+      result += buffer.get_memory_size();
+    }
+    for (auto& tiers: tiers_) {
+      for (auto& tier: tiers) {
+        result += tier.get_memory_size();
+      }
+    }
+    return result;
+  }
+
+private:
+  std::array<Sample_buffer, static_cast<size_t>(Quantity::end)> buffers_;
+  std::array<Aggregate_tiers, static_cast<size_t>(Quantity::end)> tiers_;
+};
+
+
+#endif  // SAMPLE_CACHE_H_
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
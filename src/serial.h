@@ -45,6 +45,21 @@ class Serial_exception: public runtime_error {
 struct Serial: public serial_port {
   using serial_port::serial_port;
 
+  //! Baud rate from a connection string, or 0 when it is invalid
+  static unsigned get_baud_rate(const std::string& device_str) {
+    std::vector<std::string> fields;
+    boost::split(fields, device_str, [](char c) { return c == ':'; });
+    if (fields.size() < 2) {
+      return 9600;
+    }
+    try {
+      return static_cast<unsigned>(std::stoul(fields[1], nullptr, 10));
+    }
+    catch (std::exception&) {
+      return 0;
+    }
+  }
+
   void open(const std::string& device_str) {
     std::vector<std::string> fields;
     boost::split(fields, device_str, [](char c) { return c == ':'; });
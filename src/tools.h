@@ -26,6 +26,9 @@
 #include <type_traits>
 #include <algorithm>
 #include <iostream>
+#include <utility>
+#include <atomic>
+#include <memory>
 
 #include "version.h"
 
@@ -70,6 +73,140 @@ constexpr inline decltype(auto) get_enum_trait() {
 }
 
 
+/**
+ * Non owning view of a contiguous sequence of items, along the lines of C++20 std::span
+ */
+template <typename T>
+struct Span {
+  using value_type = std::remove_cv_t<T>;
+  using iterator = T*;
+
+  constexpr Span(): data_(nullptr), size_(0) {}
+  constexpr Span(T* data, const size_t size): data_(data), size_(size) {}
+  template <class Container, typename = decltype(std::declval<Container&>().data())>
+  constexpr Span(Container& container): data_(container.data()), size_(container.size()) {}
+
+  constexpr T* begin() const { return data_; }
+  constexpr T* end() const { return data_ + size_; }
+  constexpr T* data() const { return data_; }
+  constexpr size_t size() const { return size_; }
+  constexpr bool empty() const { return size_ == 0; }
+  constexpr T& operator[](const size_t index) const { return data_[index]; }
+
+private:
+  T* data_;
+  size_t size_;
+};
+
+
+/**
+ * Bounded lock free queue for a single producer and a single consumer thread
+ *
+ * Storage for the items is allocated up front; capacity is rounded up to a
+ * power of two. push fails rather than blocks when the queue is full.
+ */
+template <typename T>
+struct Spsc_queue {
+  explicit Spsc_queue(const size_t capacity)
+    : capacity_(round_up(capacity)), items_(new T[capacity_]), head_(0), tail_(0) {}
+
+  Spsc_queue(const Spsc_queue&) = delete;
+  Spsc_queue& operator=(const Spsc_queue&) = delete;
+
+  //! Add an item, return false when the queue is full. Producer only.
+  bool push(const T& item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= capacity_) {
+      return false;
+    }
+    items_[head & (capacity_ - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  //! Add the items of both spans, or none when they don't fit. Producer only.
+  bool push(Span<const T> first, Span<const T> second=Span<const T>()) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head + first.size() + second.size() - tail_.load(std::memory_order_acquire) > capacity_) {
+      return false;
+    }
+    head = copy_in(head, first);
+    head = copy_in(head, second);
+    head_.store(head, std::memory_order_release);
+    return true;
+  }
+
+  //! Pass all queued items to f and remove them, return the number of items. Consumer only.
+  template <typename F>
+  size_t consume_all(F&& f) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    for (size_t i = tail; i != head; ++i) {
+      f(items_[i & (capacity_ - 1)]);
+    }
+    tail_.store(head, std::memory_order_release);
+    return head - tail;
+  }
+
+  /**
+   * Pass all queued items to f as at most two contiguous spans and remove them
+   *
+   * Returns the number of items. Consumer only.
+   */
+  template <typename F>
+  size_t consume_spans(F&& f) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t begin = tail & (capacity_ - 1);
+    size_t count = head - tail;
+    size_t first = std::min(count, capacity_ - begin);
+    if (first > 0) {
+      f(Span<const T>(&items_[begin], first));
+    }
+    if (count > first) {
+      f(Span<const T>(&items_[0], count - first));
+    }
+    tail_.store(head, std::memory_order_release);
+    return count;
+  }
+
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+private:
+  static size_t round_up(const size_t capacity) {
+    size_t result = 1;
+    while (result < capacity) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  size_t copy_in(const size_t head, Span<const T> items) {
+    size_t begin = head & (capacity_ - 1);
+    size_t first = std::min(items.size(), capacity_ - begin);
+    std::copy(items.begin(), items.begin() + first, &items_[begin]);
+    std::copy(items.begin() + first, items.end(), &items_[0]);
+    return head + items.size();
+  }
+
+  const size_t capacity_;
+  std::unique_ptr<T[]> items_;
+  // Keep the indices of producer and consumer in separate cache lines
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
+};
+
+
 template <class Container, typename Items>
 struct contains_checker {
   int operator() (const Container& container, const Items& items) const {
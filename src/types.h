@@ -93,6 +93,52 @@ private:
 
 namespace pt = boost::posix_time;
 
+
+/**
+ * Counters of the packets received from a device
+ *
+ * Collected by packet parsers to quantify loss on the link with the device.
+ */
+struct Link_statistics {
+  //! Valid packets
+  uint64_t packets = 0;
+  //! Packets the device sent according to its packet counter
+  uint64_t expected = 0;
+  //! Packets missing according to the packet counter
+  uint64_t dropped = 0;
+  //! Intervals between packet sample times longer than the nominal interval
+  uint64_t gaps = 0;
+  uint64_t checksum_errors = 0;
+  //! Bytes skipped looking for the start of a packet
+  uint64_t junk_bytes = 0;
+  //! Times bytes were skipped to find the start of a packet
+  uint64_t resyncs = 0;
+
+  static constexpr size_t size = 7;
+
+  //! Return the name of counter index
+  static const char* get_name(const size_t index) {
+    static const char* const names[size] = {
+      "packets", "expected", "dropped", "gaps", "checksum_errors", "junk_bytes", "resyncs"
+    };
+    return index < size ? names[index] : "";
+  }
+
+  //! Return counter index, in the order of the members
+  uint64_t get(const size_t index) const {
+    switch (index) {
+      case 0: return packets;
+      case 1: return expected;
+      case 2: return dropped;
+      case 3: return gaps;
+      case 4: return checksum_errors;
+      case 5: return junk_bytes;
+      case 6: return resyncs;
+      default: return 0;
+    }
+  }
+};
+
 extern std::ostream& operator<<(std::ostream& os, cbytes_t data);
 
 template <typename C>
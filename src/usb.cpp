@@ -27,6 +27,7 @@
 
 #include <cstdlib>
 #include <functional>
+#include <chrono>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -65,6 +66,247 @@ std::string get_usb_class_string(uint8_t class_enum) {
 
 
 
+boost::system::error_code get_transfer_error(const libusb_transfer* transfer) {
+  namespace errc = boost::system::errc;
+  switch(transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+      DEBUGLOG("USB transferred % bytes", transfer->actual_length);
+      return errc::make_error_code(errc::success);
+    case LIBUSB_TRANSFER_CANCELLED:
+      DEBUGLOG("USB transfer cancelled");
+      return errc::make_error_code(errc::operation_canceled);
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      log(level::warning, "USB no device");
+      return errc::make_error_code(errc::bad_file_descriptor);
+    case LIBUSB_TRANSFER_TIMED_OUT:
+      log(level::info, "USB timeout");
+      return errc::make_error_code(errc::timed_out);
+    case LIBUSB_TRANSFER_ERROR:
+      log(level::error, "USB transfer error");
+      return errc::make_error_code(errc::io_error);
+    case LIBUSB_TRANSFER_OVERFLOW:
+      log(level::error, "USB tranfer overflow");
+      return errc::make_error_code(errc::value_too_large);
+    case LIBUSB_TRANSFER_STALL:
+      log(level::error, "USB transfer stall");
+      return errc::make_error_code(errc::io_error);
+    default:
+      log(level::error, "Unexpected USB error");
+      return errc::make_error_code(errc::io_error);
+  }
+}
+
+
+void Read_pool::handle_transfer(libusb_transfer* transfer) {
+  Read_transfer* read_transfer = static_cast<Read_transfer*>(transfer->user_data);
+  Read_pool* pool = read_transfer->pool;
+  size_t length = static_cast<size_t>(transfer->actual_length);
+  boost::system::error_code ec;
+  if (transfer->status != LIBUSB_TRANSFER_TIMED_OUT || length == 0) {
+    ec = get_transfer_error(transfer);
+  }
+  if (!ec && length == 0) {
+    if (pool->is_cancelling()) {
+      ec = asio::error::operation_aborted;
+    }
+    else {
+      int r = pool->submit_(transfer);
+      if (r == 0) {
+        return;
+      }
+      log(level::error, "Failed to re-submit USB transfer, error %", r);
+      ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
+    }
+  }
+  size_t session = read_transfer->session;
+  std::weak_ptr<Read_pool*> self = pool->self_;
+  asio::post(pool->get_strand(), [self, read_transfer, session, ec, length]() {
+      if (auto pool = self.lock()) {
+        (*pool)->complete(read_transfer, session, ec, length);
+      }
+    });
+  // Libusb is done with the transfer: the pool may be destroyed from here on
+  --pool->in_flight_;
+}
+
+
+Read_pool::Read_pool(asio::io_context& io_context, asio::io_context::strand& strand)
+    : strand_(strand), signal_(io_context), handle_(nullptr), endpoint_(0),
+      transfers_(), ready_(), ready_first_(0), ready_count_(0), current_(nullptr), offset_(0),
+      error_(), cancels_(0), session_(0), waiting_(0), in_flight_(0), cancelling_(false),
+      submit_([](libusb_transfer* transfer) { return libusb_submit_transfer(transfer); }),
+      cancel_([](libusb_transfer* transfer) { return libusb_cancel_transfer(transfer); }),
+      self_(std::make_shared<Read_pool*>(this)) {
+  // Never expires: waiters are woken by cancelling
+  signal_.expires_at(asio::steady_timer::time_point::max());
+}
+
+
+Read_pool::~Read_pool() {
+  if (in_flight_ > 0) {
+    log(level::error, "Destroying USB read pool with % transfers in flight", in_flight_.load());
+  }
+}
+
+
+void Read_pool::setup(libusb_device_handle* handle, int endpoint, size_t packet_size) {
+  handle_ = handle;
+  endpoint_ = endpoint;
+  packet_size = std::max(packet_size, size_t(1));
+  size_t size = (transfer_size + packet_size - 1) / packet_size * packet_size;
+  if (transfers_.empty()) {
+    ready_.resize(transfer_count);
+    for (size_t i = 0; i < transfer_count; ++i) {
+      transfers_.push_back(std::make_unique<Read_transfer>());
+      transfers_.back()->pool = this;
+    }
+  }
+  for (auto& transfer: transfers_) {
+    transfer->data.resize(size);
+  }
+  reset();
+}
+
+
+bool Read_pool::read(Usb_read_data& data, boost::system::error_code& ec, size_t max_size,
+    size_t cancels) {
+  if (cancels != cancels_) {
+    ec = asio::error::operation_aborted;
+    return true;
+  }
+  if (max_size == 0) {
+    return true;
+  }
+  if (current_ != nullptr && offset_ == current_->length) {
+    // Consumed: resubmit
+    current_->state = Read_transfer::State::idle;
+    current_ = nullptr;
+  }
+  if (current_ == nullptr && ready_count_ > 0) {
+    current_ = ready_[ready_first_];
+    current_->state = Read_transfer::State::current;
+    ready_first_ = (ready_first_ + 1) % ready_.size();
+    --ready_count_;
+    offset_ = 0;
+  }
+  submit_idle();
+  if (current_ != nullptr) {
+    data.data = current_->data.data() + offset_;
+    data.size = std::min(max_size, current_->length - offset_);
+    offset_ += data.size;
+    return true;
+  }
+  if (error_) {
+    ec = error_;
+    error_.clear();
+    return true;
+  }
+  return false;
+}
+
+
+void Read_pool::submit_idle() {
+  if (error_ || handle_ == nullptr || cancelling_) {
+    // Deliver the error before trying again
+    return;
+  }
+  for (auto& transfer: transfers_) {
+    if (transfer->state != Read_transfer::State::idle) {
+      continue;
+    }
+    libusb_transfer* usb_transfer = transfer->transfer.get_transfer();
+    libusb_fill_bulk_transfer(
+        usb_transfer,
+        handle_,
+        static_cast<uint8_t>(endpoint_),
+        transfer->data.data(),
+        static_cast<int>(transfer->data.size()),
+        handle_transfer,
+        transfer.get(),
+        timeout);
+    transfer->state = Read_transfer::State::submitted;
+    transfer->session = session_;
+    // Counted before submitting, as it may complete before submit returns
+    ++in_flight_;
+    int r = submit_(usb_transfer);
+    if (r != 0) {
+      --in_flight_;
+      transfer->state = Read_transfer::State::idle;
+      log(level::error, "Failed to submit USB transfer, error %", r);
+      error_ = boost::system::errc::make_error_code(boost::system::errc::io_error);
+      return;
+    }
+  }
+}
+
+
+void Read_pool::complete(Read_transfer* transfer, size_t session, const boost::system::error_code& ec,
+    size_t length) {
+  if (session != session_) {
+    // Submitted before reset(), which returned the transfer to idle
+    return;
+  }
+  if (ec) {
+    transfer->state = Read_transfer::State::idle;
+    if (cancelling_) {
+      return;
+    }
+    if (ec == boost::system::errc::timed_out && waiting_ == 0) {
+      // Only a timeout for a waiting read is an error
+      submit_idle();
+      return;
+    }
+    if (!error_) {
+      error_ = ec;
+    }
+  }
+  else {
+    transfer->state = Read_transfer::State::ready;
+    transfer->length = length;
+    ready_[(ready_first_ + ready_count_) % ready_.size()] = transfer;
+    ++ready_count_;
+  }
+  signal();
+}
+
+
+void Read_pool::signal() {
+  // Woken reads wait again when there is nothing for them
+  waiting_ = 0;
+  signal_.cancel();
+}
+
+
+void Read_pool::abort_reads() {
+  ++cancels_;
+  signal();
+}
+
+
+void Read_pool::cancel() {
+  cancelling_ = true;
+  for (auto& transfer: transfers_) {
+    if (transfer->state == Read_transfer::State::submitted) {
+      cancel_(transfer->transfer.get_transfer());
+    }
+  }
+}
+
+
+void Read_pool::reset() {
+  ++session_;
+  for (auto& transfer: transfers_) {
+    transfer->state = Read_transfer::State::idle;
+  }
+  ready_first_ = 0;
+  ready_count_ = 0;
+  current_ = nullptr;
+  offset_ = 0;
+  error_.clear();
+  cancelling_ = false;
+}
+
+
 struct Usb_context {
   Usb_context(Usb_context const&) = delete;
   void operator=(Usb_context const&) = delete;
@@ -435,11 +677,12 @@ private:
 Usb::Usb(boost::asio::io_context& io_context)
     : Lib_usb(), io_ctx_(io_context), strand_(io_context),
       read_endpoint_(0), write_endpoint_(0), read_packet_size_(0),
-      transfers_() {
+      transfers_(), read_pool_(io_context, strand_) {
 }
 
 
 Usb::~Usb() {
+  stop_reads();
 }
 
 
@@ -447,6 +690,7 @@ void Usb::setup_endpoints() {
   write_endpoint_ = this->get_descriptors()->get_write_endpoint();
   read_endpoint_ = this->get_descriptors()->get_read_endpoint();
   read_packet_size_ = this->get_descriptors()->get_read_packet_size(read_endpoint_);
+  read_pool_.setup(this->get_handle(), read_endpoint_, read_packet_size_);
   log(level::info, "Successfully setup USB device with endpoints: %, %: %",
       write_endpoint_, read_endpoint_, read_packet_size_);
 }
@@ -460,14 +704,34 @@ void Usb::setup_events() {
 
 void Usb::close() {
   cancel();
-  event_handler_ = nullptr;
+  stop_reads();
   Lib_usb::close();
+  read_pool_.reset();
+}
+
+
+void Usb::stop_reads() {
+  read_pool_.cancel();
+  if (event_handler_ != nullptr) {
+    // Libusb only returns cancelled transfers while handling events
+    auto start = std::chrono::steady_clock::now();
+    bool warned = false;
+    while (read_pool_.get_in_flight() > 0) {
+      if (!warned && std::chrono::steady_clock::now() - start > std::chrono::seconds(1)) {
+        log(level::warning, "Waiting for % cancelled USB transfers", read_pool_.get_in_flight());
+        warned = true;
+      }
+      boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    }
+  }
+  event_handler_ = nullptr;
 }
 
 
 void Usb::cancel() {
   log(level::info, "Cancelling outstanding USB IO...");
   transfers_.cancel();
+  read_pool_.abort_reads();
   // Wait a little bit...
   asio::deadline_timer tmr(io_ctx_, pt::milliseconds(20));
   tmr.wait();
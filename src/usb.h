@@ -26,8 +26,12 @@
 #include <string>
 #include <memory>
 #include <iostream>
-#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <atomic>
 #include <exception>
+#include <limits>
 #include <boost/asio.hpp>
 #include <boost/thread/thread.hpp>
 
@@ -76,40 +80,195 @@ private:
 using Usb_transfer_ptr = std::unique_ptr<Usb_transfer>;
 
 
+/**
+ * Write transfers in flight
+ *
+ * Transfers are looked up by their libusb transfer and reused after
+ * completion.
+ */
 struct Transfer_queue {
   libusb_transfer* new_transfer() {
-    transfers_.emplace_back(new Usb_transfer);
-    return transfers_.back()->get_transfer();
+    Usb_transfer_ptr transfer;
+    if (free_.empty()) {
+      transfer = std::make_unique<Usb_transfer>();
+    }
+    else {
+      transfer = std::move(free_.back());
+      free_.pop_back();
+    }
+    libusb_transfer* result = transfer->get_transfer();
+    transfers_.emplace(result, std::move(transfer));
+    return result;
   }
 
   void delete_transfer(libusb_transfer* usb_transfer) {
-    for (auto&& transfer: transfers_) {
-      if (transfer != nullptr) {
-        if (usb_transfer == transfer->get_transfer()) {
-          transfer = nullptr;
-        }
-      }
-    }
-    while (!transfers_.empty()) {
-      if (transfers_.front() == nullptr) {
-        transfers_.pop_front();
-      }
-      else
-        break;
+    auto it = transfers_.find(usb_transfer);
+    if (it != transfers_.end()) {
+      free_.push_back(std::move(it->second));
+      transfers_.erase(it);
     }
   }
 
   void cancel() {
-    for (auto&& transfer: transfers_) {
-      if (transfer != nullptr) {
-        auto tr = transfer->get_transfer();
-        log(level::debug, "Cancelling transfer: %", tr);
-        libusb_cancel_transfer(tr);
-      }
+    for (auto& transfer: transfers_) {
+      log(level::debug, "Cancelling transfer: %", transfer.first);
+      libusb_cancel_transfer(transfer.first);
     }
   }
 private:
-  std::deque<Usb_transfer_ptr> transfers_;
+  std::unordered_map<libusb_transfer*, Usb_transfer_ptr> transfers_;
+  std::vector<Usb_transfer_ptr> free_;
+};
+
+
+//! Data of a completed read, valid until the next read from the same port
+struct Usb_read_data {
+  const unsigned char* data = nullptr;
+  size_t size = 0;
+
+  const unsigned char* begin() const {
+    return data;
+  }
+  const unsigned char* end() const {
+    return data + size;
+  }
+};
+
+
+struct Read_pool;
+
+//! Read transfer of a Read_pool with its buffer
+struct Read_transfer {
+  enum class State {
+    idle,
+    submitted,
+    ready,  ///< Completed, waiting to be read
+    current  ///< Being read
+  };
+
+  Usb_transfer transfer;
+  std::vector<unsigned char> data;
+  State state = State::idle;
+  //! Bytes received
+  size_t length = 0;
+  //! Connection the transfer was submitted for
+  size_t session = 0;
+  Read_pool* pool = nullptr;
+};
+
+
+/**
+ * Pool of read transfers kept in flight
+ *
+ * All transfers are submitted on the first read and resubmitted as soon as
+ * their data is consumed, so the device doesn't wait for a read to be
+ * submitted between transfers. Completed transfers are queued in order on
+ * the io context and read in place: there is no allocation per read.
+ */
+struct Read_pool {
+  static constexpr size_t transfer_count = 4;
+  //! Transfer size, rounded up to a multiple of the endpoint packet size
+  static constexpr size_t transfer_size = 0x1000;
+  static constexpr unsigned int timeout = 2000U;
+
+  //! Call submitting or cancelling a transfer, returning a libusb error code
+  using Transfer_call = std::function<int(libusb_transfer*)>;
+
+  Read_pool(boost::asio::io_context& io_context, boost::asio::io_context::strand& strand);
+  ~Read_pool();
+
+  //! Replace libusb_submit_transfer and libusb_cancel_transfer, e.g. for testing
+  void set_transfer_calls(Transfer_call submit, Transfer_call cancel) {
+    submit_ = std::move(submit);
+    cancel_ = std::move(cancel);
+  }
+
+  /**
+   * Set up the transfers for reading endpoint of handle
+   *
+   * There should be no transfers in flight.
+   */
+  void setup(libusb_device_handle* handle, int endpoint, size_t packet_size);
+
+  /**
+   * Take up to max_size bytes of received data, or the error of a failed transfer
+   *
+   * Returns false when there is neither and the reader has to wait. Reads
+   * started before abort_reads() was called get operation_aborted.
+   */
+  bool read(Usb_read_data& data, boost::system::error_code& ec, size_t max_size, size_t cancels);
+
+  //! Call handler when a transfer completed or reads were aborted
+  template <typename Handler>
+  void wait(Handler&& handler) {
+    ++waiting_;
+    signal_.async_wait(std::forward<Handler>(handler));
+  }
+
+  //! Count of abort_reads() calls, for read() to detect aborts
+  size_t get_cancels() const {
+    return cancels_;
+  }
+
+  //! Transfers submitted that libusb hasn't returned yet
+  size_t get_in_flight() const {
+    return in_flight_;
+  }
+
+  //! Whether cancel() was called since the last reset()
+  bool is_cancelling() const {
+    return cancelling_;
+  }
+
+  //! Have pending reads complete with operation_aborted, keeping the transfers in flight
+  void abort_reads();
+  /**
+   * Cancel the transfers in flight
+   *
+   * Their completion has to be awaited with get_in_flight() before the
+   * handle is closed.
+   */
+  void cancel();
+  //! Forget received data and errors before reading from a new connection, with no transfers in flight
+  void reset();
+  //! Handle completion of transfer submitted in session, on the io context
+  void complete(Read_transfer* transfer, size_t session, const boost::system::error_code& ec,
+      size_t length);
+
+  //! Handle completion of transfer, on the USB event thread
+  static void handle_transfer(libusb_transfer* transfer);
+
+  boost::asio::io_context::strand& get_strand() {
+    return strand_;
+  }
+
+private:
+  boost::asio::io_context::strand& strand_;
+  boost::asio::steady_timer signal_;
+  libusb_device_handle* handle_;
+  int endpoint_;
+  std::vector<std::unique_ptr<Read_transfer> > transfers_;
+  //! Ring of completed transfers, in order of completion
+  std::vector<Read_transfer*> ready_;
+  size_t ready_first_;
+  size_t ready_count_;
+  Read_transfer* current_;
+  //! Bytes of the current transfer read
+  size_t offset_;
+  boost::system::error_code error_;
+  size_t cancels_;
+  size_t session_;
+  //! Reads waiting for a transfer to complete
+  size_t waiting_;
+  std::atomic<size_t> in_flight_;
+  std::atomic<bool> cancelling_;
+  Transfer_call submit_;
+  Transfer_call cancel_;
+  //! Completions posted to the strand only reach the pool while it exists
+  std::shared_ptr<Read_pool*> self_;
+
+  void submit_idle();
+  void signal();
 };
 
 
@@ -181,46 +340,16 @@ private:
 };
 
 
+//! Return error code for the status of a finished transfer
+boost::system::error_code get_transfer_error(const libusb_transfer* transfer);
+
+
 template <typename OperationContext>
 static void handle_transfer(libusb_transfer* transfer) {
   OperationContext* operation_context = static_cast<OperationContext*>(transfer->user_data);
-  boost::system::error_code ec;
+  boost::system::error_code ec = get_transfer_error(transfer);
   size_t bytes_transferred = static_cast<size_t>(transfer->actual_length);
 
-  switch(transfer->status) {
-    case LIBUSB_TRANSFER_COMPLETED:
-      ec = boost::system::errc::make_error_code(boost::system::errc::success);
-      DEBUGLOG("USB transferred % bytes", bytes_transferred);
-      break;
-    case LIBUSB_TRANSFER_CANCELLED:
-      DEBUGLOG("USB transfer cancelled");
-      ec = boost::system::errc::make_error_code(boost::system::errc::operation_canceled);
-      break;
-    case LIBUSB_TRANSFER_NO_DEVICE:
-      log(level::warning, "USB no device");
-      ec = boost::system::errc::make_error_code(boost::system::errc::bad_file_descriptor);
-      break;
-    case LIBUSB_TRANSFER_TIMED_OUT:
-      log(level::info, "USB timeout");
-      ec = boost::system::errc::make_error_code(boost::system::errc::timed_out);
-      break;
-    case LIBUSB_TRANSFER_ERROR:
-      log(level::error, "USB transfer error");
-      ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
-      break;
-    case LIBUSB_TRANSFER_OVERFLOW:
-      log(level::error, "USB tranfer overflow");
-      ec = boost::system::errc::make_error_code(boost::system::errc::value_too_large);
-      break;
-    case LIBUSB_TRANSFER_STALL:
-      log(level::error, "USB transfer stall");
-      ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
-      break;
-    default:
-      ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
-      log(level::error, "Unexpected USB error");
-      break;
-  }
   if (!ec && bytes_transferred == 0) {
     DEBUGLOG("Resubmitting transfer: %", transfer);
     int r = libusb_submit_transfer(transfer);
@@ -295,23 +424,44 @@ struct Usb: public Lib_usb {
   }
 
   template <typename MutableBufferSequence, typename ReadHandler>
-  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
-      void (boost::system::error_code, std::size_t))
-  async_read_some(const MutableBufferSequence& buffers,
+  auto async_read_some(const MutableBufferSequence& buffers,
       BOOST_ASIO_MOVE_ARG(ReadHandler) handler) {
     BOOST_ASIO_READ_HANDLER_CHECK(ReadHandler, handler) type_check;
-    log(level::debug, "Doing Usb::async_read_some for % bytes", 
-        boost::asio::buffer_size(buffers));
-
-    typedef boost::asio::async_completion<ReadHandler, void (boost::system::error_code, std::size_t)> Init;
-    Init init(handler);
-
-    typedef Operation_context<MutableBufferSequence, typename Init::completion_handler_type> Read_context;
-
-    Read_context* read_context = new Read_context{strand_, buffers, init.completion_handler, read_packet_size_, &transfers_};
-    submit_operation(read_context, read_endpoint_);
+    return boost::asio::async_compose<ReadHandler, void (boost::system::error_code, std::size_t)>(
+        [this, buffers, cancels = read_pool_.get_cancels()]
+        (auto& self, boost::system::error_code = boost::system::error_code()) mutable {
+          Usb_read_data data;
+          boost::system::error_code ec;
+          if (read_pool_.read(data, ec, boost::asio::buffer_size(buffers), cancels)) {
+            self.complete(ec, boost::asio::buffer_copy(buffers, boost::asio::buffer(data.data, data.size)));
+          }
+          else {
+            read_pool_.wait(std::move(self));
+          }
+        },
+        handler, io_ctx_);
+  }
 
-    return init.result.get();
+  /**
+   * Read the data of the next completed transfer in place
+   *
+   * The data is valid until the next read, which resubmits its transfer.
+   */
+  template <typename ReadHandler>
+  auto async_read_data(BOOST_ASIO_MOVE_ARG(ReadHandler) handler) {
+    return boost::asio::async_compose<ReadHandler, void (boost::system::error_code, Usb_read_data)>(
+        [this, cancels = read_pool_.get_cancels()]
+        (auto& self, boost::system::error_code = boost::system::error_code()) mutable {
+          Usb_read_data data;
+          boost::system::error_code ec;
+          if (read_pool_.read(data, ec, std::numeric_limits<size_t>::max(), cancels)) {
+            self.complete(ec, data);
+          }
+          else {
+            read_pool_.wait(std::move(self));
+          }
+        },
+        handler, io_ctx_);
   }
 
   template <typename ConstBufferSequence, typename WriteHandler>
@@ -340,6 +490,9 @@ protected:
   void setup_endpoints() override;
   void setup_events() override;
 private:
+  //! Cancel the read transfers and stop handling events once libusb returned them
+  void stop_reads();
+
   boost::asio::io_context& io_ctx_;
   boost::asio::io_context::strand strand_;
   struct Usb_event_handler;
@@ -347,6 +500,7 @@ private:
   int read_endpoint_, write_endpoint_;
   size_t read_packet_size_;
   Transfer_queue transfers_;
+  Read_pool read_pool_;
 };
 
 
@@ -58,11 +58,12 @@ BOOST_AUTO_TEST_CASE(datetime_adjust_test)
   double diff = get_test_time() - get_time();
   BOOST_TEST(diff > 9.9);
   BOOST_TEST(diff < 10.1);
-  // Adjust once
+  // The first adjustment steps the clock
   adjust_clock(get_test_time());
   diff = get_test_time() - get_time();
-  BOOST_TEST(diff > 9.7);
-  BOOST_TEST(diff < 9.8);
+  BOOST_TEST(diff > -0.1);
+  BOOST_TEST(diff < 0.1);
+  BOOST_TEST((get_clock_status().state == Clock_state::locking));
 }
 
 BOOST_AUTO_TEST_CASE(to_timestamp_test) 
@@ -71,3 +72,148 @@ BOOST_AUTO_TEST_CASE(to_timestamp_test)
   double ut = to_timestamp(dt);
   BOOST_TEST(ut == 1587575443.782);
 }
+
+BOOST_AUTO_TEST_CASE(device_clock_test)
+{
+  // Device sampling at 100 Hz on a clock running 50 ppm fast, read in chunks of
+  // 8 samples that arrive with a delay of 2 to 20 ms
+  Device_clock clock;
+  const double start = 1587575443.0;
+  const double drift = 50E-6;
+  uint32_t seed = 1;
+  double previous = 0;
+  double max_jitter = 0;
+  double max_error = 0;
+  for (int i = 0; i < 30000; i += 8) {
+    seed = seed * 1103515245 + 12345;
+    double delay = 0.002 + 0.018 * ((seed >> 16) & 0x7FFF) / 32768.0;
+    double arrival = start + (i + 7) * 0.01 + delay;
+    for (int j = i; j < i + 8; ++j) {
+      double device_time = 100.0 + j * 0.01 * (1 + drift);
+      double stamp = clock.map(device_time, arrival);
+      if (j > 3000) {
+        max_jitter = std::max(max_jitter, std::abs(stamp - previous - 0.01));
+        max_error = std::max(max_error, std::abs(stamp - (start + j * 0.01)));
+      }
+      previous = stamp;
+    }
+  }
+  BOOST_TEST(clock.has_drift());
+  BOOST_TEST(clock.get_drift() < -40E-6);
+  BOOST_TEST(clock.get_drift() > -60E-6);
+  // Arrival times of samples in a chunk are up to 90 ms apart
+  BOOST_TEST(max_jitter < 0.001);
+  BOOST_TEST(max_error < 0.01);
+
+  // Device time wrapping around
+  Device_clock wrapping(10.0);
+  BOOST_TEST(wrapping.map(9.5, 1000.0) == 1000.0);
+  BOOST_TEST(wrapping.map(0.5, 1001.0) == 1001.0);
+  // A device restart restarts estimation
+  BOOST_TEST(wrapping.map(0.0, 1002.0) == 1002.0);
+  BOOST_TEST(wrapping.map(0.1, 1002.2) == 1002.1, boost::test_tools::tolerance(1E-9));
+}
+
+
+BOOST_AUTO_TEST_CASE(clock_discipline_test)
+{
+  // Reference sampled once a second with up to 2 ms jitter by a local clock
+  // running 100 ppm slow
+  Clock_discipline discipline;
+  double drift = 100E-6;
+  uint32_t seed = 1;
+  double reference_offset = 1587575443.0;
+  auto jitter = [&seed]() {
+    seed = seed * 1103515245 + 12345;
+    return 0.002 * ((seed >> 16) & 0x7FFF) / 32768.0 - 0.001;
+  };
+  auto reference = [&](const double local) {
+    return local * (1 + drift) + reference_offset;
+  };
+  auto run = [&](const int from, const int to) {
+    double max_error = 0;
+    for (int t = from; t < to; ++t) {
+      double local = t;
+      discipline.update(local, reference(local) + jitter());
+      if (t > to - 100) {
+        max_error = std::max(max_error,
+            std::abs(local + 0.5 + discipline.get_correction(local + 0.5) - reference(local + 0.5)));
+      }
+    }
+    return max_error;
+  };
+
+  BOOST_TEST((discipline.get_status().state == Clock_state::unlocked));
+  BOOST_TEST(discipline.get_correction(0.0) == 0.0);
+  double max_error = run(0, 300);
+  Clock_status status = discipline.get_status();
+  BOOST_TEST((status.state == Clock_state::locked));
+  BOOST_TEST(status.drift > 90E-6);
+  BOOST_TEST(status.drift < 110E-6);
+  BOOST_TEST(max_error < 0.002);
+  BOOST_TEST(status.rejected == 0);
+
+  // Single outliers are rejected
+  BOOST_TEST(!discipline.update(300.0, reference(300.0) + 0.2));
+  BOOST_TEST(discipline.get_status().rejected == 1);
+  BOOST_TEST(run(301, 400) < 0.002);
+
+  // A persistent step of the reference steps the clock after max_rejected samples
+  reference_offset += 0.5;
+  int rejected = 0;
+  for (int t = 400; t < 420; ++t) {
+    if (!discipline.update(t, reference(t) + jitter())) {
+      ++rejected;
+    }
+  }
+  BOOST_TEST(rejected == Clock_discipline::max_rejected);
+  BOOST_TEST(run(420, 600) < 0.002);
+  BOOST_TEST((discipline.get_status().state == Clock_state::locked));
+
+  // A change of drift is followed without rejections
+  drift += 50E-6;
+  reference_offset -= 600 * 50E-6;
+  BOOST_TEST(run(600, 900) < 0.002);
+  status = discipline.get_status();
+  BOOST_TEST(status.drift > 140E-6);
+  BOOST_TEST(status.drift < 160E-6);
+  BOOST_TEST(status.rejected == Clock_discipline::max_rejected + 1);
+  BOOST_TEST(status.steps == 2);
+
+  // A backward step of the central clock slows it down instead of moving time back
+  double before = get_time();
+  uint64_t steps = get_clock_status().steps;
+  adjust_clock(before - 10.0);
+  BOOST_TEST(get_clock_status().steps == steps + 1);
+  double after = get_time();
+  BOOST_TEST(after >= before);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  double later = get_time();
+  BOOST_TEST(later > after);
+  BOOST_TEST(later - after < 0.05);
+}
+
+
+BOOST_AUTO_TEST_CASE(monotonic_clock_test)
+{
+  Monotonic_clock clock;
+  BOOST_TEST(clock.get_time(100.0) == 100.0);
+  BOOST_TEST(clock.get_time(101.0) == 101.0);
+  // Step forward
+  BOOST_TEST(clock.get_time(111.0) == 111.0);
+  // Step back by 10 s: time runs at a tenth of the speed until the clock catches up
+  BOOST_TEST(clock.get_time(101.0) == 111.0);
+  BOOST_TEST(clock.get_time(102.0) == 111.1, boost::test_tools::tolerance(1E-9));
+  double previous = 111.1;
+  double clock_time = 102.0;
+  while (clock_time < 120.0) {
+    clock_time += 0.5;
+    double time = clock.get_time(clock_time);
+    BOOST_TEST(time > previous);
+    previous = time;
+  }
+  // Caught up after 111.1 + 0.1 * (t - 102) = t
+  BOOST_TEST(previous == 120.0);
+  // Going back in small steps doesn't run time backwards either
+  BOOST_TEST(clock.get_time(119.99) == 120.0);
+}
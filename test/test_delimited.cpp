@@ -0,0 +1,89 @@
+#define BOOST_TEST_MODULE delimited_test
+#include "../src/types.h"
+#include "../src/devices/delimited.h"
+#include "../src/socket.h"
+#include "../src/quantities.h"
+
+#include "test_common.h"
+
+#include <string>
+#include <map>
+#include <boost/property_tree/ptree.hpp>
+
+namespace utf = boost::unit_test;
+namespace tt = boost::test_tools;
+namespace prtr = boost::property_tree;
+
+using namespace delimited;
+
+
+BOOST_AUTO_TEST_CASE(construction_test) {
+  auto device = std::make_shared<Delimited_device<Socket, Ctx> >();
+  prtr::ptree options;
+  options.put("frq.column", 3);
+  device->set_options(options);
+  BOOST_TEST(device->get_parser().get_columns().size() == 1);
+}
+
+
+BOOST_AUTO_TEST_CASE(parse_test, * utf::tolerance(0.00001)) {
+  prtr::ptree options;
+  options.put("prefix", "$DAT;");
+  options.put("delimiter", ";");
+  options.put("ax.column", 1);
+  options.put("ay.column", 2);
+  options.put("ay.multiplier", 0.5);
+  options.put("az.column", 2);
+  options.put("az.offset", 1.0);
+  options.put("vx.column", 4);
+  parser::Delimited_parser parser;
+  parser.set_options(options);
+  BOOST_TEST(parser.get_columns().size() == 4);
+
+  std::string data = "$DAT;x; 1.5;+3;skip;-2\r\n$OTHER;1;2;3;4;5\n$DAT;x;;4\n$DAT;x;1";
+  parser.add_and_parse(10.0, data.begin(), data.end());
+  auto& values = parser.get_values();
+  std::map<Quantity, double> found;
+  for (auto& value: values) {
+    found[value.quantity] = value.value;
+    BOOST_TEST(value.stamp == 10.0);
+  }
+  // An empty field has no value, the last line is incomplete
+  BOOST_TEST(values.size() == 6);
+  BOOST_TEST(found[Quantity::ax] == 1.5);
+  BOOST_TEST(found[Quantity::ay] == 2.0);
+  BOOST_TEST(found[Quantity::az] == 5.0);
+  BOOST_TEST(found[Quantity::vx] == -2.0);
+  BOOST_TEST(parser.buffer == "$DAT;x;1");
+}
+
+
+BOOST_AUTO_TEST_CASE(time_column_test) {
+  double value = 0;
+  using parser::Time_format;
+  std::string iso = "2020-04-22T17:10:43.782Z";
+  BOOST_TEST(parser::read_time(iso.data(), iso.data() + iso.size(), Time_format::iso, value));
+  BOOST_TEST(value == 1587575443.782, tt::tolerance(1E-9));
+  std::string tod = "7:10:43.5";
+  BOOST_TEST(parser::read_time(tod.data(), tod.data() + tod.size(), Time_format::time_of_day, value));
+  BOOST_TEST(value == 25843.5, tt::tolerance(1E-9));
+  std::string bad = "17:1:43";
+  BOOST_TEST(!parser::read_time(bad.data(), bad.data() + bad.size(), Time_format::time_of_day, value));
+
+  prtr::ptree options;
+  options.put("ax.column", 1);
+  options.put("time_column", 0);
+  options.put("time_format", "seconds");
+  parser::Delimited_parser parser;
+  parser.set_options(options);
+  // Lines at 10 Hz of device time, arriving with varying delays
+  for (int i = 0; i < 20; ++i) {
+    std::string line = fmt::format("{:.1f},1.0\n", 100.0 + 0.1 * i);
+    parser.add_and_parse(5.0 + 0.1 * i + (i % 2) * 0.03, line.begin(), line.end());
+  }
+  auto& values = parser.get_values();
+  BOOST_TEST(values.size() == 20);
+  for (int i = 10; i < 20; ++i) {
+    BOOST_TEST(values[i].stamp == 5.0 + 0.1 * i, tt::tolerance(1E-6));
+  }
+}
@@ -118,4 +118,330 @@ BOOST_AUTO_TEST_CASE(json_test) {
   Device dev;
   std::string json = get_device_json(dev);
   BOOST_TEST(json.find("\"connected\": false") != json.npos);
+  BOOST_TEST(json.find("\"link\"") == json.npos);
+}
+
+struct Link_device: public Device {
+  const Link_statistics* get_link_statistics() const override {
+    return &statistics;
+  }
+  Link_statistics statistics;
+};
+
+BOOST_AUTO_TEST_CASE(link_json_test) {
+  Link_device dev;
+  dev.statistics.dropped = 3;
+  dev.statistics.junk_bytes = 12;
+  std::string json = get_device_json(dev);
+  BOOST_TEST(json.find("\"dropped\": 3") != json.npos);
+  BOOST_TEST(json.find("\"junk_bytes\": 12") != json.npos);
+}
+
+BOOST_AUTO_TEST_CASE(sample_buffer_test) {
+  Sample_buffer buffer;
+  buffer.set_capacity(100);
+  buffer.set_max_age(50);
+  BOOST_TEST(buffer.empty());
+  for (int i = 0; i < 40; ++i) {
+    buffer.push_back(i, 2.0 * i);
+  }
+  BOOST_TEST(buffer.size() == 40);
+  BOOST_TEST(buffer.front().stamp == 0);
+  BOOST_TEST(buffer.back().value == 78);
+  // Age limit
+  for (int i = 40; i < 90; ++i) {
+    buffer.push_back(i, 2.0 * i);
+  }
+  BOOST_TEST(buffer.size() == 51);
+  BOOST_TEST(buffer.front().stamp == 39);
+  BOOST_TEST(buffer.back().stamp == 89);
+  // Size limit
+  buffer.set_max_age(1000);
+  for (int i = 90; i < 300; ++i) {
+    buffer.push_back(i, 2.0 * i);
+  }
+  BOOST_TEST(buffer.size() == 100);
+  BOOST_TEST(buffer.front().stamp == 200);
+  BOOST_TEST(buffer.back().stamp == 299);
+  BOOST_TEST(buffer.get_memory_size() == 100 * 2 * sizeof(double));
+  for (size_t i = 0; i < buffer.size(); ++i) {
+    BOOST_TEST(buffer.value(i) == 2 * buffer.stamp(i));
+  }
+  // Shrinking keeps most recent samples
+  buffer.set_capacity(10);
+  BOOST_TEST(buffer.size() == 10);
+  BOOST_TEST(buffer.front().stamp == 290);
+  BOOST_TEST(buffer.back().stamp == 299);
+}
+
+
+struct Sample_device: public My_device {
+  using Device::insert_value;
+};
+
+
+BOOST_AUTO_TEST_CASE(sample_cache_test) {
+  Sample_device dev;
+  dev.set_cache_size(8);
+  Value_type value = 0;
+  BOOST_TEST(!dev.get_value(Quantity::ro, value));
+  for (int i = 0; i < 20; ++i) {
+    dev.insert_value(Stamped_quantity(0.5 * i, i, Quantity::ro));
+  }
+  BOOST_TEST(dev.get_value(Quantity::ro) == 9.5);
+  Stamped_value sample;
+  BOOST_TEST(dev.get_sample(Quantity::ro, sample));
+  BOOST_TEST(sample.stamp == 19);
+  BOOST_TEST(dev.get_samples(Quantity::ro).size() == 8);
+  BOOST_TEST(dev.get_samples(Quantity::ro).front().stamp == 12);
+  BOOST_TEST(!dev.get_sample(Quantity::pi, sample));
+}
+
+BOOST_AUTO_TEST_CASE(sample_range_test) {
+  Sample_buffer buffer;
+  buffer.set_capacity(10);
+  for (int i = 0; i < 25; ++i) {
+    buffer.push_back(i, i);
+  }
+  BOOST_TEST(buffer.lower_bound(0) == 0);
+  BOOST_TEST(buffer.lower_bound(17) == 2);
+  BOOST_TEST(buffer.lower_bound(17.5) == 3);
+  BOOST_TEST(buffer.upper_bound(17) == 3);
+  BOOST_TEST(buffer.upper_bound(24) == 10);
+  BOOST_TEST(buffer.lower_bound(100) == 10);
+}
+
+
+BOOST_AUTO_TEST_CASE(history_test) {
+  Sample_device dev;
+  dev.set_name("history");
+  for (int i = 0; i < 10; ++i) {
+    dev.insert_value(Stamped_quantity(0.5 * i, i, Quantity::ro));
+    dev.insert_value(Stamped_quantity(-0.5 * i, i, Quantity::pi));
+  }
+  std::vector<Quantity> quantities = {Quantity::ro, Quantity::pi};
+  History_writer writer(dev, quantities, 2, 5, 0);
+  std::string json;
+  std::string chunk;
+  int chunks = 0;
+  bool more = true;
+  while (more) {
+    chunk.clear();
+    // Use a small chunk size to test continuation
+    more = writer.write(chunk, 16);
+    json += chunk;
+    ++chunks;
+  }
+  BOOST_TEST(chunks > 2);
+  BOOST_TEST(!writer.write(chunk, 16));
+  BOOST_TEST(json.find("\"ro\":[[2,1],[3,1.5],[4,2],[5,2.5]]") != json.npos);
+  BOOST_TEST(json.find("\"pi\":[[2,-1],[3,-1.5],[4,-2],[5,-2.5]]") != json.npos);
+  BOOST_TEST(json.substr(json.size() - 2) == "}}");
+
+  History_writer decimated(dev, {Quantity::ro}, 0, 100, 4);
+  json.clear();
+  while (decimated.write(json, 0x4000));
+  BOOST_TEST(json.find("\"ro\":[[0,0],[3,1.5],[6,3],[9,4.5]]") != json.npos);
+  prtr::ptree tree;
+  std::stringstream ss(json);
+  BOOST_CHECK_NO_THROW(prtr::read_json(ss, tree));
+}
+
+
+BOOST_AUTO_TEST_CASE(clock_step_history_test) {
+  // Samples stamped by the central clock keep increasing when it steps back
+  Sample_device dev;
+  dev.set_name("step");
+  dev.set_cache_tiers(parse_retention_tiers("0:3600,1:3600"));
+  double from = get_time();
+  for (int i = 0; i < 10; ++i) {
+    dev.insert_value(Stamped_quantity(i, get_time(), Quantity::ro));
+  }
+  adjust_clock(get_time() - 10.0);
+  for (int i = 10; i < 20; ++i) {
+    dev.insert_value(Stamped_quantity(i, get_time(), Quantity::ro));
+  }
+  double to = get_time();
+  auto& samples = dev.get_samples(Quantity::ro);
+  BOOST_TEST(samples.size() == 20);
+  for (size_t i = 1; i < samples.size(); ++i) {
+    BOOST_TEST(samples.stamp(i) >= samples.stamp(i - 1));
+  }
+  BOOST_TEST(samples.lower_bound(from) == 0);
+  BOOST_TEST(samples.upper_bound(to) == 20);
+
+  History_writer writer(dev, {Quantity::ro}, from, to, 0);
+  std::string json;
+  while (writer.write(json, 0x4000));
+  auto start = json.find("\"ro\":[");
+  BOOST_TEST(start != json.npos);
+  BOOST_TEST(std::count(json.begin() + start, json.end(), '[') == 21);
+}
+
+struct Counting_processor: public Processor {
+  void insert_value(const Stamped_quantity&) override {
+    ++values;
+  }
+
+  void insert_values(Stamped_span batch) override {
+    ++batches;
+    values += static_cast<int>(batch.size());
+  }
+
+  Quantity_set get_subscription() const override {
+    return subscription;
+  }
+
+  int values = 0;
+  int batches = 0;
+  Quantity_set subscription = Quantity_set().set();
+};
+
+
+struct Batch_device: public My_device {
+  using Device::insert_value;
+  using Device::insert_values;
+};
+
+
+BOOST_AUTO_TEST_CASE(insert_values_test) {
+  Batch_device dev;
+  auto processor = std::make_shared<Counting_processor>();
+  dev.add_processor(processor);
+  std::vector<Stamped_quantity> values;
+  for (int i = 0; i < 10; ++i) {
+    values.emplace_back(0.5 * i, i, Quantity::ro);
+  }
+  dev.insert_values(values);
+  BOOST_TEST(processor->batches == 1);
+  BOOST_TEST(processor->values == 10);
+  BOOST_TEST(dev.get_value(Quantity::ro) == 4.5);
+  BOOST_TEST(dev.get_samples(Quantity::ro).size() == 10);
+
+  dev.insert_values(Stamped_span());
+  BOOST_TEST(processor->batches == 1);
+  dev.insert_value(Stamped_quantity(5, 10, Quantity::ro));
+  BOOST_TEST(processor->values == 11);
+}
+
+
+BOOST_AUTO_TEST_CASE(subscription_test) {
+  Batch_device dev;
+  auto all = std::make_shared<Counting_processor>();
+  auto roll = std::make_shared<Counting_processor>();
+  roll->subscription = Quantity_set().set(static_cast<size_t>(Quantity::ro));
+  auto none = std::make_shared<Counting_processor>();
+  none->subscription.reset();
+  dev.add_processor(all);
+  dev.add_processor(roll);
+  dev.add_processor(none);
+
+  dev.insert_value(Stamped_quantity(1, 1, Quantity::ro));
+  dev.insert_value(Stamped_quantity(2, 1, Quantity::pi));
+  BOOST_TEST(all->values == 2);
+  BOOST_TEST(roll->values == 1);
+  BOOST_TEST(none->values == 0);
+
+  std::vector<Stamped_quantity> values = {
+    {3, 2, Quantity::ro}, {4, 2, Quantity::pi}, {5, 2, Quantity::ya}
+  };
+  dev.insert_values(values);
+  BOOST_TEST(all->values == 5);
+  BOOST_TEST(roll->values == 2);
+  BOOST_TEST(roll->batches == 1);
+  BOOST_TEST(none->batches == 0);
+
+  values = {{6, 3, Quantity::pi}};
+  dev.insert_values(values);
+  BOOST_TEST(roll->batches == 1);
+}
+
+
+BOOST_AUTO_TEST_CASE(retention_tiers_test) {
+  Retention_tiers tiers = parse_retention_tiers("60:2592000, 0:600,1:86400");
+  BOOST_TEST(tiers.size() == 3);
+  BOOST_TEST(tiers[0].interval == 0);
+  BOOST_TEST(tiers[0].max_age == 600);
+  BOOST_TEST(tiers[1].interval == 1);
+  BOOST_TEST(tiers[2].interval == 60);
+  BOOST_TEST(tiers[2].max_age == 2592000);
+  BOOST_TEST(parse_retention_tiers("").empty());
+  BOOST_CHECK_THROW(parse_retention_tiers("1"), std::invalid_argument);
+  BOOST_CHECK_THROW(parse_retention_tiers("1:0"), std::invalid_argument);
+  BOOST_CHECK_THROW(parse_retention_tiers("a:1"), std::invalid_argument);
+}
+
+
+BOOST_AUTO_TEST_CASE(aggregate_tier_test) {
+  Aggregate_tier tier(1, 10);
+  for (int i = 0; i < 100; ++i) {
+    tier.insert(Quantity::fax, 0.1 * i, i % 10);
+  }
+  // The aggregate of the last interval is still being accumulated
+  auto& samples = tier.get_samples();
+  BOOST_TEST(samples.size() == 9);
+  BOOST_TEST(samples.stamp(0) == 0);
+  BOOST_TEST(samples.value(0).mean == 4.5);
+  BOOST_TEST(samples.value(0).min == 0);
+  BOOST_TEST(samples.value(0).max == 9);
+  BOOST_TEST(samples.stamp(8) == 8);
+  tier.insert(Quantity::fax, 12.5, 1);
+  BOOST_TEST(samples.size() == 10);
+  tier.insert(Quantity::fax, 15, 1);
+  // Aggregates more than 10 seconds older than the last are dropped
+  BOOST_TEST(samples.size() == 9);
+  BOOST_TEST(samples.stamp(0) == 2);
+  BOOST_TEST(samples.stamp(8) == 12);
+  BOOST_TEST(samples.value(8).mean == 1);
+
+  // Angles are averaged across the wrap
+  Aggregate_tier angles(1, 10);
+  angles.insert(Quantity::hdg, 0, 2 * M_PI - 0.1);
+  angles.insert(Quantity::hdg, 0.5, 0.3);
+  angles.insert(Quantity::hdg, 1, 0);
+  BOOST_TEST(std::abs(angles.get_samples().value(0).mean - 0.1) < 1e-9);
+  // So are their minimum and maximum
+  BOOST_TEST(std::abs(angles.get_samples().value(0).min - (2 * M_PI - 0.1)) < 1e-9);
+  BOOST_TEST(std::abs(angles.get_samples().value(0).max - 0.3) < 1e-9);
+  Aggregate_tier yaw(1, 10);
+  yaw.insert(Quantity::ya, 0, M_PI - 0.1);
+  yaw.insert(Quantity::ya, 0.2, -M_PI + 0.2);
+  yaw.insert(Quantity::ya, 0.4, M_PI - 0.3);
+  yaw.insert(Quantity::ya, 1, 0);
+  BOOST_TEST(std::abs(yaw.get_samples().value(0).mean - (M_PI - 0.2 / 3)) < 1e-9);
+  BOOST_TEST(std::abs(yaw.get_samples().value(0).min - (M_PI - 0.3)) < 1e-9);
+  BOOST_TEST(std::abs(yaw.get_samples().value(0).max - (-M_PI + 0.2)) < 1e-9);
+}
+
+
+BOOST_AUTO_TEST_CASE(cache_tiers_test) {
+  Sample_device dev;
+  dev.set_name("tiers");
+  dev.set_cache_tiers(parse_retention_tiers("0:10,1:100,10:1000"));
+  for (int i = 0; i < 5000; ++i) {
+    dev.insert_value(Stamped_quantity(i % 10, 0.1 * i, Quantity::fax));
+  }
+  BOOST_TEST(dev.get_samples(Quantity::fax).front().stamp == 489.9, boost::test_tools::tolerance(1e-9));
+  BOOST_TEST(dev.get_aggregates(Quantity::fax).size() == 2);
+  BOOST_TEST(dev.get_aggregates(Quantity::fax)[0].get_samples().size() == 101);
+  BOOST_TEST(dev.get_aggregates(Quantity::fax)[1].get_samples().size() == 49);
+  BOOST_TEST(dev.get_cache_memory_size() > 0);
+
+  // The raw samples cover this range
+  History_writer raw(dev, {Quantity::fax}, 495, 496, 0);
+  std::string json;
+  while (raw.write(json, 0x4000));
+  BOOST_TEST(json.find("\"fax\":[[495,0],") != json.npos);
+
+  // Only the 1 second aggregates cover this range
+  History_writer seconds(dev, {Quantity::fax}, 450, 452, 0);
+  json.clear();
+  while (seconds.write(json, 0x4000));
+  BOOST_TEST(json.find("\"fax\":[[450,4.5,0,9],[451,4.5,0,9],[452,4.5,0,9]]") != json.npos);
+
+  // Only the 10 second aggregates cover this range
+  History_writer minutes(dev, {Quantity::fax}, 0, 20, 0);
+  json.clear();
+  while (minutes.write(json, 0x4000));
+  BOOST_TEST(json.find("\"fax\":[[0,4.5,0,9],[10,4.5,0,9],[20,4.5,0,9]]") != json.npos);
 }
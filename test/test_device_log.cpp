@@ -0,0 +1,221 @@
+#define BOOST_TEST_MODULE device_log_test
+
+#include "../src/device_log.h"
+
+#include <sstream>
+#include <fstream>
+
+#include "test_common.h"
+
+
+struct Log_dir {
+  Log_dir(): path(fs::temp_directory_path() / fs::unique_path("device_log_test_%%%%%%%%")) {
+    fs::create_directories(path);
+  }
+
+  ~Log_dir() {
+    fs::remove_all(path);
+  }
+
+  std::vector<fs::path> files() const {
+    std::vector<fs::path> result;
+    for (auto& entry: fs::directory_iterator(path)) {
+      result.push_back(entry.path());
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  fs::path path;
+};
+
+
+static std::vector<Stamped_quantity> read_log(const fs::path& file) {
+  std::vector<Stamped_quantity> result;
+  std::ifstream in(file.string(), std::ios_base::binary);
+  Device_log_reader reader(in);
+  Stamped_quantity value;
+  while (reader.read(value)) {
+    result.push_back(value);
+  }
+  return result;
+}
+
+
+BOOST_AUTO_TEST_CASE(plain_test) {
+  Log_dir dir;
+  {
+    Device_log_writer writer("id_0", "mti", dir.path, 32, 1024 * 1024);
+    for (int i = 0; i < 3000; ++i) {
+      writer.write(Stamped_quantity(0.5 * i, 1000 + 0.01 * i, static_cast<Quantity>(i % 30)));
+    }
+  }
+  auto files = dir.files();
+  BOOST_TEST(files.size() == 1);
+  BOOST_TEST(files[0].extension() == ".sdl");
+  auto values = read_log(files[0]);
+  BOOST_TEST(values.size() == 3000);
+  BOOST_TEST(values[2999].stamp == 1000 + 0.01 * 2999);
+  BOOST_TEST(values[2999].value == 0.5 * 2999);
+  BOOST_TEST((values[2999].quantity == static_cast<Quantity>(2999 % 30)));
+
+  std::ifstream in(files[0].string(), std::ios_base::binary);
+  Device_log_reader reader(in);
+  BOOST_TEST(reader.get_device_id() == "id_0");
+  BOOST_TEST(reader.get_device_name() == "mti");
+  BOOST_TEST(reader.get_quantity_name(Quantity::fax) == "fax");
+}
+
+
+BOOST_AUTO_TEST_CASE(delta_test) {
+  Log_dir dir;
+  {
+    Device_log_writer writer("id_1", "mti", dir.path, 32, 1024 * 1024, device_log::Format::delta);
+    for (int i = 0; i < 3000; ++i) {
+      writer.write(Stamped_quantity(0.5 * i, 1000 + 0.01 * i, static_cast<Quantity>(i % 30)));
+    }
+    // Going back in time starts a new block
+    writer.write(Stamped_quantity(1, 10, Quantity::ro));
+  }
+  auto files = dir.files();
+  BOOST_TEST(files.size() == 1);
+  auto values = read_log(files[0]);
+  BOOST_TEST(values.size() == 3001);
+  for (int i = 0; i < 3000; ++i) {
+    BOOST_TEST(std::abs(values[i].stamp - (1000 + 0.01 * i)) < 1e-6);
+  }
+  BOOST_TEST(values[3000].stamp == 10);
+  BOOST_TEST(values[3000].value == 1);
+  // Delta encoded records are 4 bytes smaller
+  BOOST_TEST(fs::file_size(files[0]) < 3001 * (device_log::delta_record_size + 1));
+}
+
+
+BOOST_AUTO_TEST_CASE(rotation_test) {
+  Log_dir dir;
+  {
+    Device_log_writer writer("id_2", "gps", dir.path, 3, 4096);
+    for (int i = 0; i < 2000; ++i) {
+      writer.write(Stamped_quantity(i, i, Quantity::la));
+    }
+  }
+  auto files = dir.files();
+  BOOST_TEST(files.size() == 3);
+  size_t count = 0;
+  double last = 0;
+  for (auto& file: files) {
+    BOOST_TEST(fs::file_size(file) <= 4096);
+    for (auto& value: read_log(file)) {
+      BOOST_TEST(value.stamp > last);
+      last = value.stamp;
+      ++count;
+    }
+  }
+  BOOST_TEST(last == 1999);
+  BOOST_TEST(count < 2000);
+}
+
+
+BOOST_AUTO_TEST_CASE(csv_test) {
+  Log_dir dir;
+  {
+    Device_log_writer writer("id_3", "gps", dir.path, 32, 1024 * 1024);
+    writer.write(Stamped_quantity(52.5, 1600000000.25, Quantity::la));
+    writer.write(Stamped_quantity(4.25, 1600000000.25, Quantity::lo));
+  }
+  std::ifstream in(dir.files()[0].string(), std::ios_base::binary);
+  std::stringstream out;
+  BOOST_TEST(device_log_to_csv(in, out) == 2);
+  BOOST_TEST(out.str() == "1600000000.25,la,52.5\n1600000000.25,lo,4.25\n");
+
+  std::stringstream invalid("not a device log");
+  BOOST_CHECK_THROW(Device_log_reader reader(invalid), Device_log_exception);
+}
+
+
+BOOST_AUTO_TEST_CASE(text_test) {
+  Log_dir dir;
+  {
+    Device_log_writer writer("id_4", "gps", dir.path, 32, 1024 * 1024, device_log::Format::text);
+    writer.write(Stamped_quantity(52.5, 1600000000.25, Quantity::la));
+    writer.write(Stamped_quantity(4.25, 1600000000.25, Quantity::lo));
+    writer.sync();
+    BOOST_TEST(writer.get_bytes_written() == 44);
+  }
+  auto files = dir.files();
+  BOOST_TEST(files.size() == 1);
+  BOOST_TEST(files[0].extension() == ".log");
+  std::ifstream in(files[0].string());
+  std::stringstream content;
+  content << in.rdbuf();
+  BOOST_TEST(content.str() == "1600000000.25,la,52.5\n1600000000.25,lo,4.25\n");
+}
+
+
+BOOST_AUTO_TEST_CASE(service_test) {
+  Log_dir dir;
+  Device_log_channel_ptr channel;
+  Device_log_channel_ptr small;
+  {
+    Device_log_service service;
+    service.set_sync_interval(0.1);
+    channel = service.open("id_5", "mti", dir.path, 32, 1024 * 1024, device_log::Format::binary);
+    small = service.open("id_6", "gps", dir.path, 32, 1024 * 1024, device_log::Format::delta, 16);
+    for (int i = 0; i < 3000; ++i) {
+      channel->push(Stamped_quantity(i, 1000 + 0.01 * i, Quantity::fax));
+    }
+    // Samples exceeding the queue size are dropped
+    for (int i = 0; i < 20; ++i) {
+      small->push(Stamped_quantity(i, 1000 + 0.01 * i, Quantity::la));
+    }
+    BOOST_TEST(small->get_dropped() == 4);
+    channel->close();
+    // Service writes out queued samples on destruction
+  }
+  BOOST_TEST(channel->get_queue_depth() == 0);
+  BOOST_TEST(channel->get_dropped() == 0);
+  BOOST_TEST(channel->get_bytes_written() > 3000 * device_log::plain_record_size);
+  auto files = dir.files();
+  BOOST_TEST(files.size() == 2);
+  auto values = read_log(files[0]);
+  BOOST_TEST(values.size() == 3000);
+  BOOST_TEST(values[2999].value == 2999);
+  BOOST_TEST(fs::file_size(files[0]) == channel->get_bytes_written());
+  BOOST_TEST(read_log(files[1]).size() == 16);
+}
+
+
+BOOST_AUTO_TEST_CASE(capture_test) {
+  Log_dir dir;
+  Raw_capture_channel_ptr channel;
+  {
+    Device_log_service service;
+    channel = service.open_capture("id_7", "ublox", dir.path, 32, 1024 * 1024, 64);
+    channel->push(1000.5, "\xb5\x62\x01\x07", 4);
+    channel->push(1000.75, "", 0);
+    // Chunk that doesn't fit in the queue is dropped whole
+    channel->push(1001, std::string(64, 'x').data(), 64);
+    channel->push(1001.25, "abc", 3);
+    BOOST_TEST(channel->get_dropped() == 1);
+    channel->close();
+  }
+  auto files = dir.files();
+  BOOST_TEST(files.size() == 1);
+  BOOST_TEST(files[0].extension() == ".raw");
+  BOOST_TEST(fs::file_size(files[0]) == channel->get_bytes_written());
+  std::ifstream in(files[0].string(), std::ios_base::binary);
+  Raw_capture_reader reader(in);
+  BOOST_TEST(reader.get_device_name() == "ublox");
+  double stamp;
+  std::vector<char> data;
+  BOOST_TEST(reader.read(stamp, data));
+  BOOST_TEST(stamp == 1000.5);
+  BOOST_TEST((data == std::vector<char>{'\xb5', '\x62', '\x01', '\x07'}));
+  BOOST_TEST(reader.read(stamp, data));
+  BOOST_TEST(stamp == 1000.75);
+  BOOST_TEST(data.empty());
+  BOOST_TEST(reader.read(stamp, data));
+  BOOST_TEST(stamp == 1001.25);
+  BOOST_TEST(std::string(data.begin(), data.end()) == "abc");
+  BOOST_TEST(!reader.read(stamp, data));
+}
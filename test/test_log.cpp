@@ -16,9 +16,3 @@ BOOST_AUTO_TEST_CASE(log_test) {
   log(level::debug, "Should be in there");
 }
 
-BOOST_AUTO_TEST_CASE(device_log_test) {
-  init_device_log("test_id", "test_device");
-  log("test_device", "Test device message");
-  log(level::info, "Logged test device message");
-}
-
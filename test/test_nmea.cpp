@@ -0,0 +1,177 @@
+#define BOOST_TEST_MODULE nmea_test
+#include "../src/types.h"
+#include "../src/devices/nmea.h"
+#include "../src/socket.h"
+#include "../src/quantities.h"
+
+#include "test_common.h"
+
+#include <string>
+#include <map>
+#include <boost/property_tree/ptree.hpp>
+
+namespace utf = boost::unit_test;
+namespace tt = boost::test_tools;
+namespace prtr = boost::property_tree;
+
+using namespace nmea;
+
+
+//! Return sentence with start, checksum and end of line added
+std::string sentence(const std::string& body) {
+  uint8_t checksum = 0;
+  for (char c: body)
+    checksum ^= static_cast<uint8_t>(c);
+  return fmt::format("${}*{:02X}\r\n", body, checksum);
+}
+
+
+std::map<Quantity, double> parse(parser::Nmea_parser& parser, const std::string& data, const double stamp=10.0) {
+  parser.add_and_parse(stamp, data.begin(), data.end());
+  std::map<Quantity, double> found;
+  for (auto& value: parser.get_values()) {
+    found[value.quantity] = value.value;
+  }
+  parser.get_values().clear();
+  return found;
+}
+
+
+BOOST_AUTO_TEST_CASE(construction_test) {
+  auto device = std::make_shared<Generic_NMEA<Socket, Ctx> >();
+  prtr::ptree options;
+  options.put("talkers", "GP, HE");
+  device->set_options(options);
+  BOOST_TEST(device->get_link_statistics()->packets == 0);
+}
+
+
+BOOST_AUTO_TEST_CASE(position_test, * utf::tolerance(0.000001)) {
+  parser::Nmea_parser parser;
+  auto found = parse(parser,
+      sentence("GPGGA,123519,4807.038,N,01131.000,W,1,08,0.9,545.4,M,46.9,M,,"));
+  BOOST_TEST(found.size() == 4);
+  BOOST_TEST(found[Quantity::la] == deg_to_rad(48 + 7.038 / 60));
+  BOOST_TEST(found[Quantity::lo] == -deg_to_rad(11 + 31.0 / 60));
+  BOOST_TEST(found[Quantity::hmsl] == 545.4);
+  BOOST_TEST(found[Quantity::hg84] == 592.3);
+
+  // No fix
+  found = parse(parser, sentence("GPGGA,123519,,,,,0,00,,,M,,M,,"));
+  BOOST_TEST(found.size() == 0);
+
+  found = parse(parser, sentence("GPVTG,054.7,T,034.4,M,005.5,N,010.2,K,A"));
+  BOOST_TEST(found[Quantity::crs] == deg_to_rad(54.7));
+  BOOST_TEST(found[Quantity::vog] == 10.2 / 3.6);
+
+  found = parse(parser, sentence("GPGST,172814.0,0.006,0.023,0.020,273.6,0.3,0.4,0.5"));
+  BOOST_TEST(found[Quantity::hacc] == 0.5);
+  BOOST_TEST(found[Quantity::vacc] == 0.5);
+  BOOST_TEST(parser.get_statistics().packets == 4);
+}
+
+
+BOOST_AUTO_TEST_CASE(time_test, * utf::tolerance(0.000001)) {
+  parser::Nmea_parser parser;
+  // Time of day without date has no time
+  auto found = parse(parser, sentence("GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,,M,,"));
+  BOOST_TEST(found.count(Quantity::ut) == 0);
+
+  found = parse(parser, sentence("GPRMC,123519.50,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W"));
+  BOOST_TEST(found[Quantity::ut] == compose_time_value(1994, 3, 23, 12, 35, 19, 500000000));
+  BOOST_TEST(found[Quantity::vog] == 22.4 * 1852 / 3600);
+  BOOST_TEST(found[Quantity::crs] == deg_to_rad(84.4));
+
+  found = parse(parser, sentence("GPZDA,201530.00,04,07,2002,00,00"));
+  BOOST_TEST(found[Quantity::ut] == compose_time_value(2002, 7, 4, 20, 15, 30, 0));
+
+  // Sentence times are mapped to hub time
+  prtr::ptree options;
+  options.put("device_time", true);
+  parser.set_options(options);
+  parse(parser, sentence("GPZDA,235959.00,04,07,2002,00,00"), 100.0);
+  std::string data = sentence("HEHDT,274.07,T") + sentence("GPGGA,000000.50,4807.038,N,01131.000,E,1,08,0.9,545.4,M,,M,,");
+  parser.add_and_parse(101.7, data.begin(), data.end());
+  auto& values = parser.get_values();
+  BOOST_TEST(values.size() == 4);
+  BOOST_TEST(values[0].quantity == Quantity::hdg);
+  BOOST_TEST(values[0].stamp == 101.7);
+  // Passed midnight
+  BOOST_TEST(values[1].stamp == 101.5);
+  values.clear();
+}
+
+
+BOOST_AUTO_TEST_CASE(attitude_test, * utf::tolerance(0.000001)) {
+  parser::Nmea_parser parser;
+  auto found = parse(parser, sentence("PASHR,085335.000,224.19,T,-01.26,+00.83,+0.01,0.101,0.113,2.145,1,0"));
+  BOOST_TEST(found[Quantity::hdg] == deg_to_rad(224.19));
+  BOOST_TEST(found[Quantity::ro] == deg_to_rad(-1.26));
+  BOOST_TEST(found[Quantity::pi] == deg_to_rad(0.83));
+  BOOST_TEST(found[Quantity::z] == -0.01);
+  BOOST_TEST(found[Quantity::hdac] == deg_to_rad(2.145));
+
+  found = parse(parser, sentence("PSAT,HPR,130041.00,276.45,-1.23,0.52,N"));
+  BOOST_TEST(found.size() == 3);
+  BOOST_TEST(found[Quantity::hdg] == deg_to_rad(276.45));
+  BOOST_TEST(found[Quantity::pi] == deg_to_rad(-1.23));
+  BOOST_TEST(found[Quantity::ro] == deg_to_rad(0.52));
+
+  found = parse(parser, sentence("HEROT,-12.0,A") + sentence("HEROT,5.0,V"));
+  BOOST_TEST(found.size() == 1);
+  BOOST_TEST(found[Quantity::yr] == deg_to_rad(-0.2));
+}
+
+
+BOOST_AUTO_TEST_CASE(wind_test, * utf::tolerance(0.000001)) {
+  parser::Nmea_parser parser;
+  prtr::ptree options;
+  options.put("true_wind_angle", "cst6");
+  parser.set_options(options);
+  auto found = parse(parser, sentence("WIMWV,045.0,R,10.0,N,A") + sentence("WIMWV,090.0,T,36.0,K,A"));
+  BOOST_TEST(found[Quantity::cst0] == deg_to_rad(45.0));
+  BOOST_TEST(found[Quantity::cst1] == 10.0 * 1852 / 3600);
+  BOOST_TEST(found[Quantity::cst6] == deg_to_rad(90.0));
+  BOOST_TEST(found[Quantity::cst3] == 10.0);
+
+  found = parse(parser, sentence("WIMWV,045.0,R,10.0,N,V"));
+  BOOST_TEST(found.size() == 0);
+}
+
+
+BOOST_AUTO_TEST_CASE(filter_test) {
+  parser::Nmea_parser parser;
+  prtr::ptree options;
+  options.put("talkers", "HE");
+  options.put("sentences", "HDT,ROT");
+  parser.set_options(options);
+  auto found = parse(parser, sentence("GPHDT,274.07,T") + sentence("HEHDT,90.0,T")
+      + sentence("HEVTG,054.7,T,034.4,M,005.5,N,010.2,K,A"));
+  BOOST_TEST(found.size() == 1);
+  BOOST_TEST(found[Quantity::hdg] == deg_to_rad(90.0));
+}
+
+
+BOOST_AUTO_TEST_CASE(errors_test) {
+  parser::Nmea_parser parser;
+  std::string good = sentence("HEHDT,90.0,T");
+  std::string bad = good;
+  bad[7] = '8';
+  std::string data = "junk" + bad + good.substr(0, 8) + good + "$HEHDT,91.0,T\r\n" + good.substr(0, 5);
+  auto found = parse(parser, data);
+  auto& statistics = parser.get_statistics();
+  BOOST_TEST(statistics.checksum_errors == 1);
+  // The good sentence and the sentence without checksum
+  BOOST_TEST(statistics.packets == 2);
+  BOOST_TEST(statistics.junk_bytes == 12);
+  BOOST_TEST(statistics.resyncs == 2);
+  BOOST_TEST(found[Quantity::hdg] == deg_to_rad(91.0), tt::tolerance(0.000001));
+  // Incomplete sentence waits for more data
+  BOOST_TEST(parser.buffer.size() == 5);
+  data = good.substr(5);
+  parse(parser, data);
+  BOOST_TEST(statistics.packets == 3);
+  BOOST_TEST(parser.buffer.size() == 0);
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
@@ -0,0 +1,114 @@
+#define BOOST_TEST_MODULE packet_test
+#include <boost/test/unit_test.hpp>
+
+#include "../src/packet.h"
+#include "../src/types.h"
+
+#include <string>
+#include <cstdint>
+
+namespace tt = boost::test_tools;
+
+
+// Toy protocol: sync byte, big endian 16 bit length, id and xor checksum
+using Framing = packet::Framing<packet::Sync<0xAA>, 3,
+    packet::Header_field<0, uint16_t, packet::Endian::big>, packet::Header_field<2, uint8_t>,
+    packet::Xor8, 0x40>;
+
+inline constexpr auto attitude = packet::message(uint8_t(1), 9,
+    packet::field<int16_t, packet::Endian::big>(0, Quantity::ro, 0.01),
+    packet::field<int16_t, packet::Endian::big>(2, Quantity::pi, 0.01),
+    packet::field<float, packet::Endian::big>(4, Quantity::hdg),
+    packet::field<uint8_t>(8, Quantity::yr, 1.0, packet::bits_set(8, 0x80)));
+
+// Any size holding the field
+inline constexpr auto depth = packet::message(uint8_t(2), 0,
+    packet::field<uint32_t, packet::Endian::big>(0, Quantity::z, 1E-3));
+
+using Toy_parser = packet::Parser<Framing, attitude, depth>;
+
+
+bytes_t frame(const uint8_t id, cbytes_t& payload) {
+  bytes_t result = { 0xAA, static_cast<uint8_t>(payload.size() >> 8),
+      static_cast<uint8_t>(payload.size()), id };
+  result.insert(result.end(), payload.begin(), payload.end());
+  uint8_t checksum = 0;
+  for (size_t i = 1; i < result.size(); ++i)
+    checksum ^= result[i];
+  result.push_back(checksum);
+  return result;
+}
+
+
+BOOST_AUTO_TEST_CASE(description_test) {
+  static_assert(attitude.get_min_size() == 9);
+  static_assert(depth.get_min_size() == 4);
+  static_assert(Framing::overhead == 5);
+  cbytes_t data = { 0x12, 0x34 };
+  uint16_t big = packet::get<uint16_t, packet::Endian::big>(data.data());
+  BOOST_TEST(big == 0x1234);
+  BOOST_TEST(packet::get<uint16_t>(data.data()) == 0x3412);
+}
+
+
+BOOST_AUTO_TEST_CASE(parse_test) {
+  // 1.5 as big endian float
+  bytes_t payload = { 0x01, 0x02, 0xFF, 0x38, 0x3F, 0xC0, 0x00, 0x00, 0x85 };
+  Bytes stream;
+  stream << frame(1, payload) << frame(2, { 0x00, 0x00, 0x30, 0x39, 0x00 })
+      << frame(3, { 0x01 }) << frame(2, { 0x01 });
+  payload[8] = 0x05;
+  stream << frame(1, payload);
+
+  // Byte by byte gives the same values as all at once
+  for (size_t chunk: { size_t(1), stream.size() }) {
+    Toy_parser parser;
+    Stamped_quantities values;
+    for (size_t i = 0; i < stream.size(); i += chunk) {
+      auto end = stream.begin() + std::min(i + chunk, stream.size());
+      parser.add_and_parse(2.0, stream.begin() + i, end);
+      values.insert(values.end(), parser.get_values().begin(), parser.get_values().end());
+      parser.get_values().clear();
+    }
+    // Unknown id and too short payload add nothing, the condition fails for the last
+    BOOST_TEST(values.size() == 8);
+    BOOST_TEST(values[0].quantity == Quantity::ro);
+    BOOST_TEST(values[0].value == 2.58, tt::tolerance(1E-9));
+    BOOST_TEST(values[1].value == -2.00, tt::tolerance(1E-9));
+    BOOST_TEST(values[2].value == 1.5);
+    BOOST_TEST(values[3].value == 0x85);
+    BOOST_TEST(values[4].quantity == Quantity::z);
+    BOOST_TEST(values[4].value == 12.345, tt::tolerance(1E-9));
+    BOOST_TEST(values[4].stamp == 2.0);
+    BOOST_TEST(values[7].quantity == Quantity::hdg);
+    BOOST_TEST(parser.get_statistics().packets == 5);
+    BOOST_TEST(parser.buffer.empty());
+  }
+}
+
+
+BOOST_AUTO_TEST_CASE(errors_test) {
+  bytes_t good = frame(2, { 0x00, 0x00, 0x00, 0x01 });
+  bytes_t corrupt = good;
+  corrupt[5] ^= 0x01;
+  // Longer than the maximum payload
+  bytes_t invalid = { 0xAA, 0x01, 0x00 };
+  // False sync with a length running into the next frame
+  bytes_t false_sync = { 0xAA, 0x00, 0x02, 0x01 };
+  Bytes stream = { 0x01, 0x02 };
+  stream << good << corrupt << invalid << good << false_sync << good
+      << bytes_t(good.begin(), good.begin() + 3);
+  Toy_parser parser;
+  parser.add_and_parse(1.0, stream.begin(), stream.end());
+  BOOST_TEST(parser.get_values().size() == 3);
+  auto& statistics = parser.get_statistics();
+  BOOST_TEST(statistics.packets == 3);
+  BOOST_TEST(statistics.checksum_errors == 2);
+  // A frame failing its checksum is searched for a sync from its second byte
+  BOOST_TEST(statistics.junk_bytes == 2 + corrupt.size() + invalid.size() + false_sync.size());
+  BOOST_TEST(statistics.resyncs == 3);
+  // The partial frame waits for the rest
+  BOOST_TEST(parser.buffer.size() == 3);
+}
+
+// vim: autoindent syntax=cpp expandtab tabstop=2 softtabstop=2 shiftwidth=2
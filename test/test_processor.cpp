@@ -124,6 +124,20 @@ BOOST_AUTO_TEST_CASE(random_statistics_test, * ut::tolerance(0.00000001)) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(statistics_filter_test) {
+  Statistics stats;
+  stats.set_filter("ax");
+  BOOST_TEST(stats.get_subscription().count() == 1);
+  // Values of other quantities are ignored when inserted regardless
+  std::vector<Stamped_quantity> values = {
+    { 1.0, 0.1, Quantity::ax }, { 2.0, 0.1, Quantity::ay }, { 3.0, 0.2, Quantity::ax }
+  };
+  stats.insert_values(values);
+  stats.insert_value({ 4.0, 0.2, Quantity::ay });
+  BOOST_TEST(stats[Statistic::size() * static_cast<int>(Quantity::ax) + Statistic::f_n] == 2);
+  BOOST_TEST(stats[Statistic::size() * static_cast<int>(Quantity::ay) + Statistic::f_n] == 0);
+}
+
 BOOST_AUTO_TEST_CASE(horizontal_acceleration_peak_test, * ut::tolerance(0.00000001)) {
   Acceleration_history history;
 
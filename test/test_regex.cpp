@@ -144,3 +144,56 @@ BOOST_FIXTURE_TEST_CASE(full_test, Log, * utf::tolerance(0.00001)) {
   value = dev->get_value(Quantity::vx);
   BOOST_TEST(value == 1587575443.782);
 }
+
+
+BOOST_AUTO_TEST_CASE(split_captures_test) {
+  using namespace regexp::parser;
+  std::string skeleton;
+  Capture_spans captures;
+  BOOST_TEST(split_captures("^[0-2],([0-9]+),(?:a|b)[()]\\(x\\)$", skeleton, captures));
+  BOOST_TEST(skeleton == "^[0-2],[0-9]+,(?:a|b)[()]\\(x\\)$");
+  BOOST_TEST(captures.size() == 1);
+  BOOST_TEST(captures[0].begin == 7);
+  BOOST_TEST(captures[0].end == 13);
+  BOOST_TEST(join_captures(skeleton, captures) == "^[0-2],([0-9]+),(?:a|b)[()]\\(x\\)$");
+  // Removing these groups would change what is matched
+  BOOST_TEST(!split_captures("^([0-9],)+$", skeleton, captures));
+  BOOST_TEST(!split_captures("^(a|b)$", skeleton, captures));
+  BOOST_TEST(!split_captures("^(a)\\1$", skeleton, captures));
+}
+
+
+BOOST_AUTO_TEST_CASE(line_mode_test, * utf::tolerance(0.00001)) {
+  prtr::ptree options;
+  options.put("ax.filter", "^([0-9.]+),[0-9.]+,[0-9.]+$");
+  options.put("ay.filter", "^[0-9.]+,([0-9.]+),[0-9.]+$");
+  options.put("az.filter", "^[0-9.]+,[0-9.]+,([0-9.]+)$");
+  options.put("az.multiplier0", 2.0);
+  options.put("vx.filter", "^speed ([0-9]+),([0-9]+)$");
+  options.put("vx.multiplier1", 0.01);
+  regexp::parser::Regex_parser parser;
+  parser.set_filters(options);
+  parser.set_line_mode(true);
+  // The acceleration filters become one expression
+  BOOST_TEST(parser.get_pattern_set_count() == 2);
+
+  std::string data = "1.5,2.5,3.5\r\nspeed 3,25\njunk\n4,5,";
+  parser.add_and_parse(1.0, data.begin(), data.end());
+  auto& values = parser.get_values();
+  BOOST_TEST(values.size() == 4);
+  std::map<Quantity, double> found;
+  for (auto& value: values) {
+    found[value.quantity] = value.value;
+  }
+  BOOST_TEST(found[Quantity::ax] == 1.5);
+  BOOST_TEST(found[Quantity::ay] == 2.5);
+  BOOST_TEST(found[Quantity::az] == 7.0);
+  BOOST_TEST(found[Quantity::vx] == 3.25);
+  values.clear();
+
+  // The incomplete line is completed by the next chunk
+  data = "6\n";
+  parser.add_and_parse(2.0, data.begin(), data.end());
+  BOOST_TEST(values.size() == 3);
+  BOOST_TEST(parser.buffer.empty());
+}
@@ -0,0 +1,126 @@
+#define BOOST_TEST_MODULE replay_test
+
+#include "../src/replay.h"
+
+#include "test_common.h"
+
+#include <chrono>
+
+
+struct Capture_file {
+  Capture_file(): dir(fs::temp_directory_path() / fs::unique_path("replay_test_%%%%%%%%")) {
+    fs::create_directories(dir);
+    {
+      Device_log_service service;
+      auto channel = service.open_capture("id_0", "test", dir, 32, 1024 * 1024);
+      channel->push(100.0, "abc", 3);
+      channel->push(100.2, "defgh", 5);
+      channel->push(100.3, "i", 1);
+      channel->close();
+    }
+    path = fs::directory_iterator(dir)->path();
+  }
+
+  ~Capture_file() {
+    fs::remove_all(dir);
+  }
+
+  fs::path dir;
+  fs::path path;
+};
+
+
+static std::vector<std::string> read_all(Replay_port& port, const size_t size=0x100) {
+  std::vector<std::string> result;
+  asio::io_context& ctx = Ctx::get_context();
+  asio::spawn(ctx, [&](asio::yield_context yield) {
+      std::vector<char> buffer(size);
+      boost::system::error_code ec;
+      while (true) {
+        size_t bytes_read = port.async_read_some(asio::buffer(buffer), yield[ec]);
+        if (ec) {
+          BOOST_TEST((ec == asio::error::eof));
+          break;
+        }
+        result.push_back(std::string(buffer.data(), bytes_read));
+      }
+    });
+  ctx.restart();
+  ctx.run();
+  return result;
+}
+
+
+BOOST_AUTO_TEST_CASE(capture_test) {
+  Capture_file capture;
+  Replay_port port(Ctx::get_context());
+  port.open(capture.path.string() + ":0");
+  auto chunks = read_all(port);
+  // Chunks are replayed as they were captured
+  BOOST_TEST((chunks == std::vector<std::string>{"abc", "defgh", "i"}));
+
+  // A chunk that doesn't fit in the buffer takes multiple reads
+  port.open(capture.path.string() + ":0");
+  chunks = read_all(port, 2);
+  BOOST_TEST((chunks == std::vector<std::string>{"ab", "c", "de", "fg", "h", "i"}));
+}
+
+
+BOOST_AUTO_TEST_CASE(timing_test) {
+  Capture_file capture;
+  Replay_port port(Ctx::get_context());
+  auto start = std::chrono::steady_clock::now();
+  port.open(capture.path.string() + ":2");
+  auto chunks = read_all(port);
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  BOOST_TEST(chunks.size() == 3);
+  // Last chunk was captured 0.3 s after the first
+  BOOST_TEST(elapsed >= 0.15);
+  BOOST_TEST(elapsed < 1.0);
+}
+
+
+BOOST_AUTO_TEST_CASE(plain_test) {
+  Replay_port port(Ctx::get_context());
+  port.open("data/ublox_bin.log:0");
+  auto chunks = read_all(port, 0x1000);
+  BOOST_TEST(chunks.size() > 1);
+  BOOST_TEST(chunks[0].size() == Replay_port::plain_chunk_size);
+  BOOST_TEST(chunks[0].substr(0, 2) == "\xb5\x62");
+}
+
+
+BOOST_AUTO_TEST_CASE(script_test) {
+  Capture_file capture;
+  Replay_port port(Ctx::get_context());
+  port.set_script(Replay_script{
+      { { 0x01, 0x02 }, { 'o', 'k' } },
+      { { 0x01 }, { 'n', 'o' } },
+    });
+  port.open(capture.path.string() + ":0");
+  std::string response;
+  asio::io_context& ctx = Ctx::get_context();
+  asio::spawn(ctx, [&](asio::yield_context yield) {
+      std::vector<char> buffer(0x100);
+      asio::async_write(port, asio::buffer(bytes_t{ 0x01, 0x02, 0x03 }), yield);
+      size_t bytes_read = port.async_read_some(asio::buffer(buffer), yield);
+      response = std::string(buffer.data(), bytes_read);
+      asio::async_write(port, asio::buffer(bytes_t{ 0x01, 0x03 }), yield);
+      bytes_read = port.async_read_some(asio::buffer(buffer), yield);
+      response += std::string(buffer.data(), bytes_read);
+      // Unknown commands are ignored
+      asio::async_write(port, asio::buffer(bytes_t{ 0x03 }), yield);
+      bytes_read = port.async_read_some(asio::buffer(buffer), yield);
+      response += std::string(buffer.data(), bytes_read);
+    });
+  ctx.restart();
+  ctx.run();
+  BOOST_TEST(response == "oknoabc");
+}
+
+
+BOOST_AUTO_TEST_CASE(invalid_test) {
+  Replay_port port(Ctx::get_context());
+  BOOST_CHECK_THROW(port.open("data/does_not_exist.log"), std::exception);
+  BOOST_CHECK_THROW(port.open("data/ublox_bin.log:-1"), std::exception);
+}
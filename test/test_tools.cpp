@@ -62,3 +62,40 @@ BOOST_AUTO_TEST_CASE(test_locale)
 {
   std::setlocale(LC_TIME, "de_DE.UTF8");
 }
+
+BOOST_AUTO_TEST_CASE(test_spsc_queue)
+{
+  Spsc_queue<int> queue(5);
+  BOOST_TEST(queue.capacity() == 8);
+  BOOST_TEST(queue.empty());
+  for (int i = 0; i < 8; ++i) {
+    BOOST_TEST(queue.push(i));
+  }
+  BOOST_TEST(!queue.push(8));
+  BOOST_TEST(queue.size() == 8);
+  std::vector<int> items;
+  BOOST_TEST(queue.consume_all([&items](int i) { items.push_back(i); }) == 8);
+  BOOST_TEST(items.size() == 8);
+  BOOST_TEST(items[7] == 7);
+  BOOST_TEST(queue.empty());
+  // Wrap around
+  BOOST_TEST(queue.push(9));
+  BOOST_TEST(queue.push(10));
+  items.clear();
+  queue.consume_all([&items](int i) { items.push_back(i); });
+  BOOST_TEST((items == std::vector<int>{9, 10}));
+
+  // Bulk push wrapping around, consumed as two spans
+  std::vector<int> first{1, 2, 3, 4, 5};
+  std::vector<int> second{6, 7};
+  BOOST_TEST(queue.push(Span<const int>(first), Span<const int>(second)));
+  BOOST_TEST(!queue.push(Span<const int>(first)));
+  items.clear();
+  int spans = 0;
+  BOOST_TEST(queue.consume_spans([&](Span<const int> span) {
+      items.insert(items.end(), span.begin(), span.end());
+      ++spans;
+    }) == 7);
+  BOOST_TEST(spans == 2);
+  BOOST_TEST((items == std::vector<int>{1, 2, 3, 4, 5, 6, 7}));
+}
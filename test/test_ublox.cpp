@@ -62,3 +62,23 @@ BOOST_AUTO_TEST_CASE(connection_test, *ut::precondition(ublox_available)) {
   ublox.disconnect();
   BOOST_TEST(!ublox.is_connected());
 }
+
+BOOST_AUTO_TEST_CASE(replay_test) {
+  asio::io_context& ctx = Ctx::get_context();
+  NEO_M8U_replay<Ctx> ublox;
+  ublox.set_name("ublox-replay");
+  ublox.set_connection_string("data/ublox_bin.log:0");
+  asio::spawn(ctx,
+      [&](asio::yield_context yield) {
+        ublox.connect(yield);
+      }
+  );
+  ctx.restart();
+  ctx.run_for(std::chrono::seconds(5));
+  // Initialization is answered by the replay script, after which the recorded data is parsed
+  BOOST_TEST(ublox.get_id() == "ublox_0000000000");
+  Value_type value;
+  BOOST_TEST(ublox.get_value(Quantity::fax, value));
+  // Replay ends with end of file, disconnecting the device
+  BOOST_TEST(!ublox.is_connected());
+}
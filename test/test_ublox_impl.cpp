@@ -11,9 +11,12 @@
 #include <sstream>
 #include <cstdint>
 #include <algorithm>
+#include <fstream>
+#include <iterator>
 
 
 using namespace ubx;
+namespace tt = boost::test_tools;
 
 
 BOOST_AUTO_TEST_CASE(ublox_parse_acceleration_test) {
@@ -56,3 +59,302 @@ BOOST_AUTO_TEST_CASE(sensor_data_test) {
   BOOST_TEST(sd.get_value(25600) == (M_PI * -1.0 / (4096.0 * 180.0)));
   BOOST_TEST(sd.get_value(25600) == Data_stamp{-1.0});
 }
+
+BOOST_AUTO_TEST_CASE(ublox_device_time_test) {
+  auto att_packet = [](uint32_t itow) {
+    Bytes payload;
+    payload << endian::order::little << itow << 0u
+        << 100000u << 200000u << 300000u  // roll - heading
+        << 100u << 100u << 100u;  // accroll - accheading
+    return parser::Data_packet(command::cls_nav, command::nav::att, payload).get_packet();
+  };
+
+  for (bool device_time: {false, true}) {
+    parser::Ublox_parser parser;
+    parser.set_use_device_time(device_time);
+    auto& values = parser.get_values();
+    // Packets at 10 Hz arriving with a delay of 0, 20 or 40 ms
+    for (uint32_t i = 0; i < 30; ++i) {
+      cbytes_t data = att_packet(1000 + 100 * i);
+      parser.add_and_parse(5.0 + 0.1 * i + (i % 3) * 0.02, data.begin(), data.end());
+    }
+    BOOST_TEST(values.size() == 180);
+    for (size_t i = 15; i < 30; ++i) {
+      double expected = device_time ? 5.0 + 0.1 * i : 5.0 + 0.1 * i + (i % 3) * 0.02;
+      BOOST_TEST(values[6 * i].stamp == expected, tt::tolerance(1E-9));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ublox_hnr_nav_test) {
+  auto att_packet = [](byte_t cls, byte_t id, uint32_t itow) {
+    Bytes payload;
+    payload << endian::order::little << itow << 0u
+        << 100000u << 200000u << 300000u  // roll - heading
+        << 100u << 100u << 100u;  // accroll - accheading
+    return parser::Data_packet(cls, id, payload).get_packet();
+  };
+
+  parser::Ublox_parser parser;
+  parser.set_use_device_time(true);
+  auto& values = parser.get_values();
+  // HNR-ATT at 10 Hz and NAV-ATT at 2 Hz, arriving after the HNR-ATT of the next epoch
+  cbytes_t first = att_packet(command::cls_nav, command::nav::att, 900);
+  parser.add_and_parse(4.95, first.begin(), first.end());
+  for (uint32_t i = 0; i < 30; ++i) {
+    cbytes_t hnr = att_packet(command::cls_hnr, command::hnr::att, 1000 + 100 * i);
+    parser.add_and_parse(5.0 + 0.1 * i, hnr.begin(), hnr.end());
+    if (i % 5 == 1) {
+      cbytes_t nav = att_packet(command::cls_nav, command::nav::att, 1000 + 100 * (i - 1));
+      parser.add_and_parse(5.0 + 0.1 * i + 0.05, nav.begin(), nav.end());
+    }
+  }
+  // NAV-ATT is only decoded until the first HNR message
+  BOOST_TEST(parser.get_statistics().packets == 37);
+  BOOST_TEST(values.size() == 6 * 31);
+  double previous = 0;
+  for (auto& value: values) {
+    if (value.quantity == Quantity::ro) {
+      BOOST_TEST(value.stamp > previous);
+      previous = value.stamp;
+    }
+  }
+}
+
+static bytes_t read_ublox_log() {
+  std::ifstream in("data/ublox_bin.log", std::ios_base::binary);
+  return bytes_t((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+BOOST_AUTO_TEST_CASE(ublox_parser_test) {
+  cbytes_t stream = read_ublox_log();
+  BOOST_TEST(stream.size() > 0);
+  parser::Ublox_parser reference;
+  reference.add_and_parse(1.0, stream.begin(), stream.end());
+  auto& expected = reference.get_values();
+  BOOST_TEST(expected.size() > 0);
+  BOOST_TEST(reference.get_statistics().checksum_errors == 0);
+
+  // Chunk boundaries anywhere in a packet give the same values
+  for (size_t chunk_size: {1, 7, 0x200}) {
+    parser::Ublox_parser parser;
+    for (size_t i = 0; i < stream.size(); i += chunk_size) {
+      auto end = stream.begin() + std::min(i + chunk_size, stream.size());
+      parser.add_and_parse(1.0, stream.begin() + i, end);
+    }
+    auto& values = parser.get_values();
+    BOOST_TEST(values.size() == expected.size());
+    for (size_t i = 0; i < std::min(values.size(), expected.size()); ++i) {
+      BOOST_TEST(values[i].quantity == expected[i].quantity);
+      BOOST_TEST(values[i].value == expected[i].value);
+    }
+    BOOST_TEST(parser.get_statistics().packets == reference.get_statistics().packets);
+    BOOST_TEST(parser.buffer.empty());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ublox_parser_errors_test) {
+  Bytes payload;
+  payload << endian::order::little << 1000u << 0u
+      << 100000u << 200000u << 300000u  // roll - heading
+      << 100u << 100u << 100u;  // accroll - accheading
+  bytes_t good = parser::Data_packet(command::cls_nav, command::nav::att, payload).get_packet();
+  bytes_t corrupt = good;
+  corrupt[10] ^= 0x01;
+  bytes_t unknown = parser::Data_packet(command::cls_mon, command::mon::ver, bytes_t(40, ' ')).get_packet();
+  // Too long to be a valid packet
+  bytes_t invalid = { command::sync_1, command::sync_2, command::cls_nav, command::nav::att, 0xFF, 0xFF };
+  Bytes stream = { 0x01, command::sync_1, 0x02 };
+  stream << good << corrupt << unknown << invalid << good;
+
+  parser::Ublox_parser parser;
+  parser.add_and_parse(1.0, stream.begin(), stream.end());
+  // Junk, the corrupt packet, the unknown message and the invalid length are skipped
+  BOOST_TEST(parser.get_values().size() == 12);
+  auto& statistics = parser.get_statistics();
+  BOOST_TEST(statistics.packets == 2);
+  BOOST_TEST(statistics.checksum_errors == 1);
+  // The leading junk and the second checksum byte of the corrupt packet
+  BOOST_TEST(statistics.junk_bytes == 4);
+  BOOST_TEST(statistics.resyncs == 4);
+}
+
+BOOST_AUTO_TEST_CASE(ublox_parser_skip_test) {
+  Bytes payload;
+  payload << endian::order::little << 1000u << 0u
+      << 100000u << 200000u << 300000u  // roll - heading
+      << 100u << 100u << 100u;  // accroll - accheading
+  bytes_t good = parser::Data_packet(command::cls_nav, command::nav::att, payload).get_packet();
+  bytes_t corrupt = parser::Data_packet(command::cls_mon, command::mon::ver, bytes_t(40, ' ')).get_packet();
+  corrupt[10] ^= 0x01;
+  // False sync of a message we don't decode, running into the next packet
+  bytes_t false_sync = { command::sync_1, command::sync_2, command::cls_mon, command::mon::ver, 0x04, 0x00 };
+  Bytes stream;
+  stream << corrupt << good << false_sync << good << good;
+
+  parser::Ublox_parser parser;
+  parser.add_and_parse(1.0, stream.begin(), stream.end());
+  // Checksums of skipped messages are checked as well
+  auto& statistics = parser.get_statistics();
+  BOOST_TEST(statistics.checksum_errors == 2);
+  BOOST_TEST(statistics.packets == 2);
+  BOOST_TEST(parser.get_values().size() == 12);
+}
+
+BOOST_AUTO_TEST_CASE(ublox_decode_test) {
+  Bytes pvt;
+  pvt << endian::order::little << 1000u << uint16_t(2020)
+      << byte_t(6) << byte_t(15) << byte_t(12) << byte_t(30) << byte_t(0)  // month - sec
+      << byte_t(0x07) << 100u << 0u  // valid - nano
+      << byte_t(3) << byte_t(0x21) << byte_t(0) << byte_t(12)  // fixtype - numsv
+      << 45000000u << 520000000u << 10000u << 5000u << 1500u << 2500u  // lon - vacc
+      << 0u << 0u << 0u << 2500u << 9000000u << 100u << 50000u  // veln - headacc
+      << uint16_t(150) << 0u << uint16_t(0) << 9100000u  // pdop - headveh
+      << uint16_t(0) << uint16_t(0);  // magdec - magacc
+  BOOST_TEST(pvt.size() == 92);
+
+  Stamped_quantities values;
+  BOOST_TEST(!parser::nav_pvt_message.decode(pvt.data(), 72, 2.0, values));
+  BOOST_TEST(parser::nav_pvt_message.decode(pvt.data(), pvt.size(), 2.0, values));
+  const double deg = M_PI / 180.0;
+  std::vector<std::pair<Quantity, double>> expected = {
+    { Quantity::la, 52.0 * deg }, { Quantity::lo, 4.5 * deg }, { Quantity::hacc, 1.5 },
+    { Quantity::hg84, 10.0 }, { Quantity::hmsl, 5.0 }, { Quantity::vacc, 2.5 },
+    { Quantity::vog, 2.5 }, { Quantity::crs, 90.0 * deg }, { Quantity::sacc, 0.1 },
+    { Quantity::cacc, 0.5 * deg }, { Quantity::hdg, 91.0 * deg }, { Quantity::hdac, 0.5 * deg }
+  };
+  // Date and time first
+  BOOST_TEST(values.size() == expected.size() + 1);
+  BOOST_TEST(values[0].quantity == Quantity::ut);
+  for (size_t i = 0; i < std::min(values.size() - 1, expected.size()); ++i) {
+    BOOST_TEST(values[i + 1].quantity == expected[i].first);
+    BOOST_TEST(values[i + 1].value == expected[i].second, tt::tolerance(1E-12));
+    BOOST_TEST(values[i + 1].stamp == 2.0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ublox_hnr_test) {
+  Bytes pvt;
+  pvt << endian::order::little << 1000u << uint16_t(2020)
+      << byte_t(6) << byte_t(15) << byte_t(12) << byte_t(30) << byte_t(0)  // month - sec
+      << byte_t(0x07) << 0u  // valid - nano
+      << byte_t(3) << byte_t(0x11) << uint16_t(0)  // fix - reserved1
+      << 45000000u << 520000000u << 10000u << 5000u  // lon - hmsl
+      << 2500u << 2600u << 9000000u << 9100000u  // gspeed - headveh
+      << 1500u << 2500u << 100u << 50000u  // hacc - headacc
+      << 0u;  // reserved2
+  BOOST_TEST(pvt.size() == 72);
+  Bytes att;
+  att << endian::order::little << 1000u << 0u
+      << 100000u << 200000u << 300000u  // roll - heading
+      << 100u << 100u << 100u;  // accroll - accheading
+  Bytes ins;
+  ins << endian::order::little << 0x3F00u << 0u << 1000u
+      << 1000u << 2000u << 3000u  // xangrate - zangrate
+      << 10u << 20u << 30u;  // xaccel - zaccel
+
+  Bytes stream;
+  stream << parser::Data_packet(command::cls_hnr, command::hnr::pvt, pvt).get_packet()
+      << parser::Data_packet(command::cls_hnr, command::hnr::att, att).get_packet()
+      << parser::Data_packet(command::cls_hnr, command::hnr::ins, ins).get_packet();
+
+  parser::Ublox_parser parser;
+  parser.add_and_parse(1.0, stream.begin(), stream.end());
+  auto& values = parser.get_values();
+  BOOST_TEST(parser.get_statistics().packets == 3);
+  BOOST_TEST(values.size() == 25);
+  auto find = [&](const Quantity quantity) {
+    return std::find_if(values.begin(), values.end(),
+        [quantity](const Stamped_quantity& value) { return value.quantity == quantity; });
+  };
+  BOOST_TEST(find(Quantity::la)->value == 52.0 * M_PI / 180.0, tt::tolerance(1E-12));
+  BOOST_TEST(find(Quantity::lo)->value == 4.5 * M_PI / 180.0, tt::tolerance(1E-12));
+  BOOST_TEST(find(Quantity::hmsl)->value == 5.0, tt::tolerance(1E-12));
+  BOOST_TEST(find(Quantity::vog)->value == 2.5, tt::tolerance(1E-12));
+  BOOST_TEST(find(Quantity::hdg)->value == 91.0 * M_PI / 180.0, tt::tolerance(1E-12));
+  BOOST_TEST(find(Quantity::ya)->value == 3.0 * M_PI / 180.0, tt::tolerance(1E-12));
+  BOOST_TEST(find(Quantity::yr)->value == 30.0 * M_PI / 180.0, tt::tolerance(1E-12));
+  BOOST_TEST(find(Quantity::faz)->value == 3.0, tt::tolerance(1E-12));
+}
+
+BOOST_AUTO_TEST_CASE(ublox_raw_batch_test) {
+  // Three sensors at 100 Hz, with the time tag wrapping around in the last epoch
+  auto raw_packet = [](uint32_t first_tag) {
+    Bytes payload;
+    payload << endian::order::little << 0u;
+    for (uint32_t epoch = 0; epoch < 4; ++epoch) {
+      uint32_t tag = first_tag + 256 * epoch;
+      payload << ((16u << 24) | 0x100u) << tag  // x acceleration
+          << ((5u << 24) | 0x200u) << tag  // yaw rate
+          << ((17u << 24) | 0x300u) << tag;  // y acceleration
+    }
+    return parser::Data_packet(command::cls_esf, command::esf::raw, payload).get_packet();
+  };
+
+  for (bool device_time: {false, true}) {
+    parser::Ublox_parser parser;
+    parser.set_use_device_time(device_time);
+    cbytes_t first = raw_packet(0xFFFFFFFF - 700);
+    parser.add_and_parse(10.0, first.begin(), first.end());
+    auto& values = parser.get_values();
+    BOOST_TEST(values.size() == 12);
+    // One time ordered block per sensor
+    for (size_t i = 0; i < values.size(); ++i) {
+      Quantity expected = i < 4 ? Quantity::rax : i < 8 ? Quantity::ray : Quantity::ryr;
+      BOOST_TEST(values[i].quantity == expected);
+      BOOST_TEST(values[i].stamp == 10.0 - 0.01 * (3 - i % 4), tt::tolerance(1E-9));
+    }
+    values.clear();
+
+    // Next packet arrives 50 ms late, stamped at its sensor time with device time
+    cbytes_t second = raw_packet(0xFFFFFFFF - 700 + 1024);
+    parser.add_and_parse(10.09, second.begin(), second.end());
+    BOOST_TEST(values.size() == 12);
+    double expected = device_time ? 10.04 : 10.09;
+    BOOST_TEST(values[3].stamp == expected, tt::tolerance(1E-9));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ublox_packet_nav_pvt_test) {
+  // The parser generated from the NAV-PVT description adds the NAV-PVT values of Ublox_parser
+  cbytes_t recorded = read_ublox_log();
+  bytes_t stream;
+  for (size_t i = 0; i + 8 <= recorded.size(); ) {
+    if (recorded[i] != command::sync_1 || recorded[i + 1] != command::sync_2) {
+      ++i;
+      continue;
+    }
+    size_t size = 8 + recorded[i + 4] + (recorded[i + 5] << 8);
+    if (i + size > recorded.size()) {
+      break;
+    }
+    if (recorded[i + 2] == command::cls_nav && recorded[i + 3] == command::nav::pvt) {
+      stream.insert(stream.end(), recorded.begin() + i, recorded.begin() + i + size);
+    }
+    i += size;
+  }
+  parser::Ublox_parser reference;
+  reference.add_and_parse(0.0, stream.begin(), stream.end());
+  auto& expected = reference.get_values();
+  BOOST_TEST(expected.size() > 0);
+
+  for (size_t chunk: { size_t(0x10), size_t(0x200) }) {
+    parser::Nav_pvt_parser parser;
+    Stamped_quantities values;
+    for (size_t i = 0; i < stream.size(); i += chunk) {
+      auto end = stream.begin() + std::min(i + chunk, stream.size());
+      parser.add_and_parse(0.0, stream.begin() + i, end);
+      auto& parsed = parser.get_values();
+      values.insert(values.end(), parsed.begin(), parsed.end());
+      parsed.clear();
+    }
+    BOOST_TEST(values.size() == expected.size());
+    for (size_t j = 0; j < std::min(values.size(), expected.size()); ++j) {
+      BOOST_TEST(values[j].quantity == expected[j].quantity);
+      BOOST_TEST(values[j].value == expected[j].value);
+    }
+    BOOST_TEST(parser.get_statistics().packets == reference.get_statistics().packets);
+    BOOST_TEST(parser.get_statistics().checksum_errors == 0);
+    BOOST_TEST(parser.buffer.empty());
+  }
+}
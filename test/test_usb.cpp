@@ -128,3 +128,163 @@ BOOST_AUTO_TEST_CASE(usb_xsens_test, *ut::precondition(usb_available)) {
   BOOST_TEST(response2 == measurement_ok);
   BOOST_TEST(i > 0);
 }
+
+
+// Read pool with libusb submit and cancel replaced, so transfers are completed by the test
+struct Read_pool_fixture {
+  Read_pool_fixture(): context(), strand(context), pool(context, strand), submitted(), cancelled() {
+    pool.set_transfer_calls(
+        [this](libusb_transfer* transfer) { submitted.push_back(transfer); return 0; },
+        [this](libusb_transfer* transfer) { cancelled.push_back(transfer); return 0; });
+    pool.setup(reinterpret_cast<libusb_device_handle*>(&handle), 0x81, 512);
+  }
+
+  // Have libusb return transfer with status and data, as on the event thread
+  void finish(libusb_transfer* transfer, libusb_transfer_status status, const std::string& data="",
+      bool run=true) {
+    std::copy(data.begin(), data.end(), transfer->buffer);
+    transfer->actual_length = static_cast<int>(data.size());
+    transfer->status = status;
+    transfer->callback(transfer);
+    if (run) {
+      poll();
+    }
+  }
+
+  void poll() {
+    context.restart();
+    context.poll();
+  }
+
+  std::string read(size_t max_size=Read_pool::transfer_size) {
+    Usb_read_data data;
+    boost::system::error_code ec;
+    if (!pool.read(data, ec, max_size, pool.get_cancels())) {
+      return "<wait>";
+    }
+    if (ec) {
+      return ec.message();
+    }
+    return std::string(data.begin(), data.end());
+  }
+
+  size_t get_session(libusb_transfer* transfer) {
+    return static_cast<Read_transfer*>(transfer->user_data)->session;
+  }
+
+  int handle = 0;
+  asio::io_context context;
+  asio::io_context::strand strand;
+  Read_pool pool;
+  std::vector<libusb_transfer*> submitted;
+  std::vector<libusb_transfer*> cancelled;
+};
+
+
+BOOST_FIXTURE_TEST_CASE(read_pool_order_test, Read_pool_fixture) {
+  BOOST_TEST(read() == "<wait>");
+  BOOST_TEST(submitted.size() == Read_pool::transfer_count);
+  BOOST_TEST(pool.get_in_flight() == Read_pool::transfer_count);
+
+  // Data is read in order of completion, in place and in parts
+  finish(submitted[1], LIBUSB_TRANSFER_COMPLETED, "first");
+  finish(submitted[0], LIBUSB_TRANSFER_COMPLETED, "second");
+  BOOST_TEST(pool.get_in_flight() == Read_pool::transfer_count - 2);
+  BOOST_TEST(read(3) == "fir");
+  BOOST_TEST(read(3) == "st");
+  BOOST_TEST(submitted.size() == Read_pool::transfer_count);
+  // Consumed transfers are resubmitted on the next read
+  BOOST_TEST(read() == "second");
+  BOOST_TEST(submitted.size() == Read_pool::transfer_count + 1);
+  BOOST_TEST(submitted.back() == submitted[1]);
+  BOOST_TEST(read() == "<wait>");
+  BOOST_TEST(submitted.size() == Read_pool::transfer_count + 2);
+  BOOST_TEST(pool.get_in_flight() == Read_pool::transfer_count);
+
+  // Empty transfers are resubmitted straight away
+  finish(submitted[2], LIBUSB_TRANSFER_COMPLETED);
+  BOOST_TEST(submitted.size() == Read_pool::transfer_count + 3);
+  BOOST_TEST(read() == "<wait>");
+
+  // The ring wraps around, transfers complete in order of submission
+  size_t next = 3;
+  for (int i = 0; i < 10; ++i) {
+    std::string data = std::to_string(i);
+    finish(submitted[next++], LIBUSB_TRANSFER_COMPLETED, data);
+    BOOST_TEST(read() == data);
+  }
+  BOOST_TEST(pool.get_in_flight() == Read_pool::transfer_count - 1);
+}
+
+
+BOOST_FIXTURE_TEST_CASE(read_pool_abort_test, Read_pool_fixture) {
+  BOOST_TEST(read() == "<wait>");
+  size_t cancels = pool.get_cancels();
+  pool.abort_reads();
+  Usb_read_data data;
+  boost::system::error_code ec;
+  BOOST_TEST(pool.read(data, ec, 100, cancels));
+  BOOST_TEST((ec == asio::error::operation_aborted));
+  // Transfers stay in flight for later reads
+  BOOST_TEST(pool.get_in_flight() == Read_pool::transfer_count);
+  finish(submitted[0], LIBUSB_TRANSFER_COMPLETED, "data");
+  BOOST_TEST(read() == "data");
+}
+
+
+BOOST_FIXTURE_TEST_CASE(read_pool_timeout_test, Read_pool_fixture) {
+  BOOST_TEST(read() == "<wait>");
+  // A timeout without a waiting read resubmits the transfer
+  finish(submitted[0], LIBUSB_TRANSFER_TIMED_OUT);
+  BOOST_TEST(read() == "<wait>");
+  BOOST_TEST(submitted.size() == Read_pool::transfer_count + 1);
+
+  // A timeout for a waiting read wakes it with the error
+  bool woken = false;
+  pool.wait([&woken](const boost::system::error_code&) { woken = true; });
+  finish(submitted[1], LIBUSB_TRANSFER_TIMED_OUT);
+  BOOST_TEST(woken);
+  BOOST_TEST(read() == boost::system::errc::make_error_code(boost::system::errc::timed_out).message());
+  BOOST_TEST(read() == "<wait>");
+
+  // A timed out transfer with data delivers its data
+  finish(submitted[2], LIBUSB_TRANSFER_TIMED_OUT, "partial");
+  BOOST_TEST(read() == "partial");
+}
+
+
+BOOST_FIXTURE_TEST_CASE(read_pool_cancel_test, Read_pool_fixture) {
+  BOOST_TEST(read() == "<wait>");
+  finish(submitted[0], LIBUSB_TRANSFER_COMPLETED, "old");
+  std::vector<libusb_transfer*> in_flight(submitted.begin() + 1, submitted.end());
+  size_t old_session = get_session(submitted[0]);
+
+  pool.cancel();
+  BOOST_TEST(pool.is_cancelling());
+  BOOST_TEST(cancelled == in_flight, tt::per_element());
+  BOOST_TEST(pool.get_in_flight() == Read_pool::transfer_count - 1);
+  // An empty completion isn't resubmitted while cancelling
+  finish(in_flight[0], LIBUSB_TRANSFER_COMPLETED);
+  finish(in_flight[1], LIBUSB_TRANSFER_CANCELLED);
+  BOOST_TEST(pool.get_in_flight() == 1U);
+  BOOST_TEST(submitted.size() == Read_pool::transfer_count);
+
+  // A transfer returned before, but handled after the reset isn't read in the new session
+  finish(in_flight[2], LIBUSB_TRANSFER_COMPLETED, "late", false);
+  BOOST_TEST(pool.get_in_flight() == 0U);
+  pool.reset();
+  BOOST_TEST(!pool.is_cancelling());
+  poll();
+  BOOST_TEST(read() == "<wait>");
+
+  // All transfers are submitted again for the new session
+  BOOST_TEST(submitted.size() == 2 * Read_pool::transfer_count);
+  for (size_t i = Read_pool::transfer_count; i < submitted.size(); ++i) {
+    BOOST_TEST(get_session(submitted[i]) != old_session);
+  }
+  // A completion of the old session is ignored, also when its transfer is in flight again
+  pool.complete(static_cast<Read_transfer*>(submitted[0]->user_data), old_session, {}, 3);
+  BOOST_TEST(read() == "<wait>");
+  finish(submitted[0], LIBUSB_TRANSFER_COMPLETED, "new");
+  BOOST_TEST(read() == "new");
+}
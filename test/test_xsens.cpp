@@ -7,6 +7,7 @@
 
 #include "test_common.h"
 
+#include <fstream>
 #include <memory>
 #include <boost/filesystem.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -23,6 +24,60 @@ BOOST_AUTO_TEST_CASE(construction_test) {
   Device_ptr dev = std::make_unique<MTi_G_710<Usb, Ctx> >();
 }
 
+BOOST_AUTO_TEST_CASE(output_rate_options_test) {
+  MTi_670<Serial, Ctx> mti_670;
+  prtr::ptree options;
+  options.put("output_rate.free_acceleration", 400);
+  options.put("output_rate.rate_of_turn", 400);
+  options.put("output_rate.quaternion", 0);
+  // Not a divisor of the maximum rate
+  options.put("output_rate.acceleration", 300);
+  mti_670.set_options(options);
+  bytes_t configuration = mti_670.get_output_configuration();
+  BOOST_TEST(configuration.size() == command::output_configuration.size() - 4);
+  BOOST_TEST(contains(configuration, bytes_t{ 0x40, 0x30, 0x01, 0x90 }));
+  BOOST_TEST(contains(configuration, bytes_t{ 0x80, 0x20, 0x01, 0x90 }));
+  BOOST_TEST(contains(configuration, bytes_t{ 0x40, 0x20, 0x00, 0x64 }));
+
+  // Without GNSS receiver position can't be output
+  MTi_630<Serial, Ctx> mti_630;
+  options.clear();
+  options.put("output_rate.lat_lon", 10);
+  mti_630.set_options(options);
+  BOOST_TEST(mti_630.get_output_configuration() == command::output_configuration_630);
+
+  mti_670.set_connection_string("/dev/ttyUSB0:921600");
+  BOOST_TEST(mti_670.get_baud_rate() == 921600);
+  mti_670.set_connection_string("/dev/ttyUSB0");
+  BOOST_TEST(mti_670.get_baud_rate() == 9600);
+  MTi_G_710<Usb, Ctx> mti_g_710;
+  BOOST_TEST(mti_g_710.get_baud_rate() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(replay_output_configuration_test) {
+  fs::path path = fs::temp_directory_path() / fs::unique_path("xsens_replay_%%%%%%%%.log");
+  std::ofstream(path.string()).close();
+  MTi_670_replay<Ctx> mti_670;
+  prtr::ptree options;
+  options.put("output_rate.free_acceleration", 400);
+  options.put("output_format.orientation", "fp1632");
+  mti_670.set_options(options);
+  mti_670.get_port().open(path.string() + ":0");
+  bool checked = false;
+  asio::io_context& ctx = Ctx::get_context();
+  asio::spawn(ctx,
+      [&](asio::yield_context yield) {
+        checked = mti_670.check_output_configuration(yield);
+      }
+  );
+  ctx.restart();
+  ctx.run();
+  // The replayed device reports the configuration the options ask for
+  BOOST_TEST(checked);
+  mti_670.get_port().close();
+  fs::remove(path);
+}
+
 BOOST_AUTO_TEST_CASE(connection_test_g_710, *ut::precondition(xsens_g_710_available)) {
   asio::io_context& ctx = Ctx::get_context();
   MTi_G_710<Usb, Ctx> mti_g_710;
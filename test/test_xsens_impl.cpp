@@ -11,8 +11,8 @@
 #include <algorithm>
 
 
-namespace x3 = boost::spirit::x3;
 using namespace std::string_literals;
+namespace tt = boost::test_tools;
 
 using namespace xsens;
 
@@ -26,27 +26,32 @@ float to_float(const char* c) {
 
 BOOST_AUTO_TEST_CASE(xsens_parse_acceleration_test) {
   std::string data = "\x40\x20\x0c\xbd\x77\x48\x07\xbc\x0e\xdc\x7b\x41\x1c\xd1\x56"s;
-  auto cur = data.begin();
-  parser::Acceleration acceleration;
-  BOOST_TEST(std::is_floating_point<parser::Acceleration::bytes_type>::value);
-  auto result = x3::parse(cur, data.end(), parser::acceleration, acceleration);
-  BOOST_TEST(result);
-  BOOST_TEST(acceleration.data.size() == 3);
-  BOOST_TEST(acceleration.data[0] == to_float(data.data() + 3));
-  BOOST_TEST(acceleration.data[1] == to_float(data.data() + 7));
-  BOOST_TEST(acceleration.data[2] == to_float(data.data() + 11));
+  auto bytes = reinterpret_cast<const byte_t*>(data.data());
+  Stamped_quantities values;
+  BOOST_TEST(parser::Acceleration::decode(parser::get_big<uint16_t>(bytes), bytes + 3, bytes[2], 1.0, values));
+  BOOST_TEST(values.size() == 3);
+  BOOST_TEST(values[0].quantity == Quantity::ax);
+  BOOST_TEST(values[0].value == to_float(data.data() + 3));
+  BOOST_TEST(values[1].value == to_float(data.data() + 7));
+  BOOST_TEST(values[2].value == to_float(data.data() + 11));
+  // Items of another type or size are not decoded
+  BOOST_TEST(!parser::Free_acceleration::decode(parser::get_big<uint16_t>(bytes), bytes + 3, bytes[2], 1.0, values));
+  BOOST_TEST(!parser::Acceleration::decode(parser::get_big<uint16_t>(bytes), bytes + 3, 8, 1.0, values));
+  BOOST_TEST(values.size() == 3);
 }
 
 BOOST_AUTO_TEST_CASE(xsens_parse_date_time_test) {
   std::string data = "\x10\x10\x0c\x14\x70\x3d\x20\x07\xe2\x09\x0a\x08\x39\x38\x37"s;
-  auto cur = data.begin();
-  parser::Date_time date_time;
-  auto result = x3::parse(cur, data.end(), parser::date_time, date_time);
-  BOOST_TEST(result);
-  BOOST_TEST(date_time.hour == 8);
-  BOOST_TEST(date_time.minute == 57);
-  BOOST_TEST(date_time.get_values()[0].quantity == Quantity::ut);
-  BOOST_TEST(date_time.get_values()[0].value == 1536569876.3429);
+  auto bytes = reinterpret_cast<const byte_t*>(data.data());
+  Stamped_quantities values;
+  BOOST_TEST(parser::Date_time::decode(parser::get_big<uint16_t>(bytes), bytes + 3, bytes[2], 1.0, values));
+  BOOST_TEST(values.size() == 1);
+  BOOST_TEST(values[0].quantity == Quantity::ut);
+  BOOST_TEST(values[0].value == 1536569876.3429);
+  // Without the valid UTC flag there is no value
+  data[14] &= ~parser::Date_time::valid_utc;
+  BOOST_TEST(parser::Date_time::decode(parser::get_big<uint16_t>(bytes), bytes + 3, bytes[2], 1.0, values));
+  BOOST_TEST(values.size() == 1);
 }
 
 BOOST_AUTO_TEST_CASE(data_converter_test) {
@@ -69,16 +74,10 @@ BOOST_AUTO_TEST_CASE(data_converter_test) {
 
 BOOST_AUTO_TEST_CASE(xsens_parse_bytes_test) {
   std::string data = "\x40\x20\x0c\xbd\x77\x48\x07\xbc\x0e\xdc\x7b\x41\x1c\xd1\x56\x01\x00\x02\x00\x00\x10\x10\x0c\x14\x70\x3d\x20\x07\xe2\x09\x0a\x08\x39\x38\x37"s;
-  parser::Xsens_parser::Data_packets packets;
-  auto cur = data.begin();
-  bool result = x3::parse(cur, data.end(), parser::data_parser, packets);
+  auto bytes = reinterpret_cast<const byte_t*>(data.data());
+  Stamped_quantities values;
+  bool result = parser::decode_data(bytes, bytes + data.size(), 1.0, false, values);
   BOOST_TEST(result);
-  BOOST_TEST(packets.size() == 3);
-  parser::Xsens_parser::Data_visitor visitor;
-  for (auto& packet: packets) {
-    boost::apply_visitor(visitor, packet);
-  }
-  auto values = visitor.values;
   BOOST_TEST(values.size() == 4);
   BOOST_TEST(values[0].value == to_float(data.data() + 3));
   BOOST_TEST(values[0].quantity == Quantity::ax);
@@ -106,3 +105,287 @@ BOOST_AUTO_TEST_CASE(xsens_command_test) {
   };
   BOOST_TEST(packet(XMID_SetOptionFlags, message) == expected);
 }
+
+BOOST_AUTO_TEST_CASE(contiguous_buffer_test) {
+  Contiguous_buffer buffer;
+  std::string data = "abcdef";
+  buffer.insert(buffer.end(), data.begin(), data.end());
+  BOOST_TEST(buffer.size() == 6);
+  buffer.erase(buffer.begin(), buffer.begin() + 4);
+  BOOST_TEST(std::string(buffer.begin(), buffer.end()) == "ef");
+  // Remaining data moves to the front when more doesn't fit
+  data = "ghijklmnop";
+  buffer.insert(buffer.end(), data.begin(), data.end());
+  BOOST_TEST(std::string(buffer.begin(), buffer.end()) == "efghijklmnop");
+  buffer.erase(buffer.begin(), buffer.end());
+  BOOST_TEST(buffer.empty());
+}
+
+BOOST_AUTO_TEST_CASE(xsens_parser_test) {
+  using namespace xsens::command;
+  cbytes_t data = {0x40, 0x20, 0x0c, 0xbd, 0x77, 0x48, 0x07, 0xbc, 0x0e, 0xdc, 0x7b, 0x41, 0x1c, 0xd1, 0x56};
+  bytes_t good = packet(XMID_MtData2, data);
+  bytes_t corrupt = good;
+  corrupt[5] ^= 0x01;
+  Bytes stream = {0x01, packet_start, 0x02};
+  stream << good << corrupt << good;
+
+  parser::Xsens_parser parser;
+  parser.set_flip_axes(false);
+  // Feed the stream in chunks that split the packets
+  for (size_t i = 0; i < stream.size(); i += 7) {
+    auto end = stream.begin() + std::min(i + 7, stream.size());
+    parser.add_and_parse(1.0, stream.begin() + i, end);
+  }
+  auto& values = parser.get_values();
+  // Junk is skipped and the corrupt packet is dropped
+  BOOST_TEST(values.size() == 6);
+  BOOST_TEST(values[0].value == to_float(reinterpret_cast<const char*>(data.data()) + 3));
+  BOOST_TEST(values[0].quantity == Quantity::ax);
+  BOOST_TEST(values[3].quantity == Quantity::ax);
+  BOOST_TEST(parser.buffer.empty());
+}
+
+BOOST_AUTO_TEST_CASE(xsens_link_statistics_test) {
+  using namespace xsens::command;
+  auto data_packet = [](const uint16_t counter, const uint32_t sample_time) {
+    Bytes content;
+    content << endian::order::big
+        << static_cast<uint16_t>(XDI_PacketCounter) << static_cast<byte_t>(2) << counter
+        << static_cast<uint16_t>(XDI_SampleTimeFine) << static_cast<byte_t>(4) << sample_time;
+    return bytes_t(packet(XMID_MtData2, content));
+  };
+  bytes_t corrupt = data_packet(3, 1300);
+  corrupt[6] ^= 0x01;
+  Bytes stream;
+  // Packets at 100 Hz, with packet 3 corrupt and 4 and 5 lost
+  stream << data_packet(0xFFFE, 1000) << data_packet(0xFFFF, 1100)
+      << data_packet(0, 1200) << data_packet(1, 1300) << data_packet(2, 1400)
+      << corrupt << cbytes_t{0x01, 0x02} << data_packet(6, 1800);
+
+  parser::Xsens_parser parser;
+  parser.add_and_parse(1.0, stream.begin(), stream.end());
+  auto& statistics = parser.get_statistics();
+  BOOST_TEST(statistics.packets == 6);
+  BOOST_TEST(statistics.expected == 9);
+  BOOST_TEST(statistics.dropped == 3);
+  BOOST_TEST(statistics.gaps == 1);
+  BOOST_TEST(statistics.checksum_errors == 1);
+  // The rest of the corrupt packet and the junk after it
+  BOOST_TEST(statistics.junk_bytes == corrupt.size() - 1 + 2);
+  BOOST_TEST(statistics.resyncs == 1);
+  BOOST_TEST(parser.buffer.empty());
+
+  // A counter restart isn't a drop
+  stream.clear();
+  stream << data_packet(0, 1900);
+  parser.add_and_parse(1.0, stream.begin(), stream.end());
+  BOOST_TEST(statistics.dropped == 3);
+  BOOST_TEST(statistics.expected == 10);
+}
+
+BOOST_AUTO_TEST_CASE(xsens_decode_data_test) {
+  // Items of each decoded type, an unknown item and a date-time
+  Bytes content;
+  content << endian::order::big;
+  for (uint16_t did: {XDI_Acceleration, XDI_FreeAcceleration, XDI_RateOfTurn, XDI_MagneticField,
+                      XDI_VelocityXYZ, XDI_EulerAngles}) {
+    content << did << static_cast<byte_t>(12) << 0x3f800000u << 0x40000000u << 0xc0400000u;
+  }
+  content << static_cast<uint16_t>(XDI_Quaternion) << static_cast<byte_t>(16)
+      << 0x3f800000u << 0x40000000u << 0xc0400000u << 0x40800000u;
+  content << static_cast<uint16_t>(XDI_AltitudeMsl) << static_cast<byte_t>(4) << 0x3f800000u;
+  content << static_cast<uint16_t>(XDI_LatLon | XDI_SubFormatDouble) << static_cast<byte_t>(16)
+      << 0x40490000u << 0u << 0x40100000u << 0u;
+  content << static_cast<uint16_t>(XDI_PacketCounter) << static_cast<byte_t>(2) << static_cast<uint16_t>(1);
+  content << static_cast<uint16_t>(XDI_UtcTime) << static_cast<byte_t>(12)
+      << 0x14703d20u << static_cast<uint16_t>(2018) << cbytes_t{0x09, 0x0a, 0x08, 0x39, 0x38, 0x37};
+
+  // Expected quantities and values, unflipped and flipped
+  const double deg = M_PI / 180.0;
+  const std::vector<std::pair<Quantity, double> > expected[] = {
+    {
+      {Quantity::ax, 1}, {Quantity::ay, 2}, {Quantity::az, -3},
+      {Quantity::fax, 1}, {Quantity::fay, 2}, {Quantity::faz, -3},
+      {Quantity::rr, 1}, {Quantity::pr, 2}, {Quantity::yr, -3},
+      {Quantity::mx, 1E-4}, {Quantity::my, 2E-4}, {Quantity::mz, -3E-4},
+      {Quantity::vx, 1}, {Quantity::vy, 2}, {Quantity::vz, -3},
+      {Quantity::ro, deg - M_PI}, {Quantity::pi, -2 * deg}, {Quantity::ya, 3 * deg},
+      {Quantity::q1, -2}, {Quantity::q2, 1}, {Quantity::q3, -4}, {Quantity::q4, -3},
+      {Quantity::hmsl, 1}, {Quantity::la, 50 * deg}, {Quantity::lo, 4 * deg},
+      {Quantity::ut, 1536569876.3429}
+    },
+    {
+      {Quantity::ax, 1}, {Quantity::ay, -2}, {Quantity::az, 3},
+      {Quantity::fax, 1}, {Quantity::fay, -2}, {Quantity::faz, 3},
+      {Quantity::rr, 1}, {Quantity::pr, -2}, {Quantity::yr, 3},
+      {Quantity::mx, 1E-4}, {Quantity::my, -2E-4}, {Quantity::mz, 3E-4},
+      {Quantity::vx, 1}, {Quantity::vy, -2}, {Quantity::vz, 3},
+      {Quantity::ro, deg}, {Quantity::pi, -2 * deg}, {Quantity::ya, 3 * deg},
+      {Quantity::q1, 1}, {Quantity::q2, 2}, {Quantity::q3, 3}, {Quantity::q4, -4},
+      {Quantity::hmsl, 1}, {Quantity::la, 50 * deg}, {Quantity::lo, 4 * deg},
+      {Quantity::ut, 1536569876.3429}
+    }
+  };
+
+  for (bool flip: {false, true}) {
+    Stamped_quantities values;
+    BOOST_TEST(parser::decode_data(content.data(), content.data() + content.size(), 1.0, flip, values));
+    auto& expect = expected[flip];
+    BOOST_TEST(values.size() == expect.size());
+    for (size_t i = 0; i < values.size() && i < expect.size(); ++i) {
+      BOOST_TEST(values[i].quantity == expect[i].first);
+      BOOST_TEST(values[i].value == expect[i].second, tt::tolerance(1E-12));
+      BOOST_TEST(values[i].stamp == 1.0);
+    }
+  }
+
+  // Items running past the end of the content are rejected
+  Stamped_quantities values;
+  BOOST_TEST(!parser::decode_data(content.data(), content.data() + content.size() - 1, 1.0, false, values));
+}
+
+BOOST_AUTO_TEST_CASE(xsens_fixed_point_test) {
+  using namespace xsens::command;
+  // MTData2 reference packet with acceleration in Fp1220 and position in Fp1632
+  cbytes_t data = {
+    0x40, 0x21, 0x0c,                   // Acceleration, Fp1220
+    0x00, 0x18, 0x00, 0x00,             // 1.5
+    0xff, 0xdc, 0x00, 0x00,             // -2.25
+    0x00, 0x9c, 0xf5, 0xc3,             // 9.81 (rounded)
+    0x50, 0x42, 0x0c,                   // LatLon, Fp1632
+    0x80, 0x00, 0x00, 0x00, 0x00, 0x33, // 51.5
+    0xc0, 0x00, 0x00, 0x00, 0xff, 0xff, // -0.25
+    0x50, 0x12, 0x06,                   // Altitude MSL, Fp1632
+    0x40, 0x00, 0x00, 0x00, 0x00, 0x02  // 2.25
+  };
+  auto reference = packet(XMID_MtData2, data);
+
+  for (bool flip: {false, true}) {
+    parser::Xsens_parser parser;
+    parser.set_flip_axes(flip);
+    parser.add_and_parse(1.0, reference.begin(), reference.end());
+    auto& values = parser.get_values();
+    BOOST_TEST(values.size() == 6);
+    if (values.size() != 6) {
+      continue;
+    }
+    double sign = flip ? -1 : 1;
+    BOOST_TEST(values[0].quantity == Quantity::ax);
+    BOOST_TEST(values[0].value == 1.5);
+    BOOST_TEST(values[1].value == sign * -2.25);
+    BOOST_TEST(values[2].value == sign * 0x9cf5c3 / static_cast<double>(1 << 20));
+    BOOST_TEST(values[3].quantity == Quantity::la);
+    BOOST_TEST(values[3].value == 51.5 * M_PI / 180, tt::tolerance(1E-12));
+    BOOST_TEST(values[4].quantity == Quantity::lo);
+    BOOST_TEST(values[4].value == -0.25 * M_PI / 180, tt::tolerance(1E-12));
+    BOOST_TEST(values[5].quantity == Quantity::hmsl);
+    BOOST_TEST(values[5].value == 2.25);
+  }
+
+  // Items with a size not matching their format are skipped
+  bytes_t truncated = { 0x40, 0x22, 0x0c, 0x00, 0x18, 0x00, 0x00, 0x00, 0x18, 0x00, 0x00, 0x00, 0x18, 0x00, 0x00 };
+  Stamped_quantities values;
+  BOOST_TEST(parser::decode_data(truncated.data(), truncated.data() + truncated.size(), 1.0, false, values));
+  BOOST_TEST(values.empty());
+}
+
+BOOST_AUTO_TEST_CASE(xsens_output_formats_test) {
+  using namespace xsens::command;
+  cbytes_t configuration = {
+    0x10, 0x10, 0xFF, 0xFF, // Utc time
+    0x40, 0x20, 0x00, 0x64, // Acceleration, float
+    0x50, 0x43, 0x00, 0x0A, // LatLon, double
+    0x50, 0x10, 0x00, 0x0A, // Altitude above MSL, float
+    0x20, 0x30, 0x00, 0x0A  // Euler angles, float
+  };
+  Output_formats formats = {
+    { XDI_PositionGroup, XDI_SubFormatFp1632 },
+    { XDI_AccelerationGroup, XDI_SubFormatFp1220 }
+  };
+  cbytes_t expected = {
+    0x10, 0x10, 0xFF, 0xFF,
+    0x40, 0x21, 0x00, 0x64,
+    0x50, 0x42, 0x00, 0x0A,
+    0x50, 0x12, 0x00, 0x0A,
+    0x20, 0x30, 0x00, 0x0A
+  };
+  BOOST_TEST(apply_output_formats(configuration, formats) == expected);
+  BOOST_TEST(apply_output_formats(configuration, Output_formats()) == configuration);
+}
+
+
+BOOST_AUTO_TEST_CASE(xsens_output_rates_test) {
+  using namespace xsens::command;
+  cbytes_t configuration = {
+    0x10, 0x10, 0xFF, 0xFF, // Utc time
+    0x40, 0x20, 0x00, 0x64, // Acceleration, 100Hz
+    0x50, 0x43, 0x00, 0x0A, // LatLon, 10Hz
+    0x20, 0x30, 0x00, 0x0A  // Euler angles, 10 Hz
+  };
+  Output_rates rates = {
+    { XDI_Acceleration, 400 },
+    { XDI_LatLon, 0 },
+    { XDI_RateOfTurn, 200 }
+  };
+  cbytes_t expected = {
+    0x10, 0x10, 0xFF, 0xFF,
+    0x40, 0x20, 0x01, 0x90,
+    0x20, 0x30, 0x00, 0x0A,
+    0x80, 0x20, 0x00, 0xC8
+  };
+  BOOST_TEST(apply_output_rates(configuration, rates) == expected);
+  BOOST_TEST(apply_output_rates(configuration, Output_rates()) == configuration);
+}
+
+
+BOOST_AUTO_TEST_CASE(xsens_output_bandwidth_test) {
+  using namespace xsens::command;
+  cbytes_t configuration = {
+    0x10, 0x10, 0xFF, 0xFF, // Utc time, in every packet
+    0x40, 0x20, 0x00, 0x64, // Acceleration, 100Hz
+    0x50, 0x43, 0x00, 0x0A  // LatLon double, 10Hz
+  };
+  // 100 packets of 5 + 15 bytes, 100 accelerations of 15 and 10 positions of 19 bytes
+  BOOST_TEST(get_output_bytes_per_second(configuration) == 3690, tt::tolerance(1e-9));
+  Output_rates rates = { { XDI_Acceleration, 400 } };
+  Output_formats formats = { { XDI_AccelerationGroup, XDI_SubFormatFp1632 } };
+  bytes_t fast = apply_output_formats(apply_output_rates(configuration, rates), formats);
+  // 400 packets of 20 bytes, 400 accelerations of 21 bytes and positions
+  BOOST_TEST(get_output_bytes_per_second(fast) == 16590, tt::tolerance(1e-9));
+  BOOST_TEST(get_output_bytes_per_second(bytes_t()) == 0);
+}
+
+
+BOOST_AUTO_TEST_CASE(xsens_device_time_test) {
+  using namespace xsens::command;
+  auto data_packet = [](const uint32_t sample_time) {
+    Bytes content;
+    content << endian::order::big
+        << static_cast<uint16_t>(XDI_SampleTimeFine) << static_cast<byte_t>(4) << sample_time
+        << static_cast<uint16_t>(XDI_Acceleration) << static_cast<byte_t>(12)
+        << 0x3f800000u << 0x40000000u << 0xc0400000u;
+    return bytes_t(packet(XMID_MtData2, content));
+  };
+
+  for (bool device_time: {false, true}) {
+    parser::Xsens_parser parser;
+    parser.set_use_device_time(device_time);
+    auto& values = parser.get_values();
+    // Packets at 100 Hz read in chunks of 4 that arrive with a delay of 0 to 20 ms
+    for (uint32_t i = 0; i < 400; i += 4) {
+      bytes_t data;
+      for (uint32_t j = i; j < i + 4; ++j) {
+        bytes_t packet = data_packet(10000 + 100 * j);
+        data.insert(data.end(), packet.begin(), packet.end());
+      }
+      parser.add_and_parse(10.03 + 0.01 * i + (i % 12) * 0.005 / 3, data.begin(), data.end());
+    }
+    BOOST_TEST(values.size() == 1200);
+    for (size_t i = 200; i < 400; ++i) {
+      double arrival = 10.03 + 0.01 * (i - i % 4) + ((i - i % 4) % 12) * 0.005 / 3;
+      double expected = device_time ? 10.0 + 0.01 * i : arrival;
+      BOOST_TEST(values[3 * i].stamp == expected, tt::tolerance(1E-9));
+    }
+  }
+}